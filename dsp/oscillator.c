@@ -1,36 +1,125 @@
 #include "oscillator.h"
 
+#include <stdlib.h>
+
 void init_oscillator(Oscillator *osc, float frequency, float sample_rate) {
 	osc->phase = 0.0f;
 	osc->phase_increment = (M_2PI * frequency) / sample_rate;
 	osc->sample_rate = sample_rate;
+	osc->table = NULL;
+	osc->table_period = 0;
+	osc->table_cycles = 0;
+	osc->table_index = 0;
+	osc->table_turn = 0;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+	while (b) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+bool init_oscillator_table(Oscillator *osc, float frequency) {
+	uint64_t rate = (uint64_t)osc->sample_rate;
+	uint64_t freq = (uint64_t)frequency;
+	if (freq == 0 || (float)freq != frequency || (float)rate != osc->sample_rate) return false;
+
+	uint64_t common = gcd(rate, freq);
+	uint64_t period = rate / common;
+	if (period > OSCILLATOR_TABLE_MAX_PERIOD) return false;
+
+	float* table = malloc(sizeof(float) * period * OSCILLATOR_TABLE_HARMONICS * 2);
+	if (!table) return false;
+
+	osc->table = table;
+	osc->table_period = (uint32_t)period;
+	osc->table_cycles = (uint32_t)(freq / common);
+	// Harmonic h of sample n is h*n*cycles/period of a turn, reduced as integers so even the last row is exact
+	for (uint32_t n = 0; n < period; n++) {
+		float* row = &table[n * OSCILLATOR_TABLE_HARMONICS * 2];
+		for (uint32_t h = 1; h <= OSCILLATOR_TABLE_HARMONICS; h++) {
+			double turn = (double)(((uint64_t)h * n * osc->table_cycles) % period) / period;
+			row[h - 1] = (float)sin(M_2PI * turn);
+			row[OSCILLATOR_TABLE_HARMONICS + h - 1] = (float)cos(M_2PI * turn);
+		}
+	}
+
+	osc->table_index = 0;
+	osc->table_turn = 0;
+	osc->phase = 0.0f;
+	return true;
+}
+
+void free_oscillator_table(Oscillator *osc) {
+	free(osc->table);
+	osc->table = NULL;
+	osc->table_period = 0;
 }
 
 inline void change_oscillator_frequency(Oscillator *osc, float frequency) {
+	free_oscillator_table(osc); // The table is of the old one
 	osc->phase_increment = (M_2PI * frequency) / osc->sample_rate;
 }
 
+static inline const float* table_row(const Oscillator *osc) {
+	return &osc->table[osc->table_index * OSCILLATOR_TABLE_HARMONICS * 2];
+}
+
+static inline int table_harmonic(const Oscillator *osc, float multiplier) {
+	if (!osc->table) return 0;
+	int harmonic = (int)multiplier;
+	if (harmonic < 1 || harmonic > OSCILLATOR_TABLE_HARMONICS || (float)harmonic != multiplier) return 0;
+	return harmonic;
+}
+
 float get_oscillator_sin_sample(Oscillator *osc) {
-	float sample = sinf(osc->phase);
+	float sample = osc->table ? table_row(osc)[0] : sinf(osc->phase);
 	advance_oscillator(osc);
 	return sample;
 }
 
 float get_oscillator_cos_sample(Oscillator *osc) {
-	float sample = cosf(osc->phase);
+	float sample = osc->table ? table_row(osc)[OSCILLATOR_TABLE_HARMONICS] : cosf(osc->phase);
 	advance_oscillator(osc);
 	return sample;
 }
 
 float get_oscillator_sin_multiplier_ni(Oscillator *osc, float multiplier) {
+	int harmonic = table_harmonic(osc, multiplier);
+	if (harmonic) return table_row(osc)[harmonic - 1];
 	return sinf(osc->phase * multiplier);
 }
 
 float get_oscillator_cos_multiplier_ni(Oscillator *osc, float multiplier) {
+	int harmonic = table_harmonic(osc, multiplier);
+	if (harmonic) return table_row(osc)[OSCILLATOR_TABLE_HARMONICS + harmonic - 1];
 	return cosf(osc->phase * multiplier);
 }
 
 inline void advance_oscillator(Oscillator *osc) {
+	if (osc->table) {
+		// The phase is worked out from the index, the encoders that clock off it see the same numbers every period
+		if (++osc->table_index == osc->table_period) osc->table_index = 0;
+		osc->table_turn += osc->table_cycles;
+		if (osc->table_turn >= osc->table_period) osc->table_turn -= osc->table_period;
+		osc->phase = (float)(M_2PI / osc->table_period) * (float)osc->table_turn;
+		return;
+	}
 	osc->phase += osc->phase_increment;
 	if (osc->phase >= M_2PI) osc->phase -= M_2PI;
-}
\ No newline at end of file
+}
+
+void sync_oscillator_phase(Oscillator *osc, float frequency, uint64_t sample_index) {
+	uint64_t rate = (uint64_t)osc->sample_rate;
+	if (osc->table) {
+		osc->table_index = (uint32_t)(sample_index % osc->table_period); // A period is a whole number of cycles
+		osc->table_turn = (uint32_t)(((uint64_t)osc->table_index * osc->table_cycles) % osc->table_period);
+		osc->phase = (float)(M_2PI / osc->table_period) * (float)osc->table_turn;
+		return;
+	}
+	double cycles = (double)(sample_index % rate) * frequency / rate; // Whole seconds are whole cycles
+	osc->phase = (float)(M_2PI * (cycles - floor(cycles)));
+}
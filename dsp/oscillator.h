@@ -2,17 +2,35 @@
 
 #include "../lib/constants.h"
 #include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OSCILLATOR_TABLE_HARMONICS 16 // 76 khz is the 16th of 4750 hz
+#define OSCILLATOR_TABLE_MAX_PERIOD 4800 // samples, 4750 hz repeats every 768 at 192 khz
 
 typedef struct {
 	float phase;
 	float phase_increment;
 	float sample_rate;
+
+	// One period of sin and cos of the harmonics, when the frequency repeats in a whole number of samples, NULL otherwise
+	float* table; // table_period rows of OSCILLATOR_TABLE_HARMONICS sines then as many cosines
+	uint32_t table_period; // samples
+	uint32_t table_cycles; // of the base in that period
+	uint32_t table_index;
+	uint32_t table_turn; // table_index * table_cycles, modulo the period, the phase in 1/table_period of a cycle
 } Oscillator;
 
 void init_oscillator(Oscillator *osc, float frequency, float sample_rate);
+// Precomputes the harmonics so that the getters below are lookups and the phase can't drift, false (and sinf stays) when the period is too long,
+// call right after init_oscillator
+bool init_oscillator_table(Oscillator *osc, float frequency);
+void free_oscillator_table(Oscillator *osc);
 void change_oscillator_frequency(Oscillator *osc, float frequency);
 float get_oscillator_sin_sample(Oscillator *osc);
 float get_oscillator_cos_sample(Oscillator *osc);
 float get_oscillator_sin_multiplier_ni(Oscillator *osc, float multiplier);
 float get_oscillator_cos_multiplier_ni(Oscillator *osc, float multiplier);
-void advance_oscillator(Oscillator *osc);
\ No newline at end of file
+void advance_oscillator(Oscillator *osc);
+// Sets the phase a whole-hz oscillator started at sample 0 would have at sample_index
+void sync_oscillator_phase(Oscillator *osc, float frequency, uint64_t sample_index);
@@ -0,0 +1,108 @@
+#include "polyphase.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KAISER_BETA 8.0
+
+double bessel_i0(double x) {
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < 1e-12 * sum) break;
+	}
+	return sum;
+}
+
+int init_polyphase_filter(PolyphaseFilter *filter, uint16_t phases, uint16_t length, float cutoff, float gain) {
+	filter->phases = phases;
+	filter->length = length;
+	filter->taps = malloc(sizeof(float) * (phases + 1) * length);
+	if (!filter->taps) return -1;
+
+	double half = length * 0.5;
+	double norm = bessel_i0(KAISER_BETA);
+
+	for (uint16_t p = 0; p <= phases; p++) {
+		float* row = &filter->taps[p * length];
+		double sum = 0.0;
+		for (uint16_t k = 0; k < length; k++) {
+			// Distance from the output point to input sample k
+			double t = (double)p / phases + half - 1.0 - k;
+			double x = 2.0 * cutoff * t;
+			double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			double r = t / half;
+			double window = (fabs(r) >= 1.0) ? 0.0 : bessel_i0(KAISER_BETA * sqrt(1.0 - r * r)) / norm;
+			row[k] = (float)(sinc * window);
+			sum += row[k];
+		}
+		for (uint16_t k = 0; k < length; k++) row[k] = (float)(row[k] * gain / sum);
+	}
+	return 0;
+}
+
+void free_polyphase_filter(PolyphaseFilter *filter) {
+	free(filter->taps);
+	filter->taps = NULL;
+}
+
+float polyphase_interpolate(const PolyphaseFilter *filter, const float *x, size_t stride, float frac) {
+	float position = frac * filter->phases;
+	uint16_t phase = (uint16_t)position;
+	float alpha = position - phase;
+
+	const float* a = &filter->taps[phase * filter->length];
+	const float* b = a + filter->length;
+
+	float out_a = 0.0f, out_b = 0.0f;
+	for (uint16_t k = 0; k < filter->length; k++) {
+		out_a += a[k] * x[k * stride];
+		out_b += b[k] * x[k * stride];
+	}
+	return out_a + (out_b - out_a) * alpha;
+}
+
+float polyphase_filter_phase(const PolyphaseFilter *filter, const float *x, size_t stride, uint16_t phase) {
+	const float* row = &filter->taps[phase * filter->length];
+	float out = 0.0f;
+	for (uint16_t k = 0; k < filter->length; k++) out += row[k] * x[k * stride];
+	return out;
+}
+
+typedef float polyphase_v4f __attribute__((vector_size(16)));
+
+// length has to be a multiple of 4
+static inline float polyphase_dot4(const float* row, const float* window, uint16_t length) {
+	polyphase_v4f acc = {0.0f, 0.0f, 0.0f, 0.0f};
+	for (uint16_t k = 0; k < length; k += 4) {
+		polyphase_v4f a, b;
+		memcpy(&a, &row[k], sizeof(a));
+		memcpy(&b, &window[k], sizeof(b));
+		acc += a * b;
+	}
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+void polyphase_upsample(const PolyphaseFilter *filter, const float *x, size_t count, float *out) {
+	uint16_t length = filter->length;
+	if(length & 3) {
+		for (size_t n = 0; n < count; n++) {
+			for (uint16_t p = 0; p < filter->phases; p++) *out++ = polyphase_filter_phase(filter, &x[n], 1, p);
+		}
+		return;
+	}
+
+	for (size_t n = 0; n < count; n++) {
+		for (uint16_t p = 0; p < filter->phases; p++) *out++ = polyphase_dot4(&filter->taps[p * length], &x[n], length);
+	}
+}
+
+void polyphase_decimate(const PolyphaseFilter *filter, const float *x, size_t count, uint16_t factor, float *out) {
+	uint16_t length = filter->length;
+	for (size_t n = 0; n < count; n++) {
+		const float* window = &x[n * factor];
+		out[n] = (length & 3) ? polyphase_filter_phase(filter, window, 1, 0) : polyphase_dot4(filter->taps, window, length);
+	}
+}
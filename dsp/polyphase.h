@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../lib/constants.h"
+
+typedef struct
+{
+	float* taps; // (phases + 1) rows of length taps each, the extra row makes interpolating past the last phase free
+	uint16_t phases;
+	uint16_t length;
+} PolyphaseFilter;
+
+// Modified Bessel function of the first kind of order 0, for Kaiser windows
+double bessel_i0(double x);
+
+// Windowed sinc bank, cutoff is relative to the input sample rate (0.5 is nyquist), every phase is normalized to the gain
+int init_polyphase_filter(PolyphaseFilter *filter, uint16_t phases, uint16_t length, float cutoff, float gain);
+void free_polyphase_filter(PolyphaseFilter *filter);
+
+// x points at the first of length input samples (spaced by stride), the output lands frac after sample length/2-1
+float polyphase_interpolate(const PolyphaseFilter *filter, const float *x, size_t stride, float frac);
+// Same for an integer upsampler with phases as the factor, frac is phase/phases, one row only
+float polyphase_filter_phase(const PolyphaseFilter *filter, const float *x, size_t stride, uint16_t phase);
+// Whole block of the integer upsampler, x holds count + length - 1 samples, out gets count * phases, taps 4 at a time when length allows
+void polyphase_upsample(const PolyphaseFilter *filter, const float *x, size_t count, float *out);
+// Lowpass with the first row, keeping every factor-th output, x holds (count - 1) * factor + length samples, out gets count, taps 4 at a time when length allows
+void polyphase_decimate(const PolyphaseFilter *filter, const float *x, size_t count, uint16_t factor, float *out);
@@ -0,0 +1,17 @@
+#include "sine_table.h"
+
+#include <math.h>
+#include <pthread.h>
+#include "../lib/constants.h"
+
+float sine_table[SINE_TABLE_SIZE + 1];
+static pthread_once_t sine_table_once = PTHREAD_ONCE_INIT;
+
+static void build_sine_table(void) {
+	for (int i = 0; i <= SINE_TABLE_SIZE; i++) sine_table[i] = (float)sin(M_2PI * i / SINE_TABLE_SIZE);
+}
+
+// Chains set up on several threads at once (a batch) all come through here
+void init_sine_table(void) {
+	pthread_once(&sine_table_once, build_sine_table);
+}
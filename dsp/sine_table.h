@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#define SINE_TABLE_BITS 11
+#define SINE_TABLE_SIZE (1 << SINE_TABLE_BITS) // 8 kB, stays in L1 next to everything else, linear interpolation keeps it under -115 dB
+#define SINE_TABLE_FRACTION_BITS (32 - SINE_TABLE_BITS)
+
+// One cycle of sine plus a guard entry so interpolation never wraps
+extern float sine_table[SINE_TABLE_SIZE + 1];
+
+void init_sine_table(void);
+
+// Phase is a full cycle over 2^32, so an accumulator wraps for free
+static inline float sine_table_lookup(uint32_t phase) {
+	uint32_t index = phase >> SINE_TABLE_FRACTION_BITS;
+	float fraction = (float)(phase & ((1u << SINE_TABLE_FRACTION_BITS) - 1)) * (1.0f / (1u << SINE_TABLE_FRACTION_BITS));
+	float a = sine_table[index];
+	return a + (sine_table[index + 1] - a) * fraction;
+}
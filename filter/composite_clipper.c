@@ -0,0 +1,87 @@
+#include "composite_clipper.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_HISTORY (COMPOSITE_CLIPPER_UPSAMPLE_LENGTH - 1)
+#define GUARD_HISTORY (COMPOSITE_CLIPPER_GUARD_LENGTH - 1)
+
+// Everything but low to high, the difference of two lowpasses taken off a pulse on the center tap
+static int init_guard_filter(PolyphaseFilter* guard, float low, float high) {
+	PolyphaseFilter below;
+	if(init_polyphase_filter(guard, 1, COMPOSITE_CLIPPER_GUARD_LENGTH, high, 1.0f) != 0) return -1;
+	if(init_polyphase_filter(&below, 1, COMPOSITE_CLIPPER_GUARD_LENGTH, low, 1.0f) != 0) return -1;
+	for(uint16_t k = 0; k < COMPOSITE_CLIPPER_GUARD_LENGTH; k++) {
+		guard->taps[k] = ((k == COMPOSITE_CLIPPER_GUARD_LENGTH / 2 - 1) ? 1.0f : 0.0f) - (guard->taps[k] - below.taps[k]);
+	}
+	free_polyphase_filter(&below);
+	return 0;
+}
+
+int init_composite_clipper(CompositeClipper* clipper, float threshold, uint8_t oversample, float sample_rate, uint32_t block_size) {
+	memset(clipper, 0, sizeof(CompositeClipper));
+	clipper->threshold = threshold;
+	clipper->oversample = oversample;
+	clipper->block_size = block_size;
+
+	// The lowpass is centered on its (length/2)th tap, starting it one sample into its history puts that on a sample the upsampler
+	// landed on the input's own time, then the upsampler is length/2 samples late, the lowpass half_length and the band-stop length/2
+	uint16_t lowpass_length = 2 * COMPOSITE_CLIPPER_HALF_LENGTH * oversample;
+	clipper->delay = COMPOSITE_CLIPPER_HALF_LENGTH + COMPOSITE_CLIPPER_UPSAMPLE_LENGTH / 2 + COMPOSITE_CLIPPER_GUARD_LENGTH / 2;
+
+	if(init_polyphase_filter(&clipper->upsampler, oversample, COMPOSITE_CLIPPER_UPSAMPLE_LENGTH, 0.5f, 1.0f) != 0 ||
+	   init_polyphase_filter(&clipper->lowpass, 1, lowpass_length, COMPOSITE_CLIPPER_CUTOFF / (sample_rate * oversample), 1.0f) != 0 ||
+	   init_guard_filter(&clipper->guard, COMPOSITE_CLIPPER_GUARD_LOW / sample_rate, COMPOSITE_CLIPPER_GUARD_HIGH / sample_rate) != 0) {
+		free_composite_clipper(clipper);
+		return -1;
+	}
+	clipper->input = calloc(INPUT_HISTORY + block_size, sizeof(float));
+	clipper->correction = calloc(lowpass_length + (size_t)block_size * oversample, sizeof(float));
+	clipper->dry = calloc(clipper->delay + block_size, sizeof(float));
+	clipper->filtered = calloc(GUARD_HISTORY + block_size, sizeof(float));
+	if(!clipper->input || !clipper->correction || !clipper->dry || !clipper->filtered) {
+		free_composite_clipper(clipper);
+		return -1;
+	}
+	return 0;
+}
+
+void composite_clip(CompositeClipper* clipper, float* buffer, size_t count) {
+	uint8_t oversample = clipper->oversample;
+	size_t history = clipper->lowpass.length;
+	size_t oversampled = count * oversample;
+	float threshold = clipper->threshold;
+
+	memcpy(&clipper->input[INPUT_HISTORY], buffer, sizeof(float) * count);
+	float* correction = &clipper->correction[history];
+	polyphase_upsample(&clipper->upsampler, clipper->input, count, correction);
+	for(size_t i = 0; i < oversampled; i++) {
+		float sample = correction[i];
+		float clipped = fminf(fmaxf(sample, -threshold), threshold);
+		correction[i] = clipped - sample;
+		clipper->clipped += (clipped != sample);
+	}
+	clipper->samples += oversampled;
+	polyphase_decimate(&clipper->lowpass, &clipper->correction[1], count, oversample, &clipper->filtered[GUARD_HISTORY]);
+
+	// The band-stop lands on the block, the dry input lined up with it
+	memcpy(&clipper->dry[clipper->delay], buffer, sizeof(float) * count);
+	polyphase_decimate(&clipper->guard, clipper->filtered, count, 1, buffer);
+	for(size_t i = 0; i < count; i++) buffer[i] += clipper->dry[i];
+
+	memmove(clipper->input, &clipper->input[count], sizeof(float) * INPUT_HISTORY);
+	memmove(clipper->correction, &clipper->correction[oversampled], sizeof(float) * history);
+	memmove(clipper->filtered, &clipper->filtered[count], sizeof(float) * GUARD_HISTORY);
+	memmove(clipper->dry, &clipper->dry[count], sizeof(float) * clipper->delay);
+}
+
+void free_composite_clipper(CompositeClipper* clipper) {
+	free_polyphase_filter(&clipper->upsampler);
+	free_polyphase_filter(&clipper->lowpass);
+	free_polyphase_filter(&clipper->guard);
+	free(clipper->input);
+	free(clipper->correction);
+	free(clipper->dry);
+	free(clipper->filtered);
+	clipper->input = clipper->correction = clipper->dry = clipper->filtered = NULL;
+}
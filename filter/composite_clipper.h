@@ -0,0 +1,41 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "../dsp/polyphase.h"
+
+// Clips the audio part of the MPX at a multiple of the sample rate, then puts back only what the clipping took off below the lowpass and outside of
+// the gap between the audio and the stereo subcarrier, so the peaks come down without anything landing on the pilot, RDS or above 53 khz,
+// what's left over the threshold is small
+#define COMPOSITE_CLIPPER_UPSAMPLE_LENGTH 16 // Taps of each phase of the upsampler, at the sample rate
+#define COMPOSITE_CLIPPER_HALF_LENGTH 48 // Half the lowpass, in samples at the sample rate, about 10 khz from its passband to its stopband
+#define COMPOSITE_CLIPPER_CUTOFF 50000.0f // hz, the stereo subcarrier reaches 53 khz and RDS starts at 54.6
+#define COMPOSITE_CLIPPER_GUARD_LOW 16000.0f // hz, the band kept clear around the pilot, nothing of the audio or the subcarrier is in there
+#define COMPOSITE_CLIPPER_GUARD_HIGH 22000.0f
+#define COMPOSITE_CLIPPER_GUARD_LENGTH 256 // Of the band-stop at the sample rate, its full depth covers 18 to 20 khz
+
+typedef struct
+{
+	float threshold;
+	uint8_t oversample;
+	uint32_t block_size;
+	uint32_t delay; // Samples the output is behind the input
+
+	PolyphaseFilter upsampler; // oversample phases
+	PolyphaseFilter lowpass; // One row at the oversampled rate
+	PolyphaseFilter guard; // One row, the band-stop
+	float* input; // The upsampler's history, then the block
+	float* correction; // What the clipping took off, oversampled, the lowpass's history then the block
+	float* dry; // The input lined up with the correction, delay samples then the block
+	float* filtered; // The correction back at the sample rate, the band-stop's history then the block
+
+	uint64_t clipped; // Oversampled samples over the threshold
+	uint64_t samples; // Oversampled samples of every block
+} CompositeClipper;
+
+// 0 on success
+int init_composite_clipper(CompositeClipper *clipper, float threshold, uint8_t oversample, float sample_rate, uint32_t block_size);
+// count (at most block_size) samples in place, they come out delay samples late
+void composite_clip(CompositeClipper *clipper, float *buffer, size_t count);
+void free_composite_clipper(CompositeClipper *clipper);
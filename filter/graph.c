@@ -0,0 +1,525 @@
+#include "graph.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <dlfcn.h>
+
+#define GRAPH_LPF_MAX_CUTOFF 0.49f // Of the sample rate, the lowpass prototype has no transition band left at Nyquist
+
+static const char* node_type_names[] = {
+	[GRAPH_NODE_NONE] = "",
+	[GRAPH_NODE_GAIN] = "gain",
+	[GRAPH_NODE_CLIP] = "clip",
+	[GRAPH_NODE_AGC] = "agc",
+	[GRAPH_NODE_LPF] = "lpf",
+	[GRAPH_NODE_PREEMPHASIS] = "preemphasis",
+	[GRAPH_NODE_BS412] = "bs412",
+	[GRAPH_NODE_TILT] = "tilt",
+	[GRAPH_NODE_PLUGIN] = "plugin"
+};
+
+bool init_graph_node(GraphNode* node, const char* name, const char* type) {
+	GraphNodeType found = GRAPH_NODE_NONE;
+	for (int t = GRAPH_NODE_GAIN; t <= GRAPH_NODE_PLUGIN; t++) {
+		if (strcasecmp(type, node_type_names[t]) == 0) found = (GraphNodeType)t;
+	}
+	if (found == GRAPH_NODE_NONE) return false;
+
+	memset(node, 0, sizeof(GraphNode));
+	strncpy(node->name, name, GRAPH_NAME_LENGTH - 1);
+	node->type = found;
+	node->gain = 1.0f;
+	node->threshold = 1.0f;
+	node->cutoff = 15000.0f;
+	node->order = 15;
+	node->tau = 50.0f;
+	node->unity = 15000.0f;
+	node->target = 0.625f;
+	node->min = 0.1f;
+	node->max = (found == GRAPH_NODE_BS412) ? 1.0f : 1.5f;
+	node->attack = (found == GRAPH_NODE_BS412) ? 0.05f : 0.03f;
+	node->release = (found == GRAPH_NODE_BS412) ? 0.025f : 0.225f;
+	node->power = 3.0f;
+	node->deviation = 75000.0f;
+	node->strength = 0.0f;
+	return true;
+}
+
+bool parse_graph_node(GraphNode* node, const char* key, const char* value) {
+	float number = strtof(value, NULL);
+	if (strcasecmp(key, "at") == 0) {
+		if (strcasecmp(value, "pre_agc") == 0) node->at = GRAPH_AT_PRE_AGC;
+		else if (strcasecmp(value, "post_clip") == 0) node->at = GRAPH_AT_POST_CLIP;
+		else if (strcasecmp(value, "composite") == 0) node->at = GRAPH_AT_COMPOSITE;
+		else return false;
+		return true;
+	}
+	switch (node->type) {
+		case GRAPH_NODE_GAIN:
+			if (strcasecmp(key, "gain") == 0) node->gain = number;
+			else return false;
+			break;
+		case GRAPH_NODE_CLIP:
+			if (strcasecmp(key, "threshold") == 0) node->threshold = number;
+			else return false;
+			break;
+		case GRAPH_NODE_AGC:
+			if (strcasecmp(key, "target") == 0) node->target = number;
+			else if (strcasecmp(key, "min") == 0) node->min = number;
+			else if (strcasecmp(key, "max") == 0) node->max = number;
+			else if (strcasecmp(key, "attack") == 0) node->attack = number;
+			else if (strcasecmp(key, "release") == 0) node->release = number;
+			else return false;
+			break;
+		case GRAPH_NODE_LPF:
+			if (strcasecmp(key, "cutoff") == 0) node->cutoff = number;
+			else if (strcasecmp(key, "order") == 0) node->order = (uint8_t)atoi(value);
+			else return false;
+			break;
+		case GRAPH_NODE_PREEMPHASIS:
+			if (strcasecmp(key, "tau") == 0) node->tau = number;
+			else if (strcasecmp(key, "unity") == 0) node->unity = number;
+			else return false;
+			break;
+		case GRAPH_NODE_BS412:
+			if (strcasecmp(key, "power") == 0) node->power = number;
+			else if (strcasecmp(key, "deviation") == 0) node->deviation = number;
+			else if (strcasecmp(key, "attack") == 0) node->attack = number;
+			else if (strcasecmp(key, "release") == 0) node->release = number;
+			else if (strcasecmp(key, "max") == 0) node->max = number;
+			else return false;
+			break;
+		case GRAPH_NODE_TILT:
+			if (strcasecmp(key, "strength") == 0) node->strength = number;
+			else return false;
+			break;
+		case GRAPH_NODE_PLUGIN:
+			if (strcasecmp(key, "path") == 0) {
+				strncpy(node->path, value, sizeof(node->path) - 1);
+				node->path[sizeof(node->path) - 1] = '\0';
+			} else {
+				size_t used = strlen(node->params);
+				int length = snprintf(node->params + used, sizeof(node->params) - used, "%s=%s\n", key, value);
+				if (length < 0 || (size_t)length >= sizeof(node->params) - used) {
+					node->params[used] = '\0';
+					return false;
+				}
+			}
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+const char* check_graph_node(const GraphNode* node, uint8_t channels) {
+	if (channels < 1 || channels > 2) return "the graph runs on 1 or 2 channels";
+	if ((node->type == GRAPH_NODE_BS412 || node->type == GRAPH_NODE_TILT) && channels != 1) return "it only works on the MPX";
+	if (node->type == GRAPH_NODE_LPF && node->cutoff != 0 && (node->order < 1 || node->order > 30)) return "the LPF order has to be 1 to 30";
+	if (node->type == GRAPH_NODE_AGC && node->max != 0 && (node->attack <= 0 || node->release <= 0)) return "the AGC needs an attack and a release";
+	if (node->type == GRAPH_NODE_BS412 && (node->attack <= 0 || node->release <= 0)) return "BS412 needs an attack and a release";
+	if (node->type == GRAPH_NODE_PLUGIN && node->path[0] == '\0') return "the plugin needs a path";
+	return NULL;
+}
+
+static inline float clip_sample(float sample, float threshold) {
+	return fmaxf(-threshold, fminf(threshold, sample));
+}
+
+// A new gain is ramped to over one block, from the next frame to the last
+static void ramp_gain(GraphStep* step, float* buffer, size_t count, bool clip) {
+	const float step_size = (step->target_gain - step->gain) / count;
+	for (size_t i = 0; i < count; i++) {
+		float gain = step->gain + step_size * (i + 1);
+		for (uint8_t c = 0; c < step->channels; c++) {
+			float sample = buffer[i * step->channels + c] * gain;
+			buffer[i * step->channels + c] = clip ? clip_sample(sample, step->threshold) : sample;
+		}
+	}
+	step->gain = step->target_gain;
+}
+
+static void process_gain(GraphStep* step, float* buffer, size_t count) {
+	if (step->target_gain != step->gain) {
+		ramp_gain(step, buffer, count, false);
+		return;
+	}
+	const float gain = step->gain;
+	for (size_t i = 0; i < count * step->channels; i++) buffer[i] *= gain;
+}
+
+static void process_clip(GraphStep* step, float* buffer, size_t count) {
+	const float threshold = step->threshold;
+	for (size_t i = 0; i < count * step->channels; i++) buffer[i] = clip_sample(buffer[i], threshold);
+}
+
+// A gain right before a clipper, in one go over the block
+static void process_gain_clip(GraphStep* step, float* buffer, size_t count) {
+	if (step->target_gain != step->gain) {
+		ramp_gain(step, buffer, count, true);
+		return;
+	}
+	const float gain = step->gain;
+	const float threshold = step->threshold;
+	for (size_t i = 0; i < count * step->channels; i++) buffer[i] = clip_sample(buffer[i] * gain, threshold);
+}
+
+// Both channels get the same gain, from their average level
+static void process_agc_step(GraphStep* step, float* buffer, size_t count) {
+	if (step->channels == 2) {
+		for (size_t i = 0; i < count; i++) {
+			float gain = process_agc(&step->agc, 0.5f * (fabsf(buffer[2*i+0]) + fabsf(buffer[2*i+1])));
+			buffer[2*i+0] *= gain;
+			buffer[2*i+1] *= gain;
+		}
+	} else {
+		for (size_t i = 0; i < count; i++) buffer[i] *= process_agc(&step->agc, fabsf(buffer[i]));
+	}
+}
+
+static void process_lpf(GraphStep* step, float* buffer, size_t count) {
+	for (uint8_t c = 0; c < step->channels; c++) {
+		for (size_t i = 0; i < count; i++) {
+			float* sample = &buffer[i * step->channels + c];
+			iirfilt_rrrf_execute(step->lpf[c], *sample, sample);
+		}
+	}
+}
+
+static void process_preemphasis(GraphStep* step, float* buffer, size_t count) {
+	for (uint8_t c = 0; c < step->channels; c++) {
+		for (size_t i = 0; i < count; i++) buffer[i * step->channels + c] = apply_preemphasis(&step->preemphasis[c], buffer[i * step->channels + c]);
+	}
+}
+
+static void process_bs412(GraphStep* step, float* buffer, size_t count) {
+	for (size_t i = 0; i < count; i++) buffer[i] = bs412_compress(&step->bs412, buffer[i]);
+}
+
+static void process_tilt(GraphStep* step, float* buffer, size_t count) {
+	for (size_t i = 0; i < count; i++) buffer[i] = tilt(&step->tilt, buffer[i]);
+}
+
+// In blocks of at most the size the plugin was told, MPX goes straight in, L and R are split into planar buffers and back
+static void process_plugin(GraphStep* step, float* buffer, size_t count) {
+	for (size_t done = 0; done < count; done += step->block_size) {
+		uint32_t frames = (count - done < step->block_size) ? (uint32_t)(count - done) : step->block_size;
+		float* block = buffer + done * step->channels;
+		if (step->channels == 1) {
+			float* const channels[1] = { block };
+			step->plugin->process_block(step->plugin_instance, channels, frames);
+			continue;
+		}
+		for (uint32_t i = 0; i < frames; i++) {
+			step->planar[0][i] = block[2*i+0];
+			step->planar[1][i] = block[2*i+1];
+		}
+		step->plugin->process_block(step->plugin_instance, step->planar, frames);
+		for (uint32_t i = 0; i < frames; i++) {
+			block[2*i+0] = step->planar[0][i];
+			block[2*i+1] = step->planar[1][i];
+		}
+	}
+}
+
+static int load_plugin(GraphStep* step, const GraphNode* node, uint32_t sample_rate) {
+	step->plugin_library = dlopen(node->path, RTLD_NOW | RTLD_LOCAL);
+	if (!step->plugin_library) {
+		fprintf(stderr, "Error: cannot load plugin %s: %s\n", node->name, dlerror());
+		return 1;
+	}
+	FM95PluginEntry entry = (FM95PluginEntry)dlsym(step->plugin_library, FM95_PLUGIN_ENTRY_NAME);
+	const FM95Plugin* plugin = entry ? entry() : NULL;
+	if (!plugin || plugin->abi_version != FM95_PLUGIN_ABI_VERSION || !plugin->init || !plugin->process_block || !plugin->destroy) {
+		fprintf(stderr, "Error: %s is not an fm95 plugin of ABI version %d\n", node->path, FM95_PLUGIN_ABI_VERSION);
+		return 1;
+	}
+
+	FM95PluginInfo info = {
+		.abi_version = FM95_PLUGIN_ABI_VERSION,
+		.sample_rate = sample_rate,
+		.block_size = step->block_size,
+		.channels = step->channels,
+		.name = node->name
+	};
+	step->plugin_instance = plugin->init(&info);
+	if (!step->plugin_instance) {
+		fprintf(stderr, "Error: plugin %s (%s) would not start\n", node->name, plugin->name ? plugin->name : node->path);
+		return 1;
+	}
+	step->plugin = plugin;
+
+	if (step->channels == 2) {
+		step->planar[0] = malloc(sizeof(float) * step->block_size);
+		step->planar[1] = malloc(sizeof(float) * step->block_size);
+		if (!step->planar[0] || !step->planar[1]) return 1;
+	}
+
+	char params[GRAPH_PLUGIN_PARAMS_LENGTH];
+	memcpy(params, node->params, sizeof(params));
+	char* saveptr;
+	for (char* line = strtok_r(params, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		char* value = strchr(line, '=');
+		*value++ = '\0';
+		if (!plugin->set_param || plugin->set_param(step->plugin_instance, line, value) != 0) fprintf(stderr, "Warning! Plugin %s did not take %s=%s\n", node->name, line, value);
+	}
+	return 0;
+}
+
+static bool node_is_off(const GraphNode* node) {
+	switch (node->type) {
+		case GRAPH_NODE_CLIP: return node->threshold == 0.0f;
+		case GRAPH_NODE_AGC: return node->max == 0.0f;
+		case GRAPH_NODE_LPF: return node->cutoff == 0.0f;
+		case GRAPH_NODE_PREEMPHASIS: return node->tau == 0.0f;
+		case GRAPH_NODE_TILT: return node->strength == 0.0f;
+		default: return false;
+	}
+}
+
+static const GraphStep* find_previous_step(const GraphPlan* previous, const GraphStep* step, uint32_t sample_rate) {
+	if (!previous || previous->sample_rate != sample_rate) return NULL;
+	for (uint8_t s = 0; s < previous->num_steps; s++) {
+		if (previous->steps[s].type == step->type && strcmp(previous->steps[s].name, step->name) == 0) return &previous->steps[s];
+	}
+	return NULL;
+}
+
+// FNV-1a, of the settings only, a node's place in its struct and any padding don't count
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+static uint64_t hash_graph_nodes(const GraphNode* nodes, uint8_t count, uint8_t channels, uint32_t sample_rate) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = hash_bytes(hash, &channels, sizeof(channels));
+	hash = hash_bytes(hash, &sample_rate, sizeof(sample_rate));
+	for (uint8_t n = 0; n < count; n++) {
+		const GraphNode* node = &nodes[n];
+		const float settings[] = {node->gain, node->threshold, node->cutoff, node->tau, node->unity, node->target, node->min, node->max,
+		                          node->attack, node->release, node->power, node->deviation, node->strength};
+		hash = hash_bytes(hash, node->name, strnlen(node->name, GRAPH_NAME_LENGTH));
+		hash = hash_bytes(hash, &node->type, sizeof(node->type));
+		hash = hash_bytes(hash, &node->order, sizeof(node->order));
+		hash = hash_bytes(hash, settings, sizeof(settings));
+		hash = hash_bytes(hash, node->path, strnlen(node->path, sizeof(node->path)));
+		hash = hash_bytes(hash, node->params, strnlen(node->params, sizeof(node->params)));
+	}
+	return hash;
+}
+
+int init_graph_plan(GraphPlan* plan, const GraphNode* nodes, uint8_t count, uint8_t channels, uint32_t sample_rate, uint32_t block_size, const GraphPlan* previous) {
+	GraphPlan built;
+	memset(&built, 0, sizeof(built));
+	built.channels = channels;
+	built.sample_rate = sample_rate;
+	built.block_size = block_size;
+
+	if (count > GRAPH_MAX_NODES) return 1;
+	built.hash = hash_graph_nodes(nodes, count, channels, sample_rate);
+	for (uint8_t n = 0; n < count; n++) {
+		if (nodes[n].type == GRAPH_NODE_NONE || check_graph_node(&nodes[n], channels) != NULL) return 1;
+	}
+
+	for (uint8_t n = 0; n < count; n++) {
+		const GraphNode* node = &nodes[n];
+		if (node_is_off(node)) continue;
+
+		GraphStep* step = &built.steps[built.num_steps++];
+		memcpy(step->name, node->name, GRAPH_NAME_LENGTH);
+		step->type = node->type;
+		step->channels = channels;
+		step->block_size = block_size;
+
+		switch (node->type) {
+			case GRAPH_NODE_GAIN:
+				step->gain = node->gain;
+				step->target_gain = node->gain;
+				step->process = process_gain;
+				// Fold in the clipper after it, if there is one with only stages that are off in between
+				for (uint8_t next = n + 1; next < count; next++) {
+					if (node_is_off(&nodes[next])) continue;
+					if (nodes[next].type == GRAPH_NODE_CLIP) {
+						step->threshold = nodes[next].threshold;
+						step->process = process_gain_clip;
+						n = next;
+					}
+					break;
+				}
+				break;
+			case GRAPH_NODE_CLIP:
+				step->threshold = node->threshold;
+				step->process = process_clip;
+				break;
+			case GRAPH_NODE_AGC:
+				initAGC(&step->agc, sample_rate, node->target, node->min, node->max, node->attack, node->release);
+				step->process = process_agc_step;
+				break;
+			case GRAPH_NODE_LPF: {
+				float cutoff = node->cutoff;
+				if (cutoff > sample_rate * GRAPH_LPF_MAX_CUTOFF) {
+					cutoff = sample_rate * GRAPH_LPF_MAX_CUTOFF;
+					fprintf(stderr, "Warning! The cutoff of %s is over what the sample rate allows, using %.0f hz.\n", node->name, cutoff);
+				}
+				for (uint8_t c = 0; c < channels; c++) {
+					step->lpf[c] = iirfilt_rrrf_create_prototype(LIQUID_IIRDES_CHEBY2, LIQUID_IIRDES_LOWPASS, LIQUID_IIRDES_SOS, node->order, (cutoff/sample_rate), 0.0f, 1.0f, 60.0f);
+				}
+				step->process = process_lpf;
+				break;
+			}
+			case GRAPH_NODE_PREEMPHASIS:
+				for (uint8_t c = 0; c < channels; c++) init_preemphasis(&step->preemphasis[c], node->tau * 1.0e-6f, sample_rate, node->unity);
+				step->process = process_preemphasis;
+				break;
+			case GRAPH_NODE_BS412:
+				init_bs412(&step->bs412, node->deviation, node->power, node->attack, node->release, node->max, sample_rate);
+				step->process = process_bs412;
+				break;
+			case GRAPH_NODE_TILT:
+				tilt_init(&step->tilt, node->strength, sample_rate);
+				step->process = process_tilt;
+				break;
+			case GRAPH_NODE_PLUGIN:
+				if (load_plugin(step, node, sample_rate) != 0) {
+					free_graph_plan(&built);
+					return 1;
+				}
+				step->process = process_plugin;
+				break;
+			default:
+				break;
+		}
+
+	}
+
+	carry_graph_gains(&built, previous);
+	*plan = built;
+	return 0;
+}
+
+// The gain and what it's worked out from, the filters and every setting are the new step's
+static void copy_step_state(GraphStep* step, const GraphStepState* state) {
+	if (step->type == GRAPH_NODE_AGC) {
+		step->agc.currentGain = state->gain;
+		step->agc.currentLevel = state->level;
+		step->agc.rmsBuffer = state->rms;
+	} else if (step->type == GRAPH_NODE_BS412) {
+		step->bs412.gain = state->gain;
+		step->bs412.average = state->average;
+		step->bs412.average_counter = state->average_counter;
+	}
+}
+
+static bool get_step_state(const GraphStep* step, GraphStepState* state) {
+	memset(state, 0, sizeof(GraphStepState));
+	memcpy(state->name, step->name, GRAPH_NAME_LENGTH);
+	state->type = step->type;
+	if (step->type == GRAPH_NODE_AGC) {
+		state->gain = step->agc.currentGain;
+		state->level = step->agc.currentLevel;
+		state->rms = step->agc.rmsBuffer;
+	} else if (step->type == GRAPH_NODE_BS412) {
+		state->gain = step->bs412.gain;
+		state->average = step->bs412.average;
+		state->average_counter = step->bs412.average_counter;
+	} else return false;
+	return true;
+}
+
+void carry_graph_gains(GraphPlan* plan, const GraphPlan* previous) {
+	for (uint8_t s = 0; s < plan->num_steps; s++) {
+		GraphStep* step = &plan->steps[s];
+		const GraphStep* last = find_previous_step(previous, step, plan->sample_rate);
+		GraphStepState state;
+		if (last && get_step_state(last, &state)) copy_step_state(step, &state);
+	}
+}
+
+void save_graph_state(const GraphPlan* plan, GraphState* state) {
+	state->hash = plan->hash;
+	state->num_steps = 0;
+	for (uint8_t s = 0; s < plan->num_steps; s++) {
+		if (get_step_state(&plan->steps[s], &state->steps[state->num_steps])) state->num_steps++;
+	}
+}
+
+bool restore_graph_state(GraphPlan* plan, const GraphState* state) {
+	if (state->hash != plan->hash || state->num_steps > GRAPH_MAX_NODES) return false;
+	for (uint8_t s = 0; s < plan->num_steps; s++) {
+		GraphStep* step = &plan->steps[s];
+		for (uint32_t i = 0; i < state->num_steps; i++) {
+			const GraphStepState* saved = &state->steps[i];
+			if (saved->type != (uint32_t)step->type || strncmp(saved->name, step->name, GRAPH_NAME_LENGTH) != 0) continue;
+			if (isfinite(saved->gain) && isfinite(saved->level) && isfinite(saved->rms) && isfinite(saved->average)) copy_step_state(step, saved);
+			break;
+		}
+	}
+	return true;
+}
+
+void free_graph_plan(GraphPlan* plan) {
+	for (uint8_t s = 0; s < plan->num_steps; s++) {
+		GraphStep* step = &plan->steps[s];
+		for (uint8_t c = 0; c < 2; c++) {
+			if (step->lpf[c]) iirfilt_rrrf_destroy(step->lpf[c]);
+			step->lpf[c] = NULL;
+			free(step->planar[c]);
+			step->planar[c] = NULL;
+		}
+		if (step->plugin_instance) step->plugin->destroy(step->plugin_instance);
+		step->plugin_instance = NULL;
+		if (step->plugin_library) dlclose(step->plugin_library);
+		step->plugin_library = NULL;
+	}
+}
+
+void run_graph_plan(GraphPlan* plan, float* buffer, size_t count) {
+	for (uint8_t s = 0; s < plan->num_steps; s++) plan->steps[s].process(&plan->steps[s], buffer, count);
+}
+
+void crossfade_graph_plans(GraphPlan* from, GraphPlan* to, float* buffer, float* scratch, size_t count) {
+	size_t samples = count * to->channels;
+	memcpy(scratch, buffer, samples * sizeof(float));
+	run_graph_plan(from, scratch, count);
+	run_graph_plan(to, buffer, count);
+
+	const float step = 1.0f / count;
+	for (size_t i = 0; i < count; i++) {
+		float fade = (i + 1) * step;
+		for (uint8_t c = 0; c < to->channels; c++) {
+			size_t n = i * to->channels + c;
+			buffer[n] = scratch[n] + (buffer[n] - scratch[n]) * fade;
+		}
+	}
+}
+
+// Index of the step, -1 if there is no such step or setting
+static int find_graph_param(const GraphPlan* plan, const char* name, const char* key) {
+	for (uint8_t s = 0; s < plan->num_steps; s++) {
+		const GraphStep* step = &plan->steps[s];
+		if (strcmp(step->name, name) != 0) continue;
+		if ((step->type == GRAPH_NODE_GAIN && strcmp(key, "gain") == 0) ||
+			(step->type == GRAPH_NODE_AGC && strcmp(key, "target") == 0) ||
+			(step->type == GRAPH_NODE_BS412 && strcmp(key, "power") == 0)) return s;
+		return -1;
+	}
+	return -1;
+}
+
+bool has_graph_param(const GraphPlan* plan, const char* name, const char* key) {
+	return find_graph_param(plan, name, key) >= 0;
+}
+
+bool set_graph_param(GraphPlan* plan, const char* name, const char* key, float value) {
+	int s = find_graph_param(plan, name, key);
+	if (s < 0) return false;
+	GraphStep* step = &plan->steps[s];
+	if (step->type == GRAPH_NODE_GAIN) step->target_gain = value;
+	else if (step->type == GRAPH_NODE_AGC) step->agc.targetLevel = value;
+	else step->bs412.target = value;
+	return true;
+}
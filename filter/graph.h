@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <liquid/liquid.h>
+#include "iir.h"
+#include "gain_control.h"
+#include "bs412.h"
+#include "../lib/fm95_plugin.h"
+
+// A chain of processing stages set up in the config, compiled into a list of steps that each do a whole block
+#define GRAPH_MAX_NODES 16
+#define GRAPH_NAME_LENGTH 24
+#define GRAPH_PLUGIN_PARAMS_LENGTH 256
+
+typedef enum
+{
+	GRAPH_NODE_NONE = 0,
+	GRAPH_NODE_GAIN,
+	GRAPH_NODE_CLIP,
+	GRAPH_NODE_AGC,
+	GRAPH_NODE_LPF,
+	GRAPH_NODE_PREEMPHASIS,
+	GRAPH_NODE_BS412,
+	GRAPH_NODE_TILT,
+	GRAPH_NODE_PLUGIN
+} GraphNodeType;
+
+// Where a node goes without being listed in a graph
+typedef enum
+{
+	GRAPH_AT_NONE = 0,
+	GRAPH_AT_PRE_AGC, // Audio, right before the AGC
+	GRAPH_AT_POST_CLIP, // Audio, right after the clipper
+	GRAPH_AT_COMPOSITE // MPX, right before the output clipper
+} GraphInsertPoint;
+
+// A stage and its settings, a setting that turns the stage off (a cutoff of 0, a threshold of 0...) leaves it out of the plan
+typedef struct
+{
+	char name[GRAPH_NAME_LENGTH];
+	GraphNodeType type;
+	float gain; // gain
+	float threshold; // clip
+	float cutoff; // lpf
+	uint8_t order; // lpf
+	float tau; // preemphasis, in µs
+	float unity; // preemphasis, the frequency left at its level
+	float target; // agc
+	float min; // agc
+	float max; // agc, bs412
+	float attack; // agc, bs412
+	float release; // agc, bs412
+	float power; // bs412, in dBr
+	float deviation; // bs412, what a level of 1.0 is
+	float strength; // tilt
+	char path[128]; // plugin
+	char params[GRAPH_PLUGIN_PARAMS_LENGTH]; // plugin, its other keys as key=value lines, for set_param
+	GraphInsertPoint at;
+} GraphNode;
+
+typedef struct GraphStep
+{
+	void (*process)(struct GraphStep* step, float* buffer, size_t count);
+	char name[GRAPH_NAME_LENGTH];
+	GraphNodeType type;
+	uint8_t channels;
+	float gain;
+	float target_gain; // What gain is ramped to over the next block
+	float threshold;
+	AGC agc;
+	iirfilt_rrrf lpf[2];
+	ResistorCapacitor preemphasis[2];
+	BS412Compressor bs412;
+	TiltCorrectionFilter tilt;
+	void* plugin_library;
+	const FM95Plugin* plugin;
+	void* plugin_instance;
+	uint32_t block_size;
+	float* planar[2]; // The plugin's L and R, only for 2 channels
+} GraphStep;
+
+// Every stage works in place on the interleaved block, so the plan needs no buffers of its own but a stereo plugin's
+typedef struct
+{
+	GraphStep steps[GRAPH_MAX_NODES];
+	uint8_t num_steps;
+	uint8_t channels;
+	uint32_t sample_rate;
+	uint32_t block_size;
+	uint64_t hash; // Of the nodes, channels and sample rate it was built from
+} GraphPlan;
+
+// What an AGC or BS412 step has measured of the signal so far, enough for a new plan to pick up from
+typedef struct
+{
+	char name[GRAPH_NAME_LENGTH];
+	uint32_t type;
+	float gain;
+	float level; // agc
+	float rms; // agc
+	uint32_t average_counter; // bs412
+	double average; // bs412, the power window
+} GraphStepState;
+
+// A plain struct that can be kept in a file, only valid for a plan with the same hash
+typedef struct
+{
+	uint64_t hash;
+	uint32_t num_steps;
+	GraphStepState steps[GRAPH_MAX_NODES];
+} GraphState;
+
+// A node of the type with its default settings, false if there is no such type
+bool init_graph_node(GraphNode* node, const char* name, const char* type);
+// Sets one setting from a [node.NAME] key, false if the node's type has no such setting, a plugin takes every key
+bool parse_graph_node(GraphNode* node, const char* key, const char* value);
+// Why the node can't run on this many channels, NULL if it can
+const char* check_graph_node(const GraphNode* node, uint8_t channels);
+
+// The AGC and BS412 carry on from what a step of the same name in previous (can be NULL) at the same sample rate measured, plugins are loaded again,
+// block_size is the most frames run_graph_plan is given, 0 on success, plan isn't touched otherwise
+int init_graph_plan(GraphPlan* plan, const GraphNode* nodes, uint8_t count, uint8_t channels, uint32_t sample_rate, uint32_t block_size, const GraphPlan* previous);
+// Carries the AGC and BS412 on like init_graph_plan does, for a plan that was built while previous was still running
+void carry_graph_gains(GraphPlan* plan, const GraphPlan* previous);
+// What the AGC and BS412 steps measured so far, from the thread that runs the plan
+void save_graph_state(const GraphPlan* plan, GraphState* state);
+// Puts a saved state back into the steps of the same name and type, false (and the plan isn't touched) if the plan wasn't built the same way
+bool restore_graph_state(GraphPlan* plan, const GraphState* state);
+// Frees the filters and plugins, the gains stay readable for the next init_graph_plan
+void free_graph_plan(GraphPlan* plan);
+// count frames of channels interleaved samples
+void run_graph_plan(GraphPlan* plan, float* buffer, size_t count);
+// Changes a running step from the thread that runs the plan, a gain's gain (ramped over the next block), an AGC's target or a BS412's power,
+// false if there is no such step or setting
+bool set_graph_param(GraphPlan* plan, const char* name, const char* key, float value);
+// Whether set_graph_param would find the step and setting, reads nothing that changes while the plan runs
+bool has_graph_param(const GraphPlan* plan, const char* name, const char* key);
+// Runs both plans on the same block and fades from the first one's output to the second's over it, scratch is as big as the block
+void crossfade_graph_plans(GraphPlan* from, GraphPlan* to, float* buffer, float* scratch, size_t count);
@@ -77,3 +77,11 @@ int write_PulseOutputDevice(PulseOutputDevice* dev, void* buffer, size_t size) {
 	if(pa_simple_write(dev->dev, buffer, size, &error) == 0) return 0;
 	return error;
 }
+
+int get_latency_PulseOutputDevice(PulseOutputDevice* dev, pa_usec_t* latency) {
+	if (!dev->initialized) return PA_ERR_BADSTATE;
+	int error = 0;
+	*latency = pa_simple_get_latency(dev->dev, &error);
+	if (*latency == (pa_usec_t)-1) return error;
+	return 0;
+}
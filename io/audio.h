@@ -33,3 +33,5 @@ void free_PulseDevice(PulseDevice *dev);
 typedef PulseDevice PulseOutputDevice;
 int init_PulseOutputDevice(PulseOutputDevice* dev, const int sample_rate, const int channels, const char* app_name, const char *stream_name, const char* device, pa_buffer_attr* buffer_attr, enum pa_sample_format format);
 int write_PulseOutputDevice(PulseOutputDevice *dev, void *buffer, size_t size);
+// How long until something written now gets played
+int get_latency_PulseOutputDevice(PulseOutputDevice *dev, pa_usec_t *latency);
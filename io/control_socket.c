@@ -0,0 +1,145 @@
+#include "control_socket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pulse/def.h>
+#include <pulse/error.h>
+
+#define CONTROL_POLL_MS 200 // How soon the thread sees it has to stop
+
+static void drop_client(ControlSocket* control, uint8_t c) {
+	close(control->clients[c]);
+	control->clients[c] = -1;
+	control->line_lengths[c] = 0;
+}
+
+static void accept_client(ControlSocket* control) {
+	int fd = accept(control->listen_fd, NULL, NULL);
+	if(fd < 0) return;
+	for(uint8_t c = 0; c < CONTROL_MAX_CLIENTS; c++) {
+		if(control->clients[c] != -1) continue;
+		control->clients[c] = fd;
+		control->line_lengths[c] = 0;
+		return;
+	}
+	const char* busy = "error: too many clients\n";
+	send(fd, busy, strlen(busy), MSG_NOSIGNAL | MSG_DONTWAIT);
+	close(fd);
+}
+
+// Answers every whole line that came in, false if the client is gone or sent a line too long to be one
+static bool read_client(ControlSocket* control, uint8_t c) {
+	char* line = control->lines[c];
+	size_t* length = &control->line_lengths[c];
+	ssize_t got = recv(control->clients[c], line + *length, CONTROL_LINE_LENGTH - *length, MSG_DONTWAIT);
+	if(got < 0) return errno == EAGAIN || errno == EINTR;
+	if(got == 0) return false;
+	*length += (size_t)got;
+
+	char reply[CONTROL_REPLY_LENGTH];
+	char* end;
+	while((end = memchr(line, '\n', *length)) != NULL) {
+		*end = '\0';
+		reply[0] = '\0';
+		control->handler(control->user, line, reply, sizeof(reply));
+		size_t reply_length = strlen(reply);
+		// A client that doesn't read its replies is not waited for
+		if(reply_length != 0 && send(control->clients[c], reply, reply_length, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)reply_length) return false;
+		size_t used = (size_t)(end - line) + 1;
+		memmove(line, end + 1, *length - used);
+		*length -= used;
+	}
+	return *length < CONTROL_LINE_LENGTH;
+}
+
+static void* run_ControlSocket(void* arg) {
+	ControlSocket* control = arg;
+	struct pollfd fds[CONTROL_MAX_CLIENTS + 1];
+	uint8_t owners[CONTROL_MAX_CLIENTS + 1];
+
+	while(__atomic_load_n(&control->running, __ATOMIC_ACQUIRE)) {
+		nfds_t count = 0;
+		fds[count].fd = control->listen_fd;
+		fds[count++].events = POLLIN;
+		for(uint8_t c = 0; c < CONTROL_MAX_CLIENTS; c++) {
+			if(control->clients[c] == -1) continue;
+			owners[count] = c;
+			fds[count].fd = control->clients[c];
+			fds[count++].events = POLLIN;
+		}
+
+		if(poll(fds, count, CONTROL_POLL_MS) <= 0) continue;
+		for(nfds_t i = 1; i < count; i++) {
+			if(fds[i].revents == 0) continue;
+			if(!read_client(control, owners[i])) drop_client(control, owners[i]);
+		}
+		if(fds[0].revents & POLLIN) accept_client(control);
+	}
+	return NULL;
+}
+
+int init_ControlSocket(ControlSocket* control, const char* path, ControlHandler handler, void* user) {
+	memset(control, 0, sizeof(ControlSocket));
+	for(uint8_t c = 0; c < CONTROL_MAX_CLIENTS; c++) control->clients[c] = -1;
+	control->handler = handler;
+	control->user = user;
+
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "The control socket path %s is too long\n", path);
+		return PA_ERR_INVALID;
+	}
+	strcpy(address.sun_path, path);
+	memcpy(control->path, path, strlen(path) + 1);
+
+	control->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if(control->listen_fd < 0) {
+		fprintf(stderr, "Cannot open the control socket: %s\n", strerror(errno));
+		return PA_ERR_IO;
+	}
+
+	// Only a socket is replaced, and only when nothing answers on it
+	struct stat st;
+	if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		bool in_use = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+		if(probe >= 0) close(probe);
+		if(in_use) {
+			fprintf(stderr, "The control socket %s is in use by another process\n", path);
+			close(control->listen_fd);
+			return PA_ERR_EXIST;
+		}
+		unlink(path);
+	}
+
+	if(bind(control->listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(control->listen_fd, CONTROL_MAX_CLIENTS) != 0) {
+		fprintf(stderr, "Cannot listen on the control socket %s: %s\n", path, strerror(errno));
+		close(control->listen_fd);
+		return PA_ERR_IO;
+	}
+
+	control->running = true;
+	if(pthread_create(&control->thread, NULL, run_ControlSocket, control) != 0) {
+		close(control->listen_fd);
+		unlink(control->path);
+		return PA_ERR_INTERNAL;
+	}
+	return 0;
+}
+
+void free_ControlSocket(ControlSocket* control) {
+	__atomic_store_n(&control->running, false, __ATOMIC_RELEASE);
+	pthread_join(control->thread, NULL);
+	for(uint8_t c = 0; c < CONTROL_MAX_CLIENTS; c++) {
+		if(control->clients[c] != -1) drop_client(control, c);
+	}
+	close(control->listen_fd);
+	unlink(control->path);
+}
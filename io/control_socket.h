@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Text commands from local clients on a UNIX stream socket, a line each, answered from a thread of its own
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_LINE_LENGTH 128
+#define CONTROL_REPLY_LENGTH 1024
+
+// Fills reply (size bytes, every line ending in \n) for a line without its \n, an empty reply sends nothing
+typedef void (*ControlHandler)(void* user, char* line, char* reply, size_t size);
+
+typedef struct
+{
+	int listen_fd;
+	int clients[CONTROL_MAX_CLIENTS]; // -1 when free
+	char lines[CONTROL_MAX_CLIENTS][CONTROL_LINE_LENGTH];
+	size_t line_lengths[CONTROL_MAX_CLIENTS];
+	char path[108];
+	ControlHandler handler;
+	void* user;
+	pthread_t thread;
+	bool running;
+} ControlSocket;
+
+// A socket file left at path by an earlier run is replaced, 0 on success
+int init_ControlSocket(ControlSocket* control, const char* path, ControlHandler handler, void* user);
+// Stops the thread, drops the clients and removes the socket file
+void free_ControlSocket(ControlSocket* control);
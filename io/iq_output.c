@@ -0,0 +1,89 @@
+#include "iq_output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pulse/def.h>
+#include <pulse/error.h>
+
+int parse_iq_format(const char* name) {
+	if(strcasecmp(name, "cs8") == 0) return IQ_FORMAT_CS8;
+	if(strcasecmp(name, "cs16") == 0) return IQ_FORMAT_CS16;
+	if(strcasecmp(name, "cf32") == 0) return IQ_FORMAT_CF32;
+	return -1;
+}
+
+int init_IQOutput(IQOutput* out, const char* path, IQFormat format) {
+	memset(out, 0, sizeof(IQOutput));
+	out->format = format;
+
+	if(strcmp(path, "-") == 0) {
+		out->fd = STDOUT_FILENO;
+		return 0;
+	}
+
+	out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(out->fd < 0) {
+		fprintf(stderr, "Cannot open the IQ output %s: %s\n", path, strerror(errno));
+		return PA_ERR_IO;
+	}
+	out->close_fd = true;
+	return 0;
+}
+
+static size_t sample_size(IQFormat format) {
+	switch(format) {
+		case IQ_FORMAT_CS8: return sizeof(int8_t);
+		case IQ_FORMAT_CS16: return sizeof(int16_t);
+		default: return sizeof(float);
+	}
+}
+
+static int write_all(int fd, const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	while(size) {
+		ssize_t written = write(fd, bytes, size);
+		if(written < 0) {
+			if(errno == EINTR) continue;
+			return PA_ERR_IO;
+		}
+		bytes += written;
+		size -= (size_t)written;
+	}
+	return 0;
+}
+
+int write_IQOutput(IQOutput* out, const float* iq, size_t count) {
+	size_t values = count * 2;
+	if(out->format == IQ_FORMAT_CF32) return write_all(out->fd, iq, values * sizeof(float));
+
+	size_t size = values * sample_size(out->format);
+	if(size > out->buffer_size) {
+		void* buffer = realloc(out->buffer, size);
+		if(!buffer) return PA_ERR_INTERNAL;
+		out->buffer = buffer;
+		out->buffer_size = size;
+	}
+
+	// The modulator stays within a hair of 1, the clamp only catches that hair
+	if(out->format == IQ_FORMAT_CS8) {
+		int8_t* samples = out->buffer;
+		for(size_t i = 0; i < values; i++) samples[i] = (int8_t)lrintf(fmaxf(-1.0f, fminf(1.0f, iq[i])) * 127.0f);
+	} else {
+		int16_t* samples = out->buffer;
+		for(size_t i = 0; i < values; i++) samples[i] = (int16_t)lrintf(fmaxf(-1.0f, fminf(1.0f, iq[i])) * 32767.0f);
+	}
+	return write_all(out->fd, out->buffer, size);
+}
+
+void free_IQOutput(IQOutput* out) {
+	if(out->close_fd) close(out->fd);
+	free(out->buffer);
+	out->buffer = NULL;
+	out->close_fd = false;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum
+{
+	IQ_FORMAT_CS8 = 0, // Signed 8 bit pairs, like a HackRF takes
+	IQ_FORMAT_CS16, // Signed 16 bit pairs
+	IQ_FORMAT_CF32 // Native 32 bit float pairs
+} IQFormat;
+
+typedef struct
+{
+	int fd;
+	bool close_fd;
+	IQFormat format;
+	void* buffer; // Converted samples
+	size_t buffer_size;
+} IQOutput;
+
+// "cs8", "cs16" or "cf32", -1 for anything else
+int parse_iq_format(const char* name);
+
+// path is a file (truncated), a FIFO (waits for a reader) or - for stdout
+int init_IQOutput(IQOutput* out, const char* path, IQFormat format);
+// iq holds count interleaved I and Q pairs in -1 to 1
+int write_IQOutput(IQOutput* out, const float* iq, size_t count);
+void free_IQOutput(IQOutput* out);
@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include "mpx_sender.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <pulse/def.h>
+#include <pulse/error.h>
+
+#define MPX_SENDER_BATCH 16
+#define MPX_SENDER_DLL_BANDWIDTH 0.1 // Hz, low enough that scheduling jitter does not reach the timestamps
+#define MPX_SENDER_DLL_RESET_NS 50000000.0 // A block this far off the prediction means we stalled, start over
+
+static int64_t realtime_ns(const MPXSender* sender) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + sender->clock_offset_ns;
+}
+
+int init_MPXSender(MPXSender* sender, const char* destination, const char* interface, uint8_t ttl, uint32_t sample_rate, float clock_offset_ms) {
+	memset(sender, 0, sizeof(MPXSender));
+	sender->sockfd = -1;
+
+	if(parse_UDPEndpoint(&sender->destination, destination, MPXDIST_DEFAULT_PORT) != 0) {
+		fprintf(stderr, "Invalid MPX distribution destination: %s\n", destination);
+		return PA_ERR_INVALID;
+	}
+
+	sender->sockfd = open_UDPSender(&sender->destination, interface, 0, ttl, true);
+	if(sender->sockfd < 0) return PA_ERR_IO;
+
+	sender->sample_rate = sample_rate;
+	sender->clock_offset_ns = (int64_t)(clock_offset_ms * 1e6);
+
+	// Start on the wall clock, so that the oscillator phases are a function of time and not of when we were started
+	uint64_t index = MPXDist_index_at(realtime_ns(sender), sample_rate);
+	sender->sample_index = (index + MPXDIST_SAMPLES - 1) / MPXDIST_SAMPLES * MPXDIST_SAMPLES;
+	sender->restart = true;
+	return 0;
+}
+
+static void update_dll(MPXSender* sender, size_t count) {
+	double now = (double)realtime_ns(sender);
+
+	if(!sender->dll_running || sender->dll_block != count || fabs(now - sender->dll_next) > MPX_SENDER_DLL_RESET_NS) {
+		sender->dll_period = 1e9 * count / sender->sample_rate;
+		sender->dll_time = now;
+		sender->dll_next = now + sender->dll_period;
+		sender->dll_block = count;
+		if(sender->dll_running) sender->restart = true;
+		sender->dll_running = true;
+		return;
+	}
+
+	double omega = 2.0 * M_PI * MPX_SENDER_DLL_BANDWIDTH * sender->dll_period * 1e-9;
+	double error = now - sender->dll_next;
+	sender->dll_time = sender->dll_next;
+	sender->dll_next += M_SQRT2 * omega * error + sender->dll_period;
+	sender->dll_period += omega * omega * error;
+}
+
+int send_MPXSender(MPXSender* sender, const float* samples, size_t count) {
+	if(sender->sockfd < 0) return PA_ERR_BADSTATE;
+
+	update_dll(sender, count);
+
+	// The index the block started on, packets that began in the last block get a time before dll_time
+	uint64_t block_index = sender->sample_index + sender->pending_count;
+	double ns_per_sample = sender->dll_period / count;
+
+	MPXDistPacket packets[MPX_SENDER_BATCH];
+	struct mmsghdr messages[MPX_SENDER_BATCH];
+	struct iovec iovecs[MPX_SENDER_BATCH];
+	int batched = 0;
+
+	for(size_t i = 0; i < count; i++) {
+		sender->pending[sender->pending_count++] = samples[i];
+		if(sender->pending_count < MPXDIST_SAMPLES) continue;
+
+		MPXDistPacket* packet = &packets[batched];
+		packet->header.magic = MPXDIST_MAGIC;
+		packet->header.version = MPXDIST_VERSION;
+		packet->header.flags = sender->restart ? MPXDIST_FLAG_RESTART : 0;
+		packet->header.samples = MPXDIST_SAMPLES;
+		packet->header.sample_rate = sender->sample_rate;
+		packet->header.sequence = sender->sequence++;
+		packet->header.sample_index = sender->sample_index;
+		packet->header.timestamp_ns = (int64_t)(sender->dll_time + ((double)sender->sample_index - (double)block_index) * ns_per_sample);
+		memcpy(packet->samples, sender->pending, sizeof(packet->samples));
+
+		iovecs[batched].iov_base = packet;
+		iovecs[batched].iov_len = sizeof(MPXDistPacket);
+		memset(&messages[batched], 0, sizeof(struct mmsghdr));
+		messages[batched].msg_hdr.msg_name = &sender->destination.addr;
+		messages[batched].msg_hdr.msg_namelen = sender->destination.len;
+		messages[batched].msg_hdr.msg_iov = &iovecs[batched];
+		messages[batched].msg_hdr.msg_iovlen = 1;
+		batched++;
+
+		sender->restart = false;
+		sender->sample_index += MPXDIST_SAMPLES;
+		sender->pending_count = 0;
+
+		if(batched == MPX_SENDER_BATCH) {
+			sendmmsg(sender->sockfd, messages, batched, 0); // A full socket buffer only costs the receivers these packets
+			batched = 0;
+		}
+	}
+	if(batched) sendmmsg(sender->sockfd, messages, batched, 0);
+
+	return 0;
+}
+
+void free_MPXSender(MPXSender* sender) {
+	if(sender->sockfd >= 0) close(sender->sockfd);
+	sender->sockfd = -1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "udp.h"
+#include "../lib/mpx_dist.h"
+
+typedef struct
+{
+	int sockfd;
+	UDPAddress destination;
+	uint32_t sample_rate;
+	int64_t clock_offset_ns; // Added to the local clock, to simulate a badly synced sender
+
+	uint64_t sample_index; // Of the next sample to be sent
+	uint32_t sequence;
+	bool restart;
+
+	// Samples waiting for a full packet
+	float pending[MPXDIST_SAMPLES];
+	uint16_t pending_count;
+
+	// Delay locked loop turning the jittery block times into a smooth timeline
+	bool dll_running;
+	double dll_time; // ns, of the block being sent
+	double dll_next; // ns, predicted for the next block
+	double dll_period; // ns per block
+	size_t dll_block;
+} MPXSender;
+
+// destination is ip[:port] or [ipv6][:port]
+int init_MPXSender(MPXSender* sender, const char* destination, const char* interface, uint8_t ttl, uint32_t sample_rate, float clock_offset_ms);
+// Call once per block, right after the block was handed to the audio device, so the time seen here follows its clock
+int send_MPXSender(MPXSender* sender, const float* samples, size_t count);
+void free_MPXSender(MPXSender* sender);
@@ -0,0 +1,286 @@
+#include "udp.h"
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef IPV6_MULTICAST_ALL
+#define IPV6_MULTICAST_ALL 29 // Linux 4.20, older headers don't have it
+#endif
+
+int parse_UDPAddress(UDPAddress* address, const char* ip, uint16_t port) {
+	memset(address, 0, sizeof(UDPAddress));
+
+	struct sockaddr_in* v4 = (struct sockaddr_in*)&address->addr;
+	struct sockaddr_in6* v6 = (struct sockaddr_in6*)&address->addr;
+
+	if(ip == NULL || ip[0] == '\0') {
+		v4->sin_family = AF_INET;
+		v4->sin_addr.s_addr = htonl(INADDR_ANY);
+		v4->sin_port = htons(port);
+		address->len = sizeof(struct sockaddr_in);
+		return 0;
+	}
+
+	if(inet_pton(AF_INET, ip, &v4->sin_addr) == 1) {
+		v4->sin_family = AF_INET;
+		v4->sin_port = htons(port);
+		address->len = sizeof(struct sockaddr_in);
+		return 0;
+	}
+
+	if(inet_pton(AF_INET6, ip, &v6->sin6_addr) == 1) {
+		v6->sin6_family = AF_INET6;
+		v6->sin6_port = htons(port);
+		address->len = sizeof(struct sockaddr_in6);
+		return 0;
+	}
+
+	return -1;
+}
+
+int parse_UDPEndpoint(UDPAddress* address, const char* endpoint, uint16_t default_port) {
+	char host[INET6_ADDRSTRLEN];
+	const char* host_start = endpoint;
+	const char* host_end;
+	const char* port = NULL;
+
+	if(endpoint == NULL) return parse_UDPAddress(address, NULL, default_port);
+
+	if(endpoint[0] == '[') {
+		host_start++;
+		host_end = strchr(host_start, ']');
+		if(host_end == NULL) return -1;
+		if(host_end[1] == ':') port = host_end + 2;
+		else if(host_end[1] != '\0') return -1;
+	} else {
+		host_end = strchr(endpoint, ':');
+		if(host_end != NULL && strchr(host_end + 1, ':') != NULL) host_end = NULL; // A bare IPv6 address, no port
+		if(host_end != NULL) port = host_end + 1;
+		else host_end = endpoint + strlen(endpoint);
+	}
+
+	size_t host_len = host_end - host_start;
+	if(host_len >= sizeof(host)) return -1;
+	memcpy(host, host_start, host_len);
+	host[host_len] = '\0';
+
+	uint16_t port_number = default_port;
+	if(port != NULL) {
+		char* end;
+		unsigned long value = strtoul(port, &end, 10);
+		if(*end != '\0' || value == 0 || value > 65535) return -1;
+		port_number = (uint16_t)value;
+	}
+
+	return parse_UDPAddress(address, host, port_number);
+}
+
+bool is_multicast_UDPAddress(const UDPAddress* address) {
+	if(address->addr.ss_family == AF_INET) {
+		const struct sockaddr_in* v4 = (const struct sockaddr_in*)&address->addr;
+		return IN_MULTICAST(ntohl(v4->sin_addr.s_addr));
+	}
+	if(address->addr.ss_family == AF_INET6) {
+		const struct sockaddr_in6* v6 = (const struct sockaddr_in6*)&address->addr;
+		return IN6_IS_ADDR_MULTICAST(&v6->sin6_addr);
+	}
+	return false;
+}
+
+// The IPv4 address of an IPv4 one or an IPv4 mapped IPv6 one (::ffff:a.b.c.d, what an IPv6 socket sees of an IPv4 sender)
+static bool get_UDPAddress_v4(const UDPAddress* address, struct in_addr* v4) {
+	if(address->addr.ss_family == AF_INET) {
+		*v4 = ((const struct sockaddr_in*)&address->addr)->sin_addr;
+		return true;
+	}
+	const struct in6_addr* v6 = &((const struct sockaddr_in6*)&address->addr)->sin6_addr;
+	if(address->addr.ss_family != AF_INET6 || !IN6_IS_ADDR_V4MAPPED(v6)) return false;
+	memcpy(&v4->s_addr, &v6->s6_addr[12], sizeof(v4->s_addr));
+	return true;
+}
+
+bool compare_UDPAddress_host(const UDPAddress* a, const UDPAddress* b) {
+	struct in_addr a4, b4;
+	bool a_v4 = get_UDPAddress_v4(a, &a4);
+	bool b_v4 = get_UDPAddress_v4(b, &b4);
+	if(a_v4 || b_v4) return a_v4 && b_v4 && a4.s_addr == b4.s_addr;
+	if(a->addr.ss_family != b->addr.ss_family) return false;
+	if(a->addr.ss_family == AF_INET6) {
+		return memcmp(&((const struct sockaddr_in6*)&a->addr)->sin6_addr, &((const struct sockaddr_in6*)&b->addr)->sin6_addr, sizeof(struct in6_addr)) == 0;
+	}
+	return false;
+}
+
+const char* format_UDPAddress(const UDPAddress* address, char* buffer, size_t size) {
+	const void* src = (address->addr.ss_family == AF_INET6) ? (const void*)&((const struct sockaddr_in6*)&address->addr)->sin6_addr : (const void*)&((const struct sockaddr_in*)&address->addr)->sin_addr;
+	if(inet_ntop(address->addr.ss_family, src, buffer, size) == NULL) snprintf(buffer, size, "?");
+	return buffer;
+}
+
+static int set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1) {
+		perror("fcntl(F_GETFL)");
+		return -1;
+	}
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		perror("fcntl(F_SETFL)");
+		return -1;
+	}
+	return 0;
+}
+
+static int join_multicast(int fd, const UDPAddress* group, unsigned int ifindex) {
+	if(group->addr.ss_family == AF_INET) {
+		struct ip_mreqn mreq;
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.imr_multiaddr = ((const struct sockaddr_in*)&group->addr)->sin_addr;
+		mreq.imr_address.s_addr = htonl(INADDR_ANY);
+		mreq.imr_ifindex = ifindex;
+		if(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+			perror("setsockopt(IP_ADD_MEMBERSHIP)");
+			return -1;
+		}
+		return 0;
+	}
+
+	struct ipv6_mreq mreq;
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.ipv6mr_multiaddr = ((const struct sockaddr_in6*)&group->addr)->sin6_addr;
+	mreq.ipv6mr_interface = ifindex;
+	if(setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0) {
+		perror("setsockopt(IPV6_JOIN_GROUP)");
+		return -1;
+	}
+	return 0;
+}
+
+static int lookup_interface(const char* interface, unsigned int* ifindex) {
+	*ifindex = 0;
+	if(interface == NULL || interface[0] == '\0') return 0;
+	*ifindex = if_nametoindex(interface);
+	if(*ifindex == 0) {
+		fprintf(stderr, "Unknown network interface: %s\n", interface);
+		return -1;
+	}
+	return 0;
+}
+
+int open_UDPListener(const UDPAddress* group, const char* interface, bool reuseport, bool nonblock) {
+	unsigned int ifindex;
+	if(lookup_interface(interface, &ifindex) != 0) return -1;
+
+	int family = group->addr.ss_family;
+	int fd = socket(family, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	int one = 1;
+	if(reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		perror("setsockopt(SO_REUSEPORT)");
+		close(fd);
+		return -1;
+	}
+	if(is_multicast_UDPAddress(group) && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) { // Let other receivers on this box join the group too
+		perror("setsockopt(SO_REUSEADDR)");
+		close(fd);
+		return -1;
+	}
+
+	if(nonblock && set_nonblocking(fd) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	// Bind to the wildcard of the family so that both unicast and group traffic arrive, the group is then only let in by the membership below
+	UDPAddress local;
+	memset(&local, 0, sizeof(local));
+	if(family == AF_INET6) {
+		struct sockaddr_in6* v6 = (struct sockaddr_in6*)&local.addr;
+		v6->sin6_family = AF_INET6;
+		v6->sin6_addr = in6addr_any;
+		v6->sin6_port = ((const struct sockaddr_in6*)&group->addr)->sin6_port;
+		local.len = sizeof(struct sockaddr_in6);
+	} else {
+		struct sockaddr_in* v4 = (struct sockaddr_in*)&local.addr;
+		v4->sin_family = AF_INET;
+		v4->sin_addr.s_addr = htonl(INADDR_ANY);
+		v4->sin_port = ((const struct sockaddr_in*)&group->addr)->sin_port;
+		local.len = sizeof(struct sockaddr_in);
+	}
+
+	if (bind(fd, (struct sockaddr *)&local.addr, local.len) < 0) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+
+	if(is_multicast_UDPAddress(group)) {
+		// A wildcard socket otherwise gets every group any socket on this box joined on the port, not only its own
+		int zero = 0;
+		if(family == AF_INET && setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &zero, sizeof(zero)) < 0) {
+			perror("setsockopt(IP_MULTICAST_ALL)");
+			close(fd);
+			return -1;
+		}
+		if(family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &zero, sizeof(zero)) < 0) {
+			perror("Warning! setsockopt(IPV6_MULTICAST_ALL), other groups joined on this box can get through too");
+		}
+		if(join_multicast(fd, group, ifindex) != 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+int open_UDPSender(const UDPAddress* destination, const char* interface, uint16_t local_port, uint8_t multicast_ttl, bool nonblock) {
+	unsigned int ifindex;
+	if(lookup_interface(interface, &ifindex) != 0) return -1;
+
+	int family = destination->addr.ss_family;
+	int fd = socket(family, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if(nonblock && set_nonblocking(fd) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	UDPAddress local;
+	parse_UDPAddress(&local, (family == AF_INET6) ? "::" : NULL, local_port);
+	if (bind(fd, (struct sockaddr *)&local.addr, local.len) < 0) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+
+	if(is_multicast_UDPAddress(destination)) {
+		int ttl = multicast_ttl;
+		if(family == AF_INET) {
+			setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+			if(ifindex != 0) {
+				struct ip_mreqn mreq;
+				memset(&mreq, 0, sizeof(mreq));
+				mreq.imr_ifindex = ifindex;
+				if(setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) < 0) perror("setsockopt(IP_MULTICAST_IF)");
+			}
+		} else {
+			setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+			if(ifindex != 0 && setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex)) < 0) perror("setsockopt(IPV6_MULTICAST_IF)");
+		}
+	}
+
+	return fd;
+}
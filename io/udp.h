@@ -0,0 +1,29 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+	struct sockaddr_storage addr;
+	socklen_t len;
+} UDPAddress;
+
+// Parses an IPv4 or IPv6 literal, an empty string or NULL gives the IPv4 any address
+int parse_UDPAddress(UDPAddress* address, const char* ip, uint16_t port);
+// Same, but for ip[:port] or [ipv6][:port], default_port is used when there's no port
+int parse_UDPEndpoint(UDPAddress* address, const char* endpoint, uint16_t default_port);
+bool is_multicast_UDPAddress(const UDPAddress* address);
+// Compares only the host part, the port is ignored, an IPv4 mapped IPv6 address is the same as the IPv4 one
+bool compare_UDPAddress_host(const UDPAddress* a, const UDPAddress* b);
+const char* format_UDPAddress(const UDPAddress* address, char* buffer, size_t size);
+
+// Binds to the port on the any address of the group's family, joins the group if it is a multicast one, then only that group's traffic
+// and unicast to the port come in
+// interface is a name such as "eth0", empty or NULL lets the kernel pick
+// reuseport lets several sockets share the port, the kernel then spreads unicast flows between them
+int open_UDPListener(const UDPAddress* group, const char* interface, bool reuseport, bool nonblock);
+// Binds to local_port (0 for any) and points multicast traffic at the interface with the given TTL
+int open_UDPSender(const UDPAddress* destination, const char* interface, uint16_t local_port, uint8_t multicast_ttl, bool nonblock);
@@ -0,0 +1,348 @@
+#include "vban_input.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <pulse/error.h>
+#include "../lib/vban.h"
+
+#ifdef VBAN_INPUT_DEBUG
+#include "../lib/debug.h"
+#endif
+
+#define VBAN_INPUT_DEFAULT_PORT 6980
+#define VBAN_INPUT_PACKET_SIZE 1500
+#define VBAN_INPUT_INTERPOLATOR_PHASES 128
+#define VBAN_INPUT_INTERPOLATOR_LENGTH 16
+#define VBAN_INPUT_MAX_DRIFT 0.002 // 2000 ppm, anything more than this is not drift
+#define VBAN_INPUT_DRIFT_KP 0.0005
+#define VBAN_INPUT_DRIFT_KI 0.000002
+#define VBAN_INPUT_RESYNC_FRAMES 65536 // Further than this and the sender probably restarted
+
+bool is_vban_url(const char* device) {
+	return strncmp(device, VBAN_URL_PREFIX, strlen(VBAN_URL_PREFIX)) == 0;
+}
+
+static int parse_vban_url(const char* url, char* host, size_t host_size, uint16_t* port, char* stream) {
+	const char* p = url + strlen(VBAN_URL_PREFIX);
+	const char* host_end;
+	size_t host_len;
+
+	if (*p == '[') {
+		host_end = strchr(p, ']');
+		if (!host_end) return -1;
+		host_len = host_end - p - 1;
+		p++;
+		host_end++;
+	} else {
+		host_end = p + strcspn(p, ":/");
+		host_len = host_end - p;
+	}
+	if (host_len >= host_size) return -1;
+	memcpy(host, p, host_len);
+	host[host_len] = '\0';
+
+	p = host_end;
+	*port = VBAN_INPUT_DEFAULT_PORT;
+	if (*p == ':') {
+		*port = (uint16_t)strtoul(p + 1, (char**)&p, 10);
+	}
+
+	memset(stream, 0, 16);
+	if (*p == '/' && p[1] != '\0') memcpy(stream, p + 1, strnlen(p + 1, 16));
+	else memcpy(stream, "VBAN", 4);
+	return 0;
+}
+
+static bool is_any_UDPAddress(const UDPAddress* address) {
+	if (address->addr.ss_family == AF_INET6) return IN6_IS_ADDR_UNSPECIFIED(&((const struct sockaddr_in6*)&address->addr)->sin6_addr);
+	return ((const struct sockaddr_in*)&address->addr)->sin_addr.s_addr == htonl(INADDR_ANY);
+}
+
+static inline float vban_sample_to_float(const uint8_t* src, uint8_t format) {
+	switch (format) {
+		case 0: return (src[0] - 128) / 128.0f;
+		case 1: {
+			int16_t v;
+			memcpy(&v, src, sizeof(v));
+			return v / 32768.0f;
+		}
+		case 2: {
+			int32_t v = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 24) >> 8;
+			return v / 8388608.0f;
+		}
+		case 3: {
+			int32_t v;
+			memcpy(&v, src, sizeof(v));
+			return v / 2147483648.0f;
+		}
+		default: {
+			float v;
+			memcpy(&v, src, sizeof(v));
+			return v;
+		}
+	}
+}
+
+static void write_silence(VBANInputDevice* dev, uint64_t* w, uint32_t frames) {
+	uint32_t mask = dev->ring_frames - 1;
+	for (uint32_t i = 0; i < frames; i++, (*w)++) {
+		float* a = &dev->ring[(*w & mask) * dev->channels];
+		memset(a, 0, sizeof(float) * dev->channels);
+		memset(a + dev->ring_frames * dev->channels, 0, sizeof(float) * dev->channels);
+	}
+}
+
+static void answer_ping(VBANInputDevice* dev, const VBANHeader* request, const UDPAddress* sender) {
+	VBANHeaderUnion reply_header;
+	VBANPing0DataUnion ping_data;
+	init_VBANPingReply(&reply_header.packet_data, &ping_data.data, request, VBANPING_TYPE_RECEPTOR, VBANPING_FEATURE_AUDIO | VBANPING_FEATURE_AOIP, "fm95", 1, 0);
+	format_UDPAddress(sender, ping_data.data.DistantIP_ascii, sizeof(ping_data.data.DistantIP_ascii));
+	ping_data.data.DistantPort = htons(dev->port);
+
+	char reply[sizeof(VBANHeader) + sizeof(VBANPing0Data)];
+	memcpy(reply, &reply_header.raw_data, sizeof(VBANHeader));
+	memcpy(reply + sizeof(VBANHeader), &ping_data.raw_data, sizeof(VBANPing0Data));
+	sendto(dev->sockfd, reply, sizeof(reply), 0, (const struct sockaddr*)&sender->addr, sender->len);
+}
+
+static void* vban_receive_thread(void* arg) {
+	VBANInputDevice* dev = (VBANInputDevice*)arg;
+	uint8_t packet[VBAN_INPUT_PACKET_SIZE];
+	UDPAddress sender;
+
+	bool sequence_valid = false;
+	uint32_t next_frame_num = 0;
+	uint8_t last_format = 0xff, last_sr = 0xff, last_channels = 0xff;
+	uint32_t mask = dev->ring_frames - 1;
+	uint64_t w = 0;
+
+	while (__atomic_load_n(&dev->running, __ATOMIC_RELAXED)) {
+		sender.len = sizeof(sender.addr);
+		ssize_t len = recvfrom(dev->sockfd, packet, sizeof(packet), 0, (struct sockaddr*)&sender.addr, &sender.len);
+		if (len < 0) continue; // Timeout, so that we see running go down
+		if ((size_t)len < sizeof(VBANHeader)) continue;
+		if (dev->source_only && !compare_UDPAddress_host(&sender, &dev->source)) continue;
+
+		VBANHeaderUnion data;
+		memcpy(&data.raw_data, packet, sizeof(VBANHeader));
+		if (memcmp(data.packet_data.vban, "VBAN", 4) != 0) continue;
+
+		uint8_t protocol = data.packet_data.protocol_sample_rate_idx & 0xe0;
+		if (protocol == VBAN_PROTOCOL_SERVICE) {
+			if (data.packet_data.sample_channels == VBAN_SERVICE_IDENTIFICATION && data.packet_data.samples_per_frame == 0) answer_ping(dev, &data.packet_data, &sender);
+			continue;
+		}
+		if (protocol != VBAN_PROTOCOL_AUDIO) continue;
+		if (strncmp(data.packet_data.streamname, dev->stream_name, sizeof(data.packet_data.streamname)) != 0) continue;
+
+		uint8_t sr = data.packet_data.protocol_sample_rate_idx & 0x1f;
+		uint8_t format = data.packet_data.format_type & 0x07;
+		if (sr >= VBAN_SR_MAXNUMBER || format >= VBAN_BIT_MAXNUMBER || (data.packet_data.format_type & 0xf0) != 0) continue; // Only PCM
+
+		uint8_t stream_channels = data.packet_data.sample_channels + 1;
+		uint16_t samples = data.packet_data.samples_per_frame + 1;
+		size_t frame_size = (size_t)stream_channels * VBAN_bit_size(format);
+		if (sizeof(VBANHeader) + samples * frame_size > (size_t)len) continue;
+
+		if (sr != last_sr || format != last_format || data.packet_data.sample_channels != last_channels) {
+			last_sr = sr;
+			last_format = format;
+			last_channels = data.packet_data.sample_channels;
+			sequence_valid = false;
+			__atomic_store_n(&dev->input_rate, (uint32_t)VBAN_SRList[sr], __ATOMIC_RELAXED);
+			__atomic_add_fetch(&dev->generation, 1, __ATOMIC_RELEASE);
+			#ifdef VBAN_INPUT_DEBUG
+			debug_printf("VBAN input %.16s: %ld Hz, %s, %d channel(s)\n", dev->stream_name, VBAN_SRList[sr], VBAN_TextBITList[format], stream_channels);
+			#endif
+		}
+
+		uint32_t frame_num = data.packet_data.frame_num;
+		int32_t diff = (int32_t)(frame_num - next_frame_num);
+		uint64_t gap = 0;
+		if (sequence_valid && diff > -VBAN_INPUT_RESYNC_FRAMES && diff < VBAN_INPUT_RESYNC_FRAMES) {
+			if (diff < 0) continue; // Late or duplicate, its slot already played
+			// Keep the timeline, what was lost becomes silence
+			gap = (uint64_t)diff * samples;
+			if (gap > dev->ring_frames / 2) gap = dev->ring_frames / 2;
+		}
+		sequence_valid = true;
+		next_frame_num = frame_num + 1;
+
+		// Claimed before any of it is written, like a seqlock, the reader looks at this after it read and knows if it was lapped
+		__atomic_store_n(&dev->claim_frame, w + gap + samples, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		write_silence(dev, &w, (uint32_t)gap);
+
+		const uint8_t* src = packet + sizeof(VBANHeader);
+		uint8_t bits = VBAN_bit_size(format);
+		for (uint16_t i = 0; i < samples; i++, w++) {
+			float* a = &dev->ring[(w & mask) * dev->channels];
+			float* b = a + dev->ring_frames * dev->channels;
+			for (uint8_t ch = 0; ch < dev->channels; ch++) {
+				uint8_t src_ch = (ch < stream_channels) ? ch : 0; // Mono goes to every channel
+				float v = (ch < stream_channels || stream_channels == 1) ? vban_sample_to_float(src + src_ch * bits, format) : 0.0f;
+				a[ch] = v;
+				b[ch] = v;
+			}
+			src += frame_size;
+		}
+		__atomic_store_n(&dev->write_frame, w, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+int init_VBANInputDevice(VBANInputDevice* dev, const char* url, const char* interface, uint32_t output_rate, uint8_t channels, float target_latency_ms) {
+	memset(dev, 0, sizeof(VBANInputDevice));
+	dev->sockfd = -1;
+
+	char host[64];
+	if (parse_vban_url(url, host, sizeof(host), &dev->port, dev->stream_name) != 0) return PA_ERR_INVALID;
+
+	UDPAddress group;
+	if (parse_UDPAddress(&group, host, dev->port) != 0) return PA_ERR_INVALID;
+	if (!is_multicast_UDPAddress(&group) && !is_any_UDPAddress(&group)) {
+		dev->source = group;
+		dev->source_only = true;
+	}
+
+	dev->channels = channels;
+	dev->output_rate = output_rate;
+	dev->target_latency = target_latency_ms / 1000.0f;
+
+	// Room for a few target latencies at the highest VBAN rate
+	uint32_t wanted = (uint32_t)(4.0f * dev->target_latency * 768000.0f);
+	dev->ring_frames = 8192;
+	while (dev->ring_frames < wanted) dev->ring_frames <<= 1;
+	dev->ring = calloc((size_t)dev->ring_frames * 2 * channels, sizeof(float));
+	if (!dev->ring) return PA_ERR_INTERNAL;
+
+	dev->sockfd = open_UDPListener(&group, interface, false, false);
+	if (dev->sockfd < 0) {
+		free(dev->ring);
+		return PA_ERR_CONNECTIONREFUSED;
+	}
+	struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+	setsockopt(dev->sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	dev->running = true;
+	if (pthread_create(&dev->thread, NULL, vban_receive_thread, dev) != 0) {
+		close(dev->sockfd);
+		free(dev->ring);
+		return PA_ERR_INTERNAL;
+	}
+	return 0;
+}
+
+// Waits for the target again from w on, what came before it is never played
+static void restart_consumer(VBANInputDevice* dev, uint32_t rate, uint64_t w) {
+	dev->playing = false;
+	dev->read_position = (double)w;
+	dev->nominal_ratio = (double)rate / dev->output_rate;
+	dev->ratio = dev->nominal_ratio;
+	dev->drift_integral = 0.0;
+
+	if (dev->interpolator.taps) free_polyphase_filter(&dev->interpolator);
+	float cutoff = 0.45f / (dev->nominal_ratio > 1.0 ? dev->nominal_ratio : 1.0); // Bandlimit to the lower of the two rates
+	init_polyphase_filter(&dev->interpolator, VBAN_INPUT_INTERPOLATOR_PHASES, VBAN_INPUT_INTERPOLATOR_LENGTH, cutoff, 1.0f);
+}
+
+int read_VBANInputDevice(VBANInputDevice* dev, float* buffer, size_t frames) {
+	if (!__atomic_load_n(&dev->running, __ATOMIC_RELAXED)) return PA_ERR_BADSTATE;
+
+	uint32_t generation = __atomic_load_n(&dev->generation, __ATOMIC_ACQUIRE);
+	uint32_t rate = __atomic_load_n(&dev->input_rate, __ATOMIC_RELAXED);
+	uint64_t w = __atomic_load_n(&dev->write_frame, __ATOMIC_ACQUIRE);
+
+	if (generation != dev->seen_generation) {
+		dev->seen_generation = generation;
+		restart_consumer(dev, rate, w);
+	}
+
+	if (rate == 0 || !dev->interpolator.taps) {
+		memset(buffer, 0, sizeof(float) * frames * dev->channels);
+		return 0;
+	}
+
+	double target = dev->target_latency * rate;
+	double needed = frames * dev->ratio + dev->interpolator.length;
+	if (target < needed) target = needed;
+	double fill = (double)w - dev->read_position;
+
+	if (!dev->playing) {
+		// While stopped read_position is where it stopped, only what arrived since counts
+		if (fill < target) {
+			memset(buffer, 0, sizeof(float) * frames * dev->channels);
+			return 0;
+		}
+		dev->playing = true;
+		dev->read_position = (double)w - target;
+		dev->fill_average = target;
+		fill = target;
+	} else if (fill < needed || fill > dev->ring_frames - needed) {
+		#ifdef VBAN_INPUT_DEBUG
+		debug_printf("VBAN input %.16s: %s, refilling\n", dev->stream_name, (fill < needed) ? "underrun" : "overrun");
+		#endif
+		dev->playing = false;
+		dev->read_position = (double)w; // Start over from what arrives next, and wait for the target again
+		memset(buffer, 0, sizeof(float) * frames * dev->channels);
+		return 0;
+	}
+
+	// Consume a touch faster when the buffer grows and slower when it shrinks, so the sender's clock follows ours
+	dev->fill_average += 0.05 * (fill - dev->fill_average);
+	double error = (dev->fill_average - target) / target;
+	dev->drift_integral += error * VBAN_INPUT_DRIFT_KI;
+	if (dev->drift_integral > VBAN_INPUT_MAX_DRIFT) dev->drift_integral = VBAN_INPUT_MAX_DRIFT;
+	if (dev->drift_integral < -VBAN_INPUT_MAX_DRIFT) dev->drift_integral = -VBAN_INPUT_MAX_DRIFT;
+	double correction = error * VBAN_INPUT_DRIFT_KP + dev->drift_integral;
+	if (correction > VBAN_INPUT_MAX_DRIFT) correction = VBAN_INPUT_MAX_DRIFT;
+	if (correction < -VBAN_INPUT_MAX_DRIFT) correction = -VBAN_INPUT_MAX_DRIFT;
+	dev->ratio = dev->nominal_ratio * (1.0 + correction);
+
+	uint32_t mask = dev->ring_frames - 1;
+	uint16_t half = dev->interpolator.length / 2;
+	double position = dev->read_position;
+	uint64_t oldest = (uint64_t)position - half + 1;
+	for (size_t i = 0; i < frames; i++) {
+		uint64_t index = (uint64_t)position;
+		float frac = (float)(position - (double)index);
+		const float* x = &dev->ring[((index - half + 1) & mask) * dev->channels]; // The mirror behind the ring keeps the window contiguous
+		for (uint8_t ch = 0; ch < dev->channels; ch++) {
+			buffer[i * dev->channels + ch] = polyphase_interpolate(&dev->interpolator, x + ch, dev->channels, frac);
+		}
+		position += dev->ratio;
+	}
+
+	// The receive thread never waits for us, a burst that got round the ring onto what this read used while it did tore the block
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	uint64_t claimed = __atomic_load_n(&dev->claim_frame, __ATOMIC_RELAXED);
+	if (claimed > oldest + dev->ring_frames) {
+		#ifdef VBAN_INPUT_DEBUG
+		debug_printf("VBAN input %.16s: overrun while reading, refilling\n", dev->stream_name);
+		#endif
+		dev->playing = false;
+		dev->read_position = (double)__atomic_load_n(&dev->write_frame, __ATOMIC_ACQUIRE);
+		memset(buffer, 0, sizeof(float) * frames * dev->channels);
+		return 0;
+	}
+	dev->read_position = position;
+	return 0;
+}
+
+void free_VBANInputDevice(VBANInputDevice* dev) {
+	if (dev->running) {
+		__atomic_store_n(&dev->running, false, __ATOMIC_RELAXED);
+		pthread_join(dev->thread, NULL);
+	}
+	if (dev->sockfd >= 0) close(dev->sockfd);
+	if (dev->interpolator.taps) free_polyphase_filter(&dev->interpolator);
+	free(dev->ring);
+	dev->ring = NULL;
+	dev->sockfd = -1;
+}
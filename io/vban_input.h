@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "udp.h"
+#include "../dsp/polyphase.h"
+
+#ifdef DEBUG
+#define VBAN_INPUT_DEBUG
+#endif
+
+#define VBAN_URL_PREFIX "vban://"
+
+typedef struct
+{
+	int sockfd;
+	pthread_t thread;
+	bool running;
+
+	char stream_name[16];
+	uint16_t port;
+	UDPAddress source; // A unicast ip in the URL, only its packets are taken
+	bool source_only;
+	uint8_t channels; // What the caller reads, the stream is mapped onto this
+	uint32_t output_rate;
+	float target_latency; // seconds
+
+	// Jitter buffer of float frames, written twice (at i and i + size) so any window of taps is contiguous
+	float* ring;
+	uint32_t ring_frames; // power of two
+	uint64_t write_frame; // Only the receive thread moves this
+	uint64_t claim_frame; // What the receive thread writes up to, moved before the frames are, a read it lapped is thrown away
+	uint32_t input_rate; // 0 until the first packet, changes reset the buffer
+	uint32_t generation; // Bumped by the receive thread on every reset
+
+	// Consumer side
+	uint32_t seen_generation;
+	double read_position; // in input frames, where it stopped while it isn't playing
+	double nominal_ratio; // input frames per output frame
+	double ratio;
+	double fill_average;
+	double drift_integral;
+	bool playing;
+	PolyphaseFilter interpolator;
+} VBANInputDevice;
+
+bool is_vban_url(const char* device);
+// url is vban://[ip or group][:port]/stream, e.g. vban://239.1.2.3:6980/Studio or vban://[ff15::1]/MPX, a unicast ip is the sender the stream is taken from
+int init_VBANInputDevice(VBANInputDevice* dev, const char* url, const char* interface, uint32_t output_rate, uint8_t channels, float target_latency_ms);
+// Never blocks, gives silence while the buffer (re)fills, the caller's output clock is the master
+int read_VBANInputDevice(VBANInputDevice* dev, float* buffer, size_t frames);
+void free_VBANInputDevice(VBANInputDevice* dev);
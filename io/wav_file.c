@@ -0,0 +1,269 @@
+#include "wav_file.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <pulse/def.h>
+#include <pulse/error.h>
+
+#define WAV_READ_FRAMES 4096
+#define WAV_INTERPOLATOR_PHASES 128
+#define WAV_INTERPOLATOR_LENGTH 32 // Twice what a live input gets, there's time for it offline
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+static uint16_t get_u16(const uint8_t* p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u16(uint8_t* p, uint16_t value) {
+	p[0] = value & 0xFF;
+	p[1] = value >> 8;
+}
+
+static void put_u32(uint8_t* p, uint32_t value) {
+	for(uint8_t i = 0; i < 4; i++) p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+// Finds fmt and data, the file is left at the start of the samples
+static int read_header(WavReader* wav, const char* path) {
+	uint8_t header[12];
+	if(fread(header, 1, sizeof(header), wav->file) != sizeof(header) || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+		fprintf(stderr, "%s is not a WAV file\n", path);
+		return PA_ERR_NOTSUPPORTED;
+	}
+
+	bool have_format = false;
+	uint8_t chunk[8];
+	while(fread(chunk, 1, sizeof(chunk), wav->file) == sizeof(chunk)) {
+		uint32_t size = get_u32(chunk + 4);
+		if(memcmp(chunk, "fmt ", 4) == 0) {
+			uint8_t format[40];
+			if(size < 16 || size > sizeof(format) || fread(format, 1, size, wav->file) != size) break;
+			wav->format = get_u16(format);
+			wav->channels = get_u16(format + 2);
+			wav->rate = get_u32(format + 4);
+			wav->bits = get_u16(format + 14);
+			if(wav->format == WAV_FORMAT_EXTENSIBLE && size >= 26) wav->format = get_u16(format + 24); // The first two bytes of the sub format GUID
+			if(size & 1) fseek(wav->file, 1, SEEK_CUR);
+			have_format = true;
+		} else if(memcmp(chunk, "data", 4) == 0) {
+			if(!have_format) break;
+			bool pcm = (wav->format == WAV_FORMAT_PCM && (wav->bits == 8 || wav->bits == 16 || wav->bits == 24 || wav->bits == 32));
+			bool floats = (wav->format == WAV_FORMAT_FLOAT && (wav->bits == 32 || wav->bits == 64));
+			if((!pcm && !floats) || wav->channels == 0 || wav->rate == 0) {
+				fprintf(stderr, "%s has samples that can't be read (format %u, %u bits), only PCM and float are\n", path, wav->format, wav->bits);
+				return PA_ERR_NOTSUPPORTED;
+			}
+			uint64_t data_size = size;
+			struct stat st;
+			if(size == 0xFFFFFFFF && fstat(fileno(wav->file), &st) == 0) data_size = (uint64_t)st.st_size - (uint64_t)ftell(wav->file); // Written as a stream, it goes to the end
+			wav->frames = data_size / (wav->channels * (wav->bits / 8));
+			return 0;
+		} else if(fseek(wav->file, size + (size & 1), SEEK_CUR) != 0) break;
+	}
+	fprintf(stderr, "%s has no %s\n", path, have_format ? "samples" : "format");
+	return PA_ERR_NOTSUPPORTED;
+}
+
+int open_WavReader(WavReader* wav, const char* path, uint32_t output_rate, uint8_t output_channels) {
+	memset(wav, 0, sizeof(WavReader));
+	wav->file = fopen(path, "rb");
+	if(!wav->file) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return PA_ERR_IO;
+	}
+	int err = read_header(wav, path);
+	if(err != 0) {
+		fclose(wav->file);
+		return err;
+	}
+
+	wav->frames_left = wav->frames;
+	wav->output_rate = output_rate;
+	wav->output_channels = output_channels;
+	wav->ratio = (double)wav->rate / output_rate;
+	wav->output_frames = (uint64_t)ceil(wav->frames / wav->ratio);
+	wav->raw = malloc((size_t)WAV_READ_FRAMES * wav->channels * (wav->bits / 8));
+	if(wav->rate != output_rate) {
+		float cutoff = 0.45f / (wav->ratio > 1.0 ? wav->ratio : 1.0); // Bandlimit to the lower of the two rates
+		wav->window_size = WAV_READ_FRAMES + 2 * WAV_INTERPOLATOR_LENGTH + (size_t)ceil(wav->ratio);
+		wav->window = calloc(wav->window_size * output_channels, sizeof(float));
+		if(!wav->window || init_polyphase_filter(&wav->interpolator, WAV_INTERPOLATOR_PHASES, WAV_INTERPOLATOR_LENGTH, cutoff, 1.0f) != 0) {
+			free_WavReader(wav);
+			return PA_ERR_INTERNAL;
+		}
+		// Zeros before the first frame, so it lands on the first output frame
+		wav->window_frames = WAV_INTERPOLATOR_LENGTH / 2 - 1;
+		wav->position = wav->window_frames;
+	}
+	if(!wav->raw) {
+		free_WavReader(wav);
+		return PA_ERR_INTERNAL;
+	}
+	return 0;
+}
+
+static float get_sample(const WavReader* wav, const uint8_t* p) {
+	switch(wav->bits) {
+		case 8: return (p[0] - 128) * (1.0f / 128.0f);
+		case 16: return (int16_t)get_u16(p) * (1.0f / 32768.0f);
+		case 24: return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) * (1.0f / 2147483648.0f);
+		case 32: {
+			if(wav->format == WAV_FORMAT_PCM) return (int32_t)get_u32(p) * (1.0f / 2147483648.0f);
+			float value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+		default: {
+			double value;
+			memcpy(&value, p, sizeof(value));
+			return (float)value;
+		}
+	}
+}
+
+// frames frames from the file as output_channels floats each, zeros past its end, a file that ends early ends there
+static void read_frames(WavReader* wav, float* out, size_t frames) {
+	const uint8_t channels = wav->output_channels;
+	const size_t sample_size = wav->bits / 8;
+	const size_t frame_size = wav->channels * sample_size;
+	while(frames) {
+		size_t count = (frames < WAV_READ_FRAMES) ? frames : WAV_READ_FRAMES;
+		if(count > wav->frames_left) count = wav->frames_left;
+		size_t got = count ? fread(wav->raw, frame_size, count, wav->file) : 0;
+		if(got < count) { // Shorter than the header says
+			wav->frames -= wav->frames_left - got;
+			wav->output_frames = (uint64_t)ceil(wav->frames / wav->ratio);
+			wav->frames_left = got;
+		}
+		if(got == 0) {
+			memset(out, 0, sizeof(float) * frames * channels);
+			return;
+		}
+		wav->frames_left -= got;
+
+		const uint8_t* frame = wav->raw;
+		for(size_t i = 0; i < got; i++, frame += frame_size, out += channels) {
+			float first = get_sample(wav, frame);
+			float second = (wav->channels > 1) ? get_sample(wav, frame + sample_size) : first;
+			if(channels == 1) out[0] = (wav->channels > 1) ? 0.5f * (first + second) : first;
+			else {
+				out[0] = first;
+				out[1] = second;
+				for(uint8_t ch = 2; ch < channels; ch++) out[ch] = (ch < wav->channels) ? get_sample(wav, frame + ch * sample_size) : first;
+			}
+		}
+		frames -= got;
+	}
+}
+
+// Drops what's before first and reads the window full again
+static void refill_window(WavReader* wav, size_t first) {
+	const uint8_t channels = wav->output_channels;
+	size_t keep = wav->window_frames - first;
+	memmove(wav->window, &wav->window[first * channels], sizeof(float) * keep * channels);
+	wav->position -= first;
+	read_frames(wav, &wav->window[keep * channels], wav->window_size - keep);
+	wav->window_frames = wav->window_size;
+}
+
+size_t read_WavReader(WavReader* wav, float* buffer, size_t frames) {
+	if(wav->rate == wav->output_rate) read_frames(wav, buffer, frames);
+	else {
+		const uint8_t channels = wav->output_channels;
+		const uint16_t half = wav->interpolator.length / 2;
+		for(size_t i = 0; i < frames; i++) {
+			size_t index = (size_t)wav->position;
+			if(index + half >= wav->window_frames) {
+				refill_window(wav, index - half + 1);
+				index = (size_t)wav->position;
+			}
+			float frac = (float)(wav->position - (double)index);
+			const float* x = &wav->window[(index - half + 1) * channels];
+			for(uint8_t ch = 0; ch < channels; ch++) buffer[i * channels + ch] = polyphase_interpolate(&wav->interpolator, x + ch, channels, frac);
+			wav->position += wav->ratio;
+		}
+	}
+	uint64_t left = (wav->output_frames > wav->output_given) ? wav->output_frames - wav->output_given : 0;
+	size_t real = (left < frames) ? (size_t)left : frames;
+	wav->output_given += real;
+	return real;
+}
+
+void free_WavReader(WavReader* wav) {
+	if(wav->file) fclose(wav->file);
+	wav->file = NULL;
+	free(wav->raw);
+	wav->raw = NULL;
+	free(wav->window);
+	wav->window = NULL;
+	if(wav->interpolator.taps) free_polyphase_filter(&wav->interpolator);
+}
+
+// RIFF, an 18 byte fmt for float, fact, then the data chunk's header
+#define WAV_HEADER_SIZE 58
+
+static void make_header(uint8_t* header, uint32_t rate, uint16_t channels, uint64_t data_size) {
+	uint32_t size = (data_size > 0xFFFFFFFF - WAV_HEADER_SIZE) ? 0xFFFFFFFF - WAV_HEADER_SIZE : (uint32_t)data_size; // Past 4 GB readers go on to the end of the file
+	memcpy(header, "RIFF", 4);
+	put_u32(header + 4, WAV_HEADER_SIZE - 8 + size);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_u32(header + 16, 18);
+	put_u16(header + 20, WAV_FORMAT_FLOAT);
+	put_u16(header + 22, channels);
+	put_u32(header + 24, rate);
+	put_u32(header + 28, rate * channels * sizeof(float));
+	put_u16(header + 32, channels * sizeof(float));
+	put_u16(header + 34, 32);
+	put_u16(header + 36, 0);
+	memcpy(header + 38, "fact", 4);
+	put_u32(header + 42, 4);
+	put_u32(header + 46, size / (channels * sizeof(float)));
+	memcpy(header + 50, "data", 4);
+	put_u32(header + 54, size);
+}
+
+int open_WavWriter(WavWriter* wav, const char* path, uint32_t rate, uint16_t channels) {
+	memset(wav, 0, sizeof(WavWriter));
+	wav->file = fopen(path, "wb");
+	if(!wav->file) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return PA_ERR_IO;
+	}
+	wav->rate = rate;
+	wav->channels = channels;
+	uint8_t header[WAV_HEADER_SIZE];
+	make_header(header, rate, channels, 0);
+	if(fwrite(header, 1, sizeof(header), wav->file) != sizeof(header)) {
+		fclose(wav->file);
+		wav->file = NULL;
+		return PA_ERR_IO;
+	}
+	return 0;
+}
+
+int write_WavWriter(WavWriter* wav, const float* buffer, size_t frames) {
+	if(fwrite(buffer, sizeof(float) * wav->channels, frames, wav->file) != frames) return PA_ERR_IO;
+	wav->data_size += frames * sizeof(float) * wav->channels;
+	return 0;
+}
+
+int close_WavWriter(WavWriter* wav) {
+	if(!wav->file) return PA_ERR_IO;
+	uint8_t header[WAV_HEADER_SIZE];
+	make_header(header, wav->rate, wav->channels, wav->data_size);
+	int err = 0;
+	if(fseek(wav->file, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), wav->file) != sizeof(header)) err = PA_ERR_IO;
+	if(fclose(wav->file) != 0) err = PA_ERR_IO;
+	wav->file = NULL;
+	return err;
+}
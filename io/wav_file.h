@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "../dsp/polyphase.h"
+
+// WAV files for offline work, 8 to 32 bit PCM or 32 and 64 bit float in, read at the rate and channel count asked for, 32 bit float out
+
+typedef struct
+{
+	FILE* file;
+	uint32_t rate; // Of the file
+	uint16_t channels; // Of the file
+	uint16_t format; // 1 PCM, 3 float
+	uint16_t bits;
+	uint64_t frames; // In the file
+	uint64_t frames_left; // Not read from the file yet
+	uint64_t output_frames; // What the file comes to at output_rate
+	uint64_t output_given;
+
+	uint32_t output_rate;
+	uint8_t output_channels;
+	double ratio; // File frames per output frame
+	double position; // Of the next output frame in window
+	PolyphaseFilter interpolator;
+	float* window; // output_channels interleaved frames the interpolator looks at, zeros after the end of the file
+	size_t window_frames, window_size;
+	void* raw; // One read of the file as it is
+} WavReader;
+
+// Mono goes to every output channel, one output channel is the average of the first two, more than two take the first two, 0 on success
+int open_WavReader(WavReader* wav, const char* path, uint32_t output_rate, uint8_t output_channels);
+// frames output frames, after the end of the file they are zeros, how many of them are from the file
+size_t read_WavReader(WavReader* wav, float* buffer, size_t frames);
+void free_WavReader(WavReader* wav);
+
+typedef struct
+{
+	FILE* file;
+	uint32_t rate;
+	uint16_t channels;
+	uint64_t data_size;
+} WavWriter;
+
+// 32 bit float, the file is truncated, 0 on success
+int open_WavWriter(WavWriter* wav, const char* path, uint32_t rate, uint16_t channels);
+int write_WavWriter(WavWriter* wav, const float* buffer, size_t frames);
+// Fills in the sizes, 0 if everything got to the file
+int close_WavWriter(WavWriter* wav);
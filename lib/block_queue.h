@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <semaphore.h>
+
+// Single producer, single consumer ring of block slots, the caller owns the blocks and indexes them with what reserve/take give back
+// The positions are plain atomics, the semaphores are only there so an empty or full side sleeps instead of spinning
+
+typedef struct {
+    uint32_t depth;
+    uint64_t head; // Next slot the producer fills, only it writes this
+    uint64_t tail; // Next slot the consumer takes, only it writes this
+    sem_t filled;
+    sem_t empty;
+} BlockQueue;
+
+static inline int init_block_queue(BlockQueue* q, uint32_t depth) {
+    q->depth = depth;
+    q->head = 0;
+    q->tail = 0;
+    if (sem_init(&q->filled, 0, 0) != 0) return -1;
+    if (sem_init(&q->empty, 0, depth) != 0) {
+        sem_destroy(&q->filled);
+        return -1;
+    }
+    return 0;
+}
+
+static inline void free_block_queue(BlockQueue* q) {
+    sem_destroy(&q->filled);
+    sem_destroy(&q->empty);
+}
+
+static inline void wait_semaphore(sem_t* sem) {
+    while (sem_wait(sem) != 0) {} // Only EINTR, a signal is not a reason to give up a slot
+}
+
+// Waits for a free slot
+static inline uint32_t block_queue_reserve(BlockQueue* q) {
+    wait_semaphore(&q->empty);
+    return (uint32_t)(q->head % q->depth);
+}
+
+static inline void block_queue_publish(BlockQueue* q) {
+    __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+    sem_post(&q->filled);
+}
+
+// Waits for a filled slot
+static inline uint32_t block_queue_take(BlockQueue* q) {
+    wait_semaphore(&q->filled);
+    return (uint32_t)(q->tail % q->depth);
+}
+
+// A filled slot if there is one right now, -1 otherwise, for a consumer that can't wait
+static inline int block_queue_try_take(BlockQueue* q) {
+    if (sem_trywait(&q->filled) != 0) return -1;
+    return (int)(q->tail % q->depth);
+}
+
+static inline void block_queue_release(BlockQueue* q) {
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+    sem_post(&q->empty);
+}
+
+// Wakes a producer stuck in reserve without giving it a real slot, for when the consumer quits
+static inline void block_queue_unblock(BlockQueue* q) {
+    sem_post(&q->empty);
+}
+
+// Filled slots, safe from either side
+static inline uint32_t block_queue_fill(BlockQueue* q) {
+    return (uint32_t)(__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// Processing stages loaded by fm95 from shared objects, a plugin only needs this header
+// The plugin exports FM95_PLUGIN_ENTRY_NAME, fm95 checks abi_version and then calls process_block from the thread that runs the chain,
+// the other calls can come from the reload thread, never at the same time as a call on the same instance
+
+#define FM95_PLUGIN_ABI_VERSION 1
+#define FM95_PLUGIN_ENTRY_NAME "fm95_plugin_entry"
+
+typedef struct {
+	uint32_t abi_version; // What fm95 speaks, FM95_PLUGIN_ABI_VERSION
+	uint32_t sample_rate;
+	uint32_t block_size; // The most frames process_block is ever given
+	uint32_t channels; // 2 (L and R) in the audio graph, 1 in the MPX graph
+	const char* name; // Of the node the plugin is in
+} FM95PluginInfo;
+
+typedef struct {
+	uint32_t abi_version; // Set to FM95_PLUGIN_ABI_VERSION when building the plugin
+	const char* name;
+	// NULL if the plugin can't run like this
+	void* (*init)(const FM95PluginInfo* info);
+	// Settings from the node's section, before the first block and whenever they change, 0 if it was taken
+	int (*set_param)(void* instance, const char* key, const char* value);
+	// In place, channels[c] is frames planar samples, 1.0 is full scale (in the MPX graph 1.0 is the full deviation)
+	void (*process_block)(void* instance, float* const* channels, uint32_t frames);
+	void (*destroy)(void* instance);
+} FM95Plugin;
+
+typedef const FM95Plugin* (*FM95PluginEntry)(void);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// MPX distribution, the composite sent to SFN sites, every packet carries the sample counter and the wall clock time of its first sample
+
+#define MPXDIST_MAGIC 0x3539584d // "MX95"
+#define MPXDIST_VERSION 1
+#define MPXDIST_DEFAULT_PORT 6995
+#define MPXDIST_SAMPLES 256 // Per packet, packets always start on a multiple of this
+#define MPXDIST_BASE_FREQUENCY 4750 // fm95's oscillator, the pilot and every subcarrier are multiples of it
+
+#define MPXDIST_FLAG_RESTART 0x01 // The sender's timeline was (re)started with this packet
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t flags;
+	uint16_t samples;
+	uint32_t sample_rate;
+	uint32_t sequence;
+	uint64_t sample_index; // Samples since the unix epoch at sample_rate, counted by the sender's audio clock
+	int64_t timestamp_ns; // CLOCK_REALTIME of sample_index, smoothed by the sender
+} MPXDistHeader;
+
+typedef struct __attribute__((packed)) {
+	MPXDistHeader header;
+	float samples[MPXDIST_SAMPLES]; // Little endian float32 composite, 1.0 is full deviation
+} MPXDistPacket;
+
+// The absolute sample counter of a CLOCK_REALTIME time, so that independently started senders agree on it
+static inline uint64_t MPXDist_index_at(int64_t realtime_ns, uint32_t sample_rate) {
+	return (uint64_t)(realtime_ns / 1000000000) * sample_rate + (uint64_t)(realtime_ns % 1000000000) * sample_rate / 1000000000;
+}
+
+// Smallest jump in samples that keeps the pilot and all the subcarriers in phase, 768 at 192 kHz
+static inline uint32_t MPXDist_phase_quantum(uint32_t sample_rate) {
+	uint32_t a = sample_rate, b = MPXDIST_BASE_FREQUENCY;
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return sample_rate / a;
+}
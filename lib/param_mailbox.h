@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Latest value of each of a few float parameters, one writer posts and any number of readers pick them up when it suits them
+// Nothing queues up, a value posted twice before a reader looks is only seen once, with the newer value
+
+#define PARAM_MAILBOX_SLOTS 16
+
+typedef struct {
+    float value[PARAM_MAILBOX_SLOTS];
+    uint32_t sequence[PARAM_MAILBOX_SLOTS]; // Bumped after each value is stored
+    uint32_t generation; // Bumped after any of them, so a reader can skip the slots when nothing changed
+} ParamMailbox;
+
+// What a reader has seen so far, one per reader
+typedef struct {
+    uint32_t sequence[PARAM_MAILBOX_SLOTS];
+    uint32_t generation;
+} ParamMailboxReader;
+
+static inline void param_mailbox_post(ParamMailbox* m, uint8_t slot, float value) {
+    __atomic_store(&m->value[slot], &value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m->sequence[slot], 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&m->generation, 1, __ATOMIC_RELEASE);
+}
+
+// A reader starting now only gets what is posted from here on
+static inline void param_mailbox_sync(ParamMailbox* m, ParamMailboxReader* r) {
+    r->generation = __atomic_load_n(&m->generation, __ATOMIC_ACQUIRE);
+    for (uint8_t slot = 0; slot < PARAM_MAILBOX_SLOTS; slot++) r->sequence[slot] = __atomic_load_n(&m->sequence[slot], __ATOMIC_ACQUIRE);
+}
+
+// One load when nothing was posted
+static inline bool param_mailbox_changed(ParamMailbox* m, ParamMailboxReader* r) {
+    uint32_t generation = __atomic_load_n(&m->generation, __ATOMIC_ACQUIRE);
+    if (generation == r->generation) return false;
+    r->generation = generation;
+    return true;
+}
+
+// A value stored after the sequence was read is taken now and once more later, which only costs a repeat of the newest value
+static inline bool param_mailbox_take(ParamMailbox* m, ParamMailboxReader* r, uint8_t slot, float* value) {
+    uint32_t sequence = __atomic_load_n(&m->sequence[slot], __ATOMIC_ACQUIRE);
+    if (sequence == r->sequence[slot]) return false;
+    r->sequence[slot] = sequence;
+    __atomic_load(&m->value[slot], value, __ATOMIC_RELAXED);
+    return true;
+}
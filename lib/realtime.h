@@ -0,0 +1,106 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Real-time scheduling, locked memory and CPU pinning for the threads that have to keep up with the audio clock
+// Needs _GNU_SOURCE before the first include, for the affinity calls
+// Every call gives back 0 or an errno, what to do without real-time (usually carry on with a warning) is up to the caller
+
+#define REALTIME_MAX_CPUS 16
+#define REALTIME_STACK_PREFAULT (512 * 1024) // More than the deepest a chain's stack goes, blocks and configs are on it
+
+typedef struct {
+    int policy; // SCHED_OTHER leaves the scheduling alone
+    int priority; // Of the threads doing the DSP
+    int io_priority; // Of the threads that only move data from a device
+    bool lock_memory;
+    int cpus[REALTIME_MAX_CPUS]; // Where the DSP threads go, in order
+    uint8_t num_cpus;
+    bool isolate; // Keep every other thread of the process off cpus
+} RealtimeSettings;
+
+static inline bool realtime_settings_equal(const RealtimeSettings* a, const RealtimeSettings* b) {
+    return a->policy == b->policy && a->priority == b->priority && a->io_priority == b->io_priority && a->lock_memory == b->lock_memory &&
+           a->isolate == b->isolate && a->num_cpus == b->num_cpus && memcmp(a->cpus, b->cpus, sizeof(int) * a->num_cpus) == 0;
+}
+
+// "other", "fifo" or "rr", -1 for anything else
+static inline int parse_realtime_policy(const char* name) {
+    if (strcasecmp(name, "other") == 0) return SCHED_OTHER;
+    if (strcasecmp(name, "fifo") == 0) return SCHED_FIFO;
+    if (strcasecmp(name, "rr") == 0) return SCHED_RR;
+    return -1;
+}
+
+// Comma separated CPUs, at most REALTIME_MAX_CPUS of them
+static inline void parse_realtime_cpus(RealtimeSettings* rt, const char* value) {
+    char cpus[128];
+    strncpy(cpus, value, sizeof(cpus) - 1);
+    cpus[sizeof(cpus) - 1] = '\0';
+    rt->num_cpus = 0;
+    char* saveptr;
+    for (char* cpu = strtok_r(cpus, ", ", &saveptr); cpu && rt->num_cpus < REALTIME_MAX_CPUS; cpu = strtok_r(NULL, ", ", &saveptr)) rt->cpus[rt->num_cpus++] = atoi(cpu);
+}
+
+// The CPU for the index-th DSP thread, -1 when they aren't pinned
+static inline int realtime_cpu(const RealtimeSettings* rt, uint8_t index) {
+    return rt->num_cpus ? rt->cpus[index % rt->num_cpus] : -1;
+}
+
+// Everything mapped now and later stays in RAM, and freed memory isn't given back, so it never has to be faulted in again
+static inline int realtime_lock_memory(void) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) return errno;
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    return 0;
+}
+
+// Touches the stack the calling thread will use, once it's locked the pages stay
+static inline void realtime_prefault_stack(void) {
+    volatile uint8_t stack[REALTIME_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) stack[i] = 0;
+}
+
+// Policy and priority for a thread, cpu -1 leaves it where it is
+static inline int realtime_set_thread(pthread_t thread, int policy, int priority, int cpu) {
+    int err = 0;
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    }
+    if (policy != SCHED_OTHER) {
+        struct sched_param param = {.sched_priority = priority};
+        int sched_err = pthread_setschedparam(thread, policy, &param);
+        if (sched_err != 0) err = sched_err;
+    }
+    return err;
+}
+
+// Back to normal scheduling, on every CPU but the ones kept for the DSP when they are, for a helper started from a real-time thread
+static inline int realtime_leave(const RealtimeSettings* rt) {
+    struct sched_param param = {.sched_priority = 0};
+    int err = (rt->policy != SCHED_OTHER) ? pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) : 0;
+    if (!rt->isolate || rt->num_cpus == 0) return err;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &set);
+    for (uint8_t i = 0; i < rt->num_cpus; i++) {
+        if (rt->cpus[i] >= 0 && rt->cpus[i] < CPU_SETSIZE) CPU_CLR(rt->cpus[i], &set);
+    }
+    if (CPU_COUNT(&set) == 0) return EINVAL; // Nothing left for the rest
+    int affinity_err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    return affinity_err ? affinity_err : err;
+}
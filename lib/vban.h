@@ -1,4 +1,10 @@
 #include <pulse/simple.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pwd.h>
 
 #define VBAN_SR_MAXNUMBER 21
 static long VBAN_SRList[VBAN_SR_MAXNUMBER] = {
@@ -23,6 +29,9 @@ static char VBAN_TextBITList[VBAN_BIT_MAXNUMBER][4] = {
     "F32",
 };
 
+#define VBAN_MAX_SAMPLES_PER_FRAME 256
+#define VBAN_MAX_DATA_SIZE 1436 // Keeps header + data under the 1464 byte VBAN packet limit
+
 #define VBAN_PROTOCOL_AUDIO 0x00
 #define VBAN_PROTOCOL_SERIAL 0x20
 #define VBAN_PROTOCOL_TXT 0x40
@@ -99,4 +108,46 @@ typedef union {
     VBANPing0Data data;
     char raw_data[sizeof(VBANPing0Data)];
 } VBANPing0DataUnion;
-#pragma pack()
\ No newline at end of file
+#pragma pack()
+
+static inline uint8_t VBAN_bit_size(uint8_t bit_idx) {
+    static const uint8_t sizes[VBAN_BIT_MAXNUMBER] = {1, 2, 3, 4, 4};
+    return sizes[bit_idx % VBAN_BIT_MAXNUMBER];
+}
+
+static inline int VBAN_find_sr_idx(long sample_rate) {
+    for(int i = 0; i < VBAN_SR_MAXNUMBER; i++) {
+        if(VBAN_SRList[i] == sample_rate) return i;
+    }
+    return -1;
+}
+
+static inline int VBAN_find_bit_idx(const char* name) {
+    for(int i = 0; i < VBAN_BIT_MAXNUMBER; i++) {
+        if(strcasecmp(VBAN_TextBITList[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Fills in the answer to a VBAN_SERVICE_IDENTIFICATION ping, the caller adds the addresses it knows about
+static inline void init_VBANPingReply(VBANHeader* header, VBANPing0Data* ping, const VBANHeader* request, uint32_t type, uint32_t features, const char* application, uint8_t major, uint8_t minor) {
+    memset(ping, 0, sizeof(VBANPing0Data));
+
+    ping->bitType = type;
+    ping->bitfeature = features;
+    ping->nVersion[0] = major;
+    ping->nVersion[1] = minor;
+    strncpy(ping->ApplicationName_ascii, application, sizeof(ping->ApplicationName_ascii) - 1);
+
+    struct passwd *pw = getpwuid(getuid());
+    if (pw != NULL) snprintf(ping->UserName_utf8, sizeof(ping->UserName_utf8), "%s", pw->pw_name);
+
+    gethostname(ping->HostName_ascii, sizeof(ping->HostName_ascii));
+
+    memset(header, 0, sizeof(VBANHeader));
+    memcpy(header->vban, "VBAN", 4);
+    header->protocol_sample_rate_idx = VBAN_PROTOCOL_SERVICE;
+    header->sample_channels = VBAN_SERVICE_IDENTIFICATION;
+    header->samples_per_frame = 0x80; // reply
+    header->frame_num = request->frame_num;
+}
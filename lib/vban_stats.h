@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+
+// Layout of the vban95 statistics file (--stats_file), it is a plain mmap of this struct, so any reader can map it read-only
+// Counters only ever go up, a reader computes rates from two snapshots
+// A slot is only consistent when its sequence was even and the same before and after the reader copied it, the worker makes it odd while it
+// updates the slot
+
+#define VBAN95_STATS_MAGIC 0x35394256 // "VB95" little endian
+#define VBAN95_STATS_VERSION 2
+
+#define VBAN95_STATS_MAX_SLOTS 128 // workers * streams
+#define VBAN95_JITTER_BUCKETS 16 // bucket n counts |D| in [2^(n+2), 2^(n+3)) us, first and last are open ended
+#define VBAN95_FILL_BUCKETS 16 // bucket n counts sink fill in [n*4, n*4+4) ms, last is open ended
+
+typedef struct {
+    uint32_t sequence;
+    char name[16];
+    uint32_t worker;
+    uint32_t active;
+
+    uint64_t received;
+    uint64_t bytes;
+    uint64_t lost;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t underruns; // Times a look found Pulse had played out everything we gave it
+
+    uint32_t last_frame;
+    int32_t sink_fill_us; // Audio Pulse had queued at the last look (every 100 ms of packets), the sink's own latency included
+    uint32_t jitter_us; // RFC 3550 style smoothed inter-arrival jitter
+    uint32_t max_jitter_us;
+    uint64_t last_arrival_ns; // CLOCK_REALTIME kernel timestamp
+
+    uint64_t jitter_histogram[VBAN95_JITTER_BUCKETS];
+    uint64_t fill_histogram[VBAN95_FILL_BUCKETS];
+} VBAN95_StreamStats;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t pid;
+    VBAN95_StreamStats slots[VBAN95_STATS_MAX_SLOTS];
+} VBAN95_Stats;
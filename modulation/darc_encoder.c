@@ -0,0 +1,339 @@
+#include "darc_encoder.h"
+
+#include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../lib/constants.h"
+#include "../dsp/sine_table.h"
+#include "../dsp/polyphase.h"
+
+#define DARC_CRC_POLY 0x0805 // x^14 + x^11 + x^2 + 1, without the x^14
+#define DARC_SCRAMBLER_SEED 0x155 // 101010101
+
+#define DARC_BIC1 0x135E
+#define DARC_BIC2 0x74A6
+#define DARC_BIC3 0xA791
+#define DARC_BIC4 0xC875
+
+#define DARC_FILTER_CUTOFF 0.875 // 14 khz in cycles per bit, the tx filter mask is -0.5 db at 12 khz off the carrier and -20 db at 16
+#define DARC_FILTER_BETA 5.65 // Kaiser, about 60 db down
+#define DARC_SIDE_RELEASE 0.1f // s, the L-R peak meter
+#define DARC_LEVEL_SMOOTHING 0.005f // s, keeps the level changes out of the subcarrier's spectrum
+
+#define PHASE_SCALE 4294967296.0 // One cycle of the integer phase
+#define DARC_SOURCE_UNCHANGED -2
+
+// x^82 + x^77 + x^76 + x^71 + x^67 + x^66 + x^56 + x^52 + x^48 + x^40 + x^36 + x^34 + x^24 + x^22 + x^18 + x^10 + x^4 + 1, of the (272,190) code
+static const uint8_t darc_parity_taps[] = {77, 76, 71, 67, 66, 56, 52, 48, 40, 36, 34, 24, 22, 18, 10, 4, 0};
+
+float darc_waveform[DARC_WAVEFORM_SPAN][DARC_WAVEFORM_RESOLUTION + 1];
+static uint8_t darc_scrambler[DARC_DATA_BITS];
+static pthread_once_t darc_tables_once = PTHREAD_ONCE_INIT;
+
+// Tx filter, a Kaiser windowed sinc, t in bits
+static double darc_filter(double t) {
+	const double half_width = DARC_WAVEFORM_SPAN / 2.0 - 1.0; // The MSK pulse itself takes a bit each side
+	if (fabs(t) >= half_width) return 0.0;
+	double x = 2.0 * DARC_FILTER_CUTOFF * t;
+	double sinc = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+	double r = t / half_width;
+	return 2.0 * DARC_FILTER_CUTOFF * sinc * bessel_i0(DARC_FILTER_BETA * sqrt(1.0 - r * r)) / bessel_i0(DARC_FILTER_BETA);
+}
+
+// MSK is OQPSK with half cosine pulses two bits long, this is one of them through the tx filter
+static double darc_shaping(double t) {
+	const int steps = 400;
+	double sum = 0.0;
+	for (int i = 0; i < steps; i++) {
+		double tau = (i + 0.5) * 2.0 / steps - 1.0;
+		sum += cos(M_PI * tau / 2.0) * darc_filter(t - tau);
+	}
+	return sum * 2.0 / steps;
+}
+
+static void build_darc_tables(void) {
+	// Unity gain at DC, so the envelope stays near 1
+	const int steps = 4000;
+	const double half_width = DARC_WAVEFORM_SPAN / 2.0 - 1.0;
+	double dc = 0.0;
+	for (int i = 0; i < steps; i++) dc += darc_filter((i + 0.5) * 2.0 * half_width / steps - half_width);
+	dc *= 2.0 * half_width / steps;
+
+	for (int k = 0; k < DARC_WAVEFORM_SPAN; k++) {
+		for (int x = 0; x <= DARC_WAVEFORM_RESOLUTION; x++) {
+			double t = (double)x / DARC_WAVEFORM_RESOLUTION + k - DARC_WAVEFORM_SPAN / 2.0;
+			darc_waveform[k][x] = (float)(darc_shaping(t) / dc);
+		}
+	}
+
+	// g(x) = x^9 + x^4 + 1 from 101010101, the same for every block as it restarts on each
+	uint16_t reg = DARC_SCRAMBLER_SEED;
+	for (int i = 0; i < DARC_DATA_BITS; i++) {
+		uint8_t out = (reg >> 8) & 1;
+		darc_scrambler[i] = out;
+		reg = (uint16_t)(((reg << 1) | (out ^ ((reg >> 3) & 1))) & 0x1FF);
+	}
+
+	init_sine_table();
+}
+
+// Shared by every encoder, a batch may set several up at once
+static void init_darc_tables(void) {
+	pthread_once(&darc_tables_once, build_darc_tables);
+}
+
+static void put_bits(uint8_t* bits, uint64_t value, int count) {
+	for (int i = 0; i < count; i++) bits[i] = (value >> (count - 1 - i)) & 1;
+}
+
+static uint16_t darc_crc(const uint8_t* bits, int count) {
+	uint16_t reg = 0;
+	for (int i = 0; i < count; i++) {
+		uint8_t feedback = ((reg >> (DARC_CRC_BITS - 1)) & 1) ^ bits[i];
+		reg = (uint16_t)((reg << 1) & ((1u << DARC_CRC_BITS) - 1));
+		if (feedback) reg ^= DARC_CRC_POLY;
+	}
+	return reg;
+}
+
+// Remainder of the 190 bits times x^82, kept as 18 high and 64 low bits
+static void darc_parity(const uint8_t* bits, int count, uint8_t* parity) {
+	uint64_t high = 0;
+	uint64_t low = 0;
+	for (int i = 0; i < count; i++) {
+		uint8_t feedback = ((high >> (DARC_PARITY_BITS - 65)) & 1) ^ bits[i];
+		high = ((high << 1) | (low >> 63)) & ((1ull << (DARC_PARITY_BITS - 64)) - 1);
+		low <<= 1;
+		if (!feedback) continue;
+		for (size_t t = 0; t < sizeof(darc_parity_taps); t++) {
+			if (darc_parity_taps[t] >= 64) high ^= 1ull << (darc_parity_taps[t] - 64);
+			else low ^= 1ull << darc_parity_taps[t];
+		}
+	}
+	put_bits(parity, high, DARC_PARITY_BITS - 64);
+	put_bits(parity + DARC_PARITY_BITS - 64, low, 64);
+}
+
+// 176 information bits, their CRC, then the parity of both, not scrambled yet
+static void encode_information_row(uint8_t* data, const uint8_t* l3_block) {
+	for (int i = 0; i < DARC_L3_BLOCK_BYTES; i++) put_bits(&data[i * 8], l3_block[i], 8);
+	const int information_bits = DARC_L3_BLOCK_BYTES * 8;
+	put_bits(&data[information_bits], darc_crc(data, information_bits), DARC_CRC_BITS);
+	darc_parity(data, information_bits + DARC_CRC_BITS, &data[information_bits + DARC_CRC_BITS]);
+}
+
+static void scramble_row(uint8_t* data) {
+	for (int i = 0; i < DARC_DATA_BITS; i++) data[i] ^= darc_scrambler[i];
+}
+
+// The columns go through the same code, a bit of every column per information block
+static void update_vertical_parity(DARCEncoder* enc, const uint8_t* data) {
+	uint64_t row[DARC_ROW_WORDS] = {0};
+	for (int i = 0; i < DARC_DATA_BITS; i++) row[i >> 6] |= (uint64_t)data[i] << (63 - (i & 63));
+
+	uint64_t feedback[DARC_ROW_WORDS];
+	for (int w = 0; w < DARC_ROW_WORDS; w++) feedback[w] = enc->vertical[DARC_PARITY_BITS - 1][w] ^ row[w];
+	memmove(enc->vertical[1], enc->vertical[0], sizeof(enc->vertical[0]) * (DARC_PARITY_BITS - 1));
+	memset(enc->vertical[0], 0, sizeof(enc->vertical[0]));
+	for (size_t t = 0; t < sizeof(darc_parity_taps); t++) {
+		for (int w = 0; w < DARC_ROW_WORDS; w++) enc->vertical[darc_parity_taps[t]][w] ^= feedback[w];
+	}
+}
+
+// The next queued block, zeros (padding) if the reader has none ready
+static void next_l3_block(DARCEncoder* enc, uint8_t* l3_block) {
+	int slot = block_queue_try_take(&enc->queue);
+	if (slot < 0) {
+		memset(l3_block, 0, DARC_L3_BLOCK_BYTES);
+		return;
+	}
+	memcpy(l3_block, enc->queued[slot], DARC_L3_BLOCK_BYTES);
+	block_queue_release(&enc->queue);
+}
+
+// Frame A0 is 60 BIC3, 70 BIC2 and 60 BIC1 information blocks, then the 82 BIC4 parity blocks
+static uint16_t frame_a_bic(uint16_t block_index) {
+	if (block_index < 60) return DARC_BIC3;
+	if (block_index < 130) return DARC_BIC2;
+	if (block_index < DARC_FRAME_INFORMATION_BLOCKS) return DARC_BIC1;
+	return DARC_BIC4;
+}
+
+static void build_next_block(DARCEncoder* enc) {
+	if (enc->block_index >= DARC_FRAME_BLOCKS) {
+		enc->block_index = 0;
+		memset(enc->vertical, 0, sizeof(enc->vertical));
+	}
+
+	uint8_t* data = &enc->block[DARC_BIC_BITS];
+	if (enc->frame_type == DARC_FRAME_A && enc->block_index >= DARC_FRAME_INFORMATION_BLOCKS) {
+		// Highest power first, like the parity in the blocks
+		const uint64_t* row = enc->vertical[DARC_PARITY_BITS - 1 - (enc->block_index - DARC_FRAME_INFORMATION_BLOCKS)];
+		put_bits(enc->block, DARC_BIC4, DARC_BIC_BITS);
+		for (int i = 0; i < DARC_DATA_BITS; i++) data[i] = (row[i >> 6] >> (63 - (i & 63))) & 1;
+	} else {
+		uint8_t l3_block[DARC_L3_BLOCK_BYTES];
+		next_l3_block(enc, l3_block);
+		put_bits(enc->block, (enc->frame_type == DARC_FRAME_A) ? frame_a_bic(enc->block_index) : DARC_BIC3, DARC_BIC_BITS);
+		encode_information_row(data, l3_block);
+		if (enc->frame_type == DARC_FRAME_A) update_vertical_parity(enc, data);
+	}
+	scramble_row(data);
+	enc->block_index++;
+}
+
+static void next_bit(DARCEncoder* enc) {
+	if (enc->bit >= DARC_BLOCK_BITS) {
+		build_next_block(enc);
+		enc->bit = 0;
+	}
+	// A 1 turns the phase forward a quarter (76 + 4 khz), a 0 back (76 - 4 khz)
+	uint8_t quadrant = (uint8_t)((enc->symbols + (enc->block[enc->bit++] ? 1 : 3)) & 3);
+	enc->symbols = ((enc->symbols << 2) | quadrant) & ((1u << (2 * DARC_WAVEFORM_SPAN)) - 1);
+}
+
+void set_darc_encoder_levels(DARCEncoder* enc, float level_min, float level_max) {
+	enc->level_min = level_min;
+	enc->level_max = level_max;
+}
+
+// Reads the source a block at a time into the queue, sleeps in reserve while it is full, a new source drops the block it was on
+static void* run_darc_reader(void* arg) {
+	DARCEncoder* enc = arg;
+	const struct timespec idle = {0, DARC_SOURCE_POLL_MS * 1000000L};
+	int source = -1;
+	bool source_is_file = false;
+	bool rewound = false;
+	uint8_t pending[DARC_L3_BLOCK_BYTES];
+	uint8_t pending_count = 0;
+
+	while (!__atomic_load_n(&enc->reader_stop, __ATOMIC_ACQUIRE)) {
+		int next = __atomic_exchange_n(&enc->next_source, DARC_SOURCE_UNCHANGED, __ATOMIC_ACQ_REL);
+		if (next != DARC_SOURCE_UNCHANGED) {
+			if (source >= 0) close(source);
+			source = next;
+			struct stat st;
+			source_is_file = (source >= 0 && fstat(source, &st) == 0 && S_ISREG(st.st_mode));
+			rewound = false;
+			pending_count = 0;
+		}
+		if (source < 0) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		struct pollfd fd = {.fd = source, .events = POLLIN};
+		if (poll(&fd, 1, DARC_SOURCE_POLL_MS) <= 0) continue;
+		ssize_t got = read(source, pending + pending_count, DARC_L3_BLOCK_BYTES - pending_count);
+		if (got > 0) {
+			pending_count += (uint8_t)got;
+			rewound = false;
+			if (pending_count < DARC_L3_BLOCK_BYTES) continue;
+			uint32_t slot = block_queue_reserve(&enc->queue);
+			if (__atomic_load_n(&enc->reader_stop, __ATOMIC_ACQUIRE)) break;
+			memcpy(enc->queued[slot], pending, DARC_L3_BLOCK_BYTES);
+			block_queue_publish(&enc->queue);
+			pending_count = 0;
+		} else if (got == 0 && source_is_file && !rewound) { // Loop the file, a piece of a block at the end is dropped
+			lseek(source, 0, SEEK_SET);
+			pending_count = 0;
+			rewound = true;
+		} else nanosleep(&idle, NULL); // A FIFO with no writer, or an empty file
+	}
+	if (source >= 0) close(source);
+	return NULL;
+}
+
+int init_darc_encoder(DARCEncoder* enc, DARCFrameType frame_type, float level_min, float level_max, uint32_t sample_rate) {
+	init_darc_tables();
+	memset(enc, 0, sizeof(DARCEncoder));
+	enc->frame_type = frame_type;
+	enc->next_source = DARC_SOURCE_UNCHANGED;
+	enc->bit = DARC_BLOCK_BITS; // Build a block on the first bit
+	enc->last_bit = -1;
+	set_darc_encoder_levels(enc, level_min, level_max);
+	enc->level = level_min;
+	enc->side_release = expf(-1.0f / (DARC_SIDE_RELEASE * sample_rate));
+	enc->level_smoothing = 1.0f - expf(-1.0f / (DARC_LEVEL_SMOOTHING * sample_rate));
+
+	if (init_block_queue(&enc->queue, DARC_QUEUE_BLOCKS) != 0) return -1;
+	if (pthread_create(&enc->reader, NULL, run_darc_reader, enc) != 0) {
+		free_block_queue(&enc->queue);
+		return -1;
+	}
+	enc->reader_running = true;
+	return 0;
+}
+
+int set_darc_encoder_source(DARCEncoder* enc, const char* path) {
+	int source = -1;
+	int err = 0;
+	if (path[0] != '\0') {
+		source = open(path, O_RDONLY | O_NONBLOCK); // A FIFO would otherwise wait for its writer here
+		if (source < 0) err = errno;
+	}
+	// One the reader hasn't picked up yet is never going to be read
+	int old = __atomic_exchange_n(&enc->next_source, source, __ATOMIC_ACQ_REL);
+	if (old >= 0) close(old);
+	return err;
+}
+
+void free_darc_encoder(DARCEncoder* enc) {
+	if (!enc->reader_running) return;
+	__atomic_store_n(&enc->reader_stop, true, __ATOMIC_RELEASE);
+	block_queue_unblock(&enc->queue);
+	pthread_join(enc->reader, NULL);
+	enc->reader_running = false;
+	int old = __atomic_exchange_n(&enc->next_source, DARC_SOURCE_UNCHANGED, __ATOMIC_ACQ_REL);
+	if (old >= 0) close(old);
+	free_block_queue(&enc->queue);
+}
+
+// L-MSK: under 2.5% of L-R the minimum, over 5% the maximum, a straight line between
+static float update_level(DARCEncoder* enc, float side) {
+	enc->side_envelope *= enc->side_release;
+	if (side > enc->side_envelope) enc->side_envelope = side;
+
+	float position = (enc->side_envelope - 0.025f) * 40.0f;
+	position = fmaxf(0.0f, fminf(1.0f, position));
+	float target = enc->level_min + (enc->level_max - enc->level_min) * position;
+	enc->level += (target - enc->level) * enc->level_smoothing;
+	return enc->level;
+}
+
+float get_darc_sample(DARCEncoder* enc, float osc_phase, float side) {
+	if (osc_phase < enc->last_osc_phase) enc->osc_cycles = (enc->osc_cycles + 1) % 19;
+	enc->last_osc_phase = osc_phase;
+
+	float position = (enc->osc_cycles + osc_phase * (float)(1.0 / M_2PI)) * (64.0f / 19.0f);
+	int bit = (int)position;
+	if (bit > 63) bit = 63;
+	if (enc->last_bit < 0) enc->last_bit = (int8_t)bit;
+	while (enc->last_bit != bit) {
+		enc->last_bit = (enc->last_bit + 1) & 63;
+		next_bit(enc);
+	}
+
+	float fraction_position = (position - bit) * DARC_WAVEFORM_RESOLUTION;
+	int index = (int)fraction_position;
+	if (index >= DARC_WAVEFORM_RESOLUTION) index = DARC_WAVEFORM_RESOLUTION - 1;
+	float fraction = fraction_position - index;
+
+	// The symbols are 1, j, -1 or -j, the waveform is real, so each one lands on I or Q
+	float iq[2] = {0.0f, 0.0f};
+	for (int k = 0; k < DARC_WAVEFORM_SPAN; k++) {
+		float w = darc_waveform[k][index] + (darc_waveform[k][index + 1] - darc_waveform[k][index]) * fraction;
+		uint8_t quadrant = (enc->symbols >> (2 * k)) & 3;
+		iq[quadrant & 1] += (quadrant & 2) ? -w : w;
+	}
+
+	uint32_t carrier = (uint32_t)(uint64_t)((double)osc_phase * (16.0 * PHASE_SCALE / M_2PI));
+	float carrier_cos = sine_table_lookup(carrier + (1u << 30));
+	float carrier_sin = sine_table_lookup(carrier);
+	return (iq[0] * carrier_cos - iq[1] * carrier_sin) * update_level(enc, side);
+}
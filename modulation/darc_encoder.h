@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "../lib/block_queue.h"
+
+// DARC (EN 300 751), layer 1 and 2: 16 kbit/s L-MSK on 76 khz
+#define DARC_WAVEFORM_SPAN 12 // bits a shaped MSK pulse lasts, 2 of its own and 10 of the tx filter
+#define DARC_WAVEFORM_RESOLUTION 128 // table points per bit
+#define DARC_BIC_BITS 16
+#define DARC_DATA_BITS 272
+#define DARC_BLOCK_BITS (DARC_BIC_BITS + DARC_DATA_BITS)
+#define DARC_L3_BLOCK_BYTES 22 // 176 information bits
+#define DARC_CRC_BITS 14
+#define DARC_PARITY_BITS 82
+#define DARC_FRAME_BLOCKS 272
+#define DARC_FRAME_INFORMATION_BLOCKS 190
+#define DARC_ROW_WORDS ((DARC_DATA_BITS + 63) / 64)
+#define DARC_QUEUE_BLOCKS 8 // L3 blocks read ahead, about 140 ms
+#define DARC_SOURCE_POLL_MS 50 // How long the reader waits on its source before it looks for a new one
+
+typedef enum
+{
+	DARC_FRAME_A = 0, // 190 information blocks and 82 vertical parity blocks (A0, no real time blocks)
+	DARC_FRAME_C // 272 information blocks, only the block code
+} DARCFrameType;
+
+typedef struct
+{
+	DARCFrameType frame_type;
+
+	// L3 blocks come from a file or a FIFO, read ahead into the queue on a thread of its own so the DSP never waits on the source,
+	// zeros when nothing is queued
+	pthread_t reader;
+	bool reader_running;
+	bool reader_stop;
+	int next_source; // Opened by set_darc_encoder_source and handed to the reader, DARC_SOURCE_UNCHANGED once it has it
+	BlockQueue queue;
+	uint8_t queued[DARC_QUEUE_BLOCKS][DARC_L3_BLOCK_BYTES];
+
+	// Block on air, as bits, and where it sits in the frame
+	uint8_t block[DARC_BLOCK_BITS];
+	uint16_t bit;
+	uint16_t block_index;
+	// Vertical parity over the information blocks so far, row j is x^j of the column remainders
+	uint64_t vertical[DARC_PARITY_BITS][DARC_ROW_WORDS];
+
+	// Bit clock, 64 bits in 19 cycles of the 4750 hz oscillator
+	float last_osc_phase;
+	uint8_t osc_cycles;
+	int8_t last_bit;
+	// Quadrant of the last DARC_WAVEFORM_SPAN MSK symbols (1, j, -1, -j), newest in the low 2 bits
+	uint32_t symbols;
+
+	// Injection, follows the L-R level
+	float level_min;
+	float level_max;
+	float side_envelope;
+	float side_release;
+	float level;
+	float level_smoothing;
+} DARCEncoder;
+
+// Shaped MSK pulse, waveform[k][x] is the pulse of the symbol k bits back, x through the current bit
+extern float darc_waveform[DARC_WAVEFORM_SPAN][DARC_WAVEFORM_RESOLUTION + 1];
+
+// Levels are the share of the deviation for an L-R under 2.5% and over 5% of it
+// Starts the reader, 0 on success
+int init_darc_encoder(DARCEncoder* enc, DARCFrameType frame_type, float level_min, float level_max, uint32_t sample_rate);
+void set_darc_encoder_levels(DARCEncoder* enc, float level_min, float level_max);
+// Path of a file (looped) or FIFO of 22 byte L3 blocks, an empty path sends padding, 0 on success, opens it so call it off the DSP threads,
+// what is already queued of the old source still goes out
+int set_darc_encoder_source(DARCEncoder* enc, const char* path);
+void free_darc_encoder(DARCEncoder* enc);
+
+// Modulated subcarrier for the current sample, osc_phase is the 4750 hz oscillator's phase (76 khz is its 16th harmonic),
+// side is the level of the L-R subcarrier as a share of the deviation
+float get_darc_sample(DARCEncoder* enc, float osc_phase, float side);
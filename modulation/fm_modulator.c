@@ -1,5 +1,14 @@
 #include "fm_modulator.h"
 
+#include <string.h>
+#include <stdbool.h>
+
+#define FM_BLOCK_CHUNK 256
+#define PHASE_SCALE 4294967296.0 // One cycle of the integer phase
+
+typedef float fm_v4f __attribute__((vector_size(16)));
+typedef int32_t fm_v4i __attribute__((vector_size(16)));
+
 void init_fm_modulator(FMModulator *fm, float frequency, float deviation, float sample_rate) {
 	fm->frequency = frequency;
 	fm->deviation = deviation;
@@ -10,6 +19,80 @@ void init_fm_modulator(FMModulator *fm, float frequency, float deviation, float
 float modulate_fm(FMModulator *fm, float sample) {
 	float inst_freq = fm->frequency+(sample*fm->deviation);
 	fm->osc_phase += (M_2PI * inst_freq) / fm->sample_rate;
-	fm->osc_phase -= (fm->osc_phase >= M_2PI) ? M_2PI : 0.0f;
+	if (fm->osc_phase >= M_2PI || fm->osc_phase < 0.0f) fm->osc_phase -= M_2PI * floorf(fm->osc_phase / M_2PI); // A big deviation can step more than a cycle
 	return sinf(fm->osc_phase);
-}
\ No newline at end of file
+}
+
+bool check_fm_block_deviation(float deviation, float clip, float sample_rate) {
+	if (!isfinite(deviation) || !isfinite(clip) || !(sample_rate > 0.0f) || clip <= 0.0f) return false;
+	return fabs((double)deviation * clip / sample_rate) <= FM_BLOCK_MAX_STEP;
+}
+
+int init_fm_block_modulator(FMBlockModulator *fm, float frequency, float deviation, float clip, float sample_rate) {
+	init_sine_table();
+	fm->phase = 0;
+	return change_fm_block_modulator(fm, frequency, deviation, clip, sample_rate);
+}
+
+int change_fm_block_modulator(FMBlockModulator *fm, float frequency, float deviation, float clip, float sample_rate) {
+	if (!check_fm_block_deviation(deviation, clip, sample_rate)) return -1;
+	double cycles = (double)frequency / sample_rate;
+	fm->carrier_increment = (uint32_t)(int64_t)llround((cycles - floor(cycles)) * PHASE_SCALE);
+	fm->deviation_scale = (float)((double)deviation / sample_rate * PHASE_SCALE);
+	fm->clip = clip;
+	return 0;
+}
+
+static inline fm_v4f clip_v4f(fm_v4f x, fm_v4f low, fm_v4f high) {
+	fm_v4i over = x > high;
+	fm_v4i under = x < low;
+	fm_v4i bits = (fm_v4i)x;
+	bits = (bits & ~over) | ((fm_v4i)high & over);
+	bits = (bits & ~under) | ((fm_v4i)low & under);
+	return (fm_v4f)bits;
+}
+
+// Phase steps from the deviation part, the clip keeps them inside an int32, check_fm_block_deviation made sure of that
+static void deviation_steps(const float *in, int32_t *steps, size_t count, float input_gain, float clip, float deviation_scale) {
+	const fm_v4f gain = {input_gain, input_gain, input_gain, input_gain};
+	const fm_v4f high = {clip, clip, clip, clip};
+	const fm_v4f low = -high;
+	const fm_v4f scale = {deviation_scale, deviation_scale, deviation_scale, deviation_scale};
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		fm_v4f x;
+		memcpy(&x, &in[i], sizeof(x));
+		fm_v4i step = __builtin_convertvector(clip_v4f(x * gain, low, high) * scale, fm_v4i);
+		memcpy(&steps[i], &step, sizeof(step));
+	}
+	for (; i < count; i++) steps[i] = (int32_t)(fmaxf(-clip, fminf(clip, in[i] * input_gain)) * deviation_scale);
+}
+
+static inline void modulate_fm_block_into(FMBlockModulator *fm, const float *in, float *out, size_t count, float input_gain, float output_gain, bool add) {
+	int32_t steps[FM_BLOCK_CHUNK];
+	uint32_t phase = fm->phase;
+
+	while (count) {
+		size_t n = (count < FM_BLOCK_CHUNK) ? count : FM_BLOCK_CHUNK;
+		deviation_steps(in, steps, n, input_gain, fm->clip, fm->deviation_scale);
+		for (size_t i = 0; i < n; i++) {
+			phase += fm->carrier_increment + (uint32_t)steps[i];
+			float sample = sine_table_lookup(phase) * output_gain;
+			out[i] = add ? out[i] + sample : sample;
+		}
+		in += n;
+		out += n;
+		count -= n;
+	}
+
+	fm->phase = phase;
+}
+
+void modulate_fm_block(FMBlockModulator *fm, const float *in, float *out, size_t count, float input_gain, float output_gain) {
+	modulate_fm_block_into(fm, in, out, count, input_gain, output_gain, false);
+}
+
+void modulate_fm_block_add(FMBlockModulator *fm, const float *in, float *out, size_t count, float input_gain, float output_gain) {
+	modulate_fm_block_into(fm, in, out, count, input_gain, output_gain, true);
+}
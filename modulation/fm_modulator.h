@@ -1,6 +1,10 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include "../dsp/oscillator.h"
+#include "../dsp/sine_table.h"
 
 typedef struct
 {
@@ -11,4 +15,25 @@ typedef struct
 } FMModulator;
 
 void init_fm_modulator(FMModulator *fm, float frequency, float deviation, float sample_rate);
-float modulate_fm(FMModulator *fm, float sample);
\ No newline at end of file
+float modulate_fm(FMModulator *fm, float sample);
+
+// Block version, integer phase (2^32 is a cycle) and a sine table instead of sinf, the input is gained and clipped 4 samples at a time
+typedef struct
+{
+	uint32_t phase;
+	uint32_t carrier_increment;
+	float deviation_scale; // Phase per sample for an input of 1.0
+	float clip;
+} FMBlockModulator;
+
+#define FM_BLOCK_MAX_STEP 0.49 // Cycles per sample the deviation can move the phase at the clip, half a cycle would no longer fit the int32 steps
+
+// Whether a deviation at this clip fits the block modulator at the sample rate
+bool check_fm_block_deviation(float deviation, float clip, float sample_rate);
+// 0 on success, -1 when check_fm_block_deviation doesn't pass
+int init_fm_block_modulator(FMBlockModulator *fm, float frequency, float deviation, float clip, float sample_rate);
+int change_fm_block_modulator(FMBlockModulator *fm, float frequency, float deviation, float clip, float sample_rate);
+// out[i] = sin(phase) * output_gain, where the phase moves by frequency + clip(in[i] * input_gain) * deviation
+void modulate_fm_block(FMBlockModulator *fm, const float *in, float *out, size_t count, float input_gain, float output_gain);
+// Same, but adds into out, for summing several carriers
+void modulate_fm_block_add(FMBlockModulator *fm, const float *in, float *out, size_t count, float input_gain, float output_gain);
@@ -0,0 +1,129 @@
+#include "iq_modulator.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PHASE_SCALE 4294967296.0 // One cycle of the integer phase
+
+typedef float iq_v4f __attribute__((vector_size(16)));
+typedef int32_t iq_v4i __attribute__((vector_size(16)));
+typedef uint32_t iq_v4u __attribute__((vector_size(16)));
+
+int init_iq_modulator(IQModulator* iq, uint32_t input_rate, uint32_t output_rate, float deviation, float offset, size_t block_size) {
+	memset(iq, 0, sizeof(IQModulator));
+	if(input_rate == 0 || output_rate < input_rate || output_rate % input_rate != 0) return -1;
+	if(output_rate / input_rate > UINT16_MAX) return -1;
+	if(!check_iq_deviation(deviation, output_rate)) return -1;
+
+	iq->factor = (uint16_t)(output_rate / input_rate);
+	iq->block_size = block_size;
+	// Every phase is normalized to 1, so the MPX keeps its level and the deviation stays calibrated
+	if(init_polyphase_filter(&iq->upsampler, iq->factor, IQ_UPSAMPLER_TAPS, IQ_UPSAMPLER_CUTOFF, 1.0f) != 0) return -1;
+
+	iq->history = calloc(IQ_UPSAMPLER_TAPS - 1 + block_size, sizeof(float));
+	iq->upsampled = malloc(sizeof(float) * block_size * iq->factor);
+	if(!iq->history || !iq->upsampled) {
+		free_iq_modulator(iq);
+		return -1;
+	}
+
+	set_iq_modulator_deviation(iq, output_rate, deviation, offset);
+	return 0;
+}
+
+bool check_iq_deviation(float deviation, uint32_t output_rate) {
+	if(!isfinite(deviation) || output_rate == 0) return false;
+	return fabs((double)deviation * IQ_MPX_CLIP / output_rate) <= IQ_MAX_STEP;
+}
+
+void set_iq_modulator_deviation(IQModulator* iq, uint32_t output_rate, float deviation, float offset) {
+	double cycles = (double)offset / output_rate;
+	iq->carrier_increment = (uint32_t)(int64_t)llround((cycles - floor(cycles)) * PHASE_SCALE);
+	iq->deviation_scale = (float)((double)deviation / output_rate * PHASE_SCALE);
+}
+
+void free_iq_modulator(IQModulator* iq) {
+	free_polyphase_filter(&iq->upsampler);
+	free(iq->history);
+	free(iq->upsampled);
+	iq->history = NULL;
+	iq->upsampled = NULL;
+}
+
+// sin(2 pi phase / 2^32), 4 at a time with no table, the fold takes the phase to within a quarter cycle of 0
+static inline iq_v4f sin_v4(iq_v4u phase) {
+	iq_v4i folded = (iq_v4i)((phase ^ (phase << 1)) & 0x80000000u) >> 31; // Past a quarter cycle either way
+	phase = (phase & ~(iq_v4u)folded) | ((0x80000000u - phase) & (iq_v4u)folded);
+
+	const float turn = (float)(M_2PI / PHASE_SCALE);
+	iq_v4f x = __builtin_convertvector((iq_v4i)phase, iq_v4f) * turn;
+	iq_v4f x2 = x * x;
+	// Taylor to x^11, under 1e-7 out to pi / 2
+	iq_v4f p = x2 * (-1.0f / 39916800.0f) + (1.0f / 362880.0f);
+	p = p * x2 - (1.0f / 5040.0f);
+	p = p * x2 + (1.0f / 120.0f);
+	p = p * x2 - (1.0f / 6.0f);
+	p = p * x2 + 1.0f;
+	return p * x;
+}
+
+static inline iq_v4f clip_v4f(iq_v4f x, iq_v4f low, iq_v4f high) {
+	iq_v4i over = x > high;
+	iq_v4i under = x < low;
+	iq_v4i bits = (iq_v4i)x;
+	bits = (bits & ~over) | ((iq_v4i)high & over);
+	bits = (bits & ~under) | ((iq_v4i)low & under);
+	return (iq_v4f)bits;
+}
+
+// The clip keeps the phase steps inside an int32, check_iq_deviation made sure of that
+static void modulate_iq_samples(IQModulator* iq, const float* in, size_t count, float* out) {
+	const iq_v4f high = {IQ_MPX_CLIP, IQ_MPX_CLIP, IQ_MPX_CLIP, IQ_MPX_CLIP};
+	const iq_v4f low = -high;
+	const iq_v4f scale = {iq->deviation_scale, iq->deviation_scale, iq->deviation_scale, iq->deviation_scale};
+	const iq_v4i carrier = {(int32_t)iq->carrier_increment, (int32_t)iq->carrier_increment, (int32_t)iq->carrier_increment, (int32_t)iq->carrier_increment};
+	const iq_v4u quarter = {0x40000000u, 0x40000000u, 0x40000000u, 0x40000000u};
+	uint32_t phase = iq->phase;
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		iq_v4f x;
+		memcpy(&x, &in[i], sizeof(x));
+		iq_v4u step = (iq_v4u)(__builtin_convertvector(clip_v4f(x, low, high) * scale, iq_v4i) + carrier);
+
+		// Running sum inside the vector, then on top of where the last one ended
+		step[1] += step[0];
+		step[2] += step[1];
+		step[3] += step[2];
+		iq_v4u phases = step + phase;
+		phase = phases[3];
+
+		iq_v4f q = sin_v4(phases);
+		iq_v4f c = sin_v4(phases + quarter);
+		for (int k = 0; k < 4; k++) {
+			out[2 * (i + k) + 0] = c[k];
+			out[2 * (i + k) + 1] = q[k];
+		}
+	}
+	for (; i < count; i++) {
+		phase += iq->carrier_increment + (uint32_t)(int32_t)(fmaxf(-IQ_MPX_CLIP, fminf(IQ_MPX_CLIP, in[i])) * iq->deviation_scale);
+		iq_v4u phases = {phase, phase + 0x40000000u, 0, 0};
+		iq_v4f s = sin_v4(phases);
+		out[2 * i + 0] = s[1];
+		out[2 * i + 1] = s[0];
+	}
+
+	iq->phase = phase;
+}
+
+void modulate_iq_block(IQModulator* iq, const float* in, size_t count, float* out) {
+	if(count > iq->block_size) count = iq->block_size;
+	const size_t keep = IQ_UPSAMPLER_TAPS - 1;
+
+	memcpy(&iq->history[keep], in, sizeof(float) * count);
+	polyphase_upsample(&iq->upsampler, iq->history, count, iq->upsampled);
+	memmove(iq->history, &iq->history[count], sizeof(float) * keep);
+
+	modulate_iq_samples(iq, iq->upsampled, count * iq->factor, out);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../dsp/polyphase.h"
+
+#define IQ_UPSAMPLER_TAPS 48 // per phase, at the MPX rate
+#define IQ_UPSAMPLER_CUTOFF 0.46f // of the MPX rate, 88 khz at 192 khz so DARC still fits and the first image is 80 dB down
+#define IQ_MPX_CLIP 2.0f // The upsampled MPX is held within this before it moves the phase, twice the deviation
+#define IQ_MAX_STEP 0.49 // Cycles per output sample the phase can move at the clip, half a cycle would no longer fit the int32 steps
+
+// Complex baseband FM, the MPX goes up by an integer factor and drives a phase accumulator (2^32 is a cycle)
+typedef struct
+{
+	PolyphaseFilter upsampler;
+	uint16_t factor;
+	size_t block_size; // Most MPX samples one call takes
+
+	// The last IQ_UPSAMPLER_TAPS - 1 MPX samples of the previous block, then the current one
+	float* history;
+	float* upsampled;
+
+	uint32_t phase;
+	uint32_t carrier_increment;
+	float deviation_scale; // Phase per output sample for an MPX of 1.0
+} IQModulator;
+
+// Whether the deviation at IQ_MPX_CLIP fits the output rate
+bool check_iq_deviation(float deviation, uint32_t output_rate);
+// output_rate has to be a multiple of input_rate and pass check_iq_deviation, offset moves the carrier off 0 hz, 0 on success
+int init_iq_modulator(IQModulator* iq, uint32_t input_rate, uint32_t output_rate, float deviation, float offset, size_t block_size);
+// For a reload, the upsampler and the phase carry on
+void set_iq_modulator_deviation(IQModulator* iq, uint32_t output_rate, float deviation, float offset);
+void free_iq_modulator(IQModulator* iq);
+
+// Takes count (up to block_size) MPX samples, out gets count * factor interleaved I and Q pairs, unit amplitude
+void modulate_iq_block(IQModulator* iq, const float* in, size_t count, float* out);
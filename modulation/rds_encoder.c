@@ -0,0 +1,223 @@
+#include "rds_encoder.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include "../inih/ini.h"
+#include "../lib/constants.h"
+
+#define RDS_POLY 0x5B9 // x^10 + x^8 + x^7 + x^5 + x^4 + x^3 + 1
+#define RDS_OFFSET_A 0x0FC
+#define RDS_OFFSET_B 0x198
+#define RDS_OFFSET_C 0x168
+#define RDS_OFFSET_D 0x1B4
+
+#define RDS_NO_AF 0xE0CD // "No AF exists" and a filler
+
+float rds_waveform[RDS_WAVEFORM_SPAN][RDS_WAVEFORM_RESOLUTION + 1];
+static pthread_once_t rds_waveform_once = PTHREAD_ONCE_INIT;
+
+// Impulse response of the data shaping, H(f) = cos(pi * f * Td / 4) up to 2 / Td, t in bits
+static double rds_shaping(double t) {
+	const int steps = 2000;
+	double sum = 0.0;
+	for (int i = 0; i < steps; i++) {
+		double f = (i + 0.5) * 2.0 / steps; // in 1/Td
+		sum += cos(M_PI * f / 4.0) * cos(M_2PI * f * t);
+	}
+	return sum * 2.0 / steps;
+}
+
+static void build_rds_waveform(void) {
+	// A biphase symbol is a positive impulse in the first half of the bit and a negative one in the second
+	for (int k = 0; k < RDS_WAVEFORM_SPAN; k++) {
+		for (int x = 0; x <= RDS_WAVEFORM_RESOLUTION; x++) {
+			double t = (double)x / RDS_WAVEFORM_RESOLUTION + k - RDS_WAVEFORM_SPAN / 2.0;
+			rds_waveform[k][x] = (float)(rds_shaping(t + 0.25) - rds_shaping(t - 0.25));
+		}
+	}
+
+	// Worst case is every symbol lining up, scale that to 1
+	float peak = 0.0f;
+	for (int x = 0; x <= RDS_WAVEFORM_RESOLUTION; x++) {
+		float sum = 0.0f;
+		for (int k = 0; k < RDS_WAVEFORM_SPAN; k++) sum += fabsf(rds_waveform[k][x]);
+		if (sum > peak) peak = sum;
+	}
+	for (int k = 0; k < RDS_WAVEFORM_SPAN; k++) {
+		for (int x = 0; x <= RDS_WAVEFORM_RESOLUTION; x++) rds_waveform[k][x] /= peak;
+	}
+}
+
+// Once for the process, encoders can be set up on several threads at once
+static void init_rds_waveform(void) {
+	pthread_once(&rds_waveform_once, build_rds_waveform);
+}
+
+static uint16_t rds_checkword(uint16_t info, uint16_t offset) {
+	uint32_t reg = (uint32_t)info << 10;
+	for (int i = 25; i >= 10; i--) {
+		if (reg & (1u << i)) reg ^= (uint32_t)RDS_POLY << (i - 10);
+	}
+	return (reg & 0x3FF) ^ offset;
+}
+
+static void put_block(uint8_t* bits, uint16_t info, uint16_t offset) {
+	uint32_t block = ((uint32_t)info << 10) | rds_checkword(info, offset);
+	for (int i = 0; i < 26; i++) bits[i] = (block >> (25 - i)) & 1;
+}
+
+static uint8_t count_rt_segments(const char* rt) {
+	size_t len = strlen(rt);
+	if (len >= 64) return 16;
+	return (uint8_t)((len + 1 + 3) / 4); // Room for the 0x0D that ends it
+}
+
+void set_rds_encoder_data(RDSEncoder* enc, const RDSEncoderData* data) {
+	if (strcmp(enc->data.rt, data->rt) != 0) {
+		enc->rt_ab = !enc->rt_ab; // Tells the receivers to clear what they have
+		enc->rt_segment = 0;
+	}
+	enc->data = *data;
+	enc->rt_segments = count_rt_segments(enc->data.rt);
+}
+
+void init_rds_encoder(RDSEncoder* enc, const RDSEncoderData* data) {
+	init_rds_waveform();
+	memset(enc, 0, sizeof(RDSEncoder));
+	enc->data = *data;
+	enc->rt_segments = count_rt_segments(enc->data.rt);
+	enc->last_ct_minute = -1;
+	enc->bit = RDS_GROUP_BITS; // Build a group on the first bit
+}
+
+static uint16_t block_b(const RDSEncoder* enc, uint8_t group_type) {
+	return (uint16_t)(group_type << 12 | enc->data.tp << 10 | (enc->data.pty & 0x1F) << 5);
+}
+
+static char rt_char(const RDSEncoder* enc, uint8_t index) {
+	size_t len = strlen(enc->data.rt);
+	if (index < len) return enc->data.rt[index];
+	if (index == len) return 0x0D;
+	return ' ';
+}
+
+static char ps_char(const RDSEncoder* enc, uint8_t index) {
+	size_t len = strlen(enc->data.ps);
+	return (index < len) ? enc->data.ps[index] : ' ';
+}
+
+// Clock time, sent in the first group of every minute
+static bool build_ct_group(RDSEncoder* enc) {
+	time_t now = time(NULL);
+	struct tm local;
+	struct tm utc;
+	localtime_r(&now, &local);
+	gmtime_r(&now, &utc);
+	if (utc.tm_min == enc->last_ct_minute) return false;
+	enc->last_ct_minute = utc.tm_min;
+
+	uint32_t mjd = 40587 + (uint32_t)(now / 86400);
+	long offset = local.tm_gmtoff / 1800; // in half hours
+	uint8_t sign = offset < 0;
+	if (offset < 0) offset = -offset;
+
+	put_block(&enc->group[0], enc->data.pi, RDS_OFFSET_A);
+	put_block(&enc->group[26], block_b(enc, 4) | ((mjd >> 15) & 0x3), RDS_OFFSET_B);
+	put_block(&enc->group[52], (uint16_t)((mjd & 0x7FFF) << 1 | ((utc.tm_hour >> 4) & 1)), RDS_OFFSET_C);
+	put_block(&enc->group[78], (uint16_t)((utc.tm_hour & 0xF) << 12 | utc.tm_min << 6 | sign << 5 | (offset & 0x1F)), RDS_OFFSET_D);
+	return true;
+}
+
+static void build_ps_group(RDSEncoder* enc) {
+	uint8_t segment = enc->ps_segment;
+	// DI is sent a bit per segment, d3 first, only d0 (stereo) is ever set here
+	uint8_t di = (segment == 3) ? enc->data.stereo : 0;
+
+	put_block(&enc->group[0], enc->data.pi, RDS_OFFSET_A);
+	put_block(&enc->group[26], block_b(enc, 0) | enc->data.ta << 4 | enc->data.ms << 3 | di << 2 | segment, RDS_OFFSET_B);
+	put_block(&enc->group[52], RDS_NO_AF, RDS_OFFSET_C);
+	put_block(&enc->group[78], (uint16_t)((uint8_t)ps_char(enc, segment * 2) << 8 | (uint8_t)ps_char(enc, segment * 2 + 1)), RDS_OFFSET_D);
+
+	enc->ps_segment = (segment + 1) & 3;
+}
+
+static void build_rt_group(RDSEncoder* enc) {
+	uint8_t segment = enc->rt_segment;
+
+	put_block(&enc->group[0], enc->data.pi, RDS_OFFSET_A);
+	put_block(&enc->group[26], block_b(enc, 2) | enc->rt_ab << 4 | segment, RDS_OFFSET_B);
+	put_block(&enc->group[52], (uint16_t)((uint8_t)rt_char(enc, segment * 4) << 8 | (uint8_t)rt_char(enc, segment * 4 + 1)), RDS_OFFSET_C);
+	put_block(&enc->group[78], (uint16_t)((uint8_t)rt_char(enc, segment * 4 + 2) << 8 | (uint8_t)rt_char(enc, segment * 4 + 3)), RDS_OFFSET_D);
+
+	enc->rt_segment = (segment + 1) % enc->rt_segments;
+}
+
+// Four 0A then four 2A, with a 4A squeezed in when the minute changes
+static void build_next_group(RDSEncoder* enc) {
+	if (enc->data.ct && build_ct_group(enc)) return;
+
+	bool rt = enc->data.rt[0] != '\0' && (enc->sequence & 4);
+	if (rt) build_rt_group(enc);
+	else build_ps_group(enc);
+	enc->sequence = (enc->sequence + 1) & 7;
+}
+
+static void next_bit(RDSEncoder* enc) {
+	if (enc->bit >= RDS_GROUP_BITS) {
+		build_next_group(enc);
+		enc->bit = 0;
+	}
+	enc->last_differential ^= enc->group[enc->bit++];
+	enc->symbols = (uint8_t)(enc->symbols << 1 | enc->last_differential);
+}
+
+float get_rds_sample(RDSEncoder* enc, float osc_phase) {
+	if (osc_phase < enc->last_osc_phase) {
+		enc->osc_cycles = (enc->osc_cycles + 1) & 3;
+		if (enc->osc_cycles == 0) next_bit(enc);
+	}
+	enc->last_osc_phase = osc_phase;
+
+	float position = (enc->osc_cycles + osc_phase * (float)(1.0 / M_2PI)) * (RDS_WAVEFORM_RESOLUTION / 4.0f);
+	int index = (int)position;
+	if (index >= RDS_WAVEFORM_RESOLUTION) index = RDS_WAVEFORM_RESOLUTION - 1;
+	float fraction = position - index;
+
+	float sample = 0.0f;
+	for (int k = 0; k < RDS_WAVEFORM_SPAN; k++) {
+		float w = rds_waveform[k][index] + (rds_waveform[k][index + 1] - rds_waveform[k][index]) * fraction;
+		sample += ((enc->symbols >> k) & 1) ? w : -w;
+	}
+	return sample;
+}
+
+static void copy_text(char* dest, size_t size, const char* value) {
+	size_t len = strnlen(value, size - 1);
+	memcpy(dest, value, len);
+	dest[len] = '\0';
+}
+
+bool parse_rds_encoder_data(RDSEncoderData* data, const char* key, const char* value) {
+	if (strcasecmp(key, "pi") == 0) data->pi = (uint16_t)strtoul(value, NULL, 16);
+	else if (strcasecmp(key, "ps") == 0) copy_text(data->ps, sizeof(data->ps), value);
+	else if (strcasecmp(key, "rt") == 0) copy_text(data->rt, sizeof(data->rt), value);
+	else if (strcasecmp(key, "pty") == 0) data->pty = (uint8_t)(atoi(value) & 0x1F);
+	else if (strcasecmp(key, "tp") == 0) data->tp = atoi(value) != 0;
+	else if (strcasecmp(key, "ta") == 0) data->ta = atoi(value) != 0;
+	else if (strcasecmp(key, "ms") == 0) data->ms = atoi(value) != 0;
+	else if (strcasecmp(key, "ct") == 0) data->ct = atoi(value) != 0;
+	else return false;
+	return true;
+}
+
+static int command_file_handler(void* user, const char* section, const char* name, const char* value) {
+	(void)section;
+	return parse_rds_encoder_data((RDSEncoderData*)user, name, value);
+}
+
+int load_rds_encoder_data(RDSEncoderData* data, const char* path) {
+	return ini_parse(path, &command_file_handler, data);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define RDS_WAVEFORM_SPAN 4 // bits a shaped symbol lasts
+#define RDS_WAVEFORM_RESOLUTION 256 // table points per bit
+#define RDS_GROUP_BITS 104
+
+typedef struct
+{
+	uint16_t pi;
+	uint8_t pty;
+	bool tp;
+	bool ta;
+	bool ms;
+	bool stereo;
+	bool ct;
+	char ps[9];
+	char rt[65];
+} RDSEncoderData;
+
+typedef struct
+{
+	RDSEncoderData data;
+	bool rt_ab;
+	uint8_t rt_segments;
+
+	// Group scheduling
+	uint8_t ps_segment;
+	uint8_t rt_segment;
+	uint8_t sequence;
+	int last_ct_minute;
+
+	// Bits of the group on air
+	uint8_t group[RDS_GROUP_BITS];
+	uint8_t bit;
+	uint8_t last_differential;
+
+	// Bit clock, 4 cycles of the 4750 hz oscillator per bit
+	float last_osc_phase;
+	uint8_t osc_cycles;
+	uint8_t symbols; // Last RDS_WAVEFORM_SPAN symbols, newest in bit 0, 1 is +1
+} RDSEncoder;
+
+// Shaped biphase symbol, waveform[k][x] is symbol k bits back, x through the current bit
+extern float rds_waveform[RDS_WAVEFORM_SPAN][RDS_WAVEFORM_RESOLUTION + 1];
+
+void init_rds_encoder(RDSEncoder* enc, const RDSEncoderData* data);
+void set_rds_encoder_data(RDSEncoder* enc, const RDSEncoderData* data);
+// Sets one field from a key like the command file's, PI, PS, RT, PTY, TP, TA, MS, CT (case does not matter), false if unknown
+bool parse_rds_encoder_data(RDSEncoderData* data, const char* key, const char* value);
+// Reads a command file of key=value lines, 0 on success
+int load_rds_encoder_data(RDSEncoderData* data, const char* path);
+
+// Baseband for the current sample, osc_phase is the 4750 hz oscillator's phase, the 57k carrier has to come from the same one
+float get_rds_sample(RDSEncoder* enc, float osc_phase);
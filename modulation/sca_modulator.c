@@ -0,0 +1,130 @@
+#include "sca_modulator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define UPSAMPLE_CHUNK 256 // Output samples upsampled at a time, they go straight into the modulator while still in L1
+
+int parse_sca_carrier(const char* text, SCACarrier* carrier, uint8_t position) {
+	char* end;
+	carrier->freq = strtof(text, &end);
+	carrier->deviation = SCA_DEFAULT_DEVIATION;
+	carrier->clipper = SCA_DEFAULT_CLIPPER;
+	carrier->volume = 1.0f;
+	carrier->channel = position;
+	if(end == text || carrier->freq <= 0) return 1;
+
+	if(*end == ':') carrier->deviation = strtof(end + 1, &end);
+	if(*end == ':') carrier->clipper = strtof(end + 1, &end);
+	if(*end == ':') carrier->volume = strtof(end + 1, &end);
+	if(*end == ':') {
+		long channel = strtol(end + 1, &end, 10);
+		if(channel < 0 || channel >= SCA_MAX_CHANNELS) return 1;
+		carrier->channel = channel;
+	}
+	return (*end != '\0');
+}
+
+uint8_t count_sca_channels(const SCACarrier* carriers, uint8_t num_carriers) {
+	uint8_t channels = 1;
+	for(uint8_t c = 0; c < num_carriers; c++) {
+		if(carriers[c].channel + 1 > channels) channels = carriers[c].channel + 1;
+	}
+	return channels;
+}
+
+int init_sca_modulator(SCAModulator* sca, const SCACarrier* carriers, uint8_t num_carriers, float audio_volume, float lpf_cutoff, uint8_t preemphasis, uint32_t input_rate, uint32_t sample_rate, uint16_t output_block) {
+	memset(sca, 0, sizeof(SCAModulator));
+	if(num_carriers > SCA_MAX_CARRIERS || input_rate == 0 || sample_rate % input_rate != 0) return 1;
+
+	memcpy(sca->carriers, carriers, sizeof(SCACarrier) * num_carriers);
+	sca->num_carriers = num_carriers;
+	sca->channels = count_sca_channels(carriers, num_carriers);
+	sca->audio_volume = audio_volume;
+	sca->lpf_cutoff = lpf_cutoff;
+	sca->preemphasis = preemphasis;
+
+	sca->factor = sample_rate / input_rate;
+	sca->input_block = (output_block + sca->factor - 1) / sca->factor;
+
+	if(sca->factor > 1 && init_polyphase_filter(&sca->upsampler, sca->factor, SCA_UPSAMPLER_LENGTH, SCA_UPSAMPLER_CUTOFF, 1.0f) != 0) return 1;
+	sca->channel_input = malloc(sizeof(float) * sca->input_block * sca->channels);
+	if(!sca->channel_input) return 1;
+
+	for(uint8_t c = 0; c < num_carriers; c++) {
+		SCACarrierState* state = &sca->states[c];
+		if(init_fm_block_modulator(&state->modulator, carriers[c].freq, carriers[c].deviation, carriers[c].clipper, sample_rate) != 0) return 1;
+		if(lpf_cutoff != 0) state->lpf = iirfilt_rrrf_create_prototype(LIQUID_IIRDES_CHEBY2, LIQUID_IIRDES_LOWPASS, LIQUID_IIRDES_SOS, SCA_LPF_ORDER, (lpf_cutoff/input_rate), 0.0f, 1.0f, 60.0f);
+		if(preemphasis != 0) init_preemphasis(&state->preemp, (float)preemphasis * 1.0e-6f, input_rate, SCA_PREEMPHASIS_UNITY_FREQ);
+		state->history = calloc(SCA_UPSAMPLER_LENGTH - 1 + sca->input_block, sizeof(float));
+		if(!state->history) return 1;
+	}
+	return 0;
+}
+
+void free_sca_modulator(SCAModulator* sca) {
+	for(uint8_t c = 0; c < sca->num_carriers; c++) {
+		if(sca->states[c].lpf) iirfilt_rrrf_destroy(sca->states[c].lpf);
+		free(sca->states[c].history);
+		sca->states[c].lpf = NULL;
+		sca->states[c].history = NULL;
+	}
+	if(sca->factor > 1) free_polyphase_filter(&sca->upsampler);
+	free(sca->channel_input);
+	sca->channel_input = NULL;
+}
+
+// Gain, pre-emphasis, clip and low pass at the input rate, clipping before the filter keeps the clipper's harmonics out of the neighbours
+static void process_carrier_audio(const SCAModulator* sca, const SCACarrier* carrier, SCACarrierState* state, const float* in, float* out, uint16_t count) {
+	for(uint16_t i = 0; i < count; i++) {
+		float sample = in[i] * sca->audio_volume;
+		if(sca->preemphasis != 0) sample = apply_preemphasis(&state->preemp, sample);
+		sample = fmaxf(-carrier->clipper, fminf(carrier->clipper, sample));
+		if(sca->lpf_cutoff != 0) iirfilt_rrrf_execute(state->lpf, sample, &sample);
+		out[i] = sample;
+	}
+}
+
+// Upsamples in chunks straight into the modulator, the full rate audio never exists as a block
+static void upsample_and_modulate(const SCAModulator* sca, SCACarrierState* state, float* output, float level, bool add) {
+	float upsampled[UPSAMPLE_CHUNK];
+	uint16_t factor = sca->factor;
+	uint16_t per_chunk = UPSAMPLE_CHUNK / factor;
+
+	for(uint16_t i = 0; i < sca->input_block; i += per_chunk) {
+		uint16_t n = (sca->input_block - i < per_chunk) ? sca->input_block - i : per_chunk;
+		polyphase_upsample(&sca->upsampler, &state->history[i], n, upsampled);
+		// The filtered audio can overshoot the clipper a bit, the modulator's clip only catches that
+		if(add) modulate_fm_block_add(&state->modulator, upsampled, &output[i * factor], n * factor, 1.0f, level);
+		else modulate_fm_block(&state->modulator, upsampled, &output[i * factor], n * factor, 1.0f, level);
+	}
+
+	memmove(state->history, &state->history[sca->input_block], sizeof(float) * (SCA_UPSAMPLER_LENGTH - 1));
+}
+
+void modulate_sca_block(SCAModulator* sca, const float* input, float* output, float master_volume, bool add) {
+	uint16_t input_block = sca->input_block;
+	size_t output_block = (size_t)input_block * sca->factor;
+
+	if(sca->channels > 1) {
+		for(uint16_t i = 0; i < input_block; i++) {
+			for(uint8_t ch = 0; ch < sca->channels; ch++) sca->channel_input[ch * input_block + i] = input[i * sca->channels + ch];
+		}
+		input = sca->channel_input;
+	}
+
+	// First carrier writes the block (unless adding), the rest add to it, so the output is touched once per carrier and never cleared
+	for(uint8_t c = 0; c < sca->num_carriers; c++) {
+		const SCACarrier* carrier = &sca->carriers[c];
+		SCACarrierState* state = &sca->states[c];
+		float* audio = &state->history[SCA_UPSAMPLER_LENGTH - 1];
+		float level = carrier->volume * master_volume;
+		bool add_this = add || c != 0;
+
+		process_carrier_audio(sca, carrier, state, &input[carrier->channel * input_block], audio, input_block);
+
+		if(sca->factor > 1) upsample_and_modulate(sca, state, output, level, add_this);
+		else if(!add_this) modulate_fm_block(&state->modulator, audio, output, output_block, 1.0f, level);
+		else modulate_fm_block_add(&state->modulator, audio, output, output_block, 1.0f, level);
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <liquid/liquid.h>
+#include "fm_modulator.h"
+#include "../filter/iir.h"
+#include "../dsp/polyphase.h"
+
+#define SCA_MAX_CARRIERS 8
+#define SCA_MAX_CHANNELS 32 // As many as a Pulse capture can have
+#define SCA_DEFAULT_DEVIATION 7000.0f
+#define SCA_DEFAULT_CLIPPER 1.0f
+
+#define SCA_LPF_ORDER 10
+#define SCA_PREEMPHASIS_UNITY_FREQ 1000.0f
+#define SCA_UPSAMPLER_LENGTH 24 // taps per phase
+#define SCA_UPSAMPLER_CUTOFF 0.45f // of the input rate
+
+typedef struct
+{
+	float freq;
+	float deviation;
+	float clipper;
+	float volume; // Relative to the master level
+	uint8_t channel; // Of the capture
+} SCACarrier;
+
+typedef struct
+{
+	FMBlockModulator modulator;
+	iirfilt_rrrf lpf;
+	ResistorCapacitor preemp;
+	float* history; // The upsampler's taps from the last block, then this block, at the input rate
+} SCACarrierState;
+
+// FM subcarriers fed from one low rate capture, the audio is filtered at the capture rate and upsampled straight into the modulators
+typedef struct
+{
+	SCACarrier carriers[SCA_MAX_CARRIERS];
+	SCACarrierState states[SCA_MAX_CARRIERS];
+	uint8_t num_carriers;
+	uint8_t channels; // Of the capture, enough for the highest carrier channel
+
+	float audio_volume;
+	float lpf_cutoff;
+	uint8_t preemphasis;
+
+	PolyphaseFilter upsampler;
+	uint16_t factor; // sample_rate / input_rate
+	uint16_t input_block; // Capture frames per block
+	float* channel_input;
+} SCAModulator;
+
+// Parses freq[:deviation[:clip[:level[:channel]]]], the channel defaults to position, 0 on success
+int parse_sca_carrier(const char* text, SCACarrier* carrier, uint8_t position);
+// Channels a capture needs for these carriers
+uint8_t count_sca_channels(const SCACarrier* carriers, uint8_t num_carriers);
+
+// input_rate has to divide sample_rate, the output block is input_block * factor, at least output_block, 0 on success
+int init_sca_modulator(SCAModulator* sca, const SCACarrier* carriers, uint8_t num_carriers, float audio_volume, float lpf_cutoff, uint8_t preemphasis, uint32_t input_rate, uint32_t sample_rate, uint16_t output_block);
+void free_sca_modulator(SCAModulator* sca);
+
+// input is input_block interleaved frames, output gets input_block * factor samples, add sums into it instead of overwriting
+void modulate_sca_block(SCAModulator* sca, const float* input, float* output, float master_volume, bool add);
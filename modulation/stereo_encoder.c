@@ -20,4 +20,22 @@ float stereo_encode(StereoEncoder* st, uint8_t enabled, float left, float right)
     float signalx2 = get_oscillator_sin_multiplier_ni(st->osc, st->multiplier * 2.0f);
 
     return (mid*half_audio) + (signalx1*st->pilot_volume) + ((side*signalx2) * half_audio);
+}
+
+float stereo_encode_audio(StereoEncoder* st, Oscillator* osc, uint8_t enabled, float left, float right) {
+    float mid = (left+right) * 0.5f;
+    if(!enabled) return mid * st->audio_volume;
+
+    float half_audio = st->audio_volume * 0.5f;
+
+    float side = (left-right) * 0.5f;
+
+    float signalx2 = get_oscillator_sin_multiplier_ni(osc, st->multiplier * 2.0f);
+
+    return (mid*half_audio) + ((side*signalx2) * half_audio);
+}
+
+float stereo_encode_pilot(StereoEncoder* st, uint8_t enabled) {
+    if(!enabled) return 0.0f;
+    return get_oscillator_sin_multiplier_ni(st->osc, st->multiplier) * st->pilot_volume;
 }
\ No newline at end of file
@@ -14,3 +14,6 @@ typedef struct
 void init_stereo_encoder(StereoEncoder *st, uint8_t multiplier, Oscillator *osc, float audio_volume, float pilot_volume);
 
 float stereo_encode(StereoEncoder* st, uint8_t enabled, float left, float right);
+// The same without the pilot, on the carriers of osc instead of the encoder's own, for audio that gets to the output later than the pilot
+float stereo_encode_audio(StereoEncoder* st, Oscillator* osc, uint8_t enabled, float left, float right);
+float stereo_encode_pilot(StereoEncoder* st, uint8_t enabled);
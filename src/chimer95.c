@@ -1,9 +1,12 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
 #include <getopt.h>
 #include <time.h>
 #include <signal.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include "../inih/ini.h"
 
 #define DEFAULT_CONFIG_PATH "/etc/chimer95.conf"
@@ -24,6 +27,9 @@
 
 #define DEFAULT_MASTER_VOLUME 0.5f
 #define DEFAULT_OFFSET 0
+#define DEFAULT_RAMP 0.0f // ms, off
+
+#define SCHEDULE_LEAD_MS 250 // Wake up this long before an event, more than the device latency, to fill the silence up to it
 
 #define PIP_DURATION 100
 #define PIP_PAUSE 900
@@ -35,10 +41,6 @@
 #define SEQ_TEST_HOUR 3
 
 volatile sig_atomic_t to_run = 1;
-volatile sig_atomic_t playing_sequence = 0;
-volatile int sequence_position = 0;
-volatile int sequence_type = SEQ_NONE;
-volatile time_t last_sequence_time = 0;
 
 static void stop(int signum) {
 	(void)signum;
@@ -55,49 +57,73 @@ void show_help(char *name) {
 	);
 }
 
-void generate_signal(float *output, Oscillator *osc, float volume, int *elapsed_samples, int total_samples, int pip_samples, int pause_samples, int beep_samples, int num_pips) {
-	for (int i = 0; i < BUFFER_SIZE; i++) {
-		if (*elapsed_samples >= total_samples) {
-			output[i] = 0;
-			playing_sequence = 0;
-		} else {
-			int cycle_position = *elapsed_samples;
-			int pip_cycle = pip_samples + pause_samples;
-
-			if (cycle_position < num_pips * pip_cycle) {
-				if ((cycle_position % pip_cycle) < pip_samples) output[i] = get_oscillator_sin_sample(osc) * volume;
-				else output[i] = 0;
-			} else if (cycle_position < num_pips * pip_cycle + beep_samples) output[i] = get_oscillator_sin_sample(osc) * volume;
-			else output[i] = 0;
-
-			(*elapsed_samples)++;
+typedef struct
+{
+	int64_t time_ns; // CLOCK_REALTIME, when the first pip has to leave the DAC
+	int type;
+} Chimer95_Event;
+
+static int64_t realtime_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// First event after after_ns: XX:29:56 and XX:59:55, or every minute's :55 in test mode
+Chimer95_Event next_event(int64_t after_ns, int test_mode, int16_t offset) {
+	Chimer95_Event best = {INT64_MAX, SEQ_NONE};
+	int64_t hour = after_ns / 1000000000 / 3600 * 3600;
+
+	for (int64_t h = hour - 3600; h <= hour + 3600; h += 3600) {
+		int64_t candidates[2] = {h + 29 * 60 + 56 + offset, h + 59 * 60 + 55 + offset};
+		for (int c = 0; c < 2; c++) {
+			int64_t ns = candidates[c] * 1000000000;
+			if (ns > after_ns && ns < best.time_ns) {
+				best.time_ns = ns;
+				best.type = c == 0 ? SEQ_29_56 : SEQ_59_55;
+			}
+		}
+		if (!test_mode) continue;
+		for (int64_t m = h; m < h + 3600; m += 60) {
+			int64_t ns = (m + 55 + offset) * 1000000000;
+			if (ns > after_ns && ns < best.time_ns) {
+				best.time_ns = ns;
+				best.type = SEQ_TEST_HOUR;
+			}
 		}
 	}
+	return best;
 }
 
-int check_time_for_sequence(int test_mode, int16_t offset) {
-	static time_t last_check = 0;
-	static int last_minute = -1;
-
-	time_t now = time(NULL);
-	if (now == last_check) return SEQ_NONE;
-
-	last_check = now;
-	struct tm *utc_time = gmtime(&now);
-	int minute = utc_time->tm_min;
-	int second = utc_time->tm_sec;
+// Absolute, so neither oversleeping nor the clock being stepped meanwhile moves the wake up
+int sleep_until(int64_t ns) {
+	struct timespec ts = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+	int err;
+	while ((err = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL)) == EINTR) {
+		if (!to_run) break;
+	}
+	return err;
+}
 
-	if (difftime(now, last_sequence_time) < 1.0) return SEQ_NONE;
+// Writes silence until the next sample written leaves the DAC on time_ns, error_ns is how far off that sample is
+int pad_to_event(PulseOutputDevice* dev, int64_t time_ns, uint32_t sample_rate, int64_t* error_ns) {
+	float silence[BUFFER_SIZE] = {0};
+	pa_usec_t latency;
+	int pulse_error;
 
-	last_sequence_time = now;
-	if (minute == 29 && second == (56 + offset)) return SEQ_29_56;
-	if (minute == 59 && second == (55 + offset)) return SEQ_59_55;
-	if (test_mode && second == (55 + offset) && minute != last_minute) {
-		last_minute = minute;
-		return SEQ_TEST_HOUR;
+	while (to_run) {
+		if ((pulse_error = get_latency_PulseOutputDevice(dev, &latency))) return pulse_error;
+		int64_t remaining = time_ns - realtime_ns() - (int64_t)latency * 1000;
+		int64_t samples = (remaining * sample_rate + 500000000) / 1000000000;
+		if (samples <= 0) break; // Late already, play it right away
+		if (samples > BUFFER_SIZE) samples = BUFFER_SIZE;
+		if ((pulse_error = write_PulseOutputDevice(dev, silence, samples * sizeof(float)))) return pulse_error;
+		if (samples < BUFFER_SIZE) break;
 	}
 
-	return SEQ_NONE;
+	if ((pulse_error = get_latency_PulseOutputDevice(dev, &latency))) return pulse_error;
+	*error_ns = realtime_ns() + (int64_t)latency * 1000 - time_ns;
+	return 0;
 }
 
 typedef struct
@@ -107,12 +133,22 @@ typedef struct
 	uint32_t sample_rate;
 	int16_t offset;
 	bool test_mode;
+	float ramp;
 
 	char ini_config_path[64];
 } Chimer95_Config;
+// A whole sequence, rendered once and then only handed to Pulse
+typedef struct
+{
+	float* samples;
+	size_t count;
+} Chimer95_Sequence;
+
 typedef struct
 {
 	PulseOutputDevice output_device;
+	Chimer95_Sequence sequence_29_56;
+	Chimer95_Sequence sequence_59_55;
 } Chimer95_Runtime;
 
 typedef struct {
@@ -123,72 +159,79 @@ typedef struct {
     Chimer95_DeviceNames* devices;
 } Chimer95_SetupContext;
 
-int run_chimer95(const Chimer95_Config config, Chimer95_Runtime* runtime) {
-	int pulse_error;
-
+// Every pip starts on the same phase, the edges are raised cosines ramp_samples long so they don't click
+static void render_tone(float* output, int samples, int ramp_samples, const Chimer95_Config config) {
 	Oscillator osc;
 	init_oscillator(&osc, config.freq, config.sample_rate);
+	if (ramp_samples * 2 > samples) ramp_samples = samples / 2;
 
-	float output[BUFFER_SIZE];
+	for (int i = 0; i < samples; i++) {
+		float gain = config.master_volume;
+		int edge = (i < samples - 1 - i) ? i : samples - 1 - i;
+		if (edge < ramp_samples) gain *= 0.5f - 0.5f * cosf(M_PI * (edge + 0.5f) / ramp_samples);
+		output[i] = get_oscillator_sin_sample(&osc) * gain;
+	}
+}
 
+int render_sequence(Chimer95_Sequence* sequence, int num_pips, const Chimer95_Config config) {
 	int pip_samples = (int)((PIP_DURATION / 1000.0) * config.sample_rate);
 	int pause_samples = (int)((PIP_PAUSE / 1000.0) * config.sample_rate);
 	int beep_samples = (int)((BEEP_DURATION / 1000.0) * config.sample_rate);
+	int ramp_samples = (int)(config.ramp / 1000.0f * config.sample_rate);
 
-	int samples_29_56 = 4 * (pip_samples + pause_samples) + beep_samples;
-	int samples_59_55 = 5 * (pip_samples + pause_samples) + beep_samples;
+	sequence->count = (size_t)num_pips * (pip_samples + pause_samples) + beep_samples;
+	if (posix_memalign((void**)&sequence->samples, 64, sequence->count * sizeof(float)) != 0) return 1;
+	memset(sequence->samples, 0, sequence->count * sizeof(float));
+
+	for (int pip = 0; pip < num_pips; pip++) render_tone(&sequence->samples[pip * (pip_samples + pause_samples)], pip_samples, ramp_samples, config);
+	render_tone(&sequence->samples[num_pips * (pip_samples + pause_samples)], beep_samples, ramp_samples, config);
+	return 0;
+}
+
+void free_sequence(Chimer95_Sequence* sequence) {
+	free(sequence->samples);
+	sequence->samples = NULL;
+}
+
+int run_chimer95(const Chimer95_Config config, Chimer95_Runtime* runtime) {
+	int pulse_error;
 
 	printf("Ready to play time signals.\n");
-	printf("Will trigger at XX:29:%02d and XX:59:%02d\n", 56+config.offset, 55+config.offset);
+	// The offset can carry the seconds into the next minute (or back), even across the hour
+	int half = ((29 * 60 + 56 + config.offset) % 3600 + 3600) % 3600;
+	int full = ((59 * 60 + 55 + config.offset) % 3600 + 3600) % 3600;
+	printf("Will trigger at XX:%02d:%02d and XX:%02d:%02d\n", half / 60, half % 60, full / 60, full % 60);
 	if (config.test_mode) printf("TEST MODE: Will also play full hour signal at the end of every minute\n");
 
-	int elapsed_samples = 0;
-	int total_sequence_samples = 0;
-	int sequence_completed = 0;
+	int64_t lead_ns = (int64_t)SCHEDULE_LEAD_MS * 1000000;
+	int64_t after_ns = realtime_ns() + lead_ns;
 
 	while (to_run) {
-		if (!playing_sequence) {
-			int new_sequence = check_time_for_sequence(config.test_mode, config.offset);
-
-			if (new_sequence != SEQ_NONE) {
-				playing_sequence = 1;
-				sequence_type = new_sequence;
-				elapsed_samples = 0;
-				sequence_completed = 0;
-
-				if (new_sequence == SEQ_29_56) total_sequence_samples = samples_29_56;
-				else total_sequence_samples = samples_59_55;
-
-				memset(output, 0, sizeof(output));
-			} else {
-				static int idle_counter = 0;
-				if (idle_counter++ % 10 == 0) {
-					memset(output, 0, sizeof(output));
-					if((pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(output)))) {
-						fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
-						to_run = 0;
-						break;
-					}
-				}
-
-				struct timespec ts = {0, 5000000}; // 5ms sleep
-				nanosleep(&ts, NULL);
-				continue;
-			}
-		}
+		Chimer95_Event event = next_event(after_ns, config.test_mode, config.offset);
+		if (sleep_until(event.time_ns - lead_ns) != 0 || !to_run) break;
 
-		int num_pips = (sequence_type == SEQ_29_56) ? 4 : 5;
-		generate_signal(output, &osc, config.master_volume,
-					   &elapsed_samples, total_sequence_samples,
-					   pip_samples, pause_samples, beep_samples, num_pips);
+		int64_t error_ns;
+		if((pulse_error = pad_to_event(&runtime->output_device, event.time_ns, config.sample_rate, &error_ns))) {
+			fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
+			to_run = 0;
+			break;
+		}
 
-		if (!playing_sequence && !sequence_completed) sequence_completed = 1;
+		time_t event_time = (time_t)(event.time_ns / 1000000000);
+		struct tm utc_time;
+		gmtime_r(&event_time, &utc_time);
+		printf("%02d:%02d:%02d UTC sequence, the first pip is %+.3f ms off\n", utc_time.tm_hour, utc_time.tm_min, utc_time.tm_sec, error_ns / 1e6);
 
-		if((pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(output)))) {
+		const Chimer95_Sequence* sequence = (event.type == SEQ_29_56) ? &runtime->sequence_29_56 : &runtime->sequence_59_55;
+		if((pulse_error = write_PulseOutputDevice(&runtime->output_device, sequence->samples, sequence->count * sizeof(float)))) {
 			fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
 			to_run = 0;
 			break;
 		}
+
+		// Nothing is written until the next one, the stream just runs dry
+		after_ns = event.time_ns + (int64_t)sequence->count * 1000000000 / config.sample_rate;
+		if (realtime_ns() + lead_ns > after_ns) after_ns = realtime_ns() + lead_ns;
 	}
 
 	return 0;
@@ -230,11 +273,13 @@ static int config_handler(void* user, const char* section, const char* name, con
 	} else if(MATCH("chimer95", "volume")) {
 		pconfig->master_volume = strtof(value, NULL);
 	} else if(MATCH("chimer95", "offset")) {
-		pconfig->offset = strtoul(value, NULL, 10);
+		pconfig->offset = strtol(value, NULL, 10);
 	} else if(MATCH("chimer95", "sample_rate")) {
 		pconfig->sample_rate = atoi(value);
 	} else if(MATCH("chimer95", "test_mode")) {
 		pconfig->test_mode = atoi(value);
+	} else if(MATCH("chimer95", "ramp")) {
+		pconfig->ramp = strtof(value, NULL);
 	} else if(MATCH("devices", "chimer")) {
 		strncpy(dv->output, value, 63);
         dv->output[63] = '\0';
@@ -254,7 +299,7 @@ int parse_config(Chimer95_Config* config, Chimer95_DeviceNames* dv) {
 }
 
 int main(int argc, char **argv) {
-	printf("chimer95 (GTS time signal encoder by radio95) version 1.3\n");
+	printf("chimer95 (GTS time signal encoder by radio95) version 1.5\n");
 
 
 	Chimer95_Config config = {
@@ -263,6 +308,7 @@ int main(int argc, char **argv) {
 		.sample_rate = DEFAULT_SAMPLE_RATE,
 		.offset = DEFAULT_OFFSET,
 		.test_mode = 0,
+		.ramp = DEFAULT_RAMP,
 		.ini_config_path = DEFAULT_CONFIG_PATH
 	};
 
@@ -287,6 +333,7 @@ int main(int argc, char **argv) {
 	printf("\tVolume: %.2f\n", config.master_volume);
 	printf("\tTime offset: %d seconds\n", config.offset);
 	printf("\tTest mode: %s\n", config.test_mode ? "Enabled" : "Disabled");
+	printf("\tRamp: %.1f ms\n", config.ramp);
 
 	// Setup PulseAudio
 	pa_buffer_attr output_buffer_atr = {
@@ -306,11 +353,19 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	if (render_sequence(&runtime.sequence_29_56, 4, config) != 0 || render_sequence(&runtime.sequence_59_55, 5, config) != 0) {
+		fprintf(stderr, "Error: cannot allocate the sequences\n");
+		free_PulseDevice(&runtime.output_device);
+		return 1;
+	}
+
 	signal(SIGINT, stop);
 	signal(SIGTERM, stop);
 
 	int ret = run_chimer95(config, &runtime);
 	printf("Cleaning up...\n");
+	free_sequence(&runtime.sequence_29_56);
+	free_sequence(&runtime.sequence_59_55);
 	free_PulseDevice(&runtime.output_device);
 	return ret;
 }
\ No newline at end of file
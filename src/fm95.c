@@ -1,7 +1,10 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
 #include <getopt.h>
 #include <liquid/liquid.h>
 #include "../inih/ini.h"
 #include <stdbool.h>
+#include <sys/stat.h>
+#include <ctype.h>
 
 #define DEFAULT_INI_PATH "/etc/fm95.conf"
 
@@ -11,26 +14,62 @@
 #include "../dsp/oscillator.h"
 #include "../filter/iir.h"
 #include "../modulation/stereo_encoder.h"
+#include "../modulation/rds_encoder.h"
+#include "../modulation/darc_encoder.h"
+#include "../modulation/iq_modulator.h"
+#include "../modulation/sca_modulator.h"
 #include "../filter/bs412.h"
 #include "../filter/gain_control.h"
+#include "../filter/graph.h"
+#include "../filter/composite_clipper.h"
 
 #define BUFFER_SIZE 3072 // This defines how many samples to process at a time, because the loop here is this: get signal -> process signal -> output signal, and when we get signal we actually get BUFFER_SIZE of them
 
 #include "../io/audio.h"
-
+#include "../io/vban_input.h"
+#include "../io/mpx_sender.h"
+#include "../io/iq_output.h"
+#include "../io/control_socket.h"
+#include "../io/wav_file.h"
+#include "../lib/block_queue.h"
+#include "../lib/param_mailbox.h"
+#include "../lib/realtime.h"
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define DEFAULT_MASTER_VOLUME 1.0f
 #define DEFAULT_PILOT_VOLUME 0.09f // 9%
 #define DEFAULT_RDS_VOLUME 0.0475f // 4.75%
 #define DEFAULT_RDS_VOLUME_STEP 0.9f // 90%, so RDS2 stream 4 is 90% of stream 3 which is 90% of stream 2, which again is 90% of stream 1...
+#define DEFAULT_DARC_VOLUME 0.10f // 10%, with an L-R over 5%
+#define DEFAULT_DARC_MIN_VOLUME 0.04f // 4%, with an L-R under 2.5%
+#define DEFAULT_SCA_VOLUME 0.1f // 10%, of every carrier at a level of 1.0
+
+#define DEFAULT_SCA_FREQUENCY 67000.0f
+#define DEFAULT_SCA_INPUT_RATE 48000 // SCA audio is a few khz wide, no need for pulse to resample it to 192k for us
+#define DEFAULT_SCA_LPF_CUTOFF 7000.0f
+
+#define RDS_COMMAND_POLL_TICKS 20 // About a second of the reload thread's 50 ms ticks
 
 static volatile sig_atomic_t to_run = 1;
 static volatile sig_atomic_t to_reload = 0;
 
-inline float hard_clip(float sample, float threshold) { return fmaxf(-threshold, fminf(threshold, sample)); }
 
 typedef struct
 {
 	bool rds_on;
 	bool mpx_on;
+	bool distribution_on;
+	bool rds_encoder_on;
+	bool darc_on;
+	bool output_on;
+	bool iq_on;
+	bool sca_on;
+	bool control_on;
+	bool state_on;
+	bool composite_clipper_on;
 } FM95_Options;
 typedef struct
 {
@@ -39,6 +78,9 @@ typedef struct
 	float pilot;
 	float rds;
 	float rds_step;
+	float darc;
+	float darc_min;
+	float sca;
 } FM95_Volumes;
 typedef struct
 {
@@ -50,6 +92,8 @@ typedef struct
 	uint8_t rds_streams;
 
 	float clipper_threshold;
+	float composite_clipper; // Of the audio's share of the MPX, 0 is off
+	uint8_t composite_oversample;
 	uint8_t preemphasis;
 	float tilt;
 	uint8_t calibration;
@@ -75,20 +119,187 @@ typedef struct
 	float bs412_release;
 	float bs412_max;
 	float lpf_cutoff;
+
+	float vban_latency;
+	char vban_interface[16];
+
+	char distribution_destination[64];
+	char distribution_interface[16];
+	uint8_t distribution_ttl;
+	float distribution_clock_offset;
+
+	uint8_t rds_encoder;
+	char rds_command_file[128];
+	RDSEncoderData rds_data;
+
+	uint8_t darc;
+	char darc_frame;
+	char darc_source[128];
+
+	char iq_output[128];
+	uint8_t iq_format;
+	uint32_t iq_rate;
+	float iq_deviation;
+	float iq_offset;
+
+	SCACarrier sca_carriers[SCA_MAX_CARRIERS];
+	uint8_t sca_num_carriers;
+	uint32_t sca_input_rate;
+	float sca_audio_volume;
+	float sca_lpf_cutoff;
+	uint8_t sca_preemphasis;
+
+	uint8_t pipeline;
+	uint8_t pipeline_depth;
+	float stats;
+
+	char graph_audio[128];
+	char graph_mpx[128];
+	GraphNode graph_nodes[GRAPH_MAX_NODES]; // [node.NAME] sections
+	uint8_t graph_num_nodes;
+
+	char control_socket[108];
+
+	char state_file[128];
+	float state_interval;
+	float state_max_age;
+
+	RealtimeSettings realtime;
 } FM95_Config;
 
+// Either a Pulse capture or a VBAN stream, picked by the device name
+typedef struct
+{
+	PulseInputDevice pulse;
+	VBANInputDevice vban;
+	bool is_vban;
+	uint8_t channels;
+} FM95_InputDevice;
+
+// What the control socket can get and set
+typedef enum
+{
+	FM95_PARAM_MASTER_VOLUME = 0,
+	FM95_PARAM_AUDIO_VOLUME,
+	FM95_PARAM_AUDIO_PREAMP,
+	FM95_PARAM_AGC_TARGET,
+	FM95_PARAM_MPX_POWER,
+	FM95_PARAM_STEREO,
+	FM95_PARAM_PILOT_VOLUME,
+	FM95_PARAM_RDS_VOLUME,
+	FM95_PARAM_COUNT
+} FM95_Param;
+
+typedef struct
+{
+	const char* name;
+	bool composite; // Taken by the composite stage, else by the audio stage
+	float min, max;
+	const char* node; // The graph stage it sets, by name, NULL if it isn't one
+	const char* key; // And which of its settings
+} FM95_ParamInfo;
+
+// The stages are the built-in ones of the default graphs (see builtin_FM95_GraphNode), a graph of its own only has them set when
+// it keeps those names, a set is refused when the running graph has no such stage
+static const FM95_ParamInfo fm95_params[FM95_PARAM_COUNT] = {
+	[FM95_PARAM_MASTER_VOLUME] = {"master_volume", true, 0.0f, 4.0f, "master", "gain"},
+	[FM95_PARAM_AUDIO_VOLUME] = {"audio_volume", false, 0.0f, 4.0f, "volume", "gain"},
+	[FM95_PARAM_AUDIO_PREAMP] = {"audio_preamp", false, 0.0f, 16.0f, "preamp", "gain"},
+	[FM95_PARAM_AGC_TARGET] = {"agc_target", false, 0.0f, 1.0f, "agc", "target"},
+	[FM95_PARAM_MPX_POWER] = {"mpx_power", true, -20.0f, 20.0f, "bs412", "power"},
+	[FM95_PARAM_STEREO] = {"stereo", true, 0.0f, 1.0f, NULL, NULL},
+	[FM95_PARAM_PILOT_VOLUME] = {"pilot_volume", true, 0.0f, 0.2f, NULL, NULL},
+	[FM95_PARAM_RDS_VOLUME] = {"rds_volume", true, 0.0f, 0.2f, NULL, NULL},
+};
+
+// The socket's thread posts into the mailbox, each stage picks up its own parameters at the start of a block
+typedef struct
+{
+	ControlSocket socket;
+	ParamMailbox mailbox;
+	pthread_mutex_t lock; // Taken by a set and by a reload until it is swapped in, so no set is lost to one, never on the DSP threads
+	float values[FM95_PARAM_COUNT]; // What get answers, only stored under lock, by a set or from the config by store_FM95_Control
+	bool settable[FM95_PARAM_COUNT]; // Whether the graphs running have the parameter's stage, stored like values
+	ParamMailboxReader audio_reader;
+	ParamMailboxReader composite_reader;
+} FM95_Control;
+
+// A reload built off the DSP threads while the old chain keeps running, each stage swaps its half in at the start of a block
+// and then fades from the old graph to the new one over that block
+typedef struct
+{
+	FM95_Config config;
+	GraphPlan audio_graph, mpx_graph; // The new plans until they are swapped in, then the old ones until they are freed
+	uint32_t generation; // Bumped by the reload thread once the rest is ready
+	uint32_t audio_taken, composite_taken; // The generation each stage swapped in, only touched by that stage
+	uint32_t audio_done, composite_done; // The generation each stage is done fading from, the old plans can go after both
+} FM95_Reload;
+
+// What the chain has measured of the signal, kept in the [state] file so a restart picks up from it, see open_FM95_State
+#define FM95_STATE_MAGIC 0x35394d46 // "FM95" little endian
+#define FM95_STATE_VERSION 1
+
+// One stage's part, written by that stage only
+typedef struct
+{
+	uint64_t saved_ns; // CLOCK_REALTIME
+	uint64_t samples; // Composite only, how far the oscillator had run
+	GraphState graph;
+} FM95_StateHalf;
+
+// The file is a plain mmap of this, a half is only used when its sequence is even, a crash in the middle of writing one leaves it odd
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t pid;
+	uint32_t audio_sequence, composite_sequence;
+	FM95_StateHalf audio, composite;
+} FM95_State;
+
 typedef struct
 {
-	PulseInputDevice input_device, mpx_device, rds_device;
+	FM95_InputDevice input_device, mpx_device, rds_device, sca_device;
 	PulseOutputDevice output_device;
-	float* rds_in;
+	MPXSender distribution;
+	RDSEncoder rds_encoder;
+	bool rds_encoder_ready;
+	time_t rds_command_mtime; // Only touched off the DSP threads, like the rest of the command file
+	uint8_t rds_command_countdown;
+	// The command file is read off the DSP threads, the data is posted here and the composite stage takes it at the start of a block,
+	// the poster leaves it alone until the last one was taken
+	RDSEncoderData rds_posted;
+	uint32_t rds_posted_sequence, rds_taken_sequence;
+	DARCEncoder darc_encoder;
+	bool darc_encoder_ready;
+	char darc_source[128];
+	IQModulator iq_modulator;
+	IQOutput iq_output;
+	float* iq_buffer;
+	SCAModulator sca;
+	float* sca_in;
 	Oscillator osc;
-	iirfilt_rrrf lpf_l, lpf_r;
-	ResistorCapacitor preemp_l, preemp_r;
-	BS412Compressor bs412;
-	TiltCorrectionFilter tilter;
+	GraphPlan audio_graph; // L and R, before the stereo encoder
+	GraphPlan mpx_graph; // The whole MPX, before the output
+	TiltCorrectionFilter tilter; // Calibration only, the MPX graph has its own
 	StereoEncoder stencode;
-	AGC agc;
+	CompositeClipper composite_clipper;
+	bool composite_clipper_ready;
+	uint64_t output_wait_ns; // How long the last block's writes blocked for
+	FM95_Control control;
+	FM95_Reload reload;
+	bool fade_audio, fade_mpx; // From the old plan in reload, this block
+	bool stereo;
+	float audio_target; // The audio, pilot and RDS levels are ramped to these over a block
+	float pilot_target;
+	float rds_volume;
+	float rds_target;
+	uint64_t samples; // Since the oscillator's phase 0
+	FM95_State* state; // The mapped state file, NULL without one
+	FM95_State state_taken; // What the stages last took, written out to the file off their threads
+	uint32_t state_countdown[2]; // Blocks until the audio and the composite stage take theirs again
+	uint32_t state_written[2]; // The sequence of each half the file has
 } FM95_Runtime;
 
 typedef struct {
@@ -96,22 +307,68 @@ typedef struct {
     char output[64];
     char mpx[64];
     char rds[64];
+    char sca[64];
 } FM95_DeviceNames;
+
+#define MAX_PROGRAMMES 16
+#define MAX_WORKERS 16
+#define PROGRAMME_READ_AHEAD 4 // Blocks a programme's reader can be ahead of its worker
+#define PROGRAMME_READER_STOP_S 2 // How long the exit waits for a reader stuck on its input
+
+// A [programme.NAME] section of the main config, a whole chain set up by its own config file
+typedef struct {
+	char name[32];
+	char config_path[64];
+	int8_t worker; // -1 to have one picked
+} FM95_ProgrammeEntry;
+
+typedef struct {
+	FM95_ProgrammeEntry programmes[MAX_PROGRAMMES];
+	uint8_t num_programmes;
+	uint8_t workers; // 0 for as many as there are programmes
+	int cpus[MAX_WORKERS]; // Worker i is pinned to cpus[i % num_cpus]
+	uint8_t num_cpus;
+	float stats;
+} FM95_ProgrammeList;
+
+#define MAX_BATCH_JOBS 64
+#define BATCH_PATH_LENGTH 256
+
+// --batch, WAV files through the chain as fast as the CPUs go, each on a chain of its own
+typedef struct {
+	char output_dir[128];
+	bool mpx; // Write the MPX instead of the processed audio
+	uint8_t jobs; // 0 for one per CPU
+	char** files;
+	int num_files;
+} FM95_Batch;
+
 typedef struct {
     FM95_Config* config;
     FM95_DeviceNames* devices;
+    FM95_ProgrammeList* programmes; // NULL in a programme's own config, programmes don't nest
 } FM95_SetupContext;
 
 bool compare_dvs(const FM95_DeviceNames *a, const FM95_DeviceNames *b) {
     return strcmp(a->input,  b->input)  == 0 &&
            strcmp(a->output, b->output) == 0 &&
            strcmp(a->mpx,    b->mpx)    == 0 &&
-           strcmp(a->rds,    b->rds)    == 0;
+           strcmp(a->rds,    b->rds)    == 0 &&
+           strcmp(a->sca,    b->sca)    == 0;
+}
+
+// What the SCA carriers add up to at most
+float calculate_sca_volume(const FM95_Config* config) {
+	if(!config->options.sca_on) return 0.0f;
+	float sum = 0.0f;
+	for(uint8_t c = 0; c < config->sca_num_carriers; c++) sum += config->sca_carriers[c].volume;
+	return sum * config->volumes.sca;
 }
 
-float calculate_sharedaudio_volume(const FM95_Volumes volumes, const int rds_streams) {
+float calculate_sharedaudio_volume(const FM95_Volumes volumes, const int rds_streams, const bool darc_on, const float sca_volume) {
 	float rds_volume = volumes.rds * powf(volumes.rds_step, rds_streams);
-	return 1.0f - rds_volume - volumes.pilot - volumes.headroom;
+	float darc_volume = darc_on ? volumes.darc : 0.0f; // The most it goes up to, so a loud L-R does not push the MPX over
+	return 1.0f - rds_volume - darc_volume - sca_volume - volumes.pilot - volumes.headroom;
 }
 
 static void stop(int signum) {
@@ -123,150 +380,869 @@ static void stop(int signum) {
 static void reload(int signum) {
 	(void)signum;
 	printf("\nReceived reload signal.\n");
-	to_run = 0; // To run is a flag, just telling when to stop the loop
-	to_reload = 1;
+	to_reload = 1; // The chain keeps running, the reload is swapped in when it's ready
 }
 
 void show_help(char *name) {
 	printf(
-		"Usage: \t%s\n"
-		"\t-c,--config\tOverride the default config path (%s)\n",
+		"Usage: \t%s [-c config] [-b dir [-j jobs] [-m] files...]\n"
+		"\t-c,--config\tOverride the default config path (%s)\n"
+		"\t-b,--batch\tRender the WAV files given after the options through the chain into this directory, instead of running live\n"
+		"\t-j,--jobs\tHow many files are rendered at once (default one per CPU)\n"
+		"\t-m,--mpx\tWrite the MPX instead of the processed audio\n",
 		name,
 		DEFAULT_INI_PATH
 	);
 }
 
 void cleanup_runtime(FM95_Runtime* runtime, const FM95_Config config) {
-	if(config.lpf_cutoff != 0) {
-		iirfilt_rrrf_destroy(runtime->lpf_l);
-		iirfilt_rrrf_destroy(runtime->lpf_r);
-	}
+	free_oscillator_table(&runtime->osc);
+	if(runtime->composite_clipper_ready) free_composite_clipper(&runtime->composite_clipper);
+	runtime->composite_clipper_ready = false;
+	free_graph_plan(&runtime->audio_graph);
+	free_graph_plan(&runtime->mpx_graph);
+	free_graph_plan(&runtime->reload.audio_graph);
+	free_graph_plan(&runtime->reload.mpx_graph);
+}
+
+int init_FM95_InputDevice(FM95_InputDevice* dev, const FM95_Config config, const uint32_t sample_rate, const int channels, const char* stream_name, const char* device, pa_buffer_attr* buffer_attr) {
+	dev->channels = channels;
+	dev->is_vban = is_vban_url(device);
+	if(dev->is_vban) return init_VBANInputDevice(&dev->vban, device, config.vban_interface, sample_rate, channels, config.vban_latency);
+	return init_PulseInputDevice(&dev->pulse, sample_rate, channels, "fm95", stream_name, device, buffer_attr, PA_SAMPLE_FLOAT32NE);
+}
+
+int read_FM95_InputDevice(FM95_InputDevice* dev, float* buffer, size_t size) {
+	if(dev->is_vban) return read_VBANInputDevice(&dev->vban, buffer, size / (sizeof(float) * dev->channels));
+	return read_PulseInputDevice(&dev->pulse, buffer, size);
+}
+
+void free_FM95_InputDevice(FM95_InputDevice* dev) {
+	if(dev->is_vban) free_VBANInputDevice(&dev->vban);
+	else free_PulseDevice(&dev->pulse);
+}
+
+void free_FM95_SCA(FM95_Runtime *rt) {
+	free_FM95_InputDevice(&rt->sca_device);
+	free_sca_modulator(&rt->sca);
+	free(rt->sca_in);
 }
 
 void cleanup_audio_runtime(FM95_Runtime *rt, const FM95_Options options) {
-    free_PulseDevice(&rt->input_device);
-    if (options.mpx_on) free_PulseDevice(&rt->mpx_device);
-    if (options.rds_on) {
-		free_PulseDevice(&rt->rds_device);
-		free(rt->rds_in);
+    free_FM95_InputDevice(&rt->input_device);
+    if (options.mpx_on) free_FM95_InputDevice(&rt->mpx_device);
+    if (options.rds_on && !options.rds_encoder_on) free_FM95_InputDevice(&rt->rds_device);
+    if (options.sca_on) free_FM95_SCA(rt);
+    if (options.output_on) free_PulseDevice(&rt->output_device);
+    if (options.distribution_on) free_MPXSender(&rt->distribution);
+    if (options.control_on) {
+		free_ControlSocket(&rt->control.socket);
+		pthread_mutex_destroy(&rt->control.lock);
+	}
+    if (options.iq_on) {
+		free_IQOutput(&rt->iq_output);
+		free_iq_modulator(&rt->iq_modulator);
+		free(rt->iq_buffer);
 	}
-    free_PulseDevice(&rt->output_device);
 }
 
-int run_fm95(const FM95_Config config, FM95_Runtime* runtime) {
-	float output[BUFFER_SIZE];
+// The command file overrides the config, and is looked at again whenever it changes
+void load_rds_command_file(const FM95_Config config, FM95_Runtime* runtime, RDSEncoderData* data) {
+	struct stat st;
+	if(stat(config.rds_command_file, &st) != 0) return;
+	runtime->rds_command_mtime = st.st_mtime;
+	int err = load_rds_encoder_data(data, config.rds_command_file);
+	if(err != 0) fprintf(stderr, "Warning! RDS command file %s has an error on line %d.\n", config.rds_command_file, err);
+}
 
-	int pulse_error;
+// What the RDS encoder sends, the config with the command file over it
+static void load_FM95_RDSData(const FM95_Config config, FM95_Runtime* runtime, RDSEncoderData* data) {
+	*data = config.rds_data;
+	data->stereo = config.stereo;
+	if(config.rds_command_file[0] != '\0') load_rds_command_file(config, runtime, data);
+}
 
-	if(config.calibration != 0) {
-		while(to_run) {
-			for (int i = 0; i < BUFFER_SIZE; i++) {
-				float sample = get_oscillator_sin_sample(&runtime->osc);
-				if(config.calibration == 2) sample = (sample > 0.0f) ? 1.0f : -1.0f; // Sine wave to square wave filter, 50% duty cycle
-				if(config.tilt != 0) sample = tilt(&runtime->tilter, sample);
-				output[i] = sample*config.master_volume;
-			}
-			if((pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(output)))) { // get output from the function and assign it into pulse_error, this comment to avoid confusion
-				fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
-				to_run = 0;
-				break;
-			}
+// Off the DSP threads, false while the last one is still waiting to be taken
+static bool post_FM95_RDSData(const FM95_Config config, FM95_Runtime* runtime) {
+	uint32_t posted = runtime->rds_posted_sequence;
+	if(__atomic_load_n(&runtime->rds_taken_sequence, __ATOMIC_ACQUIRE) != posted) return false;
+	load_FM95_RDSData(config, runtime, &runtime->rds_posted);
+	__atomic_store_n(&runtime->rds_posted_sequence, posted + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// On the reload thread's tick, the config under the file is what the chain runs with since the last reload
+void poll_rds_command_file(const FM95_Config config, FM95_Runtime* runtime) {
+	if(!config.options.rds_encoder_on || config.rds_command_file[0] == '\0' || runtime->rds_command_countdown--) return;
+	runtime->rds_command_countdown = RDS_COMMAND_POLL_TICKS;
+
+	struct stat st;
+	if(stat(config.rds_command_file, &st) != 0 || st.st_mtime == runtime->rds_command_mtime) return;
+	post_FM95_RDSData(config, runtime); // If the last one is still waiting, looked at again on the next poll
+}
+
+// On the composite stage's thread
+static void take_rds_command_file(FM95_Runtime* runtime) {
+	uint32_t posted = __atomic_load_n(&runtime->rds_posted_sequence, __ATOMIC_ACQUIRE);
+	if(posted == runtime->rds_taken_sequence) return;
+	set_rds_encoder_data(&runtime->rds_encoder, &runtime->rds_posted);
+	__atomic_store_n(&runtime->rds_taken_sequence, posted, __ATOMIC_RELEASE);
+}
+
+static float load_FM95_Param(FM95_Control* control, uint8_t param) {
+	float value;
+	__atomic_load(&control->values[param], &value, __ATOMIC_RELAXED);
+	return value;
+}
+
+static int find_FM95_Param(const char* name) {
+	for(uint8_t p = 0; p < FM95_PARAM_COUNT; p++) {
+		if(strcmp(fm95_params[p].name, name) == 0) return p;
+	}
+	return -1;
+}
+
+// One command from the control socket, get NAME, set NAME VALUE or list
+static void handle_FM95_Control(void* user, char* line, char* reply, size_t size) {
+	FM95_Control* control = user;
+	char* saveptr;
+	char* command = strtok_r(line, " \t\r", &saveptr);
+	if(command == NULL) return;
+	char* name = strtok_r(NULL, " \t\r", &saveptr);
+	char* value = strtok_r(NULL, " \t\r", &saveptr);
+
+	if(strcmp(command, "list") == 0) {
+		size_t used = 0;
+		for(uint8_t p = 0; p < FM95_PARAM_COUNT && used < size; p++) {
+			used += snprintf(reply + used, size - used, "%s %g\n", fm95_params[p].name, load_FM95_Param(control, p));
 		}
-		return 0;
+		if(used < size) snprintf(reply + used, size - used, "ok\n");
+		return;
 	}
 
-	float audio_stereo_input[BUFFER_SIZE*2]; // Stereo
+	int param = (name != NULL) ? find_FM95_Param(name) : -1;
+	if(strcmp(command, "get") == 0 && param >= 0) {
+		snprintf(reply, size, "%s %g\nok\n", name, load_FM95_Param(control, param));
+	} else if(strcmp(command, "set") == 0 && param >= 0 && value != NULL) {
+		char* end;
+		float parsed = strtof(value, &end);
+		if(end == value || *end != '\0' || !isfinite(parsed) || parsed < fm95_params[param].min || parsed > fm95_params[param].max) {
+			snprintf(reply, size, "error: %s goes from %g to %g\n", name, fm95_params[param].min, fm95_params[param].max);
+			return;
+		}
+		if(param == FM95_PARAM_STEREO) parsed = (parsed != 0.0f) ? 1.0f : 0.0f;
+		pthread_mutex_lock(&control->lock);
+		if(!control->settable[param]) {
+			pthread_mutex_unlock(&control->lock);
+			snprintf(reply, size, "error: the %s graph has no %s stage for %s\n", fm95_params[param].composite ? "MPX" : "audio", fm95_params[param].node, name);
+			return;
+		}
+		__atomic_store(&control->values[param], &parsed, __ATOMIC_RELAXED);
+		param_mailbox_post(&control->mailbox, param, parsed);
+		pthread_mutex_unlock(&control->lock);
+		snprintf(reply, size, "ok\n");
+	} else if(strcmp(command, "get") == 0 || strcmp(command, "set") == 0) {
+		snprintf(reply, size, "error: no such parameter, see list\n");
+	} else snprintf(reply, size, "error: the commands are get NAME, set NAME VALUE and list\n");
+}
 
-	float mpx_in[BUFFER_SIZE] = {0};
+// Back to what the config says for the graphs that are about to run, off the DSP threads with control->lock held
+static void store_FM95_Control(const FM95_Config config, FM95_Runtime* runtime, const GraphPlan* audio_graph, const GraphPlan* mpx_graph) {
+	FM95_Control* control = &runtime->control;
+	const float values[FM95_PARAM_COUNT] = {
+		[FM95_PARAM_MASTER_VOLUME] = config.master_volume * 75000.0f / config.audio_deviation, // As it was in the config, the deviation is put back on when it's applied
+		[FM95_PARAM_AUDIO_VOLUME] = config.audio_volume,
+		[FM95_PARAM_AUDIO_PREAMP] = config.audio_preamp,
+		[FM95_PARAM_AGC_TARGET] = config.agc_target,
+		[FM95_PARAM_MPX_POWER] = config.mpx_power,
+		[FM95_PARAM_STEREO] = config.stereo ? 1.0f : 0.0f,
+		[FM95_PARAM_PILOT_VOLUME] = config.volumes.pilot,
+		[FM95_PARAM_RDS_VOLUME] = config.volumes.rds,
+	};
+	for(uint8_t p = 0; p < FM95_PARAM_COUNT; p++) {
+		const FM95_ParamInfo* info = &fm95_params[p];
+		bool settable = !info->node || has_graph_param(info->composite ? mpx_graph : audio_graph, info->node, info->key);
+		__atomic_store(&control->values[p], &values[p], __ATOMIC_RELAXED);
+		__atomic_store_n(&control->settable[p], settable, __ATOMIC_RELAXED);
+	}
+}
 
-	bool mpx_on = config.options.mpx_on;
-	bool rds_on = config.options.rds_on;
+// Anything set before is dropped, store_FM95_Control already put the values back, each stage's reader is synced from its own thread
+static void reset_FM95_Control(FM95_Runtime* runtime, bool composite) {
+	FM95_Control* control = &runtime->control;
+	param_mailbox_sync(&control->mailbox, composite ? &control->composite_reader : &control->audio_reader);
+}
 
-	while (to_run) {
-		if((pulse_error = read_PulseInputDevice(&runtime->input_device, audio_stereo_input, sizeof(audio_stereo_input)))) { // get output from the function and assign it into pulse_error, this comment to avoid confusion
-			fprintf(stderr, "Error reading from input device: %s\n", pa_strerror(pulse_error));
-			to_run = 0;
-			break;
+// Takes what was set since the last block, gains are ramped over the block that follows
+static void apply_FM95_Control(const FM95_Config config, FM95_Runtime* runtime, bool composite) {
+	FM95_Control* control = &runtime->control;
+	ParamMailboxReader* reader = composite ? &control->composite_reader : &control->audio_reader;
+	if(!param_mailbox_changed(&control->mailbox, reader)) return;
+
+	for(uint8_t p = 0; p < FM95_PARAM_COUNT; p++) {
+		float value;
+		if(fm95_params[p].composite != composite || !param_mailbox_take(&control->mailbox, reader, p, &value)) continue;
+		const FM95_ParamInfo* info = &fm95_params[p];
+		if(info->node) {
+			if(p == FM95_PARAM_MASTER_VOLUME) value *= config.audio_deviation / 75000.0f;
+			set_graph_param(composite ? &runtime->mpx_graph : &runtime->audio_graph, info->node, info->key, value);
+			continue;
 		}
-		if(mpx_on) {
-			if((pulse_error = read_PulseInputDevice(&runtime->mpx_device, mpx_in, sizeof(mpx_in)))) {
-				fprintf(stderr, "Error reading from MPX device: %s\nDisabling MPX.\n", pa_strerror(pulse_error));
-				mpx_on = 0;
-			}
+		switch((FM95_Param)p) {
+			case FM95_PARAM_STEREO: runtime->stereo = (value != 0.0f); break;
+			case FM95_PARAM_PILOT_VOLUME: runtime->pilot_target = value; break;
+			case FM95_PARAM_RDS_VOLUME: runtime->rds_target = value; break;
+			default: break;
 		}
-		if(rds_on) {
-			if((pulse_error = read_PulseInputDevice(&runtime->rds_device, runtime->rds_in, sizeof(float) * BUFFER_SIZE * config.rds_streams))) {
-				fprintf(stderr, "Error reading from RDS95 device: %s\nDisabling RDS.\n", pa_strerror(pulse_error));
-				rds_on = 0;
+	}
+}
+
+// Opens a new DARC source off the DSP threads, its reader picks it up
+static void open_FM95_DARCSource(const FM95_Config config, FM95_Runtime* runtime) {
+	if(!config.options.darc_on || strcmp(runtime->darc_source, config.darc_source) == 0) return;
+	int darc_error = set_darc_encoder_source(&runtime->darc_encoder, config.darc_source);
+	if(darc_error != 0) fprintf(stderr, "Warning! Cannot open the DARC source %s: %s, sending padding.\n", config.darc_source, strerror(darc_error));
+	memcpy(runtime->darc_source, config.darc_source, sizeof(runtime->darc_source));
+}
+
+// What the composite stage takes from the config besides its graph, the levels are ramped to from the next block on,
+// nothing in here waits on a file, the RDS data and the DARC source were set up off the DSP threads
+static void setup_FM95_Composite(const FM95_Config config, FM95_Runtime* runtime) {
+	runtime->stereo = config.stereo;
+	runtime->audio_target = config.volumes.audio;
+	runtime->pilot_target = config.volumes.pilot;
+	runtime->rds_target = config.volumes.rds;
+	if(runtime->composite_clipper_ready) runtime->composite_clipper.threshold = config.composite_clipper * config.volumes.audio;
+	if(config.options.control_on) reset_FM95_Control(runtime, true);
+
+	// On a reload only the levels change here, the frame and its bit clock carry on
+	if(config.options.darc_on) set_darc_encoder_levels(&runtime->darc_encoder, config.volumes.darc_min, config.volumes.darc);
+}
+
+// Swaps in what the reload thread built, the halves of the chain this thread runs, once per reload
+static void take_FM95_Reload(FM95_Config* config, FM95_Runtime* runtime, bool audio, bool composite) {
+	FM95_Reload* reload = &runtime->reload;
+	uint32_t generation = __atomic_load_n(&reload->generation, __ATOMIC_ACQUIRE);
+	bool take_audio = audio && reload->audio_taken != generation;
+	bool take_composite = composite && reload->composite_taken != generation;
+	if(!take_audio && !take_composite) return;
+	*config = reload->config;
+
+	// The old plan stays in reload for the fade, the gains it got to carry on into the new one
+	GraphPlan old;
+	if(take_audio) {
+		old = runtime->audio_graph;
+		runtime->audio_graph = reload->audio_graph;
+		reload->audio_graph = old;
+		carry_graph_gains(&runtime->audio_graph, &reload->audio_graph);
+		if(config->options.control_on) reset_FM95_Control(runtime, false);
+		runtime->fade_audio = true;
+		reload->audio_taken = generation;
+	}
+	if(take_composite) {
+		old = runtime->mpx_graph;
+		runtime->mpx_graph = reload->mpx_graph;
+		reload->mpx_graph = old;
+		carry_graph_gains(&runtime->mpx_graph, &reload->mpx_graph);
+		if(config->options.iq_on) set_iq_modulator_deviation(&runtime->iq_modulator, config->iq_rate, config->iq_deviation, config->iq_offset);
+		setup_FM95_Composite(*config, runtime);
+		runtime->fade_mpx = true;
+		reload->composite_taken = generation;
+	}
+}
+
+static uint64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t realtime_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t state_blocks(const FM95_Config config) {
+	uint32_t blocks = (uint32_t)(config.state_interval * config.sample_rate / BUFFER_SIZE);
+	return blocks ? blocks : 1;
+}
+
+// Every state_interval, from the stage's own thread, only into the runtime, the file is written from there by write_FM95_State
+static void take_FM95_State(const FM95_Config config, FM95_Runtime* runtime, bool composite) {
+	uint32_t* countdown = &runtime->state_countdown[composite];
+	if(!runtime->state || (*countdown)--) return;
+	*countdown = state_blocks(config);
+
+	uint32_t* sequence = composite ? &runtime->state_taken.composite_sequence : &runtime->state_taken.audio_sequence;
+	FM95_StateHalf* half = composite ? &runtime->state_taken.composite : &runtime->state_taken.audio;
+	__atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	half->saved_ns = realtime_ns();
+	if(composite) half->samples = runtime->samples;
+	save_graph_state(composite ? &runtime->mpx_graph : &runtime->audio_graph, &half->graph);
+	__atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Copies what the stages took into the file, from a thread that doesn't run the chain, a half that is being taken right now waits for the next time
+static void write_FM95_State(FM95_Runtime* runtime) {
+	if(!runtime->state) return;
+	for(uint8_t composite = 0; composite < 2; composite++) {
+		uint32_t* taken_sequence = composite ? &runtime->state_taken.composite_sequence : &runtime->state_taken.audio_sequence;
+		uint32_t* file_sequence = composite ? &runtime->state->composite_sequence : &runtime->state->audio_sequence;
+		const FM95_StateHalf* taken = composite ? &runtime->state_taken.composite : &runtime->state_taken.audio;
+		FM95_StateHalf* file = composite ? &runtime->state->composite : &runtime->state->audio;
+
+		uint32_t sequence = __atomic_load_n(taken_sequence, __ATOMIC_ACQUIRE);
+		if((sequence & 1) || sequence == runtime->state_written[composite]) continue;
+		FM95_StateHalf half = *taken;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(taken_sequence, __ATOMIC_RELAXED) != sequence) continue;
+
+		__atomic_store_n(file_sequence, (*file_sequence | 1), __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		*file = half;
+		__atomic_store_n(file_sequence, *file_sequence + 1, __ATOMIC_RELEASE);
+		runtime->state_written[composite] = sequence;
+	}
+}
+
+// The AGC and BS412 carry on from the file when it was left by the same graph not too long ago, and the carriers keep the phase they would have had,
+// the page cache keeps it over a crash, the kernel writes it out to the disk in its own time
+static void open_FM95_State(const FM95_Config config, FM95_Runtime* runtime) {
+	if(!config.options.state_on) return;
+	int fd = open(config.state_file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "Warning! Cannot open the state file %s: %s, starting cold.\n", config.state_file, strerror(errno));
+		return;
+	}
+	struct stat st;
+	bool existing = (fstat(fd, &st) == 0 && st.st_size == sizeof(FM95_State));
+	if(!existing && ftruncate(fd, sizeof(FM95_State)) != 0) {
+		fprintf(stderr, "Warning! Cannot size the state file %s: %s, starting cold.\n", config.state_file, strerror(errno));
+		close(fd);
+		return;
+	}
+	FM95_State* state = mmap(NULL, sizeof(FM95_State), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(state == MAP_FAILED) {
+		fprintf(stderr, "Warning! Cannot map the state file %s: %s, starting cold.\n", config.state_file, strerror(errno));
+		return;
+	}
+
+	if(!existing || state->magic != FM95_STATE_MAGIC || state->version != FM95_STATE_VERSION || state->sample_rate != config.sample_rate) {
+		if(existing) printf("The state file %s is from another version or sample rate, starting cold.\n", config.state_file);
+		memset(state, 0, sizeof(FM95_State));
+	} else {
+		uint64_t now = realtime_ns();
+		const uint32_t sequences[2] = {state->audio_sequence, state->composite_sequence};
+		const FM95_StateHalf* halves[2] = {&state->audio, &state->composite};
+		GraphPlan* plans[2] = {&runtime->audio_graph, &runtime->mpx_graph};
+		const char* results[2];
+		for(uint8_t composite = 0; composite < 2; composite++) {
+			double age = (now > halves[composite]->saved_ns) ? (now - halves[composite]->saved_ns) * 1e-9 : 0.0;
+			if(sequences[composite] == 0 || (sequences[composite] & 1)) results[composite] = "not saved";
+			else if(config.state_max_age != 0 && age > config.state_max_age) results[composite] = "too old";
+			else if(!restore_graph_state(plans[composite], &halves[composite]->graph)) results[composite] = "changed since";
+			else results[composite] = "picked up";
+
+			// The distribution sets the phase itself, from the sample the sites agree on
+			if(composite && sequences[1] != 0 && !(sequences[1] & 1) && !config.options.distribution_on) {
+				runtime->samples = halves[1]->samples + (uint64_t)(age * config.sample_rate);
+				sync_oscillator_phase(&runtime->osc, 4750, runtime->samples);
 			}
 		}
+		printf("State from %s: audio graph %s, MPX graph %s\n", config.state_file, results[0], results[1]);
+	}
 
-		for (uint16_t i = 0; i < BUFFER_SIZE; i++) {
-			float mpx = 0.0f;
+	state->version = FM95_STATE_VERSION;
+	state->sample_rate = config.sample_rate;
+	state->pid = getpid();
+	__atomic_store_n(&state->magic, FM95_STATE_MAGIC, __ATOMIC_RELEASE);
+	runtime->state_taken.audio_sequence = runtime->state_taken.composite_sequence = 0;
+	runtime->state_written[0] = runtime->state_written[1] = 0;
+	runtime->state_countdown[0] = runtime->state_countdown[1] = state_blocks(config);
+	runtime->state = state;
+}
 
-			float l = audio_stereo_input[2*i+0]*config.audio_preamp;
-			float r = audio_stereo_input[2*i+1]*config.audio_preamp;
-			
-			if(config.agc_max != 0.0) {
-				float agc_gain = process_agc(&runtime->agc, 0.5f * (fabsf(l) + fabsf(r)));
-				l *= agc_gain;
-				r *= agc_gain;
-			}
+// Once the chain stopped, so what it got to last is in the file too
+static void close_FM95_State(const FM95_Config config, FM95_Runtime* runtime) {
+	if(!runtime->state) return;
+	runtime->state_countdown[0] = runtime->state_countdown[1] = 0;
+	take_FM95_State(config, runtime, false);
+	take_FM95_State(config, runtime, true);
+	write_FM95_State(runtime);
+	munmap(runtime->state, sizeof(FM95_State));
+	runtime->state = NULL;
+}
 
-			if(config.lpf_cutoff != 0) {
-				iirfilt_rrrf_execute(runtime->lpf_l, l, &l);
-				iirfilt_rrrf_execute(runtime->lpf_r, r, &r);
-			}
-			
-			if(config.preemphasis != 0) {
-				l = apply_preemphasis(&runtime->preemp_l, l);
-				r = apply_preemphasis(&runtime->preemp_r, r);
-			}
+// Before any device is opened or thread started, so what they map is locked and the threads they start stay off the DSP's CPUs
+static void setup_FM95_Realtime(const RealtimeSettings* rt) {
+	int err;
+	if(rt->lock_memory && (err = realtime_lock_memory()) != 0) fprintf(stderr, "Warning! Cannot lock fm95 in memory: %s, it can be paged out.\n", strerror(err));
+	if(rt->isolate && (err = realtime_leave(rt)) != 0) fprintf(stderr, "Warning! Cannot keep the other threads off the DSP CPUs: %s\n", strerror(err));
+}
 
-			if (config.clipper_threshold != 0) {
-				l = hard_clip(l * config.audio_volume, config.clipper_threshold);
-				r = hard_clip(r * config.audio_volume, config.clipper_threshold);
-			}
+// For a thread running a chain, cpu -1 leaves it where it is, without the privileges it carries on as it was
+static void enter_FM95_Realtime(const RealtimeSettings* rt, int cpu, const char* what) {
+	if(rt->lock_memory) realtime_prefault_stack();
+	if(rt->policy == SCHED_OTHER && cpu < 0) return;
+	int err = realtime_set_thread(pthread_self(), rt->policy, rt->priority, cpu);
+	if(err == EPERM) fprintf(stderr, "Warning! No permission for real-time scheduling of the %s (needs CAP_SYS_NICE or an rtprio limit), carrying on without it.\n", what);
+	else if(err != 0) fprintf(stderr, "Warning! Cannot fully set up the %s for real-time: %s, carrying on as it is.\n", what, strerror(err));
+}
+
+// The VBAN receive threads only move packets into their ring, they go under the DSP
+static void set_FM95_IOPriority(const FM95_Config config, FM95_Runtime* runtime) {
+	if(config.realtime.policy == SCHED_OTHER) return;
+	FM95_InputDevice* devices[4] = {&runtime->input_device, NULL, NULL, NULL};
+	if(config.options.mpx_on) devices[1] = &runtime->mpx_device;
+	if(config.options.rds_on && !config.options.rds_encoder_on) devices[2] = &runtime->rds_device;
+	if(config.options.sca_on) devices[3] = &runtime->sca_device;
+	for(uint8_t i = 0; i < 4; i++) {
+		if(!devices[i] || !devices[i]->is_vban) continue;
+		int err = realtime_set_thread(devices[i]->vban.thread, config.realtime.policy, config.realtime.io_priority, -1);
+		if(err != 0) fprintf(stderr, "Warning! Cannot set up a VBAN receiver for real-time: %s, carrying on without it.\n", strerror(err));
+	}
+}
+
+// Hands a finished block to every sink, 0 or the error of the one that failed
+int write_FM95_Output(const FM95_Config config, FM95_Runtime* runtime, float* output) {
+	int pulse_error;
+	uint64_t write_start = monotonic_ns();
+	if(config.options.output_on && (pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(float) * BUFFER_SIZE))) {
+		fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
+		return pulse_error;
+	}
+	runtime->output_wait_ns = monotonic_ns() - write_start;
+	if(config.options.iq_on) {
+		modulate_iq_block(&runtime->iq_modulator, output, BUFFER_SIZE, runtime->iq_buffer);
+		write_start = monotonic_ns();
+		pulse_error = write_IQOutput(&runtime->iq_output, runtime->iq_buffer, BUFFER_SIZE * runtime->iq_modulator.factor);
+		runtime->output_wait_ns += monotonic_ns() - write_start;
+		if(pulse_error) {
+			fprintf(stderr, "Error writing to the IQ output: %s\n", pa_strerror(pulse_error));
+			return pulse_error;
+		}
+	}
+	if(config.options.distribution_on) send_MPXSender(&runtime->distribution, output, BUFFER_SIZE); // After the write, so the time it sees follows the output device's clock
+	return 0;
+}
+
+// One block between the audio stage and the composite stage
+typedef struct
+{
+	float audio[BUFFER_SIZE*2]; // Processed L and R, interleaved
+	float mpx[BUFFER_SIZE];
+	float rds[BUFFER_SIZE*4];
+	float sca[BUFFER_SIZE];
+	bool mpx_on;
+	bool rds_on;
+	bool sca_on;
+	bool end; // Nothing after this one, the audio stage stopped
+	uint64_t ready_ns; // When the reads were done
+	uint64_t wait_ns; // How long the reads had to wait for the inputs
+} FM95_Block;
+
+// Inputs stay off for the rest of the run once they failed
+typedef struct
+{
+	bool mpx_on;
+	bool rds_on;
+	bool sca_on;
+} FM95_InputState;
 
-			mpx = stereo_encode(&runtime->stencode, config.stereo, l, r);
+// Written by its own stage only, the report reads them with atomics
+typedef struct
+{
+	uint64_t busy_ns;
+	uint64_t max_ns;
+	uint64_t blocks;
+} FM95_StageTiming;
 
-			if(rds_on) {
-				float rds_level = config.volumes.rds;
-				for(uint8_t stream = 0; stream < config.rds_streams; stream++) {
-					uint8_t osc_stream = 12 + stream;
-					if(osc_stream >= 13) osc_stream++;
+// When each block of a chain has to be done by, one block after the last one, or one block after it came in when the chain had to wait for a device,
+// the time the writes blocked for is not counted
+typedef struct
+{
+	uint64_t period_ns;
+	uint64_t due_ns;
+	bool resync;
+	uint64_t blocks;
+	uint64_t missed;
+	int64_t least_slack_ns; // Closest a block came to its deadline since the last report, under 0 when one was late
+} FM95_Deadline;
+
+static void init_deadline(FM95_Deadline* deadline, uint32_t sample_rate) {
+	deadline->period_ns = (uint64_t)BUFFER_SIZE * 1000000000 / sample_rate;
+	deadline->due_ns = 0;
+	deadline->resync = false;
+	deadline->least_slack_ns = INT64_MAX;
+}
 
-					mpx += (runtime->rds_in[config.rds_streams * i + stream] * get_oscillator_cos_multiplier_ni(&runtime->osc, osc_stream)) * rds_level;
+// A block that came in at ready_ns, after waiting wait_ns for it, was just written
+static void account_deadline(FM95_Deadline* deadline, uint64_t ready_ns, uint64_t wait_ns, uint64_t output_wait_ns) {
+	uint64_t done_ns = monotonic_ns() - output_wait_ns;
+	// Waiting for a device means the chain is on time, the clock starts again from the block that came in
+	if(deadline->due_ns == 0 || deadline->resync || wait_ns > deadline->period_ns / 16) deadline->due_ns = ready_ns + deadline->period_ns;
+	else deadline->due_ns += deadline->period_ns;
+	deadline->resync = (output_wait_ns > deadline->period_ns / 16); // The output was full, it sets the pace
+
+	int64_t slack = (int64_t)deadline->due_ns - (int64_t)done_ns;
+	if(slack < 0) __atomic_store_n(&deadline->missed, deadline->missed + 1, __ATOMIC_RELAXED);
+	if(slack < __atomic_load_n(&deadline->least_slack_ns, __ATOMIC_RELAXED)) __atomic_store_n(&deadline->least_slack_ns, slack, __ATOMIC_RELAXED);
+	__atomic_store_n(&deadline->blocks, deadline->blocks + 1, __ATOMIC_RELEASE);
+}
 
-					rds_level *= config.volumes.rds_step; // Prepare level for the next stream
-				}
+// In ms, 0 if no block was done since the last time
+static double take_least_slack(FM95_Deadline* deadline) {
+	int64_t slack = __atomic_exchange_n(&deadline->least_slack_ns, INT64_MAX, __ATOMIC_RELAXED);
+	return (slack == INT64_MAX) ? 0.0 : slack * 1e-6;
+}
+
+typedef struct
+{
+	const FM95_Config* config;
+	FM95_Runtime* runtime;
+	FM95_Block* blocks;
+	BlockQueue queue;
+	bool composite_done;
+	FM95_StageTiming audio_timing, composite_timing;
+	uint64_t last_audio_busy, last_audio_blocks, last_composite_busy, last_composite_blocks;
+	uint32_t stats_countdown;
+	FM95_Deadline deadline; // Of the composite stage, the one that writes
+	uint64_t last_blocks, last_missed;
+} FM95_Pipeline;
+
+static void add_stage_time(FM95_StageTiming* timing, uint64_t ns) {
+	__atomic_store_n(&timing->busy_ns, timing->busy_ns + ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&timing->blocks, timing->blocks + 1, __ATOMIC_RELEASE);
+	if(ns > __atomic_load_n(&timing->max_ns, __ATOMIC_RELAXED)) __atomic_store_n(&timing->max_ns, ns, __ATOMIC_RELAXED);
+}
+
+static uint32_t stats_blocks(const FM95_Config* config) {
+	uint32_t blocks = (uint32_t)(config->stats * config->sample_rate / BUFFER_SIZE);
+	return blocks ? blocks : 1;
+}
+
+// Average and worst time each stage took per block since the last report, the waits for devices are not counted
+static void report_stage_timing(FM95_Pipeline* pipeline, bool pipelined) {
+	if(pipeline->config->stats == 0 || --pipeline->stats_countdown) return;
+	pipeline->stats_countdown = stats_blocks(pipeline->config);
+
+	uint64_t audio_blocks = __atomic_load_n(&pipeline->audio_timing.blocks, __ATOMIC_ACQUIRE);
+	uint64_t audio_busy = __atomic_load_n(&pipeline->audio_timing.busy_ns, __ATOMIC_RELAXED);
+	uint64_t composite_blocks = pipeline->composite_timing.blocks;
+	uint64_t composite_busy = pipeline->composite_timing.busy_ns;
+
+	double audio_ms = (audio_blocks > pipeline->last_audio_blocks) ? (audio_busy - pipeline->last_audio_busy) * 1e-6 / (audio_blocks - pipeline->last_audio_blocks) : 0.0;
+	double composite_ms = (composite_blocks > pipeline->last_composite_blocks) ? (composite_busy - pipeline->last_composite_busy) * 1e-6 / (composite_blocks - pipeline->last_composite_blocks) : 0.0;
+	uint64_t blocks = pipeline->deadline.blocks;
+	uint64_t missed = pipeline->deadline.missed;
+	printf("Stages: audio %.2f ms (max %.2f), composite %.2f ms (max %.2f), of a %.2f ms block, %s, %llu of %llu blocks late (least slack %.2f ms)\n",
+		audio_ms, __atomic_exchange_n(&pipeline->audio_timing.max_ns, 0, __ATOMIC_RELAXED) * 1e-6,
+		composite_ms, __atomic_exchange_n(&pipeline->composite_timing.max_ns, 0, __ATOMIC_RELAXED) * 1e-6,
+		BUFFER_SIZE * 1000.0 / pipeline->config->sample_rate,
+		pipelined ? "pipelined" : "one thread",
+		(unsigned long long)(missed - pipeline->last_missed), (unsigned long long)(blocks - pipeline->last_blocks),
+		take_least_slack(&pipeline->deadline));
+	pipeline->last_blocks = blocks;
+	pipeline->last_missed = missed;
+
+	pipeline->last_audio_blocks = audio_blocks;
+	pipeline->last_audio_busy = audio_busy;
+	pipeline->last_composite_blocks = composite_blocks;
+	pipeline->last_composite_busy = composite_busy;
+}
+
+// What the audio stage does with a block once it's read, the SCA carriers and the audio graph, in place
+static void process_audio_block(const FM95_Config config, FM95_Runtime* runtime, FM95_Block* block) {
+	if(block->sca_on) modulate_sca_block(&runtime->sca, runtime->sca_in, block->sca, config.volumes.sca, false); // Whole block at once, the carriers stay in their own loops
+
+	if(config.options.control_on) apply_FM95_Control(config, runtime, false);
+	if(runtime->fade_audio) {
+		float old_audio[BUFFER_SIZE*2];
+		crossfade_graph_plans(&runtime->reload.audio_graph, &runtime->audio_graph, block->audio, old_audio, BUFFER_SIZE);
+		runtime->fade_audio = false;
+		__atomic_store_n(&runtime->reload.audio_done, runtime->reload.audio_taken, __ATOMIC_RELEASE);
+	} else run_graph_plan(&runtime->audio_graph, block->audio, BUFFER_SIZE);
+	take_FM95_State(config, runtime, false);
+}
+
+// What the composite stage does, the stereo encoder and subcarriers, then the MPX graph, into output
+static void process_composite_block(const FM95_Config config, FM95_Runtime* runtime, const FM95_Block* block, float* output) {
+	if(config.options.rds_encoder_on) take_rds_command_file(runtime);
+	if(config.options.control_on) apply_FM95_Control(config, runtime, true);
+
+	// Nothing moves unless a level was just set, then it slides there over this block
+	const float audio_step = (runtime->audio_target - runtime->stencode.audio_volume) / BUFFER_SIZE;
+	const float pilot_step = (runtime->pilot_target - runtime->stencode.pilot_volume) / BUFFER_SIZE;
+	const float rds_step = (runtime->rds_target - runtime->rds_volume) / BUFFER_SIZE;
+	float rds_volume = runtime->rds_volume;
+
+	// The clipper has the audio on its own before the pilot and the subcarriers go in, it comes out delay samples late,
+	// so it's put on the carriers that far ahead of the ones the pilot is on
+	float audio[BUFFER_SIZE];
+	const bool clip = runtime->composite_clipper_ready;
+	if(clip) {
+		Oscillator ahead = runtime->osc;
+		for(uint32_t i = 0; i < runtime->composite_clipper.delay; i++) advance_oscillator(&ahead);
+		for(uint16_t i = 0; i < BUFFER_SIZE; i++) {
+			runtime->stencode.audio_volume += audio_step;
+			audio[i] = stereo_encode_audio(&runtime->stencode, &ahead, runtime->stereo, block->audio[2*i+0], block->audio[2*i+1]);
+			advance_oscillator(&ahead);
+		}
+		composite_clip(&runtime->composite_clipper, audio, BUFFER_SIZE);
+	}
+
+	for (uint16_t i = 0; i < BUFFER_SIZE; i++) {
+		float l = block->audio[2*i+0];
+		float r = block->audio[2*i+1];
+
+		runtime->stencode.pilot_volume += pilot_step;
+		rds_volume += rds_step;
+		float mpx;
+		if(clip) mpx = audio[i] + stereo_encode_pilot(&runtime->stencode, runtime->stereo);
+		else {
+			runtime->stencode.audio_volume += audio_step;
+			mpx = stereo_encode(&runtime->stencode, runtime->stereo, l, r);
+		}
+
+		if(config.options.rds_encoder_on) {
+			mpx += (get_rds_sample(&runtime->rds_encoder, runtime->osc.phase) * get_oscillator_cos_multiplier_ni(&runtime->osc, 12)) * rds_volume;
+		} else if(block->rds_on) {
+			float rds_level = rds_volume;
+			for(uint8_t stream = 0; stream < config.rds_streams; stream++) {
+				uint8_t osc_stream = 12 + stream;
+				if(osc_stream >= 13) osc_stream++;
+
+				mpx += (block->rds[config.rds_streams * i + stream] * get_oscillator_cos_multiplier_ni(&runtime->osc, osc_stream)) * rds_level;
+
+				rds_level *= config.volumes.rds_step; // Prepare level for the next stream
 			}
+		}
+
+		if(config.options.darc_on) {
+			float side = runtime->stereo ? fabsf(l - r) * 0.25f * config.volumes.audio : 0.0f; // What the 38k subcarrier carries, see stereo_encode
+			mpx += get_darc_sample(&runtime->darc_encoder, runtime->osc.phase, side);
+		}
+
+		if(block->sca_on) mpx += block->sca[i];
+		if(block->mpx_on) mpx += block->mpx[i];
+
+		output[i] = mpx;
+		advance_oscillator(&runtime->osc);
+	}
+	runtime->stencode.audio_volume = runtime->audio_target;
+	runtime->stencode.pilot_volume = runtime->pilot_target;
+	runtime->rds_volume = runtime->rds_target;
+	if(runtime->fade_mpx) {
+		float old_output[BUFFER_SIZE];
+		crossfade_graph_plans(&runtime->reload.mpx_graph, &runtime->mpx_graph, output, old_output, BUFFER_SIZE);
+		runtime->fade_mpx = false;
+		__atomic_store_n(&runtime->reload.composite_done, runtime->reload.composite_taken, __ATOMIC_RELEASE);
+	} else run_graph_plan(&runtime->mpx_graph, output, BUFFER_SIZE); // BS412, tilt and the output clipper by default
+	runtime->samples += BUFFER_SIZE;
+	take_FM95_State(config, runtime, true);
+}
+
+// Reads every input into the block, the SCA input into sca_in, nonzero if the main input failed
+static int read_FM95_Inputs(const FM95_Config config, FM95_Runtime* runtime, FM95_InputState* inputs, FM95_Block* block, float* sca_in) {
+	int pulse_error;
+
+	uint64_t read_start = monotonic_ns();
+	if((pulse_error = read_FM95_InputDevice(&runtime->input_device, block->audio, sizeof(block->audio)))) { // get output from the function and assign it into pulse_error, this comment to avoid confusion
+		fprintf(stderr, "Error reading from input device: %s\n", pa_strerror(pulse_error));
+		return pulse_error;
+	}
+	if(inputs->mpx_on) {
+		if((pulse_error = read_FM95_InputDevice(&runtime->mpx_device, block->mpx, sizeof(block->mpx)))) {
+			fprintf(stderr, "Error reading from MPX device: %s\nDisabling MPX.\n", pa_strerror(pulse_error));
+			inputs->mpx_on = 0;
+		}
+	}
+	if(inputs->rds_on && !config.options.rds_encoder_on) {
+		if((pulse_error = read_FM95_InputDevice(&runtime->rds_device, block->rds, sizeof(float) * BUFFER_SIZE * config.rds_streams))) {
+			fprintf(stderr, "Error reading from RDS95 device: %s\nDisabling RDS.\n", pa_strerror(pulse_error));
+			inputs->rds_on = 0;
+		}
+	}
+	if(inputs->sca_on) {
+		if((pulse_error = read_FM95_InputDevice(&runtime->sca_device, sca_in, sizeof(float) * runtime->sca.input_block * runtime->sca.channels))) {
+			fprintf(stderr, "Error reading from SCA device: %s\nDisabling SCA.\n", pa_strerror(pulse_error));
+			inputs->sca_on = 0;
+		}
+	}
+
+	uint64_t start = monotonic_ns();
+	block->ready_ns = start;
+	block->wait_ns = start - read_start;
+	block->mpx_on = inputs->mpx_on;
+	block->rds_on = inputs->rds_on;
+	block->sca_on = inputs->sca_on;
+	block->end = false;
+	return 0;
+}
+
+// Reads every input and does the audio processing, the AGC, filters, pre-emphasis and clipper, and the SCA carriers, nonzero if the main input failed
+int process_audio_stage(const FM95_Config config, FM95_Runtime* runtime, FM95_InputState* inputs, FM95_Block* block, FM95_StageTiming* timing) {
+	int pulse_error = read_FM95_Inputs(config, runtime, inputs, block, runtime->sca_in);
+	if(pulse_error) return pulse_error;
+
+	uint64_t start = block->ready_ns;
+	process_audio_block(config, runtime, block);
+	add_stage_time(timing, monotonic_ns() - start);
+	return 0;
+}
+
+// Stereo encoder and subcarriers, then the MPX graph and every sink, nonzero if the output failed
+int process_composite_stage(const FM95_Config config, FM95_Runtime* runtime, const FM95_Block* block, FM95_StageTiming* timing) {
+	float output[BUFFER_SIZE];
+
+	uint64_t start = monotonic_ns();
+	process_composite_block(config, runtime, block, output);
+	add_stage_time(timing, monotonic_ns() - start);
+
+	return write_FM95_Output(config, runtime, output);
+}
+
+static void* run_audio_stage(void* arg) {
+	FM95_Pipeline* pipeline = arg;
+	FM95_Config config = *pipeline->config; // Its own copy, a reload is swapped in here for this half
+	enter_FM95_Realtime(&config.realtime, realtime_cpu(&config.realtime, 1), "audio stage");
+	FM95_InputState inputs = {
+		.mpx_on = config.options.mpx_on,
+		.rds_on = config.options.rds_on,
+		.sca_on = config.options.sca_on
+	};
+
+	while(true) {
+		uint32_t slot = block_queue_reserve(&pipeline->queue);
+		if(__atomic_load_n(&pipeline->composite_done, __ATOMIC_ACQUIRE)) break; // Woken up to quit, the slot isn't real
+		FM95_Block* block = &pipeline->blocks[slot];
+		take_FM95_Reload(&config, pipeline->runtime, true, false);
+		if(!to_run || process_audio_stage(config, pipeline->runtime, &inputs, block, &pipeline->audio_timing) != 0) {
+			to_run = 0;
+			block->end = true;
+			block_queue_publish(&pipeline->queue);
+			break;
+		}
+		block_queue_publish(&pipeline->queue);
+	}
+	return NULL;
+}
+
+// The audio stage runs on its own thread, depth blocks ahead at most, so the two halves of the chain get a core each
+static int run_fm95_pipelined(FM95_Config config, FM95_Runtime* runtime, FM95_Pipeline* pipeline) {
+	pipeline->blocks = malloc(sizeof(FM95_Block) * config.pipeline_depth);
+	if(!pipeline->blocks || init_block_queue(&pipeline->queue, config.pipeline_depth) != 0) {
+		fprintf(stderr, "Error: cannot set up the pipeline, running on one thread.\n");
+		free(pipeline->blocks);
+		pipeline->blocks = NULL;
+		return -1;
+	}
+
+	pthread_t audio_thread;
+	if(pthread_create(&audio_thread, NULL, run_audio_stage, pipeline) != 0) {
+		fprintf(stderr, "Error: cannot start the audio stage, running on one thread.\n");
+		free_block_queue(&pipeline->queue);
+		free(pipeline->blocks);
+		pipeline->blocks = NULL;
+		return -1;
+	}
+
+	// Drains what the audio stage made before it stopped, so a reload loses nothing
+	while(true) {
+		uint64_t wait_start = monotonic_ns();
+		uint32_t slot = block_queue_take(&pipeline->queue);
+		uint64_t taken = monotonic_ns();
+		FM95_Block* block = &pipeline->blocks[slot];
+		if(block->end) break;
+		take_FM95_Reload(&config, runtime, false, true);
+		int err = process_composite_stage(config, runtime, block, &pipeline->composite_timing);
+		block_queue_release(&pipeline->queue);
+		if(err) {
+			to_run = 0;
+			__atomic_store_n(&pipeline->composite_done, true, __ATOMIC_RELEASE);
+			block_queue_unblock(&pipeline->queue);
+			break;
+		}
+		// The audio stage being behind is waiting for input here, it's timed on its own
+		account_deadline(&pipeline->deadline, taken, taken - wait_start, runtime->output_wait_ns);
+		report_stage_timing(pipeline, true);
+	}
 
-			mpx = bs412_compress(&runtime->bs412, mpx+mpx_in[i]);
-			if(config.tilt != 0) mpx = tilt(&runtime->tilter, mpx);
+	pthread_join(audio_thread, NULL);
+	free_block_queue(&pipeline->queue);
+	free(pipeline->blocks);
+	pipeline->blocks = NULL;
+	return 0;
+}
 
-			output[i] = hard_clip(mpx*config.master_volume, 1.0); // Ensure peak deviation of 75 khz (or the set deviation), assuming we're calibrated correctly
-			advance_oscillator(&runtime->osc);
+int run_fm95(FM95_Config config, FM95_Runtime* runtime) {
+	enter_FM95_Realtime(&config.realtime, realtime_cpu(&config.realtime, 0), "chain");
+	if(config.calibration != 0) {
+		float output[BUFFER_SIZE];
+		while(to_run) {
+			for (int i = 0; i < BUFFER_SIZE; i++) {
+				float sample = get_oscillator_sin_sample(&runtime->osc);
+				if(config.calibration == 2) sample = (sample > 0.0f) ? 1.0f : -1.0f; // Sine wave to square wave filter, 50% duty cycle
+				if(config.tilt != 0) sample = tilt(&runtime->tilter, sample);
+				output[i] = sample*config.master_volume;
+			}
+			if(write_FM95_Output(config, runtime, output)) {
+				to_run = 0;
+				break;
+			}
 		}
+		return 0;
+	}
+
+	FM95_Pipeline pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.config = &config;
+	pipeline.runtime = runtime;
+	pipeline.stats_countdown = stats_blocks(&config);
+	init_deadline(&pipeline.deadline, config.sample_rate);
+
+	if(config.pipeline && run_fm95_pipelined(config, runtime, &pipeline) == 0) return 0;
+
+	FM95_Block* block = malloc(sizeof(FM95_Block));
+	if(!block) {
+		fprintf(stderr, "Error: cannot allocate the block\n");
+		to_run = 0;
+		return 1;
+	}
+	FM95_InputState inputs = {
+		.mpx_on = config.options.mpx_on,
+		.rds_on = config.options.rds_on,
+		.sca_on = config.options.sca_on
+	};
 
-		if((pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(output)))) {
-			fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
+	while (to_run) {
+		take_FM95_Reload(&config, runtime, true, true);
+		if(process_audio_stage(config, runtime, &inputs, block, &pipeline.audio_timing) != 0 || process_composite_stage(config, runtime, block, &pipeline.composite_timing) != 0) {
 			to_run = 0;
 			break;
 		}
+		account_deadline(&pipeline.deadline, block->ready_ns, block->wait_ns, runtime->output_wait_ns);
+		report_stage_timing(&pipeline, false);
 	}
 
+	free(block);
 	return 0;
 }
 
 
-int parse_arguments(int argc, char **argv, FM95_Config* config) {
+int parse_arguments(int argc, char **argv, FM95_Config* config, FM95_Batch* batch) {
 	int opt;
-	const char	*short_opt = "c:h";
+	const char	*short_opt = "c:hb:j:m";
 	struct option	long_opt[] =
 	{
 		{"config",		required_argument,	NULL,	'c'},
 		{"help",        no_argument,       NULL, 'h'},
+		{"batch",       required_argument, NULL, 'b'},
+		{"jobs",        required_argument, NULL, 'j'},
+		{"mpx",         no_argument,       NULL, 'm'},
 		{0,             0,                 0,    0}
 	};
 
@@ -275,20 +1251,129 @@ int parse_arguments(int argc, char **argv, FM95_Config* config) {
 			case 'c':
 				memcpy(config->ini_config_path, optarg, 63);
 				break;
+			case 'b':
+				if(strlen(optarg) >= sizeof(batch->output_dir)) {
+					printf("The output directory can be up to %zu characters\n", sizeof(batch->output_dir) - 1);
+					return 1;
+				}
+				strcpy(batch->output_dir, optarg);
+				break;
+			case 'j': {
+				int jobs = atoi(optarg);
+				if(jobs < 1 || jobs > MAX_BATCH_JOBS) {
+					printf("Jobs go from 1 to %d\n", MAX_BATCH_JOBS);
+					return 1;
+				}
+				batch->jobs = jobs;
+				break;
+			}
+			case 'm':
+				batch->mpx = true;
+				break;
 			case 'h':
+			default:
 				show_help(argv[0]);
 				return 1;
 		}
 	}
 
-	return 0;
-}
+	batch->files = &argv[optind];
+	batch->num_files = argc - optind;
+	if(batch->output_dir[0] != '\0' && batch->num_files == 0) {
+		printf("Please give the files to render after the options\n");
+		return 1;
+	}
+	if(batch->output_dir[0] == '\0' && batch->num_files != 0) {
+		printf("Files are only taken with --batch\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int programme_handler(FM95_ProgrammeList* list, const char* section, const char* name, const char* value) {
+	if(strcmp(section, "pool") == 0) {
+		if(strcmp(name, "workers") == 0) {
+			int workers = atoi(value);
+			if(workers < 0 || workers > MAX_WORKERS) {
+				printf("The pool has 1 to %d workers, or 0 for one per programme\n", MAX_WORKERS);
+				return 0;
+			}
+			list->workers = workers;
+		} else if(strcmp(name, "cpus") == 0) {
+			char cpus[128];
+			strncpy(cpus, value, sizeof(cpus) - 1);
+			cpus[sizeof(cpus) - 1] = '\0';
+			list->num_cpus = 0;
+			for(char* cpu = strtok(cpus, ", "); cpu && list->num_cpus < MAX_WORKERS; cpu = strtok(NULL, ", ")) list->cpus[list->num_cpus++] = atoi(cpu);
+		} else if(strcmp(name, "stats") == 0) {
+			list->stats = strtof(value, NULL);
+		} else return 0;
+		return 1;
+	}
+
+	const char* programme_name = section + strlen("programme.");
+	uint8_t i;
+	for(i = 0; i < list->num_programmes; i++) {
+		if(strcmp(list->programmes[i].name, programme_name) == 0) break;
+	}
+	if(i == list->num_programmes) {
+		if(i == MAX_PROGRAMMES) {
+			printf("At most %d programmes\n", MAX_PROGRAMMES);
+			return 0;
+		}
+		memset(&list->programmes[i], 0, sizeof(FM95_ProgrammeEntry));
+		strncpy(list->programmes[i].name, programme_name, sizeof(list->programmes[i].name) - 1);
+		list->programmes[i].worker = -1;
+		list->num_programmes++;
+	}
+
+	FM95_ProgrammeEntry* programme = &list->programmes[i];
+	if(strcmp(name, "config") == 0) {
+		strncpy(programme->config_path, value, 63);
+		programme->config_path[63] = '\0';
+	} else if(strcmp(name, "worker") == 0) {
+		programme->worker = atoi(value);
+	} else return 0;
+	return 1;
+}
+
+// [node.NAME] sections, the type comes first and sets every setting to its default
+static int graph_node_handler(FM95_Config* config, const char* node_name, const char* name, const char* value) {
+	uint8_t i;
+	for(i = 0; i < config->graph_num_nodes; i++) {
+		if(strcmp(config->graph_nodes[i].name, node_name) == 0) break;
+	}
+	if(strcmp(name, "type") == 0) {
+		if(i == GRAPH_MAX_NODES) {
+			printf("At most %d graph nodes\n", GRAPH_MAX_NODES);
+			return 0;
+		}
+		if(strlen(node_name) >= GRAPH_NAME_LENGTH || !init_graph_node(&config->graph_nodes[i], node_name, value)) {
+			printf("Invalid graph node %s: %s\n", node_name, value);
+			return 0;
+		}
+		if(i == config->graph_num_nodes) config->graph_num_nodes++;
+		return 1;
+	}
+	if(i == config->graph_num_nodes) {
+		printf("Graph node %s needs its type first\n", node_name);
+		return 0;
+	}
+	return parse_graph_node(&config->graph_nodes[i], name, value);
+}
 
 static int config_handler(void* user, const char* section, const char* name, const char* value) {
     FM95_SetupContext* ctx = (FM95_SetupContext*)user;
     FM95_Config* pconfig = ctx->config;
     FM95_DeviceNames* dv = ctx->devices;
 
+    if(strncmp(section, "node.", strlen("node.")) == 0) return graph_node_handler(pconfig, section + strlen("node."), name, value);
+    if(strncmp(section, "programme.", strlen("programme.")) == 0 || strcmp(section, "pool") == 0) {
+        if(!ctx->programmes) return 0;
+        return programme_handler(ctx->programmes, section, name, value);
+    }
+
     #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
 
     if (MATCH("fm95", "stereo")) {
@@ -305,6 +1390,9 @@ static int config_handler(void* user, const char* section, const char* name, con
     } else if (MATCH("devices", "rds")) {
         strncpy(dv->rds, value, 63);
         dv->rds[63] = '\0';
+    } else if (MATCH("devices", "sca")) {
+        strncpy(dv->sca, value, 63);
+        dv->sca[63] = '\0';
     } else if (MATCH("fm95", "rds_streams")) {
         pconfig->rds_streams = atoi(value);
         if(pconfig->rds_streams > 4) {
@@ -313,6 +1401,8 @@ static int config_handler(void* user, const char* section, const char* name, con
         }
     } else if (MATCH("fm95", "clipper_threshold")) {
         pconfig->clipper_threshold = strtof(value, NULL);
+    } else if (MATCH("fm95", "composite_clipper")) {
+        pconfig->composite_clipper = strtof(value, NULL);
     } else if (MATCH("fm95", "preemphasis")) {
         pconfig->preemphasis = atoi(value);
     } else if (MATCH("fm95", "calibration")) {
@@ -354,19 +1444,139 @@ static int config_handler(void* user, const char* section, const char* name, con
 	} else if(MATCH("advanced", "sample_rate")) {
 		pconfig->sample_rate = atoi(value);
 	} else if(MATCH("advanced", "lpf_cutoff")) {
-		pconfig->lpf_cutoff = strtof(value, NULL);
-		if(pconfig->lpf_cutoff > (pconfig->sample_rate * 0.5)) {
-			pconfig->lpf_cutoff = (pconfig->sample_rate * 0.5);
-			fprintf(stderr, "LPF cutoff over niquist, limiting.\n");
-		}
+		pconfig->lpf_cutoff = strtof(value, NULL); // Held under Nyquist when the graph is built, the sample rate may come after this
 	} else if(MATCH("advanced", "headroom")) {
 		pconfig->volumes.headroom = strtof(value, NULL);
+	} else if(MATCH("advanced", "composite_oversample")) {
+		pconfig->composite_oversample = atoi(value);
 	} else if(MATCH("volumes", "pilot")) {
 		pconfig->volumes.pilot = strtof(value, NULL);
 	} else if(MATCH("volumes", "rds")) {
 		pconfig->volumes.rds = strtof(value, NULL);
 	} else if(MATCH("volumes", "rds_step")) {
 		pconfig->volumes.rds_step = strtof(value, NULL);
+	} else if(MATCH("volumes", "darc")) {
+		pconfig->volumes.darc = strtof(value, NULL);
+	} else if(MATCH("volumes", "darc_min")) {
+		pconfig->volumes.darc_min = strtof(value, NULL);
+	} else if(MATCH("volumes", "sca")) {
+		pconfig->volumes.sca = strtof(value, NULL);
+	} else if(MATCH("vban", "latency")) {
+		pconfig->vban_latency = strtof(value, NULL);
+	} else if(MATCH("vban", "interface")) {
+		strncpy(pconfig->vban_interface, value, 15);
+		pconfig->vban_interface[15] = '\0';
+	} else if(MATCH("distribution", "destination")) {
+		strncpy(pconfig->distribution_destination, value, 63);
+		pconfig->distribution_destination[63] = '\0';
+	} else if(MATCH("distribution", "interface")) {
+		strncpy(pconfig->distribution_interface, value, 15);
+		pconfig->distribution_interface[15] = '\0';
+	} else if(MATCH("distribution", "ttl")) {
+		pconfig->distribution_ttl = atoi(value);
+	} else if(MATCH("distribution", "clock_offset")) {
+		pconfig->distribution_clock_offset = strtof(value, NULL);
+	} else if(MATCH("rds", "encoder")) {
+		pconfig->rds_encoder = atoi(value);
+	} else if(MATCH("rds", "command_file")) {
+		strncpy(pconfig->rds_command_file, value, 127);
+		pconfig->rds_command_file[127] = '\0';
+	} else if(strcmp(section, "rds") == 0 && parse_rds_encoder_data(&pconfig->rds_data, name, value)) {
+		// PI, PS, RT and the rest, handled by the encoder
+	} else if(MATCH("darc", "encoder")) {
+		pconfig->darc = atoi(value);
+	} else if(MATCH("darc", "frame")) {
+		pconfig->darc_frame = (char)toupper((unsigned char)value[0]);
+		if(pconfig->darc_frame != 'A' && pconfig->darc_frame != 'C') {
+			printf("DARC frame has to be A or C\n");
+			return 0;
+		}
+	} else if(MATCH("darc", "source")) {
+		strncpy(pconfig->darc_source, value, 127);
+		pconfig->darc_source[127] = '\0';
+	} else if(MATCH("iq", "output")) {
+		strncpy(pconfig->iq_output, value, 127);
+		pconfig->iq_output[127] = '\0';
+	} else if(MATCH("iq", "format")) {
+		int format = parse_iq_format(value);
+		if(format < 0) {
+			printf("IQ format has to be cs8, cs16 or cf32\n");
+			return 0;
+		}
+		pconfig->iq_format = (uint8_t)format;
+	} else if(MATCH("iq", "rate")) {
+		pconfig->iq_rate = strtoul(value, NULL, 10);
+	} else if(MATCH("iq", "deviation")) {
+		pconfig->iq_deviation = strtof(value, NULL);
+	} else if(MATCH("iq", "offset")) {
+		pconfig->iq_offset = strtof(value, NULL);
+	} else if(MATCH("graph", "audio")) {
+		strncpy(pconfig->graph_audio, value, sizeof(pconfig->graph_audio) - 1);
+		pconfig->graph_audio[sizeof(pconfig->graph_audio) - 1] = '\0';
+	} else if(MATCH("graph", "mpx")) {
+		strncpy(pconfig->graph_mpx, value, sizeof(pconfig->graph_mpx) - 1);
+		pconfig->graph_mpx[sizeof(pconfig->graph_mpx) - 1] = '\0';
+	} else if(MATCH("realtime", "policy")) {
+		int policy = parse_realtime_policy(value);
+		if(policy < 0) {
+			printf("The real-time policy is other, fifo or rr\n");
+			return 0;
+		}
+		pconfig->realtime.policy = policy;
+	} else if((MATCH("realtime", "priority")) || (MATCH("realtime", "io_priority"))) {
+		int priority = atoi(value);
+		if(priority < 1 || priority > 99) {
+			printf("Real-time priorities go from 1 to 99\n");
+			return 0;
+		}
+		if(strcmp(name, "priority") == 0) pconfig->realtime.priority = priority;
+		else pconfig->realtime.io_priority = priority;
+	} else if(MATCH("realtime", "lock_memory")) {
+		pconfig->realtime.lock_memory = atoi(value);
+	} else if(MATCH("realtime", "cpus")) {
+		parse_realtime_cpus(&pconfig->realtime, value);
+	} else if(MATCH("realtime", "isolate")) {
+		pconfig->realtime.isolate = atoi(value);
+	} else if(MATCH("control", "socket")) {
+		strncpy(pconfig->control_socket, value, sizeof(pconfig->control_socket) - 1);
+	} else if(MATCH("state", "file")) {
+		strncpy(pconfig->state_file, value, sizeof(pconfig->state_file) - 1);
+	} else if(MATCH("state", "interval")) {
+		pconfig->state_interval = strtof(value, NULL);
+		if(pconfig->state_interval <= 0) {
+			printf("The state interval has to be over 0 seconds\n");
+			return 0;
+		}
+	} else if(MATCH("state", "max_age")) {
+		pconfig->state_max_age = strtof(value, NULL);
+	} else if(MATCH("pipeline", "enabled")) {
+		pconfig->pipeline = atoi(value);
+	} else if(MATCH("pipeline", "depth")) {
+		pconfig->pipeline_depth = atoi(value);
+		if(pconfig->pipeline_depth < 2 || pconfig->pipeline_depth > 8) {
+			printf("Pipeline depth has to be 2 to 8 blocks\n");
+			return 0;
+		}
+	} else if(MATCH("pipeline", "stats")) {
+		pconfig->stats = strtof(value, NULL);
+	} else if(MATCH("sca", "carrier")) {
+		if(pconfig->sca_num_carriers == SCA_MAX_CARRIERS) {
+			printf("At most %d SCA carriers\n", SCA_MAX_CARRIERS);
+			return 0;
+		}
+		if(parse_sca_carrier(value, &pconfig->sca_carriers[pconfig->sca_num_carriers], pconfig->sca_num_carriers) != 0) {
+			printf("Invalid SCA carrier: %s\n", value);
+			return 0;
+		}
+		pconfig->sca_num_carriers++;
+	} else if(MATCH("sca", "input_rate")) {
+		pconfig->sca_input_rate = strtoul(value, NULL, 10);
+	} else if(MATCH("sca", "audio_volume")) {
+		pconfig->sca_audio_volume = strtof(value, NULL);
+	} else if(MATCH("sca", "lpf_cutoff")) {
+		pconfig->sca_lpf_cutoff = strtof(value, NULL);
+	} else if(MATCH("sca", "preemphasis")) {
+		pconfig->sca_preemphasis = atoi(value);
 	} else {
         return 0; // Unknown section/name
     }
@@ -374,11 +1584,14 @@ static int config_handler(void* user, const char* section, const char* name, con
     return 1;
 }
 
-int parse_config(FM95_Config* config, FM95_DeviceNames* dv) {
+int parse_config(FM95_Config* config, FM95_DeviceNames* dv, FM95_ProgrammeList* programmes) {
 	FM95_SetupContext ctx = {
 		.config = config,
-		.devices = dv
+		.devices = dv,
+		.programmes = programmes
 	};
+	config->sca_num_carriers = 0; // They're added one by one, a reload starts over
+	config->graph_num_nodes = 0;
 	return ini_parse(config->ini_config_path, &config_handler, &ctx);
 }
 
@@ -396,7 +1609,7 @@ int setup_audio(FM95_Runtime* runtime, const FM95_DeviceNames dv_names, const FM
 	int opentime_pulse_error;
 
 	printf("Connecting to input device... (%s)\n", dv_names.input);
-	opentime_pulse_error = init_PulseInputDevice(&runtime->input_device, config.sample_rate, 2, "fm95", "Main Audio Input", dv_names.input, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
+	opentime_pulse_error = init_FM95_InputDevice(&runtime->input_device, config, config.sample_rate, 2, "Main Audio Input", dv_names.input, &input_buffer_atr);
 	if (opentime_pulse_error) {
 		fprintf(stderr, "Error: cannot open input device: %s\n", pa_strerror(opentime_pulse_error));
 		return 1;
@@ -405,83 +1618,1154 @@ int setup_audio(FM95_Runtime* runtime, const FM95_DeviceNames dv_names, const FM
 	if(config.options.mpx_on) {
 		printf("Connecting to MPX device... (%s)\n", dv_names.mpx);
 
-		opentime_pulse_error = init_PulseInputDevice(&runtime->mpx_device, config.sample_rate, 1, "fm95", "MPX Input", dv_names.mpx, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
+		opentime_pulse_error = init_FM95_InputDevice(&runtime->mpx_device, config, config.sample_rate, 1, "MPX Input", dv_names.mpx, &input_buffer_atr);
 		if (opentime_pulse_error) {
 			fprintf(stderr, "Error: cannot open MPX device: %s\n", pa_strerror(opentime_pulse_error));
-			free_PulseDevice(&runtime->input_device);
+			free_FM95_InputDevice(&runtime->input_device);
 			return 1;
 		}
 	}
-	if(config.options.rds_on) {
+	if(config.options.rds_on && !config.options.rds_encoder_on) {
 		printf("Connecting to RDS95 device... (%s)\n", dv_names.rds);
 
-		opentime_pulse_error = init_PulseInputDevice(&runtime->rds_device, config.sample_rate, config.rds_streams, "fm95", "RDS95 Input", dv_names.rds, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
+		opentime_pulse_error = init_FM95_InputDevice(&runtime->rds_device, config, config.sample_rate, config.rds_streams, "RDS95 Input", dv_names.rds, &input_buffer_atr);
 		if (opentime_pulse_error) {
 			fprintf(stderr, "Error: cannot open RDS device: %s\n", pa_strerror(opentime_pulse_error));
-			free_PulseDevice(&runtime->input_device);
-			if(config.options.mpx_on) free_PulseDevice(&runtime->mpx_device);
+			free_FM95_InputDevice(&runtime->input_device);
+			if(config.options.mpx_on) free_FM95_InputDevice(&runtime->mpx_device);
 			return 1;
 		}
-		runtime->rds_in = malloc(sizeof(float) * BUFFER_SIZE * config.rds_streams);
 	}
 
-	printf("Connecting to output device... (%s)\n", dv_names.output);
+	if(config.options.sca_on) {
+		printf("Connecting to SCA device... (%s)\n", dv_names.sca);
 
-	opentime_pulse_error = init_PulseOutputDevice(&runtime->output_device, config.sample_rate, 1, "fm95", "Main Audio Output", dv_names.output, &output_buffer_atr, PA_SAMPLE_FLOAT32NE);
-	if (opentime_pulse_error) {
-		fprintf(stderr, "Error: cannot open output device: %s\n", pa_strerror(opentime_pulse_error));
-		free_PulseDevice(&runtime->input_device);
-		if(config.options.mpx_on) free_PulseDevice(&runtime->mpx_device);
-		if(config.options.rds_on) free_PulseDevice(&runtime->rds_device);
-		return 1;
+		opentime_pulse_error = init_sca_modulator(&runtime->sca, config.sca_carriers, config.sca_num_carriers, config.sca_audio_volume, config.sca_lpf_cutoff, config.sca_preemphasis, config.sca_input_rate, config.sample_rate, BUFFER_SIZE) ? PA_ERR_INTERNAL : 0;
+		if(!opentime_pulse_error) {
+			runtime->sca_in = malloc(sizeof(float) * runtime->sca.input_block * runtime->sca.channels);
+			opentime_pulse_error = init_FM95_InputDevice(&runtime->sca_device, config, config.sca_input_rate, runtime->sca.channels, "SCA Input", dv_names.sca, &input_buffer_atr);
+		}
+		if (opentime_pulse_error) {
+			fprintf(stderr, "Error: cannot open SCA device: %s\n", pa_strerror(opentime_pulse_error));
+			free_sca_modulator(&runtime->sca);
+			free(runtime->sca_in);
+			free_FM95_InputDevice(&runtime->input_device);
+			if(config.options.mpx_on) free_FM95_InputDevice(&runtime->mpx_device);
+			if(config.options.rds_on && !config.options.rds_encoder_on) free_FM95_InputDevice(&runtime->rds_device);
+			return 1;
+		}
+	}
+
+	if(config.options.output_on) {
+		printf("Connecting to output device... (%s)\n", dv_names.output);
+
+		opentime_pulse_error = init_PulseOutputDevice(&runtime->output_device, config.sample_rate, 1, "fm95", "Main Audio Output", dv_names.output, &output_buffer_atr, PA_SAMPLE_FLOAT32NE);
+		if (opentime_pulse_error) {
+			fprintf(stderr, "Error: cannot open output device: %s\n", pa_strerror(opentime_pulse_error));
+			free_FM95_InputDevice(&runtime->input_device);
+			if(config.options.mpx_on) free_FM95_InputDevice(&runtime->mpx_device);
+			if(config.options.rds_on && !config.options.rds_encoder_on) free_FM95_InputDevice(&runtime->rds_device);
+			if(config.options.sca_on) free_FM95_SCA(runtime);
+			return 1;
+		}
+	}
+
+	if(config.options.distribution_on) {
+		printf("Distributing the MPX to %s\n", config.distribution_destination);
+		opentime_pulse_error = init_MPXSender(&runtime->distribution, config.distribution_destination, config.distribution_interface, config.distribution_ttl, config.sample_rate, config.distribution_clock_offset);
+		if (opentime_pulse_error) {
+			fprintf(stderr, "Error: cannot start MPX distribution: %s\n", pa_strerror(opentime_pulse_error));
+			free_FM95_InputDevice(&runtime->input_device);
+			if(config.options.mpx_on) free_FM95_InputDevice(&runtime->mpx_device);
+			if(config.options.rds_on && !config.options.rds_encoder_on) free_FM95_InputDevice(&runtime->rds_device);
+			if(config.options.sca_on) free_FM95_SCA(runtime);
+			if(config.options.output_on) free_PulseDevice(&runtime->output_device);
+			return 1;
+		}
+	}
+
+	if(config.options.iq_on) {
+		printf("Writing IQ at %u S/s to %s\n", config.iq_rate, config.iq_output);
+		opentime_pulse_error = init_iq_modulator(&runtime->iq_modulator, config.sample_rate, config.iq_rate, config.iq_deviation, config.iq_offset, BUFFER_SIZE);
+		if (!opentime_pulse_error) {
+			runtime->iq_buffer = malloc(sizeof(float) * 2 * BUFFER_SIZE * runtime->iq_modulator.factor);
+			opentime_pulse_error = runtime->iq_buffer ? init_IQOutput(&runtime->iq_output, config.iq_output, (IQFormat)config.iq_format) : PA_ERR_INTERNAL;
+		} else opentime_pulse_error = PA_ERR_INVALID;
+		if (opentime_pulse_error) {
+			fprintf(stderr, "Error: cannot start the IQ output: %s\n", pa_strerror(opentime_pulse_error));
+			free_iq_modulator(&runtime->iq_modulator);
+			free(runtime->iq_buffer);
+			free_FM95_InputDevice(&runtime->input_device);
+			if(config.options.mpx_on) free_FM95_InputDevice(&runtime->mpx_device);
+			if(config.options.rds_on && !config.options.rds_encoder_on) free_FM95_InputDevice(&runtime->rds_device);
+			if(config.options.sca_on) free_FM95_SCA(runtime);
+			if(config.options.output_on) free_PulseDevice(&runtime->output_device);
+			if(config.options.distribution_on) free_MPXSender(&runtime->distribution);
+			return 1;
+		}
+	}
+
+	if(config.options.control_on) {
+		printf("Listening for control commands on %s\n", config.control_socket);
+		pthread_mutex_init(&runtime->control.lock, NULL);
+		if(init_ControlSocket(&runtime->control.socket, config.control_socket, handle_FM95_Control, &runtime->control) != 0) {
+			fprintf(stderr, "Error: cannot open the control socket\n");
+			pthread_mutex_destroy(&runtime->control.lock);
+			FM95_Options options = config.options;
+			options.control_on = false; // Everything else that was opened
+			cleanup_audio_runtime(runtime, options);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// A built-in stage, set up from the usual keys, so the default graphs are the chain fm95 always had
+static bool builtin_FM95_GraphNode(const FM95_Config* config, bool mpx, const char* name, GraphNode* node) {
+	if(!mpx && strcmp(name, "preamp") == 0) {
+		init_graph_node(node, name, "gain");
+		node->gain = config->audio_preamp;
+	} else if(!mpx && strcmp(name, "agc") == 0) {
+		init_graph_node(node, name, "agc");
+		node->target = config->agc_target;
+		node->min = config->agc_min;
+		node->max = config->agc_max;
+		node->attack = config->agc_attack;
+		node->release = config->agc_release;
+	} else if(!mpx && strcmp(name, "lpf") == 0) {
+		init_graph_node(node, name, "lpf");
+		node->cutoff = config->lpf_cutoff;
+		node->order = config->lpf_order;
+	} else if(!mpx && strcmp(name, "preemphasis") == 0) {
+		init_graph_node(node, name, "preemphasis");
+		node->tau = config->preemphasis;
+		node->unity = config->preemp_unity_freq;
+	} else if(!mpx && strcmp(name, "volume") == 0) {
+		init_graph_node(node, name, "gain");
+		node->gain = (config->clipper_threshold != 0) ? config->audio_volume : 1.0f; // The audio volume has only ever gone in along with the clipper
+	} else if(!mpx && strcmp(name, "clip") == 0) {
+		init_graph_node(node, name, "clip");
+		node->threshold = config->clipper_threshold;
+	} else if(mpx && strcmp(name, "bs412") == 0) {
+		init_graph_node(node, name, "bs412");
+		node->deviation = config->mpx_deviation;
+		node->power = config->mpx_power;
+		node->attack = config->bs412_attack;
+		node->release = config->bs412_release;
+		node->max = config->bs412_max;
+	} else if(mpx && strcmp(name, "tilt") == 0) {
+		init_graph_node(node, name, "tilt");
+		node->strength = config->tilt;
+	} else if(mpx && strcmp(name, "master") == 0) {
+		init_graph_node(node, name, "gain");
+		node->gain = config->master_volume;
+	} else if(mpx && strcmp(name, "clip") == 0) {
+		init_graph_node(node, name, "clip");
+		node->threshold = 1.0f; // Ensure peak deviation of 75 khz (or the set deviation), assuming we're calibrated correctly
+	} else return false;
+	return true;
+}
+
+// Turns the [graph] audio or mpx list into nodes, each name is a [node.NAME] section or a built-in stage, nonzero if one can't be used
+int resolve_FM95_Graph(const FM95_Config* config, bool mpx, GraphNode* nodes, uint8_t* count) {
+	char list[128];
+	memcpy(list, mpx ? config->graph_mpx : config->graph_audio, sizeof(list));
+	*count = 0;
+
+	char* saveptr;
+	for(char* name = strtok_r(list, ", ", &saveptr); name; name = strtok_r(NULL, ", ", &saveptr)) {
+		if(*count == GRAPH_MAX_NODES) {
+			printf("At most %d stages in a graph\n", GRAPH_MAX_NODES);
+			return 1;
+		}
+		GraphNode* node = &nodes[*count];
+		bool found = false;
+		for(uint8_t i = 0; i < config->graph_num_nodes && !found; i++) {
+			if(strcmp(config->graph_nodes[i].name, name) != 0) continue;
+			*node = config->graph_nodes[i];
+			found = true;
+		}
+		if(!found && !builtin_FM95_GraphNode(config, mpx, name, node)) {
+			printf("Unknown stage in the %s graph: %s\n", mpx ? "MPX" : "audio", name);
+			return 1;
+		}
+		const char* problem = check_graph_node(node, mpx ? 1 : 2);
+		if(problem) {
+			printf("Stage %s can't go in the %s graph, %s\n", name, mpx ? "MPX" : "audio", problem);
+			return 1;
+		}
+		(*count)++;
+	}
+
+	// Then the nodes that say where they go, in the order of the config, before the first AGC, after the last clipper or before the last one of the MPX
+	GraphInsertPoint points[2] = { mpx ? GRAPH_AT_COMPOSITE : GRAPH_AT_PRE_AGC, mpx ? GRAPH_AT_NONE : GRAPH_AT_POST_CLIP };
+	for(uint8_t p = 0; p < 2; p++) {
+		if(points[p] == GRAPH_AT_NONE) continue;
+		int8_t position = (points[p] == GRAPH_AT_PRE_AGC) ? 0 : *count;
+		for(int8_t n = *count - 1; n >= 0; n--) {
+			if(points[p] == GRAPH_AT_PRE_AGC && nodes[n].type == GRAPH_NODE_AGC) position = n;
+			if(points[p] != GRAPH_AT_PRE_AGC && nodes[n].type == GRAPH_NODE_CLIP && position == *count) position = (points[p] == GRAPH_AT_POST_CLIP) ? n + 1 : n;
+		}
+
+		for(uint8_t i = 0; i < config->graph_num_nodes; i++) {
+			const GraphNode* node = &config->graph_nodes[i];
+			if(node->at != points[p]) continue;
+			bool listed = false;
+			for(uint8_t n = 0; n < *count; n++) listed |= (strcmp(nodes[n].name, node->name) == 0);
+			if(listed) continue;
+			if(*count == GRAPH_MAX_NODES) {
+				printf("At most %d stages in a graph\n", GRAPH_MAX_NODES);
+				return 1;
+			}
+			const char* problem = check_graph_node(node, mpx ? 1 : 2);
+			if(problem) {
+				printf("Stage %s can't go in the %s graph, %s\n", node->name, mpx ? "MPX" : "audio", problem);
+				return 1;
+			}
+			memmove(&nodes[position + 1], &nodes[position], sizeof(GraphNode) * (*count - position));
+			nodes[position++] = *node;
+			(*count)++;
+		}
 	}
 	return 0;
 }
 
-void init_runtime(FM95_Runtime* runtime, const FM95_Config config) {
+// Nonzero if a graph can't be set up, like when a plugin doesn't load
+int init_runtime(FM95_Runtime* runtime, const FM95_Config config) {
 	if(config.tilt != 0) tilt_init(&runtime->tilter, config.tilt, config.sample_rate);
+	if(config.options.iq_on) set_iq_modulator_deviation(&runtime->iq_modulator, config.iq_rate, config.iq_deviation, config.iq_offset);
 	
 	if(config.calibration != 0) {
 		init_oscillator(&runtime->osc, (config.calibration == 2) ? 60 : 400, config.sample_rate);
-		return;
+		init_oscillator_table(&runtime->osc, (config.calibration == 2) ? 60 : 400);
+		if(config.options.distribution_on) sync_oscillator_phase(&runtime->osc, (config.calibration == 2) ? 60 : 400, runtime->distribution.sample_index + runtime->distribution.pending_count);
+		return 0;
 	}
-	else init_oscillator(&runtime->osc, 4750, config.sample_rate);
-
-	if(config.lpf_cutoff != 0) {
-		runtime->lpf_l = iirfilt_rrrf_create_prototype(LIQUID_IIRDES_CHEBY2, LIQUID_IIRDES_LOWPASS, LIQUID_IIRDES_SOS, config.lpf_order, (config.lpf_cutoff/config.sample_rate), 0.0f, 1.0f, 60.0f);
-		runtime->lpf_r = iirfilt_rrrf_create_prototype(LIQUID_IIRDES_CHEBY2, LIQUID_IIRDES_LOWPASS, LIQUID_IIRDES_SOS, config.lpf_order, (config.lpf_cutoff/config.sample_rate), 0.0f, 1.0f, 60.0f);
+	init_oscillator(&runtime->osc, 4750, config.sample_rate);
+	runtime->samples = 0;
+	// The pilot and every subcarrier are harmonics of 4750 hz, one period of all of them is 768 samples at 192 khz
+	if(!init_oscillator_table(&runtime->osc, 4750)) printf("Warning! 4750 hz has no short period at %u hz, the carriers are worked out sample by sample.\n", config.sample_rate);
+	// Every SFN site and a backup generator then agree on the pilot phase, and it carries on over reloads
+	if(config.options.distribution_on) sync_oscillator_phase(&runtime->osc, 4750, runtime->distribution.sample_index + runtime->distribution.pending_count);
+
+	// What the AGC and BS412 measured carries on over a reload, the filters start again
+	GraphNode nodes[GRAPH_MAX_NODES];
+	uint8_t num_nodes;
+	if(resolve_FM95_Graph(&config, false, nodes, &num_nodes) != 0 || init_graph_plan(&runtime->audio_graph, nodes, num_nodes, 2, config.sample_rate, BUFFER_SIZE, &runtime->audio_graph) != 0 ||
+	   resolve_FM95_Graph(&config, true, nodes, &num_nodes) != 0 || init_graph_plan(&runtime->mpx_graph, nodes, num_nodes, 1, config.sample_rate, BUFFER_SIZE, &runtime->mpx_graph) != 0) {
+		fprintf(stderr, "Error: cannot set up the processing graphs\n");
+		return 1;
 	}
 
-	if(config.preemphasis != 0) {
-		init_preemphasis(&runtime->preemp_l, (float)config.preemphasis * 1.0e-6f, config.sample_rate, config.preemp_unity_freq);
-		init_preemphasis(&runtime->preemp_r, (float)config.preemphasis * 1.0e-6f, config.sample_rate, config.preemp_unity_freq);
+	if(config.options.composite_clipper_on) {
+		if(init_composite_clipper(&runtime->composite_clipper, config.composite_clipper * config.volumes.audio, config.composite_oversample, config.sample_rate, BUFFER_SIZE) != 0) {
+			fprintf(stderr, "Error: cannot set up the composite clipper\n");
+			return 1;
+		}
+		runtime->composite_clipper_ready = true;
 	}
 
-	float last_gain = 0.0f;
-	if(runtime->bs412.sample_rate == config.sample_rate) last_gain = runtime->bs412.gain;
-	init_bs412(&runtime->bs412, config.mpx_deviation, config.mpx_power, config.bs412_attack, config.bs412_release, config.bs412_max, config.sample_rate);
-	runtime->bs412.gain = last_gain;
+	// Both are kept over a restart of the runtime like a reload keeps them, a reload hands them their new data from the reload thread
+	if(config.options.rds_encoder_on) {
+		RDSEncoderData data;
+		load_FM95_RDSData(config, runtime, &data);
+		if(runtime->rds_encoder_ready) set_rds_encoder_data(&runtime->rds_encoder, &data);
+		else init_rds_encoder(&runtime->rds_encoder, &data);
+		runtime->rds_encoder_ready = true;
+	}
+	if(config.options.darc_on && !runtime->darc_encoder_ready) {
+		if(init_darc_encoder(&runtime->darc_encoder, (config.darc_frame == 'C') ? DARC_FRAME_C : DARC_FRAME_A, config.volumes.darc_min, config.volumes.darc, config.sample_rate) != 0) {
+			fprintf(stderr, "Error: cannot start the DARC source reader\n");
+			return 1;
+		}
+		runtime->darc_encoder_ready = true;
+		runtime->darc_source[0] = '\0'; // What the reader starts with
+	}
+	open_FM95_DARCSource(config, runtime);
 
 	init_stereo_encoder(&runtime->stencode, 4.0f, &runtime->osc, config.volumes.audio, config.volumes.pilot);
+	runtime->rds_volume = config.volumes.rds;
+	if(config.options.control_on) {
+		pthread_mutex_lock(&runtime->control.lock);
+		store_FM95_Control(config, runtime, &runtime->audio_graph, &runtime->mpx_graph);
+		reset_FM95_Control(runtime, false);
+		setup_FM95_Composite(config, runtime);
+		pthread_mutex_unlock(&runtime->control.lock);
+	} else setup_FM95_Composite(config, runtime);
+	return 0;
+}
 
-	if(config.agc_max != 0.0) {
-		last_gain = 1.0f;
-		if(runtime->agc.sampleRate == config.sample_rate) last_gain = runtime->agc.currentGain;
-		initAGC(&runtime->agc, config.sample_rate, config.agc_target, config.agc_min, config.agc_max, config.agc_attack, config.agc_release);
-		runtime->agc.currentGain = last_gain;
+// Checks the config and works out what's on from it and the device names, nonzero if it can't run
+int prepare_config(FM95_Config* config, const FM95_DeviceNames* dv_names) {
+	if(strlen(dv_names->input) == 0) {
+		printf("Please set the input device");
+		return 1;
+	}
+	config->options.iq_on = (strlen(config->iq_output) != 0);
+	config->options.output_on = (strlen(dv_names->output) != 0);
+	if(!config->options.output_on && !config->options.iq_on) {
+		printf("Please set the output device");
+		return 1;
+	}
+	if(config->options.iq_on && (config->iq_rate < config->sample_rate || config->iq_rate % config->sample_rate != 0)) {
+		printf("The IQ rate has to be a whole multiple of the sample rate (%u)\n", config->sample_rate);
+		return 1;
+	}
+	if(config->options.iq_on && !check_iq_deviation(config->iq_deviation, config->iq_rate)) {
+		printf("An IQ deviation of %.1f Hz does not fit an IQ rate of %u, it can be up to %.0f Hz\n", config->iq_deviation, config->iq_rate, IQ_MAX_STEP / IQ_MPX_CLIP * config->iq_rate);
+		return 1;
 	}
 
-	if(config.options.rds_on) memset(runtime->rds_in, 0, sizeof(float) * BUFFER_SIZE * config.rds_streams);
+	config->master_volume *= config->audio_deviation/75000.0f;
+
+	config->options.rds_encoder_on = (config->rds_encoder != 0 && config->calibration == 0);
+	if(config->options.rds_encoder_on) {
+		if(strlen(dv_names->rds) != 0) printf("Warning! The built-in RDS encoder is on, the RDS device is not used.\n");
+		config->rds_streams = 1;
+	}
+
+	config->options.darc_on = (config->darc != 0 && config->calibration == 0);
+	if(config->options.darc_on && config->sample_rate < 192000) {
+		printf("Warning! DARC reaches up to 94 khz, it needs a sample rate of at least 192 khz, disabling DARC.\n");
+		config->options.darc_on = false;
+	}
+
+	config->options.composite_clipper_on = (config->composite_clipper != 0 && config->calibration == 0);
+	if(config->options.composite_clipper_on && config->composite_oversample != 2 && config->composite_oversample != 4) {
+		printf("The composite clipper oversamples 2 or 4 times\n");
+		return 1;
+	}
+	if(config->options.composite_clipper_on && config->sample_rate < 2 * COMPOSITE_CLIPPER_CUTOFF + 10000) {
+		printf("Warning! The composite clipper keeps what's under 53 khz, it needs a sample rate of at least 110 khz, disabling the composite clipper.\n");
+		config->options.composite_clipper_on = false;
+	}
+
+	config->options.sca_on = (strlen(dv_names->sca) != 0 && config->calibration == 0);
+	if(config->options.sca_on) {
+		if(config->sca_num_carriers == 0) parse_sca_carrier("67000", &config->sca_carriers[config->sca_num_carriers++], 0);
+		if(config->sca_input_rate < 8000 || config->sca_input_rate > config->sample_rate || config->sample_rate % config->sca_input_rate != 0 || BUFFER_SIZE % (config->sample_rate / config->sca_input_rate) != 0) {
+			// The upsampler takes a whole number of input samples per block, so the factor has to divide the block too
+			printf("The SCA input rate has to be one of");
+			for(uint32_t factor = 1; config->sample_rate / factor >= 8000; factor++) {
+				if(config->sample_rate % factor == 0 && BUFFER_SIZE % factor == 0) printf(" %u", config->sample_rate / factor);
+			}
+			printf(" at a sample rate of %u\n", config->sample_rate);
+			return 1;
+		}
+		if(config->sca_lpf_cutoff >= config->sca_input_rate * 0.5f) {
+			config->sca_lpf_cutoff = config->sca_input_rate * 0.45f;
+			fprintf(stderr, "SCA LPF cutoff over niquist, limiting to %.0f.\n", config->sca_lpf_cutoff);
+		}
+		for(uint8_t c = 0; c < config->sca_num_carriers; c++) {
+			if(!check_fm_block_deviation(config->sca_carriers[c].deviation, config->sca_carriers[c].clipper, config->sample_rate)) {
+				printf("SCA carrier %d: a deviation of %.1f Hz with a clip of %.2f does not fit a sample rate of %u\n", c + 1, config->sca_carriers[c].deviation, config->sca_carriers[c].clipper, config->sample_rate);
+				return 1;
+			}
+			printf("SCA carrier %d: %.1f Hz, %.1f Hz deviation, level %.3f, from channel %d\n", c + 1, config->sca_carriers[c].freq, config->sca_carriers[c].deviation, config->sca_carriers[c].volume * config->volumes.sca, config->sca_carriers[c].channel + 1);
+		}
+	}
+
+	config->volumes.audio = calculate_sharedaudio_volume(config->volumes, config->rds_streams, config->options.darc_on, calculate_sca_volume(config));
+
+	config->options.mpx_on = (strlen(dv_names->mpx) != 0);
+	config->options.rds_on = config->options.rds_encoder_on || (strlen(dv_names->rds) != 0 && config->rds_streams != 0);
+	if(config->options.darc_on && config->options.rds_on && config->rds_streams == 4) printf("Warning! The 4th RDS stream is on 76 khz too, it will collide with DARC.\n");
+	config->options.distribution_on = (strlen(config->distribution_destination) != 0);
+	config->options.control_on = (strlen(config->control_socket) != 0 && config->calibration == 0);
+	config->options.state_on = (strlen(config->state_file) != 0 && config->calibration == 0);
+
+	GraphNode nodes[GRAPH_MAX_NODES];
+	uint8_t num_nodes;
+	if(resolve_FM95_Graph(config, false, nodes, &num_nodes) != 0 || resolve_FM95_Graph(config, true, nodes, &num_nodes) != 0) return 1;
+	return 0;
+}
+
+// Reads the config again for a SIGHUP, keeping what can only change with a restart
+int reload_config(FM95_Config* config, FM95_DeviceNames* dv_names, FM95_DeviceNames* old_dv_names) {
+	int err;
+	uint8_t old_streams = config->rds_streams; // keep the rds streams
+	char old_destination[64];
+	memcpy(old_destination, config->distribution_destination, sizeof(old_destination));
+	char old_iq_output[128];
+	memcpy(old_iq_output, config->iq_output, sizeof(old_iq_output));
+	uint32_t old_iq_rate = config->iq_rate;
+	uint8_t old_iq_format = config->iq_format;
+	char old_control_socket[108];
+	memcpy(old_control_socket, config->control_socket, sizeof(old_control_socket));
+	char old_state_file[128];
+	memcpy(old_state_file, config->state_file, sizeof(old_state_file));
+	uint32_t old_sample_rate = config->sample_rate;
+	float old_composite_clipper = config->composite_clipper;
+	uint8_t old_composite_oversample = config->composite_oversample;
+	uint8_t old_rds_encoder = config->rds_encoder;
+	uint8_t old_darc = config->darc;
+	char old_darc_frame = config->darc_frame;
+	uint8_t old_pipeline = config->pipeline;
+	uint8_t old_pipeline_depth = config->pipeline_depth;
+	RealtimeSettings old_realtime = config->realtime;
+	FM95_Config old_sca = *config; // Only the carriers and their audio settings are looked at
+	config->master_volume = DEFAULT_MASTER_VOLUME; // It has the deviation on it, scaling it again below would compound on every reload without the key
+	err = parse_config(config, dv_names, NULL);
+	if(err != 0) {
+		printf("Could not parse the config file. (error code as return code)\n");
+		return err;
+	}
+	if(config->options.sca_on) {
+		if(config->sca_num_carriers == 0) parse_sca_carrier("67000", &config->sca_carriers[config->sca_num_carriers++], 0);
+		if(config->sca_num_carriers != old_sca.sca_num_carriers || memcmp(config->sca_carriers, old_sca.sca_carriers, sizeof(SCACarrier) * config->sca_num_carriers) != 0 ||
+		   config->sca_input_rate != old_sca.sca_input_rate || config->sca_audio_volume != old_sca.sca_audio_volume || config->sca_lpf_cutoff != old_sca.sca_lpf_cutoff || config->sca_preemphasis != old_sca.sca_preemphasis) {
+			printf("Warning! SCA changes other than its volume are not reloaded, please restart for that to take effect.\n");
+		}
+	}
+	memcpy(config->sca_carriers, old_sca.sca_carriers, sizeof(config->sca_carriers));
+	config->sca_num_carriers = old_sca.sca_num_carriers;
+	config->sca_input_rate = old_sca.sca_input_rate;
+	config->sca_audio_volume = old_sca.sca_audio_volume;
+	config->sca_lpf_cutoff = old_sca.sca_lpf_cutoff;
+	config->sca_preemphasis = old_sca.sca_preemphasis;
+	config->volumes.audio = calculate_sharedaudio_volume(config->volumes, config->rds_streams, config->options.darc_on, calculate_sca_volume(config));
+	if(!compare_dvs(dv_names, old_dv_names)) printf("Warning! Audio Device name changes are not reloaded, please restart for that to take effect.\n");
+	*old_dv_names = *dv_names;
+	if(!config->options.rds_encoder_on && config->rds_streams != old_streams) printf("Warning! change of rds_streams requires a restart, not a reload.\n");
+	config->rds_streams = old_streams;
+	if(strcmp(old_destination, config->distribution_destination) != 0) printf("Warning! MPX distribution changes are not reloaded, please restart for that to take effect.\n");
+	if(strcmp(old_iq_output, config->iq_output) != 0 || old_iq_rate != config->iq_rate || old_iq_format != config->iq_format) printf("Warning! IQ output changes are not reloaded, please restart for that to take effect.\n");
+	memcpy(config->iq_output, old_iq_output, sizeof(old_iq_output));
+	config->iq_rate = old_iq_rate;
+	config->iq_format = old_iq_format;
+	if(config->options.iq_on && !check_iq_deviation(config->iq_deviation, config->iq_rate)) {
+		printf("An IQ deviation of %.1f Hz does not fit an IQ rate of %u\n", config->iq_deviation, config->iq_rate);
+		return 1;
+	}
+	if(strcmp(old_control_socket, config->control_socket) != 0) printf("Warning! Control socket changes are not reloaded, please restart for that to take effect.\n");
+	memcpy(config->control_socket, old_control_socket, sizeof(old_control_socket));
+	if(strcmp(old_state_file, config->state_file) != 0) printf("Warning! State file changes are not reloaded, please restart for that to take effect.\n");
+	memcpy(config->state_file, old_state_file, sizeof(old_state_file));
+	// The devices run at the sample rate and the oscillator carries on through a reload
+	if(config->sample_rate != old_sample_rate) printf("Warning! Sample rate changes are not reloaded, please restart for that to take effect.\n");
+	config->sample_rate = old_sample_rate;
+	// The clipper is set up once with the chain, only its threshold is taken while it runs
+	if((config->composite_clipper != 0) != (old_composite_clipper != 0) || config->composite_oversample != old_composite_oversample) {
+		printf("Warning! Turning the composite clipper on or off and its oversampling are not reloaded, please restart for that to take effect.\n");
+		config->composite_clipper = old_composite_clipper;
+		config->composite_oversample = old_composite_oversample;
+	}
+	// So are the encoders, options is what the chain was set up with and is kept as it is
+	if((config->rds_encoder != 0) != (old_rds_encoder != 0) || (config->darc != 0) != (old_darc != 0) || config->darc_frame != old_darc_frame) {
+		printf("Warning! Turning the RDS encoder or DARC on or off and the DARC frame are not reloaded, please restart for that to take effect.\n");
+		config->rds_encoder = old_rds_encoder;
+		config->darc = old_darc;
+		config->darc_frame = old_darc_frame;
+	}
+	if(config->pipeline != old_pipeline || config->pipeline_depth != old_pipeline_depth) printf("Warning! Pipeline changes are not reloaded, please restart for that to take effect.\n");
+	config->pipeline = old_pipeline;
+	config->pipeline_depth = old_pipeline_depth;
+	if(!realtime_settings_equal(&config->realtime, &old_realtime)) printf("Warning! Real-time changes are not reloaded, please restart for that to take effect.\n");
+	config->realtime = old_realtime;
+	config->master_volume *= config->audio_deviation/75000.0f; // As prepare_config does
+
+	GraphNode nodes[GRAPH_MAX_NODES];
+	uint8_t num_nodes;
+	if(resolve_FM95_Graph(config, false, nodes, &num_nodes) != 0 || resolve_FM95_Graph(config, true, nodes, &num_nodes) != 0) return 1;
+	return 0;
+}
+
+// Builds a reload of one chain while it keeps running, then waits for its stages to swap it in and frees the old plans,
+// write_back is for a chain that runs on copies of config, running (can be NULL) is cleared if the chain stops,
+// nonzero if the chain has to be stopped for it, like for calibration
+static int reload_FM95_Chain(FM95_Config* config, FM95_DeviceNames* dv_names, FM95_DeviceNames* old_dv_names, FM95_Runtime* runtime, bool write_back, const bool* running) {
+	if(config->calibration != 0) return 1;
+
+	FM95_Reload* reload = &runtime->reload;
+	reload->config = *config;
+	if(reload_config(&reload->config, dv_names, old_dv_names) != 0) {
+		printf("Warning! Carrying on with the config that was running.\n");
+		return 0;
+	}
+	if(reload->config.calibration != 0) return 1;
+
+	// reload_config checked that both graphs resolve
+	GraphNode nodes[GRAPH_MAX_NODES];
+	uint8_t num_nodes;
+	resolve_FM95_Graph(&reload->config, false, nodes, &num_nodes);
+	if(init_graph_plan(&reload->audio_graph, nodes, num_nodes, 2, reload->config.sample_rate, BUFFER_SIZE, NULL) != 0) {
+		fprintf(stderr, "Warning! Cannot set up the new audio graph, carrying on with the one running.\n");
+		return 0;
+	}
+	resolve_FM95_Graph(&reload->config, true, nodes, &num_nodes);
+	if(init_graph_plan(&reload->mpx_graph, nodes, num_nodes, 1, reload->config.sample_rate, BUFFER_SIZE, NULL) != 0) {
+		fprintf(stderr, "Warning! Cannot set up the new MPX graph, carrying on with the one running.\n");
+		free_graph_plan(&reload->audio_graph);
+		return 0;
+	}
+
+	// What has to wait on a file is done here, the stages only swap in what is ready, the RDS data goes through its mailbox
+	// and may be on air a block before the rest, the composite stage takes one every block so the wait is short
+	open_FM95_DARCSource(reload->config, runtime);
+	while(reload->config.options.rds_encoder_on && !post_FM95_RDSData(reload->config, runtime)) {
+		if(!to_run || (running && !__atomic_load_n(running, __ATOMIC_RELAXED))) break;
+		struct timespec tick = {0, 5000000};
+		nanosleep(&tick, NULL);
+	}
+
+	// A set waits until both stages have dropped what was set before, so it isn't lost with it
+	bool control_on = reload->config.options.control_on;
+	if(control_on) {
+		pthread_mutex_lock(&runtime->control.lock);
+		store_FM95_Control(reload->config, runtime, &reload->audio_graph, &reload->mpx_graph);
+	}
+	uint32_t generation = reload->generation + 1;
+	__atomic_store_n(&reload->generation, generation, __ATOMIC_RELEASE);
+	while(__atomic_load_n(&reload->audio_done, __ATOMIC_ACQUIRE) != generation || __atomic_load_n(&reload->composite_done, __ATOMIC_ACQUIRE) != generation) {
+		if(!to_run || (running && !__atomic_load_n(running, __ATOMIC_RELAXED))) break; // What is left in reload is freed with the rest of the runtime
+		struct timespec tick = {0, 5000000};
+		nanosleep(&tick, NULL);
+	}
+	if(control_on) pthread_mutex_unlock(&runtime->control.lock);
+	if(__atomic_load_n(&reload->audio_done, __ATOMIC_ACQUIRE) != generation || __atomic_load_n(&reload->composite_done, __ATOMIC_ACQUIRE) != generation) return 0;
+	free_graph_plan(&reload->audio_graph);
+	free_graph_plan(&reload->mpx_graph);
+	if(write_back) *config = reload->config;
+	return 0;
+}
+
+typedef struct
+{
+	FM95_Config* config; // What main has, the chain runs on copies
+	FM95_DeviceNames* dv_names;
+	FM95_DeviceNames* old_dv_names;
+	FM95_Runtime* runtime;
+} FM95_Reloader;
+
+// Looks for a SIGHUP next to the chain, a reload that needs the chain stopped stops it and leaves to_reload set for main,
+// and writes the state file out and reads the RDS command file so the chain never waits on either
+static void* run_FM95_Reloader(void* arg) {
+	FM95_Reloader* reloader = arg;
+	realtime_leave(&reloader->config->realtime); // Started from the chain's thread, it would run like it otherwise
+	while(to_run) {
+		struct timespec tick = {0, 50000000};
+		nanosleep(&tick, NULL);
+		write_FM95_State(reloader->runtime);
+		poll_rds_command_file(*reloader->config, reloader->runtime);
+		if(!to_reload) continue;
+		to_reload = 0;
+		printf("Reloading...\n");
+		if(reload_FM95_Chain(reloader->config, reloader->dv_names, reloader->old_dv_names, reloader->runtime, true, NULL) != 0) {
+			to_reload = 1;
+			to_run = 0;
+		}
+	}
+	return NULL;
+}
+
+typedef struct
+{
+	const FM95_ProgrammeEntry* entry;
+	uint8_t worker;
+	FM95_Config config;
+	FM95_DeviceNames dv_names, old_dv_names;
+	FM95_Runtime runtime;
+	FM95_StageTiming audio_timing, composite_timing;
+	FM95_Deadline deadline;
+	bool running; // Cleared by its worker when the chain fails, the others carry on
+	bool set_up;
+
+	// The inputs are read on a thread of the programme's own, so an input that stalls holds up its own chain and none of the others on the worker
+	pthread_t reader;
+	bool reader_started;
+	bool reader_stop;
+	FM95_InputState inputs; // The reader's
+	BlockQueue queue;
+	bool queue_ready;
+	FM95_Block blocks[PROGRAMME_READ_AHEAD];
+	float* sca_in[PROGRAMME_READ_AHEAD]; // The SCA input of each block, the worker copies it into the runtime's
+	sem_t* ready; // The worker's, posted for every block
+	FM95_StageTiming last_audio, last_composite;
+	uint64_t last_blocks, last_missed;
+} FM95_Programme;
+
+typedef struct
+{
+	pthread_t thread;
+	int cpu; // -1 when it isn't pinned
+	const RealtimeSettings* realtime;
+	FM95_Programme* programmes[MAX_PROGRAMMES];
+	uint8_t num_programmes;
+	sem_t ready; // Posted by its programmes' readers, so it sleeps while none of them has a block
+	bool ready_set_up;
+} FM95_Worker;
+
+// Reads a programme's inputs ahead of its worker, the block after the main input failed is marked as the end
+static void* run_programme_reader(void* arg) {
+	FM95_Programme* programme = arg;
+	enter_FM95_Realtime(&programme->config.realtime, -1, "input reader");
+	const FM95_Config config = programme->config; // The inputs don't change on a reload
+
+	while(true) {
+		uint32_t slot = block_queue_reserve(&programme->queue);
+		if(__atomic_load_n(&programme->reader_stop, __ATOMIC_ACQUIRE)) break; // Woken up to quit, the slot isn't real
+		FM95_Block* block = &programme->blocks[slot];
+		bool failed = read_FM95_Inputs(config, &programme->runtime, &programme->inputs, block, programme->sca_in[slot]) != 0;
+		block->end = failed;
+		block_queue_publish(&programme->queue);
+		sem_post(programme->ready);
+		if(failed) break;
+	}
+	return NULL;
+}
+
+// Runs its chains a block each in turn, as their inputs come in, a chain that fails is left out from then on
+static void* run_programme_worker(void* arg) {
+	FM95_Worker* worker = arg;
+	enter_FM95_Realtime(worker->realtime, worker->cpu, "worker");
+
+	bool any_running = true;
+	while(to_run && any_running) {
+		any_running = false;
+		bool any_done = false;
+		for(uint8_t i = 0; i < worker->num_programmes && to_run; i++) {
+			FM95_Programme* programme = worker->programmes[i];
+			if(!__atomic_load_n(&programme->running, __ATOMIC_RELAXED)) continue;
+			any_running = true;
+
+			int slot = block_queue_try_take(&programme->queue);
+			if(slot < 0) continue; // Its input isn't there yet, the others don't wait for it
+			FM95_Block* block = &programme->blocks[slot];
+			if(block->end) {
+				block_queue_release(&programme->queue);
+				fprintf(stderr, "Programme %s stopped, the others carry on.\n", programme->entry->name);
+				__atomic_store_n(&programme->running, false, __ATOMIC_RELAXED);
+				continue;
+			}
+
+			take_FM95_Reload(&programme->config, &programme->runtime, true, true);
+			uint64_t start = monotonic_ns();
+			if(block->sca_on) memcpy(programme->runtime.sca_in, programme->sca_in[slot], sizeof(float) * programme->runtime.sca.input_block * programme->runtime.sca.channels);
+			process_audio_block(programme->config, &programme->runtime, block);
+			add_stage_time(&programme->audio_timing, monotonic_ns() - start);
+			int err = process_composite_stage(programme->config, &programme->runtime, block, &programme->composite_timing);
+			block_queue_release(&programme->queue);
+			if(err) {
+				fprintf(stderr, "Programme %s stopped, the others carry on.\n", programme->entry->name);
+				__atomic_store_n(&programme->running, false, __ATOMIC_RELAXED);
+				continue;
+			}
+			account_deadline(&programme->deadline, block->ready_ns, block->wait_ns, programme->runtime.output_wait_ns);
+			any_done = true;
+		}
+		if(any_running && !any_done) {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += 50000000; // Looks at to_run at least this often
+			if(until.tv_nsec >= 1000000000) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+			sem_timedwait(&worker->ready, &until);
+		}
+	}
+	return NULL;
+}
+
+// The queue and the SCA buffers the reader hands its blocks over in, 0 on success
+static int setup_programme_reader(FM95_Programme* programme) {
+	if(programme->config.options.sca_on) {
+		for(uint8_t i = 0; i < PROGRAMME_READ_AHEAD; i++) {
+			programme->sca_in[i] = malloc(sizeof(float) * programme->runtime.sca.input_block * programme->runtime.sca.channels);
+			if(!programme->sca_in[i]) return -1;
+		}
+	}
+	if(init_block_queue(&programme->queue, PROGRAMME_READ_AHEAD) != 0) return -1;
+	programme->queue_ready = true;
+	return 0;
+}
+
+// False if the reader is stuck in a read that never came back, then nothing it uses can be freed
+static bool stop_programme_reader(FM95_Programme* programme) {
+	if(programme->reader_started) {
+		__atomic_store_n(&programme->reader_stop, true, __ATOMIC_RELEASE);
+		block_queue_unblock(&programme->queue);
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += PROGRAMME_READER_STOP_S;
+		if(pthread_timedjoin_np(programme->reader, NULL, &until) != 0) {
+			fprintf(stderr, "Warning! Programme %s: its input is stuck, not waiting for it.\n", programme->entry->name);
+			return false;
+		}
+		programme->reader_started = false;
+	}
+	if(programme->queue_ready) free_block_queue(&programme->queue);
+	programme->queue_ready = false;
+	for(uint8_t i = 0; i < PROGRAMME_READ_AHEAD; i++) {
+		free(programme->sca_in[i]);
+		programme->sca_in[i] = NULL;
+	}
+	return true;
+}
+
+static double average_stage_ms(const FM95_StageTiming* timing, FM95_StageTiming* last) {
+	uint64_t blocks = __atomic_load_n(&timing->blocks, __ATOMIC_ACQUIRE);
+	uint64_t busy = __atomic_load_n(&timing->busy_ns, __ATOMIC_RELAXED);
+	double ms = (blocks > last->blocks) ? (busy - last->busy_ns) * 1e-6 / (blocks - last->blocks) : 0.0;
+	last->blocks = blocks;
+	last->busy_ns = busy;
+	return ms;
+}
+
+// What each chain took per block since the last report, and how many blocks were not done in time
+static void report_programmes(FM95_Programme** programmes, uint8_t count) {
+	for(uint8_t i = 0; i < count; i++) {
+		FM95_Programme* programme = programmes[i];
+		uint64_t blocks = __atomic_load_n(&programme->deadline.blocks, __ATOMIC_ACQUIRE);
+		uint64_t missed = __atomic_load_n(&programme->deadline.missed, __ATOMIC_RELAXED);
+		double audio_ms = average_stage_ms(&programme->audio_timing, &programme->last_audio);
+		double composite_ms = average_stage_ms(&programme->composite_timing, &programme->last_composite);
+		printf("Programme %s (worker %u): audio %.2f ms, composite %.2f ms of a %.2f ms block, %llu of %llu blocks late (least slack %.2f ms)%s\n",
+			programme->entry->name, programme->worker, audio_ms, composite_ms,
+			programme->deadline.period_ns * 1e-6,
+			(unsigned long long)(missed - programme->last_missed), (unsigned long long)(blocks - programme->last_blocks),
+			take_least_slack(&programme->deadline),
+			__atomic_load_n(&programme->running, __ATOMIC_RELAXED) ? "" : ", stopped");
+		programme->last_blocks = blocks;
+		programme->last_missed = missed;
+	}
+}
+
+// Reads the programme's own config on top of the built-in defaults, then opens its devices
+static int setup_programme(FM95_Programme* programme, const FM95_Config* defaults) {
+	programme->config = *defaults;
+	memcpy(programme->config.ini_config_path, programme->entry->config_path, sizeof(programme->config.ini_config_path));
+	memset(&programme->dv_names, 0, sizeof(programme->dv_names));
+
+	printf("Setting up programme %s (%s)\n", programme->entry->name, programme->entry->config_path);
+	int err = parse_config(&programme->config, &programme->dv_names, NULL);
+	if(err != 0) {
+		printf("Could not parse the config file of programme %s. (error code as return code)\n", programme->entry->name);
+		return err;
+	}
+	if(programme->config.calibration != 0) {
+		printf("Programme %s: calibration is only done with one chain\n", programme->entry->name);
+		return 1;
+	}
+	if(programme->config.pipeline) printf("Warning! Programme %s: a programme runs on its worker's thread, its pipeline is not used.\n", programme->entry->name);
+
+	err = prepare_config(&programme->config, &programme->dv_names);
+	if(err != 0) return err;
+	programme->old_dv_names = programme->dv_names;
+
+	err = setup_audio(&programme->runtime, programme->dv_names, programme->config);
+	if(err != 0) return err;
+	programme->set_up = true;
+	programme->config.realtime = defaults->realtime; // Only the main config's is used, it's set up once for the process
+	set_FM95_IOPriority(programme->config, &programme->runtime);
+	err = init_runtime(&programme->runtime, programme->config);
+	if(err == 0) open_FM95_State(programme->config, &programme->runtime);
+	return err;
+}
+
+static void cleanup_programme(FM95_Programme* programme) {
+	if(!stop_programme_reader(programme)) return; // Left for the exit to take down
+	if(programme->set_up) {
+		close_FM95_State(programme->config, &programme->runtime);
+		cleanup_runtime(&programme->runtime, programme->config);
+		cleanup_audio_runtime(&programme->runtime, programme->config.options);
+		if(programme->config.options.darc_on) free_darc_encoder(&programme->runtime.darc_encoder);
+	}
+	free(programme);
+}
+
+// Every programme's chain on a fixed pool of workers, each chain stays on its worker so its state stays in that core's cache
+int run_programmes(const FM95_Config* defaults, const FM95_ProgrammeList* list, const RealtimeSettings* realtime) {
+	FM95_Programme* programmes[MAX_PROGRAMMES] = {0};
+	uint8_t count = list->num_programmes;
+	uint8_t num_workers = list->workers ? list->workers : count;
+	if(num_workers > count) num_workers = count;
+	FM95_Worker workers[MAX_WORKERS];
+	memset(workers, 0, sizeof(workers));
+
+	int ret = 0;
+	bool iq_on = false;
+	for(uint8_t i = 0; i < count; i++) {
+		programmes[i] = calloc(1, sizeof(FM95_Programme)); // The runtime is zeroed, like main does for one chain
+		if(!programmes[i]) {
+			fprintf(stderr, "Error: cannot allocate programme %s\n", list->programmes[i].name);
+			ret = 1;
+			break;
+		}
+		programmes[i]->entry = &list->programmes[i];
+		if(list->programmes[i].config_path[0] == '\0') {
+			printf("Programme %s has no config\n", list->programmes[i].name);
+			ret = 1;
+			break;
+		}
+		if((ret = setup_programme(programmes[i], defaults)) != 0) break;
+		iq_on |= programmes[i]->config.options.iq_on;
+
+		int8_t worker = list->programmes[i].worker;
+		if(worker >= num_workers) printf("Warning! Programme %s is set to worker %d, there are %u, picking one.\n", list->programmes[i].name, worker, num_workers);
+		programmes[i]->worker = (worker >= 0 && worker < num_workers) ? worker : i % num_workers;
+		FM95_Worker* w = &workers[programmes[i]->worker];
+		w->programmes[w->num_programmes++] = programmes[i];
+	}
+	if(ret != 0) {
+		for(uint8_t i = 0; i < count; i++) if(programmes[i]) cleanup_programme(programmes[i]);
+		return ret;
+	}
+	for(uint8_t i = 0; i < num_workers; i++) {
+		workers[i].cpu = realtime_cpu(realtime, i);
+		workers[i].realtime = realtime;
+		if(workers[i].cpu >= 0) printf("Worker %u on CPU %d: %u programme(s)\n", i, workers[i].cpu, workers[i].num_programmes);
+		else printf("Worker %u: %u programme(s)\n", i, workers[i].num_programmes);
+	}
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGHUP, reload);
+	if(iq_on) signal(SIGPIPE, SIG_IGN);
+
+	for(uint8_t i = 0; i < count; i++) {
+		FM95_Programme* programme = programmes[i];
+		programme->inputs.mpx_on = programme->config.options.mpx_on;
+		programme->inputs.rds_on = programme->config.options.rds_on;
+		programme->inputs.sca_on = programme->config.options.sca_on;
+		init_deadline(&programme->deadline, programme->config.sample_rate);
+		programme->ready = &workers[programme->worker].ready;
+		programme->running = true;
+	}
+
+	for(uint8_t i = 0; i < num_workers && ret == 0; i++) {
+		if(sem_init(&workers[i].ready, 0, 0) != 0) ret = 1;
+		else workers[i].ready_set_up = true;
+	}
+	for(uint8_t i = 0; i < count && ret == 0; i++) {
+		if(setup_programme_reader(programmes[i]) != 0 || pthread_create(&programmes[i]->reader, NULL, run_programme_reader, programmes[i]) != 0) {
+			fprintf(stderr, "Error: cannot start the input reader of programme %s\n", programmes[i]->entry->name);
+			ret = 1;
+			break;
+		}
+		programmes[i]->reader_started = true;
+	}
+	if(ret != 0) to_run = 0;
+
+	uint8_t started = 0;
+	for(; started < num_workers && ret == 0; started++) {
+		if(pthread_create(&workers[started].thread, NULL, run_programme_worker, &workers[started]) != 0) {
+			fprintf(stderr, "Error: cannot start worker %u\n", started);
+			to_run = 0;
+			ret = 1;
+			break;
+		}
+	}
+
+	uint64_t next_report = monotonic_ns() + (uint64_t)(list->stats * 1e9);
+	while(to_run) {
+		struct timespec tick = {0, 50000000};
+		nanosleep(&tick, NULL);
+
+		bool any_running = false;
+		for(uint8_t i = 0; i < count; i++) any_running |= __atomic_load_n(&programmes[i]->running, __ATOMIC_RELAXED);
+		if(!any_running) {
+			fprintf(stderr, "Every programme stopped.\n");
+			to_run = 0;
+			ret = 1;
+			break;
+		}
+
+		for(uint8_t i = 0; i < count; i++) {
+			write_FM95_State(&programmes[i]->runtime);
+			poll_rds_command_file(programmes[i]->config, &programmes[i]->runtime);
+		}
+
+		// Each programme is swapped over on its worker while the others carry on
+		if(to_reload) {
+			to_reload = 0;
+			printf("Reloading...\n");
+			for(uint8_t i = 0; i < count && to_run; i++) {
+				FM95_Programme* programme = programmes[i];
+				if(!__atomic_load_n(&programme->running, __ATOMIC_RELAXED)) continue;
+				if(reload_FM95_Chain(&programme->config, &programme->dv_names, &programme->old_dv_names, &programme->runtime, false, &programme->running) != 0) {
+					printf("Warning! Programme %s: calibration is only done with one chain, not reloaded.\n", programme->entry->name);
+				}
+			}
+		}
+
+		if(list->stats != 0 && monotonic_ns() >= next_report) {
+			report_programmes(programmes, count);
+			next_report += (uint64_t)(list->stats * 1e9);
+		}
+	}
+	for(uint8_t i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+
+	printf("Cleaning up...\n");
+	for(uint8_t i = 0; i < count; i++) cleanup_programme(programmes[i]);
+	for(uint8_t i = 0; i < num_workers; i++) if(workers[i].ready_set_up) sem_destroy(&workers[i].ready);
+	return ret;
+}
+
+// What one file came to, for its line of the batch report
+typedef struct
+{
+	uint64_t frames;
+	float audio_peak;
+	float mpx_peak;
+	double power_sum; // Of every MPX sample, as deviation squared, like BS412 measures it
+	double* minute; // Power of each of the last minute's blocks
+	uint32_t minute_blocks, minute_filled, minute_next;
+	double minute_sum;
+	double worst_minute;
+	const GraphStep* agc; // The first of each, NULL if the graph has none
+	const GraphStep* bs412;
+	const CompositeClipper* clipper; // NULL when it's off
+	float agc_min, agc_max, bs412_min;
+	double agc_sum, bs412_sum;
+	uint64_t blocks;
+} FM95_BatchReport;
+
+static const GraphStep* find_graph_step(const GraphPlan* plan, GraphNodeType type) {
+	for(uint8_t s = 0; s < plan->num_steps; s++) {
+		if(plan->steps[s].type == type) return &plan->steps[s];
+	}
+	return NULL;
+}
+
+// frames of the block are from the file, the rest is the padding after its end
+static void measure_FM95_Block(const FM95_Config config, const FM95_Block* block, const float* output, size_t frames, FM95_BatchReport* report) {
+	double power = 0.0;
+	for(size_t i = 0; i < frames; i++) {
+		report->audio_peak = fmaxf(report->audio_peak, fmaxf(fabsf(block->audio[2*i+0]), fabsf(block->audio[2*i+1])));
+		report->mpx_peak = fmaxf(report->mpx_peak, fabsf(output[i]));
+		power += (double)output[i] * output[i];
+	}
+	power *= (double)config.mpx_deviation * config.mpx_deviation;
+	report->power_sum += power;
+	report->frames += frames;
+
+	// BS412 holds for any minute, so the loudest one counts, not the whole file's average
+	double block_power = power / frames;
+	if(report->minute_filled == report->minute_blocks) report->minute_sum -= report->minute[report->minute_next];
+	else report->minute_filled++;
+	report->minute[report->minute_next] = block_power;
+	report->minute_sum += block_power;
+	report->minute_next = (report->minute_next + 1) % report->minute_blocks;
+	if(report->minute_filled == report->minute_blocks) report->worst_minute = fmax(report->worst_minute, report->minute_sum / report->minute_blocks);
+
+	float agc_gain = report->agc ? report->agc->agc.currentGain : 1.0f;
+	float bs412_gain = report->bs412 ? report->bs412->bs412.gain : 1.0f;
+	report->agc_min = report->blocks ? fminf(report->agc_min, agc_gain) : agc_gain;
+	report->agc_max = report->blocks ? fmaxf(report->agc_max, agc_gain) : agc_gain;
+	report->bs412_min = report->blocks ? fminf(report->bs412_min, bs412_gain) : bs412_gain;
+	report->agc_sum += agc_gain;
+	report->bs412_sum += bs412_gain;
+	report->blocks++;
+}
+
+static float gain_db(double gain) {
+	return 20.0f * log10f(fmaxf((float)gain, 1e-6f));
+}
+
+static float power_dbr(double power) {
+	return deviation_to_dbr(sqrtf((float)power));
+}
+
+// A line for the file, in one printf so the lines of the jobs don't mix
+static void print_FM95_BatchReport(const FM95_Config config, const char* path, const FM95_BatchReport* report, double took) {
+	char line[768];
+	double seconds = (double)report->frames / config.sample_rate;
+	double average_power = report->frames ? report->power_sum / report->frames : 0.0;
+	int used = snprintf(line, sizeof(line), "%s: %.1f s, audio peak %.2f dBFS, MPX peak %.1f%%, MPX power %+.2f dBr",
+		path, seconds, gain_db(report->audio_peak), report->mpx_peak * 100.0f, power_dbr(average_power));
+	if(report->minute_filled == report->minute_blocks) used += snprintf(line + used, sizeof(line) - used, " (loudest minute %+.2f dBr)", power_dbr(report->worst_minute));
+	else used += snprintf(line + used, sizeof(line) - used, " (under a minute)");
+	if(report->agc && report->blocks) {
+		used += snprintf(line + used, sizeof(line) - used, ", AGC %+.1f to %+.1f dB (average %+.1f)",
+			gain_db(report->agc_min), gain_db(report->agc_max), gain_db(report->agc_sum / report->blocks));
+	}
+	if(report->bs412 && report->blocks) {
+		used += snprintf(line + used, sizeof(line) - used, ", BS412 down to %+.1f dB (average %+.1f)",
+			gain_db(report->bs412_min), gain_db(report->bs412_sum / report->blocks));
+	}
+	if(report->clipper && report->clipper->samples) {
+		used += snprintf(line + used, sizeof(line) - used, ", composite clipper on %.2f%% of the time", 100.0 * report->clipper->clipped / report->clipper->samples);
+	}
+	snprintf(line + used, sizeof(line) - used, ", %.0fx real time", (took > 0) ? seconds / took : 0.0);
+	printf("%s\n", line);
+}
+
+// NAME.fm95.wav or NAME.mpx.wav in the output directory, so a file is never written over its own input, nonzero if it doesn't fit
+static int batch_output_path(const FM95_Batch* batch, const char* path, char* output, size_t size) {
+	const char* name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	const char* extension = strrchr(name, '.');
+	int length = extension ? (int)(extension - name) : (int)strlen(name);
+	int written = snprintf(output, size, "%s/%.*s.%s.wav", batch->output_dir, length, name, batch->mpx ? "mpx" : "fm95");
+	return (written < 0 || (size_t)written >= size) ? 1 : 0;
+}
+
+// The whole chain as it would run live, on a runtime of its own, 1 if the file couldn't be done, -1 if a stop cut it short,
+// then what was written is taken away, it would look like a whole file
+static int render_FM95_File(const FM95_Config config, const FM95_Batch* batch, const char* path, uint64_t* frames) {
+	char output_path[BATCH_PATH_LENGTH];
+	if(batch_output_path(batch, path, output_path, sizeof(output_path)) != 0) {
+		fprintf(stderr, "The output path for %s is too long\n", path);
+		return 1;
+	}
+
+	WavReader input;
+	if(open_WavReader(&input, path, config.sample_rate, 2) != 0) return 1;
+	WavWriter output;
+	if(open_WavWriter(&output, output_path, config.sample_rate, batch->mpx ? 1 : 2) != 0) {
+		free_WavReader(&input);
+		return 1;
+	}
+
+	FM95_Runtime* runtime = calloc(1, sizeof(FM95_Runtime)); // Zeroed like main's
+	FM95_Block* block = calloc(1, sizeof(FM95_Block));
+	FM95_BatchReport report = {.minute_blocks = (uint32_t)(60.0 * config.sample_rate / BUFFER_SIZE)};
+	report.minute = calloc(report.minute_blocks, sizeof(double));
+	int err = (!runtime || !block || !report.minute) ? 1 : init_runtime(runtime, config);
+	if(err == 0) {
+		report.agc = find_graph_step(&runtime->audio_graph, GRAPH_NODE_AGC);
+		report.bs412 = find_graph_step(&runtime->mpx_graph, GRAPH_NODE_BS412);
+		if(runtime->composite_clipper_ready) report.clipper = &runtime->composite_clipper;
+		uint64_t start = monotonic_ns();
+		float mpx[BUFFER_SIZE];
+		size_t got;
+		while(to_run && (got = read_WavReader(&input, block->audio, BUFFER_SIZE)) != 0) {
+			process_audio_block(config, runtime, block);
+			process_composite_block(config, runtime, block, mpx);
+			measure_FM95_Block(config, block, mpx, got, &report);
+			if(write_WavWriter(&output, batch->mpx ? mpx : block->audio, got) != 0) {
+				fprintf(stderr, "Error writing to %s\n", output_path);
+				err = 1;
+				break;
+			}
+		}
+		if(err == 0 && !to_run) err = -1;
+		if(err == 0) print_FM95_BatchReport(config, path, &report, (monotonic_ns() - start) * 1e-9);
+		*frames = report.frames;
+	}
+	if(runtime) {
+		cleanup_runtime(runtime, config);
+		if(config.options.darc_on && runtime->darc_encoder_ready) free_darc_encoder(&runtime->darc_encoder);
+	}
+	free(runtime);
+	free(block);
+	free(report.minute);
+	free_WavReader(&input);
+	if(close_WavWriter(&output) != 0 && err == 0) {
+		fprintf(stderr, "Error writing to %s\n", output_path);
+		err = 1;
+	}
+	if(err < 0) unlink(output_path);
+	return err;
+}
+
+// Every output path fits and no two inputs land on the same one (same name in two directories, or with two extensions), checked before anything is written
+static int check_batch_outputs(const FM95_Batch* batch) {
+	char (*outputs)[BATCH_PATH_LENGTH] = malloc(sizeof(*outputs) * batch->num_files);
+	if(!outputs) {
+		fprintf(stderr, "Error: cannot allocate the output paths\n");
+		return 1;
+	}
+	int err = 0;
+	for(int i = 0; i < batch->num_files && err == 0; i++) {
+		if(batch_output_path(batch, batch->files[i], outputs[i], BATCH_PATH_LENGTH) != 0) {
+			printf("The output path for %s is too long\n", batch->files[i]);
+			err = 1;
+			break;
+		}
+		for(int j = 0; j < i; j++) {
+			if(strcmp(outputs[i], outputs[j]) != 0) continue;
+			printf("%s and %s would both be written to %s\n", batch->files[j], batch->files[i], outputs[i]);
+			err = 1;
+			break;
+		}
+	}
+	free(outputs);
+	return err;
+}
+
+typedef struct
+{
+	const FM95_Config* config;
+	const FM95_Batch* batch;
+	int next; // The next file to take
+	int failed;
+	uint64_t frames;
+} FM95_BatchQueue;
+
+// Takes the files one by one until there are none left, each job has its own chain so they share nothing but the queue
+static void* run_batch_job(void* arg) {
+	FM95_BatchQueue* queue = arg;
+	int file;
+	while(to_run && (file = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->batch->num_files) {
+		uint64_t frames = 0;
+		int err = render_FM95_File(*queue->config, queue->batch, queue->batch->files[file], &frames);
+		if(err > 0) fprintf(stderr, "Could not render %s\n", queue->batch->files[file]);
+		if(err != 0) __atomic_add_fetch(&queue->failed, 1, __ATOMIC_RELAXED); // Stopped ones aren't done either
+		__atomic_add_fetch(&queue->frames, frames, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+// The files stand in for the input and output devices, the other inputs and every live output are left out
+int run_batch(FM95_Config* config, FM95_DeviceNames* dv_names, const FM95_Batch* batch) {
+	struct stat st;
+	if(stat(batch->output_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		printf("The output directory %s isn't there\n", batch->output_dir);
+		return 1;
+	}
+	if(config->calibration != 0) {
+		printf("Calibration has no input to render\n");
+		return 1;
+	}
+	if(check_batch_outputs(batch) != 0) return 1;
+	memset(dv_names, 0, sizeof(FM95_DeviceNames));
+	strcpy(dv_names->input, "batch");
+	strcpy(dv_names->output, "batch");
+	config->iq_output[0] = '\0';
+	config->distribution_destination[0] = '\0';
+	config->control_socket[0] = '\0';
+	config->state_file[0] = '\0'; // A file's chain mustn't take over the live one's state
+	int err = prepare_config(config, dv_names);
+	if(err != 0) return err;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int jobs = batch->jobs ? batch->jobs : (cpus > 0 ? (cpus < MAX_BATCH_JOBS ? cpus : MAX_BATCH_JOBS) : 1);
+	if(jobs > batch->num_files) jobs = batch->num_files;
+	printf("Rendering %d file(s) into %s as %s, %d at a time\n", batch->num_files, batch->output_dir, batch->mpx ? "MPX" : "audio", jobs);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	FM95_BatchQueue queue = {.config = config, .batch = batch};
+	pthread_t threads[MAX_BATCH_JOBS];
+	uint64_t start = monotonic_ns();
+	int started = 0;
+	for(; started < jobs; started++) {
+		if(pthread_create(&threads[started], NULL, run_batch_job, &queue) != 0) break;
+	}
+	if(started == 0) run_batch_job(&queue);
+	for(int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+	double took = (monotonic_ns() - start) * 1e-9;
+	double seconds = (double)queue.frames / config->sample_rate;
+	int done = (queue.next < batch->num_files ? queue.next : batch->num_files) - queue.failed;
+	printf("Rendered %d of %d file(s), %.1f s of audio in %.1f s, %.0fx real time on %d job(s)\n", done, batch->num_files, seconds, took, (took > 0) ? seconds / took : 0.0, started ? started : 1);
+	return (queue.failed != 0 || !to_run) ? 1 : 0;
 }
 
 int main(int argc, char **argv) {
-	printf("fm95 (an FM Processor by radio95) version 2.2\n");
+	printf("fm95 (an FM Processor by radio95) version 3.4\n");
 
 	FM95_Config config = {
 		.volumes = {
 			.pilot = DEFAULT_PILOT_VOLUME,
 			.rds = DEFAULT_RDS_VOLUME,
 			.rds_step = DEFAULT_RDS_VOLUME_STEP,
+			.darc = DEFAULT_DARC_VOLUME,
+			.darc_min = DEFAULT_DARC_MIN_VOLUME,
+			.sca = DEFAULT_SCA_VOLUME,
 			.headroom = 0.05f
 		},
 		.stereo = 1,
@@ -489,13 +2773,15 @@ int main(int argc, char **argv) {
 		.rds_streams = 1, // You have to match this with RDS95, otherwise may god have mercy on your RDS decoders
 
 		.clipper_threshold = 1.0f, // At what level for the clipper to work, 1.0f, clips the audio at 1 volt peak to peak, so it will be always between -1 and 1
+		.composite_clipper = 0.0f, // Off
+		.composite_oversample = 2,
 		.preemphasis = 50, // Europe, the "freedomers" use 75µs
 		.tilt = 0, // Off
 		.calibration = 0, // Off
 		.mpx_power = 3.0f, // dbr, this is for BS412, simplest bs412
 		.mpx_deviation = 75000.0f, // for BS412, this is what deviation does the compressor see as peak, so if i set here 150 khz, then the compressor will act as if it was two times louder
 		.audio_deviation = 75000.0f, // another way to set the volume
-		.master_volume = 1.0f, // Volume of everything combined, for calibration
+		.master_volume = DEFAULT_MASTER_VOLUME, // Volume of everything combined, for calibration
 		.audio_volume = 1.0f, // Volume of the audio, before stereo encoding, before clipper
 		.audio_preamp = 1.0f, // Volume of the audio before the filters
 
@@ -514,80 +2800,144 @@ int main(int argc, char **argv) {
 		.bs412_release = 0.025,
 		.bs412_max = 1.0f,
 		.lpf_cutoff = 15000,
+
+		.vban_latency = 32.0f, // ms, at least one block (16 ms at 192 kHz) plus the network jitter
+		.vban_interface = "",
+
+		.distribution_destination = "",
+		.distribution_interface = "",
+		.distribution_ttl = 16,
+		.distribution_clock_offset = 0.0f,
+
+		.rds_encoder = 0,
+		.rds_command_file = "",
+		.rds_data = {
+			.pi = 0x0000,
+			.pty = 0,
+			.ms = true,
+			.ct = true,
+			.ps = "fm95",
+			.rt = ""
+		},
+
+		.darc = 0,
+		.darc_frame = 'A',
+		.darc_source = "",
+
+		.iq_output = "",
+		.iq_format = IQ_FORMAT_CS16,
+		.iq_rate = 2304000, // 12 times 192 khz
+		.iq_deviation = 75000.0f, // What an MPX of 1.0 swings the carrier by
+		.iq_offset = 0.0f,
+
+		.sca_num_carriers = 0, // One on DEFAULT_SCA_FREQUENCY if none are set
+		.sca_input_rate = DEFAULT_SCA_INPUT_RATE,
+		.sca_audio_volume = 1.0f,
+		.sca_lpf_cutoff = DEFAULT_SCA_LPF_CUTOFF,
+		.sca_preemphasis = 0, // Off, SCA receivers mostly use 150 µs when they do
+
+		.pipeline = 0,
+		.pipeline_depth = 2, // The one being worked on and the one being filled
+		.stats = 0.0f, // Off
+
+		.graph_audio = "preamp, agc, lpf, preemphasis, volume, clip",
+		.graph_mpx = "bs412, tilt, master, clip",
+		.graph_num_nodes = 0,
+
+		.control_socket = "", // Off
+
+		.state_file = "", // Off
+		.state_interval = 2.0f,
+		.state_max_age = 3600.0f, // An hour, past that the levels and power say little about what comes on
+
+		.realtime = {
+			.policy = SCHED_OTHER, // Off
+			.priority = 70,
+			.io_priority = 60, // Under the DSP, the device only has to be read before the next block is wanted
+			.lock_memory = false,
+			.num_cpus = 0,
+			.isolate = false
+		},
 	};
 
 	FM95_DeviceNames dv_names = {
 		.input = "\0",
 		.output = "\0",
 		.mpx = "\0",
-		.rds = "\0"
+		.rds = "\0",
+		.sca = "\0"
 	};
-	FM95_DeviceNames old_dv_names = dv_names;
+
+	FM95_Batch batch;
+	memset(&batch, 0, sizeof(batch));
 
 	int err;
-	err = parse_arguments(argc, argv, &config);
+	err = parse_arguments(argc, argv, &config, &batch);
 	if(err != 0) return err;
+	FM95_Config defaults = config;
 
-	err = parse_config(&config, &dv_names);
+	FM95_ProgrammeList programmes;
+	memset(&programmes, 0, sizeof(programmes));
+	err = parse_config(&config, &dv_names, batch.output_dir[0] ? NULL : &programmes); // A batch renders the main config's chain
 	if(err != 0) {
 		printf("Could not parse the config file. (error code as return code)\n");
 		return err;
 	}
-
-	if(strlen(dv_names.input) == 0) {
-		printf("Please set the input device");
-		return 1;
-	}
-	if(strlen(dv_names.output) == 0) {
-		printf("Please set the output device");
-		return 1;
+	if(batch.output_dir[0] != '\0') return run_batch(&config, &dv_names, &batch);
+	if(programmes.num_programmes != 0 && programmes.num_cpus != 0) { // The pool's CPUs are the ones the DSP runs on
+		memcpy(config.realtime.cpus, programmes.cpus, sizeof(int) * programmes.num_cpus);
+		config.realtime.num_cpus = programmes.num_cpus;
 	}
+	setup_FM95_Realtime(&config.realtime);
+	defaults.realtime = config.realtime;
+	if(programmes.num_programmes != 0) return run_programmes(&defaults, &programmes, &config.realtime);
 
-	config.master_volume *= config.audio_deviation/75000.0f;
-
-	config.volumes.audio = calculate_sharedaudio_volume(config.volumes, config.rds_streams);
+	err = prepare_config(&config, &dv_names);
+	if(err != 0) return err;
+	FM95_DeviceNames old_dv_names = dv_names;
 
 	FM95_Runtime runtime;
 	memset(&runtime, 0, sizeof(runtime));
 
-	config.options.mpx_on = (strlen(dv_names.mpx) != 0);
-	config.options.rds_on = (strlen(dv_names.rds) != 0 && config.rds_streams != 0);
-
 	err = setup_audio(&runtime, dv_names, config);
 	if(err != 0) return err;
+	set_FM95_IOPriority(config, &runtime);
 
 	signal(SIGINT, stop);
 	signal(SIGTERM, stop);
 	signal(SIGHUP, reload);
-
-	init_runtime(&runtime, config);
-
-	int ret;
-	while(true) {
+	if(config.options.iq_on) signal(SIGPIPE, SIG_IGN); // A reader going away is a write error, not a kill
+
+	int ret = init_runtime(&runtime, config);
+	if(ret == 0) open_FM95_State(config, &runtime);
+	while(ret == 0) {
+		FM95_Reloader reloader = {
+			.config = &config,
+			.dv_names = &dv_names,
+			.old_dv_names = &old_dv_names,
+			.runtime = &runtime
+		};
+		pthread_t reload_thread;
+		bool reloading = (pthread_create(&reload_thread, NULL, run_FM95_Reloader, &reloader) == 0);
+		if(!reloading) fprintf(stderr, "Warning! Cannot start the reload thread, SIGHUP is not looked at.\n");
 		ret = run_fm95(config, &runtime);
-		if(to_reload) {
+		to_run = 0; // The reload thread stops with the chain
+		if(reloading) pthread_join(reload_thread, NULL);
+		if(to_reload) { // Only what can't be swapped in while running, like calibration
 			to_reload = 0;
-			printf("Reloading...\n");
-			uint8_t old_streams = config.rds_streams; // keep the rds streams
-			err = parse_config(&config, &dv_names);
-			if(err != 0) {
-				printf("Could not parse the config file. (error code as return code)\n");
-				return err;
-			}
-			config.volumes.audio = calculate_sharedaudio_volume(config.volumes, config.rds_streams);
-			if(!compare_dvs(&dv_names, &old_dv_names)) printf("Warning! Audio Device name changes are not reloaded, please restart for that to take effect.\n");
-			old_dv_names = dv_names;
-			if(config.rds_streams != old_streams) printf("Warning! change of rds_streams requires a restart, not a reload.\n");
-			config.rds_streams = old_streams;
+			err = reload_config(&config, &dv_names, &old_dv_names);
+			if(err != 0) return err;
 			cleanup_runtime(&runtime, config);
-			init_runtime(&runtime, config);
+			ret = init_runtime(&runtime, config);
 			to_run = 1;
 			continue;
 		}
-		printf("Cleaning up...\n");
-		cleanup_runtime(&runtime, config);
-		cleanup_audio_runtime(&runtime, config.options);
 		break;
 	}
+	printf("Cleaning up...\n");
+	close_FM95_State(config, &runtime);
+	cleanup_runtime(&runtime, config);
+	cleanup_audio_runtime(&runtime, config.options);
+	if(config.options.darc_on) free_darc_encoder(&runtime.darc_encoder);
 	return ret;
 }
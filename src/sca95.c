@@ -1,17 +1,21 @@
 #include <getopt.h>
 #include <stdio.h>
+#include <liquid/liquid.h>
 
 #define buffer_maxlength 12288
 #define buffer_tlength_fragsize 12288
 #define buffer_prebuf 8
 
 #define DEFAULT_FREQUENCY 67000.0f
-#define DEFAULT_DEVIATION 7000.0f
-#define DEFAULT_CLIPPER_THRESHOLD 1.0f
+#define DEFAULT_DEVIATION SCA_DEFAULT_DEVIATION
+#define DEFAULT_CLIPPER_THRESHOLD SCA_DEFAULT_CLIPPER
 
-#include "../modulation/fm_modulator.h"
+#include "../modulation/sca_modulator.h"
 
 #define DEFAULT_SAMPLE_RATE 192000
+#define DEFAULT_INPUT_RATE 48000 // SCA audio is a few khz wide, no need for pulse to resample it to 192k for us
+#define DEFAULT_LPF_CUTOFF 7000.0f
+#define DEFAULT_PREEMPHASIS 0 // Off, SCA receivers mostly use 150 µs when they do
 
 #define INPUT_DEVICE "SCA.monitor"
 #define OUTPUT_DEVICE "FM_MPX"
@@ -24,23 +28,26 @@
 
 #define DEFAULT_VOLUME 0.1f
 
-static volatile sig_atomic_t to_run = 1;
+#define MAX_CARRIERS SCA_MAX_CARRIERS
 
-inline float hard_clip(float sample, float threshold) { return fmaxf(-threshold, fminf(threshold, sample)); }
+static volatile sig_atomic_t to_run = 1;
 
 typedef struct {
-	float freq;
-	float deviation;
-	float clipper;
-	float volume;
+	SCACarrier carriers[MAX_CARRIERS];
+	uint8_t num_carriers;
+	uint8_t channels;
 	float master_volume;
 	float audio_volume;
 	uint32_t sample_rate;
+	uint32_t input_rate;
+	float lpf_cutoff;
+	uint8_t preemphasis;
 } Sca95_Config;
 typedef struct
 {
 	PulseInputDevice input;
 	PulseOutputDevice output;
+	SCAModulator sca;
 } Sca95_Runtime;
 
 static void stop(int signum) {
@@ -59,6 +66,12 @@ void show_help(char *name) {
 		"\t-C,--sca_clip\tOverride the SCA clipper threshold [default: %.2f]\n"
 		"\t-A,--master_vol\tSet master volume [default: %.3f]\n"
 		"\t-v,--volume\tSet audio volume [default: %.3f]\n"
+		"\t-c,--carrier\tAdd a carrier as freq[:deviation[:clip[:level[:channel]]]], repeat for more (up to %d), all are summed into one output\n"
+		"\t\t\tand fed from their channel of one capture, the channel defaults to the carrier's position, the level to 1.0\n"
+		"\t\t\tWithout this, one carrier is made from -f, -F and -C\n"
+		"\t-r,--input_rate\tCapture rate, has to divide %d, the audio is filtered at this rate and upsampled here [default: %d]\n"
+		"\t-L,--lpf\tAudio low pass cutoff in hz, 0 to disable [default: %.0f]\n"
+		"\t-e,--preemphasis\tPre-emphasis in µs, 0 to disable [default: %d]\n"
 		,name
 		,INPUT_DEVICE
 		,OUTPUT_DEVICE
@@ -67,55 +80,75 @@ void show_help(char *name) {
 		,DEFAULT_CLIPPER_THRESHOLD
 		,DEFAULT_VOLUME
 		,DEFAULT_AUDIO_VOLUME
+		,MAX_CARRIERS
+		,DEFAULT_SAMPLE_RATE
+		,DEFAULT_INPUT_RATE
+		,DEFAULT_LPF_CUTOFF
+		,DEFAULT_PREEMPHASIS
 	);
 }
 
 int run_sca95(const Sca95_Config config, Sca95_Runtime* runtime) {
-	FMModulator sca_mod;
-	init_fm_modulator(&sca_mod, config.freq, config.deviation, config.sample_rate);
-
 	int pulse_error;
 
-	float audio_input[BUFFER_SIZE];
-	float output[BUFFER_SIZE];
+	uint16_t input_block = runtime->sca.input_block;
+	size_t output_block = (size_t)input_block * runtime->sca.factor;
+	float* audio_input = malloc(sizeof(float) * input_block * config.channels);
+	float* output = malloc(sizeof(float) * output_block);
+	if(!audio_input || !output) {
+		fprintf(stderr, "Failed to allocate the buffers\n");
+		free(audio_input);
+		free(output);
+		return 1;
+	}
 
 	while (to_run) {
-		if((pulse_error = read_PulseInputDevice(&runtime->input, audio_input, sizeof(audio_input)))) {
+		if((pulse_error = read_PulseInputDevice(&runtime->input, audio_input, sizeof(float) * input_block * config.channels))) {
 			fprintf(stderr, "Error reading from input device: %s\n", pa_strerror(pulse_error));
 			to_run = 0;
 			break;
 		}
 
-		for (uint16_t i = 0; i < BUFFER_SIZE; i++) {
-			output[i] = modulate_fm(&sca_mod, hard_clip(audio_input[i]*config.audio_volume, config.clipper))*config.master_volume;
-		}
+		modulate_sca_block(&runtime->sca, audio_input, output, config.master_volume, false);
 
-		if((pulse_error = write_PulseOutputDevice(&runtime->output, output, sizeof(output)))) {
+		if((pulse_error = write_PulseOutputDevice(&runtime->output, output, sizeof(float) * output_block))) {
 			fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
 			to_run = 0;
 			break;
 		}
 	}
+	free(audio_input);
+	free(output);
 	return 0;
 }
 
 int main(int argc, char **argv) {
-	printf("sca95 (a SCA modulator by radio95) version 1.1\n");
+	printf("sca95 (a SCA modulator by radio95) version 1.5\n");
 
 	Sca95_Config config = {
-		.freq = DEFAULT_FREQUENCY,
-		.deviation = DEFAULT_DEVIATION,
-		.clipper = DEFAULT_CLIPPER_THRESHOLD,
+		.num_carriers = 0,
+		.channels = 1,
 		.master_volume = DEFAULT_VOLUME,
 		.audio_volume = DEFAULT_AUDIO_VOLUME,
-		.sample_rate = DEFAULT_SAMPLE_RATE
+		.sample_rate = DEFAULT_SAMPLE_RATE,
+		.input_rate = DEFAULT_INPUT_RATE,
+		.lpf_cutoff = DEFAULT_LPF_CUTOFF,
+		.preemphasis = DEFAULT_PREEMPHASIS
 	};
 
 	char audio_input_device[64] = INPUT_DEVICE;
 	char audio_output_device[64] = OUTPUT_DEVICE;
 
+	SCACarrier single_carrier = {
+		.freq = DEFAULT_FREQUENCY,
+		.deviation = DEFAULT_DEVIATION,
+		.clipper = DEFAULT_CLIPPER_THRESHOLD,
+		.volume = 1.0f,
+		.channel = 0
+	};
+
 	int opt;
-	const char	*short_opt = "i:o:f:F:C:A:v:h";
+	const char	*short_opt = "i:o:f:F:C:A:v:c:r:L:e:h";
 	struct option	long_opt[] =
 	{
 		{"input",       required_argument, NULL, 'i'},
@@ -126,6 +159,10 @@ int main(int argc, char **argv) {
 		{"master_vol",     required_argument,       NULL, 'A'},
 		{"output",     required_argument,       NULL, 'A'},
 		{"audio_vol",     required_argument,       NULL, 'v'},
+		{"carrier",     required_argument,       NULL, 'c'},
+		{"input_rate",     required_argument,       NULL, 'r'},
+		{"lpf",     required_argument,       NULL, 'L'},
+		{"preemphasis",     required_argument,       NULL, 'e'},
 
 		{"help",        no_argument,       NULL, 'h'},
 		{0,             0,                 0,    0}
@@ -140,13 +177,13 @@ int main(int argc, char **argv) {
 				memcpy(audio_output_device, optarg, 47);
 				break;
 			case 'f': //SCA freq
-				config.freq = strtof(optarg, NULL);
+				single_carrier.freq = strtof(optarg, NULL);
 				break;
 			case 'F': //SCA deviation
-				config.deviation = strtof(optarg, NULL);
+				single_carrier.deviation = strtof(optarg, NULL);
 				break;
 			case 'C': //SCA clip
-				config.clipper = strtof(optarg, NULL);
+				single_carrier.clipper = strtof(optarg, NULL);
 				break;
 			case 'A': // Master vol
 				config.master_volume = strtof(optarg, NULL);
@@ -154,12 +191,51 @@ int main(int argc, char **argv) {
 			case 'v': // Audio Volume
 				config.audio_volume = strtof(optarg, NULL);
 				break;
+			case 'c': // Carrier
+				if(config.num_carriers == MAX_CARRIERS) {
+					fprintf(stderr, "At most %d carriers\n", MAX_CARRIERS);
+					return 1;
+				}
+				if(parse_sca_carrier(optarg, &config.carriers[config.num_carriers], config.num_carriers) != 0) {
+					fprintf(stderr, "Invalid carrier: %s\n", optarg);
+					return 1;
+				}
+				config.num_carriers++;
+				break;
+			case 'r': // Input rate
+				config.input_rate = strtoul(optarg, NULL, 10);
+				break;
+			case 'L': // LPF
+				config.lpf_cutoff = strtof(optarg, NULL);
+				break;
+			case 'e': // Preemphasis
+				config.preemphasis = atoi(optarg);
+				break;
 			case 'h':
 				show_help(argv[0]);
 				return 1;
 		}
 	}
 
+	if(config.input_rate < 8000 || config.input_rate > config.sample_rate || config.sample_rate % config.input_rate != 0) {
+		fprintf(stderr, "The input rate has to divide %u, such as 16000, 32000, 48000 or 96000\n", config.sample_rate);
+		return 1;
+	}
+	if(config.lpf_cutoff >= config.input_rate * 0.5f) {
+		config.lpf_cutoff = config.input_rate * 0.45f;
+		fprintf(stderr, "LPF cutoff over niquist, limiting to %.0f.\n", config.lpf_cutoff);
+	}
+
+	if(config.num_carriers == 0) config.carriers[config.num_carriers++] = single_carrier;
+	config.channels = count_sca_channels(config.carriers, config.num_carriers);
+	for(uint8_t c = 0; c < config.num_carriers; c++) {
+		if(!check_fm_block_deviation(config.carriers[c].deviation, config.carriers[c].clipper, config.sample_rate)) {
+			fprintf(stderr, "Carrier %d: a deviation of %.1f Hz with a clip of %.2f does not fit a sample rate of %u\n", c + 1, config.carriers[c].deviation, config.carriers[c].clipper, config.sample_rate);
+			return 1;
+		}
+		printf("Carrier %d: %.1f Hz, %.1f Hz deviation, level %.3f, from channel %d\n", c + 1, config.carriers[c].freq, config.carriers[c].deviation, config.carriers[c].volume * config.master_volume, config.carriers[c].channel + 1);
+	}
+
 	pa_buffer_attr input_buffer_atr = {
 		.maxlength = buffer_maxlength,
 		.fragsize = buffer_tlength_fragsize
@@ -176,7 +252,7 @@ int main(int argc, char **argv) {
 	memset(&runtime, 0, sizeof(runtime));
 
 	printf("Connecting to input device... (%s)\n", audio_input_device);
-	opentime_pulse_error = init_PulseInputDevice(&runtime.input, config.sample_rate, 1, "sca95", "Main Audio Input", audio_input_device, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
+	opentime_pulse_error = init_PulseInputDevice(&runtime.input, config.input_rate, config.channels, "sca95", "Main Audio Input", audio_input_device, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
 	if (opentime_pulse_error) {
 		fprintf(stderr, "Error: cannot open input device: %s\n", pa_strerror(opentime_pulse_error));
 		return 1;
@@ -191,11 +267,20 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	if(init_sca_modulator(&runtime.sca, config.carriers, config.num_carriers, config.audio_volume, config.lpf_cutoff, config.preemphasis, config.input_rate, config.sample_rate, BUFFER_SIZE) != 0) {
+		fprintf(stderr, "Error: cannot set up the carriers\n");
+		free_sca_modulator(&runtime.sca);
+		free_PulseDevice(&runtime.input);
+		free_PulseDevice(&runtime.output);
+		return 1;
+	}
+
 	signal(SIGINT, stop);
 	signal(SIGTERM, stop);
 
 	int ret = run_sca95(config, &runtime);
 	printf("Cleaning up...\n");
+	free_sca_modulator(&runtime.sca);
 	free_PulseDevice(&runtime.input);
 	free_PulseDevice(&runtime.output);
 	return ret;
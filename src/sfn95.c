@@ -0,0 +1,494 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <inttypes.h>
+
+#define buffer_maxlength 49152
+#define buffer_tlength_fragsize 16384
+
+#include "../io/audio.h"
+#include "../io/udp.h"
+#include "../dsp/polyphase.h"
+#include "../lib/mpx_dist.h"
+
+#define OUTPUT_BLOCK 1024
+
+#define INTERPOLATOR_PHASES 256
+#define INTERPOLATOR_LENGTH 32 // Longer than for audio, the subcarriers sit close to nyquist
+
+#define RING_HEADROOM_SECONDS 1.0 // Kept on top of the delay, for packets that arrive early
+
+#define LOCK_BANDWIDTH 0.05 // Hz, of the loop that trims the playout rate
+#define LOCK_DAMPING 0.7
+#define ERROR_SMOOTHING_SECONDS 0.25 // The output latency we're told jitters by a few ms, the loop needs far better than that
+#define MAX_DRIFT 0.0005 // 500 ppm
+#define RESYNC_SECONDS 0.005 // Further off than this and we jump instead of slewing
+
+#define TIMELINE_RESET_NS 100000000 // A packet this far off the sender's timeline means the sender restarted
+
+#define MIN_SAMPLE_RATE 32000 // Anything outside of these isn't an MPX, a stray or foreign packet
+#define MAX_SAMPLE_RATE 768000
+#define RATE_CHANGE_PACKETS 16 // In a row at a new rate before the stream is opened again for it
+
+volatile uint8_t to_run = 1;
+
+static void stop(int signum) {
+    (void)signum;
+    printf("\nReceived stop signal.\n");
+    to_run = 0;
+}
+
+typedef struct {
+    UDPAddress group;
+    const char* interface;
+    const char* pulse_device;
+    float delay_ms;
+    float clock_offset_ms;
+    int stats_interval;
+    int quiet;
+} SFN95_Config;
+
+typedef struct {
+    int sockfd;
+    PulseOutputDevice output;
+    int64_t clock_offset_ns;
+
+    uint32_t sample_rate; // 0 until the first packet
+    uint32_t phase_quantum;
+    uint32_t pending_rate; // A rate other than sample_rate, and how many packets in a row have had it
+    uint32_t pending_packets;
+
+    // Composite by absolute sample index, written twice (at i and i + size) so the taps are always contiguous
+    float* ring;
+    uint32_t ring_samples; // power of two
+    uint64_t* chunk_index; // Which MPXDIST_SAMPLES chunk sits in each slot, plus one, 0 is empty
+
+    // The sender's timeline, index to CLOCK_REALTIME
+    bool timeline_valid;
+    uint64_t tag_index, mid_index, ref_index;
+    int64_t tag_ns, mid_ns, ref_ns;
+    double ns_per_sample;
+
+    // Playout, the position is split as the absolute index does not leave enough of a double for the fraction
+    bool playing;
+    uint64_t read_index;
+    double read_fraction;
+    double ratio;
+    double error_average; // samples, wanted minus actual
+    double error_integral;
+    PolyphaseFilter interpolator;
+
+    uint32_t next_sequence;
+    bool sequence_valid;
+    uint64_t received, lost, late, missing, resyncs;
+    time_t last_stats;
+} SFN95_Runtime;
+
+void show_version() {
+    printf("sfn95 (an SFN MPX receiver by radio95) version 1.0\n");
+}
+void show_help(char *name) {
+    printf(
+        "Usage: \t%s\n"
+        "\t-i,--ip\t\tMulticast group or local address to listen on [default: any]\n"
+        "\t-p,--port\tPort to listen on [default: %d]\n"
+        "\t-I,--interface\tNetwork interface for multicast\n"
+        "\t-d,--device\tPulseAudio device to play the composite on\n"
+        "\t-D,--delay\tPlayout delay after the sender's timestamp in ms, the same on every site [default: 500]\n"
+        "\t-o,--offset\tAdd this many ms to the local clock, to test what a badly synced site does [default: 0]\n"
+        "\t-S,--stats\tPrint statistics every this many seconds, 0 to disable [default: 10]\n"
+        "\t-q,--quiet\tOnly print errors\n",
+        name,
+        MPXDIST_DEFAULT_PORT
+    );
+}
+
+static int64_t local_realtime_ns(const SFN95_Runtime* runtime) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + runtime->clock_offset_ns;
+}
+
+static void free_stream(SFN95_Runtime* runtime) {
+    if (runtime->output.initialized) free_PulseDevice(&runtime->output);
+    free(runtime->ring);
+    free(runtime->chunk_index);
+    free_polyphase_filter(&runtime->interpolator);
+    runtime->ring = NULL;
+    runtime->chunk_index = NULL;
+    runtime->sample_rate = 0;
+    runtime->timeline_valid = false;
+    runtime->playing = false;
+}
+
+static int open_stream(const SFN95_Config* config, SFN95_Runtime* runtime, uint32_t sample_rate) {
+    double seconds = config->delay_ms / 1000.0 + RING_HEADROOM_SECONDS;
+    uint32_t ring_samples = MPXDIST_SAMPLES; // At least a whole packet, every slot of chunk_index holds one
+    while (ring_samples < seconds * sample_rate) ring_samples <<= 1;
+    if (ring_samples < 2 * MPXDIST_SAMPLES) {
+        fprintf(stderr, "The playout buffer for %u Hz is too short\n", sample_rate);
+        return 1;
+    }
+
+    runtime->ring = calloc((size_t)ring_samples * 2, sizeof(float));
+    runtime->chunk_index = calloc(ring_samples / MPXDIST_SAMPLES, sizeof(uint64_t));
+    if (!runtime->ring || !runtime->chunk_index || init_polyphase_filter(&runtime->interpolator, INTERPOLATOR_PHASES, INTERPOLATOR_LENGTH, 0.47f, 1.0f) != 0) {
+        fprintf(stderr, "Failed to allocate the playout buffer\n");
+        free_stream(runtime);
+        return 1;
+    }
+    runtime->ring_samples = ring_samples;
+    runtime->sample_rate = sample_rate;
+    runtime->phase_quantum = MPXDist_phase_quantum(sample_rate);
+
+    pa_buffer_attr output_buffer_atr = {
+        .maxlength = buffer_maxlength,
+        .tlength = buffer_tlength_fragsize,
+        .prebuf = (uint32_t)-1,
+        .minreq = (uint32_t)-1,
+        .fragsize = (uint32_t)-1
+    };
+    printf("Connecting to output device... (%s)\n", config->pulse_device ? config->pulse_device : "default");
+    int opentime_pulse_error = init_PulseOutputDevice(&runtime->output, sample_rate, 1, "sfn95", "SFN MPX", config->pulse_device, &output_buffer_atr, PA_SAMPLE_FLOAT32NE);
+    if (opentime_pulse_error) {
+        fprintf(stderr, "Error: cannot open output device: %s\n", pa_strerror(opentime_pulse_error));
+        free_stream(runtime);
+        return 1;
+    }
+
+    if (config->quiet == 0) printf("Playing %u Hz MPX %.1f ms after its timestamp, %u sample jitter buffer\n", sample_rate, config->delay_ms, ring_samples);
+    return 0;
+}
+
+static void reset_timeline(SFN95_Runtime* runtime, const MPXDistHeader* header) {
+    runtime->tag_index = runtime->mid_index = runtime->ref_index = header->sample_index;
+    runtime->tag_ns = runtime->mid_ns = runtime->ref_ns = header->timestamp_ns;
+    runtime->ns_per_sample = 1e9 / runtime->sample_rate;
+    runtime->timeline_valid = true;
+}
+
+static void update_timeline(SFN95_Runtime* runtime, const MPXDistHeader* header) {
+    if (!runtime->timeline_valid || (header->flags & MPXDIST_FLAG_RESTART)) {
+        reset_timeline(runtime, header);
+        return;
+    }
+    if (header->sample_index <= runtime->tag_index) {
+        if (runtime->tag_index - header->sample_index > runtime->sample_rate) reset_timeline(runtime, header); // Went back in time, a restart we missed the first packet of
+        return; // Reordered, we already know a later point
+    }
+
+    double predicted = runtime->tag_ns + (double)(header->sample_index - runtime->tag_index) * runtime->ns_per_sample;
+    if (fabs(header->timestamp_ns - predicted) > TIMELINE_RESET_NS) {
+        reset_timeline(runtime, header);
+        return;
+    }
+
+    runtime->tag_index = header->sample_index;
+    runtime->tag_ns = header->timestamp_ns;
+
+    // The rate of the sender's clock against the wall clock, over the last one to two seconds
+    if (runtime->tag_index - runtime->mid_index >= runtime->sample_rate) {
+        if (runtime->mid_index - runtime->ref_index >= runtime->sample_rate) {
+            runtime->ref_index = runtime->mid_index;
+            runtime->ref_ns = runtime->mid_ns;
+        }
+        runtime->mid_index = runtime->tag_index;
+        runtime->mid_ns = runtime->tag_ns;
+    }
+    if (runtime->tag_index - runtime->ref_index >= runtime->sample_rate / 2) {
+        runtime->ns_per_sample = (double)(runtime->tag_ns - runtime->ref_ns) / (double)(runtime->tag_index - runtime->ref_index);
+    }
+}
+
+static void handle_packet(const SFN95_Config* config, SFN95_Runtime* runtime, const MPXDistPacket* packet) {
+    const MPXDistHeader* header = &packet->header;
+
+    if (header->sample_rate != runtime->sample_rate) {
+        // One odd packet doesn't tear down the stream, the rate has to hold for a while first
+        if (header->sample_rate != runtime->pending_rate) {
+            runtime->pending_rate = header->sample_rate;
+            runtime->pending_packets = 0;
+        }
+        if (++runtime->pending_packets < RATE_CHANGE_PACKETS) return;
+        if (runtime->sample_rate != 0) {
+            printf("Sample rate changed to %u\n", header->sample_rate);
+            free_stream(runtime);
+        }
+        if (open_stream(config, runtime, header->sample_rate) != 0) {
+            to_run = 0;
+            return;
+        }
+    }
+    runtime->pending_rate = 0;
+    runtime->pending_packets = 0;
+
+    runtime->received++;
+    if (header->flags & MPXDIST_FLAG_RESTART) runtime->sequence_valid = false;
+    if (runtime->sequence_valid && header->sequence != runtime->next_sequence) {
+        int32_t gap = (int32_t)(header->sequence - runtime->next_sequence);
+        if (gap > 0) runtime->lost += gap;
+    }
+    if (!runtime->sequence_valid || (int32_t)(header->sequence - runtime->next_sequence) >= 0) runtime->next_sequence = header->sequence + 1;
+    runtime->sequence_valid = true;
+
+    update_timeline(runtime, header);
+
+    uint64_t chunk = header->sample_index / MPXDIST_SAMPLES;
+    if (runtime->playing && header->sample_index + MPXDIST_SAMPLES + INTERPOLATOR_LENGTH < runtime->read_index) {
+        runtime->late++;
+        return;
+    }
+
+    uint32_t mask = runtime->ring_samples - 1;
+    uint32_t start = (uint32_t)(header->sample_index & mask);
+    memcpy(&runtime->ring[start], packet->samples, sizeof(packet->samples));
+    memcpy(&runtime->ring[start + runtime->ring_samples], packet->samples, sizeof(packet->samples));
+    runtime->chunk_index[chunk & (runtime->ring_samples / MPXDIST_SAMPLES - 1)] = chunk + 1;
+}
+
+static bool have_samples(const SFN95_Runtime* runtime, uint64_t first, uint64_t last) {
+    uint32_t chunk_mask = runtime->ring_samples / MPXDIST_SAMPLES - 1;
+    uint64_t a = first / MPXDIST_SAMPLES, b = last / MPXDIST_SAMPLES;
+    return runtime->chunk_index[a & chunk_mask] == a + 1 && runtime->chunk_index[b & chunk_mask] == b + 1;
+}
+
+static void drain_socket(const SFN95_Config* config, SFN95_Runtime* runtime, int timeout_ms) {
+    MPXDistPacket packet;
+
+    struct pollfd pfd = {.fd = runtime->sockfd, .events = POLLIN};
+    if (timeout_ms > 0 && poll(&pfd, 1, timeout_ms) <= 0) return;
+
+    while (to_run) {
+        ssize_t len = recv(runtime->sockfd, &packet, sizeof(packet), MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("recv");
+            return;
+        }
+        if ((size_t)len != sizeof(MPXDistPacket)) continue;
+        if (packet.header.magic != MPXDIST_MAGIC || packet.header.version != MPXDIST_VERSION) continue;
+        if (packet.header.samples != MPXDIST_SAMPLES || packet.header.sample_index % MPXDIST_SAMPLES != 0) continue;
+        if (packet.header.sample_rate < MIN_SAMPLE_RATE || packet.header.sample_rate > MAX_SAMPLE_RATE) continue;
+        handle_packet(config, runtime, &packet);
+    }
+}
+
+// Moves the playout towards where the timeline says the first sample of this block has to be
+static void steer_playout(const SFN95_Config* config, SFN95_Runtime* runtime, pa_usec_t latency) {
+    // The sender's time that has to be on air when this block starts playing
+    int64_t air_ns = local_realtime_ns(runtime) + (int64_t)latency * 1000 - (int64_t)(config->delay_ms * 1e6);
+    double offset = (double)(air_ns - runtime->tag_ns) / runtime->ns_per_sample; // samples after tag_index
+
+    if (!runtime->playing) {
+        double whole = floor(offset);
+        runtime->read_index = runtime->tag_index + (int64_t)whole;
+        runtime->read_fraction = offset - whole;
+        runtime->ratio = 1.0;
+        runtime->error_average = 0.0;
+        runtime->error_integral = 0.0;
+        runtime->playing = true;
+        return;
+    }
+
+    double error = ((double)(int64_t)(runtime->tag_index - runtime->read_index) + offset) - runtime->read_fraction;
+    double rate = runtime->sample_rate;
+
+    if (fabs(error) > RESYNC_SECONDS * rate) {
+        // Jump by whole periods of the 4750 hz base, so the pilot and the subcarriers do not see a phase step
+        int64_t jump = (int64_t)llround(error / runtime->phase_quantum) * runtime->phase_quantum;
+        runtime->read_index += jump;
+        runtime->error_average = error - jump;
+        runtime->error_integral = 0.0;
+        runtime->ratio = 1.0;
+        runtime->resyncs++;
+        return;
+    }
+
+    double block_seconds = OUTPUT_BLOCK / rate;
+    runtime->error_average += (error - runtime->error_average) * fmin(1.0, block_seconds / ERROR_SMOOTHING_SECONDS);
+    runtime->error_integral += runtime->error_average * block_seconds;
+
+    double omega = 2.0 * M_PI * LOCK_BANDWIDTH;
+    double drift = (2.0 * LOCK_DAMPING * omega * runtime->error_average + omega * omega * runtime->error_integral) / rate;
+    if (drift > MAX_DRIFT) drift = MAX_DRIFT;
+    if (drift < -MAX_DRIFT) drift = -MAX_DRIFT;
+    runtime->ratio = 1.0 + drift;
+}
+
+static void render_block(SFN95_Runtime* runtime, float* output) {
+    if (!runtime->playing) {
+        memset(output, 0, sizeof(float) * OUTPUT_BLOCK);
+        return;
+    }
+
+    uint32_t mask = runtime->ring_samples - 1;
+    uint32_t half = INTERPOLATOR_LENGTH / 2;
+    bool missing = false;
+
+    for (int i = 0; i < OUTPUT_BLOCK; i++) {
+        uint64_t first = runtime->read_index - half + 1;
+        if (have_samples(runtime, first, first + INTERPOLATOR_LENGTH - 1)) {
+            output[i] = polyphase_interpolate(&runtime->interpolator, &runtime->ring[first & mask], 1, (float)runtime->read_fraction);
+        } else {
+            output[i] = 0.0f;
+            missing = true;
+        }
+
+        runtime->read_fraction += runtime->ratio;
+        double whole = floor(runtime->read_fraction);
+        runtime->read_index += (uint64_t)whole;
+        runtime->read_fraction -= whole;
+    }
+    if (missing) runtime->missing++;
+}
+
+static void print_stats(const SFN95_Runtime* runtime) {
+    double offset_us = runtime->sample_rate ? runtime->error_average / runtime->sample_rate * 1e6 : 0.0;
+    printf("rx %" PRIu64 " lost %" PRIu64 " late %" PRIu64 " blocks missing %" PRIu64 " resyncs %" PRIu64 " playout error %.1f us drift %.1f ppm sender clock %.1f ppm\n",
+        runtime->received, runtime->lost, runtime->late, runtime->missing, runtime->resyncs,
+        offset_us, (runtime->ratio - 1.0) * 1e6,
+        runtime->sample_rate ? (1e9 / (runtime->ns_per_sample * runtime->sample_rate) - 1.0) * 1e6 : 0.0);
+}
+
+int run_sfn95(const SFN95_Config* config, SFN95_Runtime* runtime) {
+    float output[OUTPUT_BLOCK];
+
+    while (to_run) {
+        if (!runtime->output.initialized) {
+            drain_socket(config, runtime, 100); // Nothing to play yet, wait for the first packet
+            continue;
+        }
+
+        drain_socket(config, runtime, 0);
+        if (!runtime->output.initialized) continue;
+
+        if (runtime->timeline_valid) {
+            pa_usec_t latency = 0;
+            int pulse_error = get_latency_PulseOutputDevice(&runtime->output, &latency);
+            if (pulse_error) {
+                fprintf(stderr, "Error getting the output latency: %s\n", pa_strerror(pulse_error));
+                latency = 0;
+            }
+            steer_playout(config, runtime, latency);
+        }
+        render_block(runtime, output);
+
+        int pulse_error = write_PulseOutputDevice(&runtime->output, output, sizeof(output));
+        if (pulse_error) {
+            fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
+            return 1;
+        }
+
+        if (config->stats_interval > 0 && config->quiet == 0) {
+            time_t now = time(NULL);
+            if (now - runtime->last_stats >= config->stats_interval) {
+                runtime->last_stats = now;
+                print_stats(runtime);
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    show_version();
+
+    SFN95_Config config = {
+        .interface = NULL,
+        .pulse_device = NULL,
+        .delay_ms = 500.0f,
+        .clock_offset_ms = 0.0f,
+        .stats_interval = 10,
+        .quiet = 0
+    };
+    const char* listen_ip = NULL;
+    int port = MPXDIST_DEFAULT_PORT;
+
+    int opt;
+    const char *short_opt = "i:p:I:d:D:o:S:qh";
+    const struct option long_opt[] = {
+        {"ip", required_argument, NULL, 'i'},
+        {"port", required_argument, NULL, 'p'},
+        {"interface", required_argument, NULL, 'I'},
+        {"device", required_argument, NULL, 'd'},
+        {"delay", required_argument, NULL, 'D'},
+        {"offset", required_argument, NULL, 'o'},
+        {"stats", required_argument, NULL, 'S'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    while ((opt = getopt_long(argc, argv, short_opt, long_opt, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                listen_ip = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'I':
+                config.interface = optarg;
+                break;
+            case 'd':
+                config.pulse_device = optarg;
+                break;
+            case 'D':
+                config.delay_ms = strtof(optarg, NULL);
+                break;
+            case 'o':
+                config.clock_offset_ms = strtof(optarg, NULL);
+                break;
+            case 'S':
+                config.stats_interval = atoi(optarg);
+                break;
+            case 'q':
+                config.quiet = 1;
+                break;
+            case 'h':
+                show_help(argv[0]);
+                return 0;
+            default:
+                show_help(argv[0]);
+                return 1;
+        }
+    }
+
+    if (config.delay_ms <= 0) {
+        fprintf(stderr, "The delay has to cover the network and the output latency, it can't be %.1f ms\n", config.delay_ms);
+        return 1;
+    }
+    if (parse_UDPAddress(&config.group, listen_ip, port) != 0) {
+        fprintf(stderr, "Invalid listen IP address: %s\n", listen_ip);
+        return 1;
+    }
+
+    SFN95_Runtime runtime;
+    memset(&runtime, 0, sizeof(runtime));
+    runtime.clock_offset_ns = (int64_t)(config.clock_offset_ms * 1e6);
+    runtime.last_stats = time(NULL);
+
+    runtime.sockfd = open_UDPListener(&config.group, config.interface, false, true);
+    if (runtime.sockfd < 0) return 1;
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(runtime.sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)); // We only read between writes to the output
+
+    if (config.quiet == 0) printf("Listening for MPX on %s:%d\n", listen_ip ? listen_ip : "any", port);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    int ret = run_sfn95(&config, &runtime);
+
+    printf("Cleaning up...\n");
+    if (config.quiet == 0) print_stats(&runtime);
+    free_stream(&runtime);
+    close(runtime.sockfd);
+
+    return ret;
+}
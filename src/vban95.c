@@ -1,24 +1,44 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <getopt.h>
-#include <pwd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <linux/filter.h>
 
 #define buffer_maxlength 12288
 #define buffer_tlength_fragsize 12288
 #define buffer_prebuf 8
 
 #include "../io/audio.h"
+#include "../io/udp.h"
 #include "../lib/debug.h"
 #include "../lib/vban.h"
+#include "../lib/vban_stats.h"
 
 #define BUF_SIZE 1500
 #define MAX_AUDIO_DATA_SIZE (BUF_SIZE - sizeof(VBANHeader))
 #define MAX_BUFFER_PACKETS 24
 
-#define POLL_TIMEOUT_MS 75
+#define POLL_TIMEOUT_MS 75 // Longest a worker waits for a packet before it looks at to_run and the stats again
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#define STREAM_NAME_OFFSET 8 // Of the name in the VBAN header, a reuseport filter sees the packet from the UDP payload on
+
+#define MAX_STREAMS 8
+#define MAX_WORKERS 16
+
+#define SEQUENCE_RESYNC_FRAMES 65536 // A bigger jump in frame_num is a sender restart, not loss
+#define SINK_SAMPLE_NS 100000000ULL // How often the sink fill is looked at, asking Pulse takes its mainloop lock so not on every packet
 
 typedef struct {
     char data[MAX_AUDIO_DATA_SIZE];
@@ -93,7 +113,57 @@ static void stop(int signum) {
     to_run = 0;
 }
 
-static PulseOutputDevice output = {0};
+typedef struct {
+    char name[16]; // Same size as the VBAN header field, not NUL terminated when full
+    AudioBuffer* buffer;
+    PulseOutputDevice output;
+    uint8_t last_sr;
+    uint8_t last_format;
+    uint8_t last_channels;
+    uint8_t audio_reset;
+
+    VBAN95_StreamStats* stats;
+    bool sequence_valid;
+    uint32_t highest_frame;
+    uint64_t seen_frames; // Bit n set means highest_frame - n arrived
+    uint64_t last_arrival_ns;
+    uint32_t last_timed_frame; // frame_num of the packet last_arrival_ns belongs to
+    uint64_t jitter_scaled; // 16 times the jitter in us, as RFC 3550 A.8 keeps it
+    uint64_t next_sink_ns;
+    bool sink_playing; // Something was written since the output was opened
+    bool sink_dry; // The last look found the sink had played everything, a dry spell counts once
+    uint64_t last_printed;
+} VBAN95_Stream;
+
+typedef struct {
+    UDPAddress remote;
+    bool any_remote;
+    UDPAddress group;
+    bool multicast;
+    const char* interface;
+    uint16_t listen_port;
+    const char* pulse_device;
+    int buffer_size;
+    int quiet;
+    int workers;
+    int cpu; // First CPU to pin workers to, -1 leaves the scheduler alone
+    int stats_interval; // Seconds between log lines, 0 is off
+
+    char stream_names[MAX_STREAMS][16];
+    int num_streams;
+} VBAN95_Config;
+
+typedef struct {
+    int id;
+    int sockfd;
+    pthread_t thread;
+    const VBAN95_Config* config;
+    VBAN95_Stream streams[MAX_STREAMS];
+    uint64_t next_stats_ns;
+} VBAN95_Worker;
+
+static VBAN95_Stats* stats = NULL;
+static size_t stats_size = 0;
 
 void process_audio_buffer(AudioBuffer* buffer, PulseOutputDevice* output_device) {
     while (buffer->count > 0) {
@@ -112,39 +182,506 @@ void reset_audio_buffer(AudioBuffer* buffer) {
 }
 
 void show_version() {
-	printf("vban95 (a VBAN AOIP receiver by radio95) version 1.1\n");
+	printf("vban95 (a VBAN AOIP receiver by radio95) version 1.2\n");
 }
 void show_help(char *name) {
     printf(
         "Usage: \t%s\n"
         "\t-i,--ip\t\tOverride remote IP address\n"
         "\t-p,--port\tOverride listen port\n"
-        "\t-s,--stream\tOverride stream name\n"
+        "\t-s,--stream\tOverride stream name, repeat or separate with commas for more streams (max %d)\n"
         "\t-b,--buffer\tOverride buffer size (1 to %d)\n"
         "\t-d,--device\tOverride PulseAudio device\n"
+        "\t-m,--multicast\tJoin an IPv4 or IPv6 multicast group\n"
+        "\t-I,--interface\tNetwork interface for the multicast group\n"
+        "\t-w,--workers\tNumber of receive workers sharing the port (1 to %d)\n"
+        "\t-a,--affinity\tPin worker N to CPU (this + N)\n"
+        "\t-S,--stats\tPrint receive statistics every this many seconds\n"
+        "\t-o,--stats_file\tKeep the statistics in this file for other programs to mmap (e.g. /dev/shm/vban95)\n"
         "\t-q,--quiet\tSuppress output messages\n",
-        name, MAX_BUFFER_PACKETS
+        name, MAX_STREAMS, MAX_BUFFER_PACKETS, MAX_WORKERS
     );
 }
 
+int add_stream_names(VBAN95_Config* config, const char* list) {
+    const char* start = list;
+    while (*start) {
+        const char* end = strchr(start, ',');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        if (len != 0) {
+            if (config->num_streams == MAX_STREAMS) {
+                fprintf(stderr, "Too many streams, max is %d\n", MAX_STREAMS);
+                return 1;
+            }
+            memset(config->stream_names[config->num_streams], 0, 16);
+            memcpy(config->stream_names[config->num_streams], start, len > 16 ? 16 : len);
+            config->num_streams++;
+        }
+        if (!end) break;
+        start = end + 1;
+    }
+    return 0;
+}
+
+// With multicast every socket on the port gets a copy of each packet, so the workers split the streams between them
+// With unicast SO_REUSEPORT already hashes each sender to a single worker, so everyone takes every stream
+static inline bool worker_owns_stream(const VBAN95_Worker* worker, int stream) {
+    if (!worker->config->multicast) return true;
+    return (stream % worker->config->workers) == worker->id;
+}
+
+// Unicast to the port still lands on just one of the sockets when there's multicast, so the kernel is told to pick the socket of the worker
+// that owns the stream named in the header, a socket's index in the group is its worker's as they are opened in order,
+// anything else (pings, streams that aren't taken) goes to worker 0, the group's packets still go to every socket
+static int steer_streams(int sockfd, const VBAN95_Config* config) {
+    struct sock_filter code[MAX_STREAMS * 10 + 1]; // 4 words of name each, a load, a mask and a compare per word, then the return
+    uint16_t len = 0;
+    for (int i = 0; i < config->num_streams; i++) {
+        const char* name = config->stream_names[i];
+        size_t compared = strnlen(name, 16) + 1; // Up to the NUL, like strncmp, what a sender leaves after it isn't looked at
+        if (compared > 16) compared = 16;
+
+        uint16_t jumps[4];
+        uint8_t num_jumps = 0;
+        for (size_t word = 0; word * 4 < compared; word++) {
+            uint32_t value = 0, mask = 0;
+            for (size_t b = 0; b < 4; b++) {
+                bool used = word * 4 + b < compared;
+                value = (value << 8) | (used ? (uint8_t)name[word * 4 + b] : 0);
+                mask = (mask << 8) | (used ? 0xff : 0);
+            }
+            code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, STREAM_NAME_OFFSET + word * 4);
+            if (mask != 0xffffffff) code[len++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, mask);
+            jumps[num_jumps++] = len;
+            code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, value, 0, 0);
+        }
+        code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i % config->workers);
+        for (uint8_t j = 0; j < num_jumps; j++) code[jumps[j]].jf = (uint8_t)(len - jumps[j] - 1); // On to the next stream
+    }
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    struct sock_fprog program = {.len = len, .filter = code};
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program));
+}
+
+void send_ping_reply(const VBAN95_Worker* worker, const VBANHeader* request, const UDPAddress* sender) {
+    VBANHeaderUnion reply_header;
+    VBANPing0DataUnion ping_data;
+    init_VBANPingReply(&reply_header.packet_data, &ping_data.data, request, VBANPING_TYPE_RECEPTOR, VBANPING_FEATURE_AUDIO | VBANPING_FEATURE_AOIP, "vban95", 1, 2);
+
+    char sender_ip[INET6_ADDRSTRLEN];
+    format_UDPAddress(sender, sender_ip, sizeof(sender_ip));
+    format_UDPAddress(sender, ping_data.data.DistantIP_ascii, sizeof(ping_data.data.DistantIP_ascii)); // Long IPv6 addresses don't fit, those get a placeholder
+    ping_data.data.DistantPort = htons(worker->config->listen_port);
+
+    char reply_buffer[sizeof(VBANHeader) + sizeof(VBANPing0Data)];
+    memcpy(reply_buffer, &reply_header.raw_data, sizeof(VBANHeader));
+    memcpy(reply_buffer + sizeof(VBANHeader), &ping_data.raw_data, sizeof(VBANPing0Data));
+    ssize_t sent_len = sendto(worker->sockfd, reply_buffer, sizeof(reply_buffer), 0,
+                              (const struct sockaddr *)&sender->addr, sender->len);
+    if (sent_len < 0) {
+        perror("sendto");
+    } else {
+        if (worker->config->quiet == 0) printf("Sent VBAN ping reply to %s:%d\n", sender_ip, ntohs(((const struct sockaddr_in*)&sender->addr)->sin_port));
+    }
+}
+
+static inline uint8_t histogram_bucket(uint64_t value, uint8_t buckets) {
+    if (value < 4) return 0;
+    uint8_t bucket = (63 - __builtin_clzll(value)) - 2;
+    return (bucket >= buckets) ? buckets - 1 : bucket;
+}
+
+// Around every change to a slot, a reader that copied it while its sequence was odd or moved takes it again
+static inline void begin_stats_update(VBAN95_StreamStats* st) {
+    __atomic_store_n(&st->sequence, st->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void end_stats_update(VBAN95_StreamStats* st) {
+    __atomic_store_n(&st->sequence, st->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Returns true for duplicates, those should not be played again
+bool account_sequence(VBAN95_Stream* stream, uint32_t frame) {
+    VBAN95_StreamStats* st = stream->stats;
+    st->last_frame = frame;
+
+    int32_t diff = (int32_t)(frame - stream->highest_frame);
+    if (!stream->sequence_valid || diff > SEQUENCE_RESYNC_FRAMES || diff < -SEQUENCE_RESYNC_FRAMES) {
+        // First packet, or the sender restarted its counter
+        stream->sequence_valid = true;
+        stream->highest_frame = frame;
+        stream->seen_frames = 1;
+        return false;
+    }
+
+    if (diff > 0) {
+        st->lost += diff - 1;
+        stream->seen_frames = (diff >= 64) ? 1 : ((stream->seen_frames << diff) | 1);
+        stream->highest_frame = frame;
+        return false;
+    }
+
+    uint32_t age = -diff;
+    if (age < 64 && (stream->seen_frames & (1ULL << age))) {
+        st->duplicated++;
+        return true;
+    }
+    st->reordered++;
+    if (st->lost) st->lost--; // Counted as lost when the gap opened
+    if (age < 64) stream->seen_frames |= 1ULL << age;
+    return false;
+}
+
+// Called before the packet is written, so the latency Pulse reports is what the sink had left, Pulse gives 0 once it played past the end
+// of what we wrote, that is an underrun. The gap expected between two packets comes from their frame_num, so a lost packet isn't jitter
+void account_timing(VBAN95_Stream* stream, uint32_t frame, uint64_t arrival_ns, uint64_t frame_ns, bool played) {
+    VBAN95_StreamStats* st = stream->stats;
+    pa_usec_t latency = 0;
+    bool measured = false;
+    if (played && arrival_ns >= stream->next_sink_ns) {
+        measured = get_latency_PulseOutputDevice(&stream->output, &latency) == 0;
+        stream->next_sink_ns = arrival_ns + SINK_SAMPLE_NS;
+    }
+
+    begin_stats_update(st);
+    int32_t frames = (int32_t)(frame - stream->last_timed_frame);
+    if (stream->last_arrival_ns != 0 && frames <= SEQUENCE_RESYNC_FRAMES && frames >= -SEQUENCE_RESYNC_FRAMES) {
+        int64_t d = (int64_t)(arrival_ns - stream->last_arrival_ns) - (int64_t)frames * (int64_t)frame_ns;
+        uint64_t d_us = (uint64_t)(d < 0 ? -d : d) / 1000;
+        if (d_us > UINT32_MAX) d_us = UINT32_MAX; // A sender that paused, the average takes it and decays
+        stream->jitter_scaled += d_us - ((stream->jitter_scaled + 8) >> 4);
+        st->jitter_us = (uint32_t)(stream->jitter_scaled >> 4);
+        if (d_us > st->max_jitter_us) st->max_jitter_us = (uint32_t)d_us;
+        st->jitter_histogram[histogram_bucket(d_us, VBAN95_JITTER_BUCKETS)]++;
+    }
+    stream->last_arrival_ns = arrival_ns;
+    stream->last_timed_frame = frame;
+    st->last_arrival_ns = arrival_ns;
+
+    if (measured) {
+        bool dry = (latency == 0);
+        if (dry && !stream->sink_dry && stream->sink_playing) st->underruns++;
+        stream->sink_dry = dry;
+        stream->sink_playing = true;
+
+        st->sink_fill_us = (int32_t)latency;
+        uint32_t fill_bucket = st->sink_fill_us / 4000;
+        st->fill_histogram[(fill_bucket >= VBAN95_FILL_BUCKETS) ? VBAN95_FILL_BUCKETS - 1 : fill_bucket]++;
+    }
+    end_stats_update(st);
+}
+
+// Quiet streams are skipped unless all is set
+void print_stats(VBAN95_Worker* worker, bool all) {
+    for (int i = 0; i < worker->config->num_streams; i++) {
+        VBAN95_Stream* stream = &worker->streams[i];
+        if (!stream->stats || stream->stats->received == 0) continue;
+        if (!all && stream->stats->received == stream->last_printed) continue;
+        stream->last_printed = stream->stats->received;
+        const VBAN95_StreamStats* st = stream->stats;
+        printf("[%.16s] w%d rx %" PRIu64 " lost %" PRIu64 " dup %" PRIu64 " reord %" PRIu64 " jitter %.2f/%.2f ms fill %.1f ms underruns %" PRIu64 "\n",
+            stream->name, worker->id, st->received, st->lost, st->duplicated, st->reordered,
+            st->jitter_us / 1000.0f, st->max_jitter_us / 1000.0f, st->sink_fill_us / 1000.0f, st->underruns);
+    }
+    fflush(stdout);
+}
+
+void handle_audio_packet(VBAN95_Worker* worker, VBAN95_Stream* stream, const VBANHeaderUnion* data, char* audio_data, size_t audio_data_size, uint64_t arrival_ns) {
+    const VBAN95_Config* config = worker->config;
+    int quiet = config->quiet;
+
+    begin_stats_update(stream->stats);
+    stream->stats->received++;
+    stream->stats->bytes += audio_data_size;
+    bool duplicate = account_sequence(stream, data->packet_data.frame_num);
+    end_stats_update(stream->stats);
+    if (duplicate) return;
+
+    uint8_t actual_sr_idx = data->packet_data.protocol_sample_rate_idx & 0x1f;
+    if(stream->last_sr != actual_sr_idx) {
+        stream->last_sr = actual_sr_idx;
+        if(quiet == 0) printf("[%.16s] New sample rate of %ld\n", stream->name, VBAN_SRList[stream->last_sr % VBAN_SR_MAXNUMBER]);
+        stream->audio_reset = 1;
+        reset_audio_buffer(stream->buffer);
+    }
+
+    if(stream->last_format != data->packet_data.format_type) {
+        stream->last_format = data->packet_data.format_type;
+        if(quiet == 0) printf("[%.16s] New data format of %s\n", stream->name, VBAN_TextBITList[stream->last_format % VBAN_BIT_MAXNUMBER]); // Here it should be fine to use the modulo, as during the reset we point out the idx may be shit
+        stream->audio_reset = 1;
+        reset_audio_buffer(stream->buffer);
+    }
+
+    if(stream->last_channels != data->packet_data.sample_channels) {
+        stream->last_channels = data->packet_data.sample_channels;
+        if(quiet == 0) printf("[%.16s] New channel count of %d\n", stream->name, stream->last_channels + 1); // Add 1 because VBAN channels are 0-based
+        stream->audio_reset = 1;
+        reset_audio_buffer(stream->buffer);
+    }
+
+    if(stream->audio_reset) {
+        if (stream->last_sr >= VBAN_SR_MAXNUMBER || stream->last_format >= VBAN_BIT_MAXNUMBER) {
+            fprintf(stderr, "Unsupported sample rate or format\n");
+            return;
+        }
+
+        if (stream->output.initialized) free_PulseDevice(&stream->output);
+
+        pa_buffer_attr buffer_attr = {
+            .maxlength = buffer_maxlength,
+            .tlength = buffer_tlength_fragsize,
+            .prebuf = buffer_prebuf
+        };
+
+        char pulse_stream_name[17] = {0};
+        memcpy(pulse_stream_name, stream->name, 16);
+
+        int result = init_PulseOutputDevice(
+            &stream->output,
+            VBAN_SRList[stream->last_sr],
+            stream->last_channels + 1, // Add 1 because VBAN channels are 0-based
+            "vban95",
+            pulse_stream_name,
+            config->pulse_device,
+            &buffer_attr,
+            VBAN_BITList[stream->last_format]
+        );
+
+        if (result != 0) fprintf(stderr, "Failed to initialize PulseAudio output device: %s\n", pa_strerror(result));
+
+        stream->audio_reset = 0;
+        stream->sink_playing = false;
+        stream->sink_dry = false;
+        stream->next_sink_ns = 0;
+        return;
+    }
+
+    uint64_t frame_ns = (uint64_t)(data->packet_data.samples_per_frame + 1) * 1000000000ULL / VBAN_SRList[stream->last_sr];
+    bool played = add_to_buffer(stream->buffer, audio_data, audio_data_size, &data->packet_data) > 0;
+    account_timing(stream, data->packet_data.frame_num, arrival_ns, frame_ns, played);
+    if (played) process_audio_buffer(stream->buffer, &stream->output);
+}
+
+void* run_worker(void* arg) {
+    VBAN95_Worker* worker = (VBAN95_Worker*)arg;
+    const VBAN95_Config* config = worker->config;
+
+    if (config->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET((config->cpu + worker->id) % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0) fprintf(stderr, "Worker %d: could not set CPU affinity: %s\n", worker->id, strerror(err));
+    }
+
+    char buffer[BUF_SIZE];
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    UDPAddress sender;
+    struct iovec iov = {.iov_base = buffer, .iov_len = BUF_SIZE};
+
+    while (to_run) {
+        struct msghdr msg = {
+            .msg_name = &sender.addr,
+            .msg_namelen = sizeof(sender.addr),
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control)
+        };
+        ssize_t recv_len = recvmsg(worker->sockfd, &msg, 0);
+        if (recv_len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (config->stats_interval) {
+                    struct timespec now;
+                    clock_gettime(CLOCK_REALTIME, &now);
+                    uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+                    if (now_ns >= worker->next_stats_ns) {
+                        print_stats(worker, false);
+                        worker->next_stats_ns = now_ns + config->stats_interval * 1000000000ULL;
+                    }
+                }
+                struct pollfd pfd = {.fd = worker->sockfd, .events = POLLIN};
+                poll(&pfd, 1, POLL_TIMEOUT_MS); // Back as soon as a packet is in
+                continue;
+            } else {
+                perror("recvmsg error");
+                break;
+            }
+        }
+        sender.len = msg.msg_namelen;
+
+        uint64_t arrival_ns = 0;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                arrival_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            }
+        }
+        if (arrival_ns == 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            arrival_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+
+        if (config->stats_interval && arrival_ns >= worker->next_stats_ns) {
+            if (worker->next_stats_ns != 0) print_stats(worker, false);
+            worker->next_stats_ns = arrival_ns + config->stats_interval * 1000000000ULL;
+        }
+
+        if ((size_t)recv_len < sizeof(VBANHeader)) continue;
+
+        if (!config->any_remote && !compare_UDPAddress_host(&sender, &config->remote)) continue;
+
+        VBANHeaderUnion data;
+        memcpy(&data.raw_data, buffer, sizeof(VBANHeader));
+
+        if (memcmp(data.packet_data.vban, "VBAN", 4) != 0) continue;
+
+        uint8_t protocol = data.packet_data.protocol_sample_rate_idx & 0xe0;
+        if(protocol != VBAN_PROTOCOL_AUDIO) {
+            if(protocol == VBAN_PROTOCOL_SERVICE && (worker->id == 0 || !config->multicast)) {
+                // Handle Service protocol
+                uint8_t service_type = data.packet_data.sample_channels;
+                uint8_t service_function = data.packet_data.samples_per_frame; // 0 if ping, 80 if reply
+
+                if(service_type == VBAN_SERVICE_IDENTIFICATION && service_function == 0) send_ping_reply(worker, &data.packet_data, &sender);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < config->num_streams; i++) {
+            if (strncmp(data.packet_data.streamname, worker->streams[i].name, sizeof(data.packet_data.streamname)) != 0) continue;
+            if (worker_owns_stream(worker, i)) handle_audio_packet(worker, &worker->streams[i], &data, buffer + sizeof(VBANHeader), recv_len - sizeof(VBANHeader), arrival_ns);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+void cleanup_worker(VBAN95_Worker* worker) {
+    for (int i = 0; i < worker->config->num_streams; i++) {
+        if (worker->streams[i].output.initialized) free_PulseDevice(&worker->streams[i].output);
+        destroy_audio_buffer(worker->streams[i].buffer);
+    }
+    if (worker->sockfd >= 0) close(worker->sockfd);
+}
+
+int init_worker(VBAN95_Worker* worker, int id, const VBAN95_Config* config) {
+    memset(worker, 0, sizeof(VBAN95_Worker));
+    worker->id = id;
+    worker->config = config;
+    worker->sockfd = -1;
+
+    for (int i = 0; i < config->num_streams; i++) {
+        memcpy(worker->streams[i].name, config->stream_names[i], 16);
+        // Invalid on purpose, so that the first packet always opens the output, even for index 0 formats
+        worker->streams[i].last_sr = 0xff;
+        worker->streams[i].last_format = 0xff;
+        worker->streams[i].last_channels = 0xff;
+        if (!worker_owns_stream(worker, i)) continue;
+        worker->streams[i].buffer = create_audio_buffer(config->buffer_size);
+        if (!worker->streams[i].buffer) {
+            cleanup_worker(worker);
+            return 1;
+        }
+
+        VBAN95_StreamStats* st = &stats->slots[id * MAX_STREAMS + i];
+        memcpy(st->name, config->stream_names[i], 16);
+        st->worker = id;
+        st->active = 1;
+        worker->streams[i].stats = st;
+    }
+
+    worker->sockfd = open_UDPListener(&config->group, config->interface, config->workers > 1, true);
+    if (worker->sockfd < 0) {
+        cleanup_worker(worker);
+        return 1;
+    }
+
+    int one = 1;
+    if (setsockopt(worker->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) perror("setsockopt(SO_TIMESTAMPNS)"); // Not fatal, we then stamp in userspace
+    return 0;
+}
+
+// Without a path the counters just live in anonymous memory
+int open_stats(const char* path) {
+    stats_size = sizeof(VBAN95_Stats);
+    if (path == NULL) {
+        stats = calloc(1, stats_size);
+        if (!stats) {
+            perror("calloc");
+            return 1;
+        }
+    } else {
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("open stats file");
+            return 1;
+        }
+        if (ftruncate(fd, stats_size) != 0) {
+            perror("ftruncate");
+            close(fd);
+            return 1;
+        }
+        stats = mmap(NULL, stats_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (stats == MAP_FAILED) {
+            perror("mmap");
+            stats = NULL;
+            return 1;
+        }
+    }
+
+    stats->version = VBAN95_STATS_VERSION;
+    stats->num_slots = VBAN95_STATS_MAX_SLOTS;
+    stats->pid = getpid();
+    __atomic_store_n(&stats->magic, VBAN95_STATS_MAGIC, __ATOMIC_RELEASE); // Readers check this last
+    return 0;
+}
+
+void close_stats(const char* path) {
+    if (!stats) return;
+    if (path == NULL) free(stats);
+    else munmap(stats, stats_size);
+    stats = NULL;
+}
+
 int main(int argc, char *argv[]) {
     show_version();
 
     char *remote_ip = "0.0.0.0";
-    int listen_port = 6980;
-    char *stream_name = "VBAN";
-    int buffer_size = 8;
-    char *pulse_device = "";
-    int quiet = 0;
-    
+    char *multicast_group = "";
+    char *stats_path = NULL;
+    VBAN95_Config config = {
+        .listen_port = 6980,
+        .buffer_size = 8,
+        .pulse_device = "",
+        .interface = "",
+        .quiet = 0,
+        .workers = 1,
+        .cpu = -1,
+        .stats_interval = 0,
+        .num_streams = 0
+    };
+
     int opt;
-    const char *short_opt = "i:p:s:b:d:qh";
+    const char *short_opt = "i:p:s:b:d:m:I:w:a:S:o:qh";
     const struct option long_opt[] = {
         {"ip", required_argument, NULL, 'i'},
         {"port", required_argument, NULL, 'p'},
         {"stream", required_argument, NULL, 's'},
         {"buffer", required_argument, NULL, 'b'},
         {"device", required_argument, NULL, 'd'},
+        {"multicast", required_argument, NULL, 'm'},
+        {"interface", required_argument, NULL, 'I'},
+        {"workers", required_argument, NULL, 'w'},
+        {"affinity", required_argument, NULL, 'a'},
+        {"stats", required_argument, NULL, 'S'},
+        {"stats_file", required_argument, NULL, 'o'},
         {"quiet", no_argument, NULL, 'q'},
         {"help", no_argument, NULL, 'h'},
         {NULL, 0, NULL, 0}
@@ -155,19 +692,37 @@ int main(int argc, char *argv[]) {
                 remote_ip = optarg;
                 break;
             case 'p':
-                listen_port = atoi(optarg);
+                config.listen_port = atoi(optarg);
                 break;
             case 's':
-                stream_name = optarg;
+                if (add_stream_names(&config, optarg) != 0) return 1;
                 break;
             case 'b':
-                buffer_size = atoi(optarg);
+                config.buffer_size = atoi(optarg);
                 break;
             case 'd':
-                pulse_device = optarg;
+                config.pulse_device = optarg;
+                break;
+            case 'm':
+                multicast_group = optarg;
+                break;
+            case 'I':
+                config.interface = optarg;
+                break;
+            case 'w':
+                config.workers = atoi(optarg);
+                break;
+            case 'a':
+                config.cpu = atoi(optarg);
+                break;
+            case 'S':
+                config.stats_interval = atoi(optarg);
+                break;
+            case 'o':
+                stats_path = optarg;
                 break;
             case 'q':
-                quiet = 1;
+                config.quiet = 1;
                 break;
             case 'h':
                 show_help(argv[0]);
@@ -178,241 +733,74 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (buffer_size <= 0 || buffer_size > MAX_BUFFER_PACKETS) {
+    if (config.buffer_size <= 0 || config.buffer_size > MAX_BUFFER_PACKETS) {
         fprintf(stderr, "Buffer size must be between 1 and %d\n", MAX_BUFFER_PACKETS);
         return 1;
     }
-
-    printf("Starting VBAN receiver with buffer size: %d packets\n", buffer_size);
-
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("socket");
+    if (config.workers <= 0 || config.workers > MAX_WORKERS) {
+        fprintf(stderr, "Worker count must be between 1 and %d\n", MAX_WORKERS);
         return 1;
     }
+    if (config.num_streams == 0) add_stream_names(&config, "VBAN");
 
-    int flags = fcntl(sockfd, F_GETFL, 0);
-    if (flags == -1) {
-        perror("fcntl(F_GETFL)");
-        return -1;
-    }
-
-    if (fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        perror("fcntl(F_SETFL)");
-        return -1;
-    }
-
-    struct sockaddr_in local_addr;
-    memset(&local_addr, 0, sizeof(local_addr));
-    local_addr.sin_family = AF_INET;
-    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    local_addr.sin_port = htons(listen_port);
-
-    if (bind(sockfd, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
-        perror("bind");
-        close(sockfd);
+    if (parse_UDPAddress(&config.remote, remote_ip, 0) != 0) {
+        fprintf(stderr, "Invalid remote IP address: %s\n", remote_ip);
         return 1;
     }
+    UDPAddress any;
+    parse_UDPAddress(&any, (config.remote.addr.ss_family == AF_INET6) ? "::" : "0.0.0.0", 0);
+    config.any_remote = compare_UDPAddress_host(&config.remote, &any);
 
-    struct in_addr remote_addr_bin;
-    if (inet_pton(AF_INET, remote_ip, &remote_addr_bin) != 1) {
-        fprintf(stderr, "Invalid remote IP address: %s\n", remote_ip);
-        close(sockfd);
+    if (parse_UDPAddress(&config.group, multicast_group, config.listen_port) != 0) {
+        fprintf(stderr, "Invalid multicast group: %s\n", multicast_group);
         return 1;
     }
-
-    char buffer[BUF_SIZE];
-    struct sockaddr_in sender_addr;
-    socklen_t sender_len = sizeof(sender_addr);
-
-    // uint32_t vban_frame = 0;
-    uint8_t vban_last_sr = 0;
-    uint8_t vban_last_format = 0;
-    uint8_t vban_last_channels = 0;
-    uint8_t vban_audio_reset = 0;
-
-    AudioBuffer* audio_buffer = create_audio_buffer(buffer_size);
-    if (!audio_buffer) {
-        close(sockfd);
+    config.multicast = is_multicast_UDPAddress(&config.group);
+    if (multicast_group[0] != '\0' && !config.multicast) {
+        fprintf(stderr, "Not a multicast address: %s\n", multicast_group);
         return 1;
     }
 
-    pa_buffer_attr buffer_attr = {
-        .maxlength = buffer_maxlength,
-        .tlength = buffer_tlength_fragsize,
-        .prebuf = buffer_prebuf
-    };
+    printf("Starting VBAN receiver with buffer size: %d packets, %d stream(s), %d worker(s)\n", config.buffer_size, config.num_streams, config.workers);
+    if (config.multicast) printf("Joining multicast group %s\n", multicast_group);
 
-    signal(SIGINT, stop);
-    signal(SIGTERM, stop);
+    if (open_stats(stats_path) != 0) return 1;
 
-    while (to_run) {
-        ssize_t recv_len = recvfrom(sockfd, buffer, BUF_SIZE, 0, (struct sockaddr *)&sender_addr, &sender_len);
-        if (recv_len < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                usleep(POLL_TIMEOUT_MS * 1000);
-                continue;
-            } else {
-                perror("recvfrom error");
-                break;
-            }
+    VBAN95_Worker workers[MAX_WORKERS];
+    for (int i = 0; i < config.workers; i++) {
+        if (init_worker(&workers[i], i, &config) != 0) {
+            for (int j = 0; j < i; j++) cleanup_worker(&workers[j]);
+            close_stats(stats_path);
+            return 1;
         }
+    }
+    if (config.multicast && config.workers > 1 && steer_streams(workers[0].sockfd, &config) != 0) {
+        perror("Warning! setsockopt(SO_ATTACH_REUSEPORT_CBPF), unicast only plays on the worker it lands on when that one owns its stream");
+    }
 
-        if ((size_t)recv_len < sizeof(VBANHeader)) continue;
-
-        if (sender_addr.sin_addr.s_addr == remote_addr_bin.s_addr || remote_addr_bin.s_addr == 0) {
-            VBANHeaderUnion data;
-            memcpy(&data.raw_data, buffer, sizeof(VBANHeader));
-
-            if (memcmp(data.packet_data.vban, "VBAN", 4) != 0) continue;
-
-            uint8_t protocol = data.packet_data.protocol_sample_rate_idx & 0xe0;
-            if(protocol != VBAN_PROTOCOL_AUDIO) {
-                if(protocol == VBAN_PROTOCOL_SERVICE) {
-                    // Handle Service protocol
-                    uint8_t service_type = data.packet_data.sample_channels;
-                    uint8_t service_function = data.packet_data.samples_per_frame; // 0 if ping, 80 if reply
-
-                    if(service_type == VBAN_SERVICE_IDENTIFICATION) {
-                        if(service_function == 0) {
-                            // Handle ping
-                            VBANPing0DataUnion ping_data;
-                            memset(&ping_data, 0, sizeof(VBANPing0Data));
-
-                            ping_data.data.bitType = VBANPING_TYPE_RECEPTOR;
-                            ping_data.data.bitfeature = VBANPING_FEATURE_AUDIO | VBANPING_FEATURE_AOIP;
-                            ping_data.data.nVersion[0] = 1;
-                            ping_data.data.nVersion[1] = 1;
-
-                            snprintf(ping_data.data.DistantIP_ascii, sizeof(ping_data.data.DistantIP_ascii), "%s", inet_ntoa(sender_addr.sin_addr));
-                            ping_data.data.DistantPort = htons(listen_port);
-                            strncpy(ping_data.data.ApplicationName_ascii, "vban95", sizeof(ping_data.data.ApplicationName_ascii));
-
-                            uid_t uid = getuid();
-                            struct passwd *pw = getpwuid(uid);
-                            if (pw != NULL) snprintf(ping_data.data.UserName_utf8, sizeof(ping_data.data.UserName_utf8), "%s", pw->pw_name);
-
-                            gethostname(ping_data.data.HostName_ascii, sizeof(ping_data.data.HostName_ascii));
-
-                            VBANHeaderUnion reply_header;
-                            memset(&reply_header, 0, sizeof(VBANHeader));
-
-                            memcpy(reply_header.packet_data.vban, "VBAN", 4);
-                            reply_header.packet_data.protocol_sample_rate_idx = VBAN_PROTOCOL_SERVICE;
-                            reply_header.packet_data.sample_channels = VBAN_SERVICE_IDENTIFICATION;
-                            reply_header.packet_data.samples_per_frame = 0x80; // reply
-                            reply_header.packet_data.frame_num = data.packet_data.frame_num;
-
-                            char reply_buffer[sizeof(VBANHeader) + sizeof(VBANPing0Data)];
-                            memcpy(reply_buffer, &reply_header.raw_data, sizeof(VBANHeader));
-                            memcpy(reply_buffer + sizeof(VBANHeader), &ping_data.raw_data, sizeof(VBANPing0Data));
-                            ssize_t sent_len = sendto(sockfd, reply_buffer, sizeof(reply_buffer), 0,
-                                                      (struct sockaddr *)&sender_addr, sender_len);
-                            if (sent_len < 0) {
-                                perror("sendto");
-                            } else {
-                                if (quiet == 0) printf("Sent VBAN ping reply to %s:%d\n", inet_ntoa(sender_addr.sin_addr), ntohs(sender_addr.sin_port));
-                            }
-                        }
-                    }
-                }
-                continue;
-            }
-
-            if (strncmp(data.packet_data.streamname, stream_name, sizeof(data.packet_data.streamname)) != 0) continue;
-            
-            char* audio_data = buffer + sizeof(VBANHeader);
-            size_t audio_data_size = recv_len - sizeof(VBANHeader);
-#if 0
-            if (vban_frame == 0) {
-                vban_frame = data.packet_data.frame_num;
-            } else {
-                int32_t diff = (int32_t)(data.packet_data.frame_num - (vban_frame++) - 1);
-                if(diff != 0) {
-                    debug_printf("Frame number diff: %d\n", diff);
-                    if(diff == 0) {
-                        if (quiet == 0) printf("Duplicate packet received\n");
-                    } else if (diff > 1) {
-                        if (quiet == 0) printf("Dropped %u packets\n", diff);
-                        
-                        AudioPacket blank_packet;
-                        uint8_t fill_value = (data.packet_data.format_type == 0) ? 0 : 128;
-                        memset(blank_packet.data, fill_value, audio_data_size);
-                        blank_packet.size = audio_data_size;
-
-                        VBANHeaderUnion temp;
-                        memset(blank_packet.data, 0, blank_packet.size);
-                        memcpy(&temp.raw_data, buffer, sizeof(VBANHeader));
-
-                        for (uint32_t i = diff; i < temp.packet_data.frame_num; i++) {
-                            temp.packet_data.frame_num = i;
-                            add_to_buffer(audio_buffer, blank_packet.data, blank_packet.size, &temp.packet_data);
-                        }
-                    } else if (diff < 1) {
-                        if (quiet == 0) printf("Packets received out of order (got:%u, expected:%u)\n", 
-                                            data.packet_data.frame_num, vban_frame);
-                    }
-                    vban_frame = data.packet_data.frame_num;
-                }
-            }
-#endif
-
-            uint8_t actual_sr_idx = data.packet_data.protocol_sample_rate_idx & 0x1f;
-            if(vban_last_sr != actual_sr_idx) {
-                vban_last_sr = actual_sr_idx;
-                if(quiet == 0) printf("New sample rate of %ld\n", VBAN_SRList[vban_last_sr % VBAN_SR_MAXNUMBER]);
-                vban_audio_reset = 1;
-                reset_audio_buffer(audio_buffer);
-            }
-            
-            if(vban_last_format != data.packet_data.format_type) {
-                vban_last_format = data.packet_data.format_type;
-                if(quiet == 0) printf("New data format of %s\n", VBAN_TextBITList[vban_last_format % VBAN_BIT_MAXNUMBER]); // Here it should be fine to use the modulo, as during the reset we point out the idx may be shit
-                vban_audio_reset = 1;
-                reset_audio_buffer(audio_buffer);
-            }
-            
-            if(vban_last_channels != data.packet_data.sample_channels) {
-                vban_last_channels = data.packet_data.sample_channels;
-                if(quiet == 0) printf("New channel count of %d\n", vban_last_channels + 1); // Add 1 because VBAN channels are 0-based
-                vban_audio_reset = 1;
-                reset_audio_buffer(audio_buffer);
-            }
-
-            if(vban_audio_reset) {
-                if (vban_last_sr >= VBAN_SR_MAXNUMBER || vban_last_format >= VBAN_BIT_MAXNUMBER) {
-                    fprintf(stderr, "Unsupported sample rate or format\n");
-                    continue;
-                }
-
-                if (output.initialized) free_PulseDevice(&output);
-                
-                int result = init_PulseOutputDevice(
-                    &output, 
-                    VBAN_SRList[vban_last_sr], 
-                    vban_last_channels + 1, // Add 1 because VBAN channels are 0-based
-                    "vban95", 
-                    stream_name, 
-                    pulse_device, 
-                    &buffer_attr,
-                    VBAN_BITList[vban_last_format]
-                );
-                
-                if (result != 0) fprintf(stderr, "Failed to initialize PulseAudio output device: %s\n", pa_strerror(result));
-                
-                vban_audio_reset = 0;
-                continue;
-            }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
 
-            if (add_to_buffer(audio_buffer, audio_data, audio_data_size, &data.packet_data) > 0) process_audio_buffer(audio_buffer, &output);
+    for (int i = 1; i < config.workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            perror("pthread_create");
+            to_run = 0;
+            for (int j = 1; j < i; j++) pthread_join(workers[j].thread, NULL);
+            for (int j = 0; j < config.workers; j++) cleanup_worker(&workers[j]);
+            close_stats(stats_path);
+            return 1;
         }
     }
+    run_worker(&workers[0]);
+    for (int i = 1; i < config.workers; i++) pthread_join(workers[i].thread, NULL);
 
     // Clean up
     printf("Cleaning up...\n");
-    if (output.initialized) free_PulseDevice(&output);
-    destroy_audio_buffer(audio_buffer);
-    close(sockfd);
-    
+    if (config.stats_interval) {
+        for (int i = 0; i < config.workers; i++) print_stats(&workers[i], true);
+    }
+    for (int i = 0; i < config.workers; i++) cleanup_worker(&workers[i]);
+    close_stats(stats_path);
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#define buffer_maxlength 12288
+#define buffer_tlength_fragsize 12288
+
+#include "../io/audio.h"
+#include "../io/udp.h"
+#include "../lib/vban.h"
+
+#define MAX_BATCH_PACKETS 32
+
+volatile uint8_t to_run = 1;
+
+static void stop(int signum) {
+    (void)signum;
+    printf("\nReceived stop signal.\n");
+    to_run = 0;
+}
+
+typedef struct {
+    UDPAddress destination;
+    const char* interface;
+    uint16_t local_port;
+    uint8_t ttl;
+    char stream_name[16];
+    long sample_rate;
+    uint8_t sr_idx;
+    uint16_t channels;
+    uint8_t format;
+    uint16_t samples_per_frame;
+    uint16_t batch;
+    bool pace;
+    const char* pulse_device;
+    const char* input_file;
+    int quiet;
+} VBANTX95_Config;
+
+typedef struct {
+    int sockfd;
+    PulseInputDevice input;
+    FILE* file;
+    uint32_t frame_num;
+} VBANTX95_Runtime;
+
+void show_version() {
+    printf("vbantx95 (a VBAN AOIP transmitter by radio95) version 1.0\n");
+}
+void show_help(char *name) {
+    printf(
+        "Usage: \t%s\n"
+        "\t-i,--ip\t\tDestination IP address, unicast or multicast [default: 127.0.0.1]\n"
+        "\t-p,--port\tDestination port [default: 6980]\n"
+        "\t-l,--local_port\tLocal port, pings sent here are answered [default: any]\n"
+        "\t-I,--interface\tNetwork interface for multicast\n"
+        "\t-t,--ttl\tMulticast TTL [default: 1]\n"
+        "\t-s,--stream\tStream name [default: VBAN]\n"
+        "\t-r,--rate\tSample rate [default: 48000]\n"
+        "\t-c,--channels\tChannel count (1 to 256) [default: 2]\n"
+        "\t-F,--format\tSample format, U08, S16, S24, S32 or F32 [default: F32]\n"
+        "\t-n,--samples\tSamples per packet (1 to %d) [default: as many as fit]\n"
+        "\t-B,--batch\tPackets per sendmmsg call (1 to %d) [default: 4]\n"
+        "\t-P,--pace\tRelease batches at the sample rate, always on for file input\n"
+        "\t-d,--device\tPulseAudio capture device\n"
+        "\t-f,--file\tRead raw interleaved samples from a file or pipe instead ('-' for stdin)\n"
+        "\t-q,--quiet\tSuppress output messages\n",
+        name, VBAN_MAX_SAMPLES_PER_FRAME, MAX_BATCH_PACKETS
+    );
+}
+
+static inline void timespec_add_ns(struct timespec* ts, long long ns) {
+    ts->tv_nsec += ns % 1000000000LL;
+    ts->tv_sec += ns / 1000000000LL;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec++;
+    }
+}
+
+void answer_pings(const VBANTX95_Config* config, VBANTX95_Runtime* runtime) {
+    char buffer[sizeof(VBANHeader) + sizeof(VBANPing0Data)];
+    UDPAddress sender;
+
+    while (1) {
+        sender.len = sizeof(sender.addr);
+        ssize_t recv_len = recvfrom(runtime->sockfd, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&sender.addr, &sender.len);
+        if (recv_len < 0) return;
+        if ((size_t)recv_len < sizeof(VBANHeader)) continue;
+
+        VBANHeaderUnion data;
+        memcpy(&data.raw_data, buffer, sizeof(VBANHeader));
+        if (memcmp(data.packet_data.vban, "VBAN", 4) != 0) continue;
+        if ((data.packet_data.protocol_sample_rate_idx & 0xe0) != VBAN_PROTOCOL_SERVICE) continue;
+        if (data.packet_data.sample_channels != VBAN_SERVICE_IDENTIFICATION || data.packet_data.samples_per_frame != 0) continue;
+
+        VBANHeaderUnion reply_header;
+        VBANPing0DataUnion ping_data;
+        init_VBANPingReply(&reply_header.packet_data, &ping_data.data, &data.packet_data, VBANPING_TYPE_TRANSMITTER, VBANPING_FEATURE_AUDIO | VBANPING_FEATURE_AOIP, "vbantx95", 1, 0);
+        ping_data.data.PreferredRate = config->sample_rate;
+        ping_data.data.MinRate = config->sample_rate;
+        ping_data.data.MaxRate = config->sample_rate;
+
+        format_UDPAddress(&sender, ping_data.data.DistantIP_ascii, sizeof(ping_data.data.DistantIP_ascii));
+        ping_data.data.DistantPort = htons(config->local_port);
+
+        memcpy(buffer, &reply_header.raw_data, sizeof(VBANHeader));
+        memcpy(buffer + sizeof(VBANHeader), &ping_data.raw_data, sizeof(VBANPing0Data));
+        if (sendto(runtime->sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *)&sender.addr, sender.len) < 0) perror("sendto");
+        else if (config->quiet == 0) {
+            char sender_ip[INET6_ADDRSTRLEN];
+            printf("Sent VBAN ping reply to %s\n", format_UDPAddress(&sender, sender_ip, sizeof(sender_ip)));
+        }
+    }
+}
+
+// Fills the whole buffer, returns 0 when the source is done
+int read_input(const VBANTX95_Config* config, VBANTX95_Runtime* runtime, char* buffer, size_t size) {
+    if (runtime->file) {
+        size_t got = fread(buffer, 1, size, runtime->file);
+        if (got == size) return 1;
+        if (got == 0) return 0;
+        memset(buffer + got, (config->format == 0) ? 128 : 0, size - got); // Pad the last packet with silence, U08 is unsigned
+        return 1;
+    }
+
+    int pulse_error = read_PulseInputDevice(&runtime->input, buffer, size);
+    if (pulse_error) {
+        fprintf(stderr, "Error reading from input device: %s\n", pa_strerror(pulse_error));
+        return 0;
+    }
+    return 1;
+}
+
+int run_vbantx95(const VBANTX95_Config* config, VBANTX95_Runtime* runtime) {
+    size_t frame_bytes = (size_t)config->channels * VBAN_bit_size(config->format);
+    size_t packet_bytes = frame_bytes * config->samples_per_frame;
+    size_t batch_bytes = packet_bytes * config->batch;
+
+    char* audio = malloc(batch_bytes);
+    if (!audio) {
+        perror("malloc");
+        return 1;
+    }
+
+    VBANHeader headers[MAX_BATCH_PACKETS];
+    struct iovec iov[MAX_BATCH_PACKETS][2];
+    struct mmsghdr msgs[MAX_BATCH_PACKETS];
+    memset(msgs, 0, sizeof(msgs));
+
+    for (uint16_t i = 0; i < config->batch; i++) {
+        memset(&headers[i], 0, sizeof(VBANHeader));
+        memcpy(headers[i].vban, "VBAN", 4);
+        headers[i].protocol_sample_rate_idx = VBAN_PROTOCOL_AUDIO | config->sr_idx;
+        headers[i].samples_per_frame = config->samples_per_frame - 1; // VBAN counts are 0-based
+        headers[i].sample_channels = config->channels - 1;
+        headers[i].format_type = config->format; // PCM codec, so only the bit format
+        memcpy(headers[i].streamname, config->stream_name, sizeof(headers[i].streamname));
+
+        iov[i][0].iov_base = &headers[i];
+        iov[i][0].iov_len = sizeof(VBANHeader);
+        iov[i][1].iov_base = audio + i * packet_bytes;
+        iov[i][1].iov_len = packet_bytes;
+
+        msgs[i].msg_hdr.msg_name = (void*)&config->destination.addr;
+        msgs[i].msg_hdr.msg_namelen = config->destination.len;
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    long long batch_ns = (long long)config->samples_per_frame * config->batch * 1000000000LL / config->sample_rate;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (to_run) {
+        if (!read_input(config, runtime, audio, batch_bytes)) break;
+
+        for (uint16_t i = 0; i < config->batch; i++) headers[i].frame_num = runtime->frame_num++;
+
+        if (config->pace) {
+            timespec_add_ns(&next, batch_ns);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        unsigned int sent = 0;
+        while (sent < config->batch) {
+            int ret = sendmmsg(runtime->sockfd, msgs + sent, config->batch - sent, 0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    usleep(1000);
+                    continue;
+                }
+                perror("sendmmsg");
+                break;
+            }
+            sent += ret;
+        }
+
+        answer_pings(config, runtime);
+    }
+
+    free(audio);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    show_version();
+
+    char *destination_ip = "127.0.0.1";
+    int port = 6980;
+    char *format = "F32";
+    int samples = 0;
+    int channels = 2;
+    int batch = 4;
+    int ttl = 1;
+
+    VBANTX95_Config config = {
+        .interface = "",
+        .local_port = 0,
+        .sample_rate = 48000,
+        .pace = false,
+        .pulse_device = "",
+        .input_file = NULL,
+        .quiet = 0
+    };
+    memset(config.stream_name, 0, sizeof(config.stream_name));
+    memcpy(config.stream_name, "VBAN", 4);
+
+    int opt;
+    const char *short_opt = "i:p:l:I:t:s:r:c:F:n:B:Pd:f:qh";
+    const struct option long_opt[] = {
+        {"ip", required_argument, NULL, 'i'},
+        {"port", required_argument, NULL, 'p'},
+        {"local_port", required_argument, NULL, 'l'},
+        {"interface", required_argument, NULL, 'I'},
+        {"ttl", required_argument, NULL, 't'},
+        {"stream", required_argument, NULL, 's'},
+        {"rate", required_argument, NULL, 'r'},
+        {"channels", required_argument, NULL, 'c'},
+        {"format", required_argument, NULL, 'F'},
+        {"samples", required_argument, NULL, 'n'},
+        {"batch", required_argument, NULL, 'B'},
+        {"pace", no_argument, NULL, 'P'},
+        {"device", required_argument, NULL, 'd'},
+        {"file", required_argument, NULL, 'f'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    while ((opt = getopt_long(argc, argv, short_opt, long_opt, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                destination_ip = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'l':
+                config.local_port = atoi(optarg);
+                break;
+            case 'I':
+                config.interface = optarg;
+                break;
+            case 't':
+                ttl = atoi(optarg);
+                break;
+            case 's':
+                memset(config.stream_name, 0, sizeof(config.stream_name));
+                memcpy(config.stream_name, optarg, strnlen(optarg, sizeof(config.stream_name)));
+                break;
+            case 'r':
+                config.sample_rate = atol(optarg);
+                break;
+            case 'c':
+                channels = atoi(optarg);
+                break;
+            case 'F':
+                format = optarg;
+                break;
+            case 'n':
+                samples = atoi(optarg);
+                break;
+            case 'B':
+                batch = atoi(optarg);
+                break;
+            case 'P':
+                config.pace = true;
+                break;
+            case 'd':
+                config.pulse_device = optarg;
+                break;
+            case 'f':
+                config.input_file = optarg;
+                break;
+            case 'q':
+                config.quiet = 1;
+                break;
+            case 'h':
+                show_help(argv[0]);
+                return 0;
+            default:
+                show_help(argv[0]);
+                return 1;
+        }
+    }
+
+    int sr_idx = VBAN_find_sr_idx(config.sample_rate);
+    if (sr_idx < 0) {
+        fprintf(stderr, "Sample rate %ld is not one of the VBAN rates\n", config.sample_rate);
+        return 1;
+    }
+    config.sr_idx = sr_idx;
+
+    int format_idx = VBAN_find_bit_idx(format);
+    if (format_idx < 0) {
+        fprintf(stderr, "Unknown sample format: %s\n", format);
+        return 1;
+    }
+    config.format = format_idx;
+
+    if (channels < 1 || channels > 256) {
+        fprintf(stderr, "Channel count must be between 1 and 256\n");
+        return 1;
+    }
+    config.channels = channels;
+
+    int max_samples = VBAN_MAX_DATA_SIZE / (channels * VBAN_bit_size(config.format));
+    if (max_samples > VBAN_MAX_SAMPLES_PER_FRAME) max_samples = VBAN_MAX_SAMPLES_PER_FRAME;
+    if (max_samples < 1) {
+        fprintf(stderr, "Too many channels for this format to fit a single sample in a packet\n");
+        return 1;
+    }
+    if (samples == 0) samples = max_samples;
+    if (samples < 1 || samples > max_samples) {
+        fprintf(stderr, "Samples per packet must be between 1 and %d for this format\n", max_samples);
+        return 1;
+    }
+    config.samples_per_frame = samples;
+
+    if (batch < 1 || batch > MAX_BATCH_PACKETS) {
+        fprintf(stderr, "Batch must be between 1 and %d\n", MAX_BATCH_PACKETS);
+        return 1;
+    }
+    config.batch = batch;
+    config.ttl = ttl;
+
+    if (parse_UDPAddress(&config.destination, destination_ip, port) != 0) {
+        fprintf(stderr, "Invalid destination IP address: %s\n", destination_ip);
+        return 1;
+    }
+
+    VBANTX95_Runtime runtime;
+    memset(&runtime, 0, sizeof(runtime));
+
+    runtime.sockfd = open_UDPSender(&config.destination, config.interface, config.local_port, config.ttl, false);
+    if (runtime.sockfd < 0) return 1;
+
+    if (config.input_file) {
+        runtime.file = (strcmp(config.input_file, "-") == 0) ? stdin : fopen(config.input_file, "rb");
+        if (!runtime.file) {
+            perror("fopen");
+            close(runtime.sockfd);
+            return 1;
+        }
+        config.pace = true; // A file has no clock of its own
+    } else {
+        pa_buffer_attr input_buffer_atr = {
+            .maxlength = buffer_maxlength,
+            .fragsize = buffer_tlength_fragsize
+        };
+
+        printf("Connecting to input device... (%s)\n", config.pulse_device);
+        int opentime_pulse_error = init_PulseInputDevice(&runtime.input, config.sample_rate, config.channels, "vbantx95", "VBAN Input", config.pulse_device, &input_buffer_atr, VBAN_BITList[config.format]);
+        if (opentime_pulse_error) {
+            fprintf(stderr, "Error: cannot open input device: %s\n", pa_strerror(opentime_pulse_error));
+            close(runtime.sockfd);
+            return 1;
+        }
+    }
+
+    if (config.quiet == 0) printf("Sending %.16s to %s:%d, %ld Hz, %d channel(s), %s, %d samples per packet, %d packets per batch\n", config.stream_name, destination_ip, port, config.sample_rate, config.channels, VBAN_TextBITList[config.format], config.samples_per_frame, config.batch);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    int ret = run_vbantx95(&config, &runtime);
+
+    printf("Cleaning up...\n");
+    if (runtime.file && runtime.file != stdin) fclose(runtime.file);
+    if (runtime.input.initialized) free_PulseDevice(&runtime.input);
+    close(runtime.sockfd);
+
+    return ret;
+}